@@ -129,6 +129,9 @@ hljs.registerLanguage('rrbasic', function(hljs) {
         'SPRITEROW',
         'ARRAYFIND',
         'MAPSET',
+        'NICE',
+        'SYNC',
+        'WRITEBACK',
     ];
 
     const literal_list = [
@@ -207,6 +210,7 @@ hljs.registerLanguage('rrbasic', function(hljs) {
         'GETPROCID',
         'GETPROCMEM',
         'GETPROCNAME$',
+        'GETPROCNICE',
         'GETPROCPARENT',
         'GETPROCSTATE$',
         'GETSIZE',
@@ -306,6 +306,10 @@ typedef struct {
 #define ATA_IDENT_COMMANDSETS		164
 /** @brief ATA IDENTIFY: 48-bit max LBA (bytes). */
 #define ATA_IDENT_MAX_LBA_EXT		200
+/** @brief ATA IDENTIFY: queue depth word 75, bits 4:0 hold depth - 1 (bytes). */
+#define ATA_IDENT_QUEUE_DEPTH		150
+/** @brief ATA IDENTIFY: SATA capabilities word 76, bit 8 is NCQ support (bytes). */
+#define ATA_IDENT_SATA_CAPS		152
 
 /* ----------------------------- SATA signatures ----------------------------- */
 
@@ -319,6 +323,7 @@ typedef struct {
 #define	SATA_SIG_PM	0x96690101
 
 #define HBA_CAP_S64A (1u << 31) /* 64-bit Addressing (AHCI CAP.S64A) */
+#define HBA_CAP_SNCQ (1u << 30) /* Native Command Queuing (AHCI CAP.SNCQ) */
 
 /* ----------------------------- Device type codes ----------------------------- */
 
@@ -362,6 +367,14 @@ typedef struct {
 #define ATA_CMD_READ_DMA_EX 0x25
 /** @brief ATA command: WRITE DMA EXT (48-bit). */
 #define ATA_CMD_WRITE_DMA_EX 0x35
+/** @brief ATA command: READ FPDMA QUEUED (NCQ). */
+#define ATA_CMD_READ_FPDMA_QUEUED 0x60
+/** @brief ATA command: WRITE FPDMA QUEUED (NCQ). */
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
+/** @brief ATA command: READ LOG EXT. */
+#define ATA_CMD_READ_LOG_EXT 0x2F
+/** @brief ATA log address of the NCQ command error log, read to clear an NCQ error. */
+#define ATA_LOG_NCQ_ERROR 0x10
 
 /* ----------------------------- ATA Status bits ----------------------------- */
 
@@ -377,6 +390,93 @@ typedef struct {
 /** @brief ATAPI logical sector size in bytes (2048 B). */
 #define ATAPI_SECTOR_SIZE 2048
 
+/* ----------------------------- Command queue ----------------------------- */
+/** @brief PRDT entries in each command table, as laid out by port_rebase(). */
+#define AHCI_PRDT_ENTRIES 8
+/** @brief Largest transfer one PRDT entry can describe. */
+#define AHCI_PRD_MAX_BYTES (4 * 1024 * 1024)
+/** @brief Largest transfer issued as one command; longer requests are split. */
+#define AHCI_MAX_SECTORS_PER_CMD 2048
+/** @brief Largest transfer through the shared bounce buffers. */
+#define AHCI_BOUNCE_SECTORS 128
+
+/**
+ * @brief Per-port state for queued reads and writes.
+ *
+ * Slots are claimed by submitters and handed back once complete. The
+ * interrupt handler, or a submitter polling with interrupts masked, moves
+ * finished slots from the hardware's PxCI/PxSACT into @ref done, so waiters
+ * spin on memory rather than on MMIO.
+ */
+typedef struct ahci_port_queue_t {
+	ahci_hba_port_t* port;		/**< Port registers, NULL if the port has no queue */
+	ahci_hba_mem_t* abar;		/**< HBA registers */
+	uint32_t slots;			/**< Command slots usable for queued I/O */
+	uint32_t depth;			/**< Most commands in flight at once */
+	bool ncq;			/**< Device and HBA both support NCQ */
+	bool s64a;			/**< HBA can DMA above 4 GiB */
+	volatile uint32_t issued;	/**< Slots claimed and not yet handed back */
+	volatile uint32_t active;	/**< Claimed slots whose command has been given to the HBA */
+	volatile uint32_t done;		/**< Issued slots whose command has finished */
+	volatile uint32_t failed;	/**< Claimed slots whose command finished in error */
+	volatile bool recover;		/**< An error stopped the port, the next waiter restarts it */
+	volatile bool recovering;	/**< A waiter is restarting the port, nothing may be issued */
+	uint8_t* log;			/**< DMA-able sector for reading the NCQ error log */
+	spinlock_t lock;		/**< Guards the slot masks */
+} ahci_port_queue_t;
+
+/**
+ * @brief Set up queued I/O on a SATA port.
+ * @param abar AHCI HBA memory block.
+ * @param portno Port number.
+ * @param id_page IDENTIFY DEVICE data, or NULL if unavailable (NCQ stays off).
+ */
+void ahci_queue_init(ahci_hba_mem_t* abar, int portno, const uint8_t* id_page);
+
+/**
+ * @brief Collect finished commands on a port.
+ * Called from the interrupt handler and by waiters. An error only fails the
+ * outstanding commands and marks the port for recovery, which the next
+ * waiter carries out, as it polls the device.
+ * @param abar AHCI HBA memory block.
+ * @param portno Port number.
+ * @param pis PxIS value already read and about to be cleared by the caller, or 0.
+ */
+void ahci_queue_reap(ahci_hba_mem_t* abar, int portno, uint32_t pis);
+
+/**
+ * @brief Wait until no queued commands are outstanding on a port, so that a
+ * non-queued command may be issued.
+ * @param abar AHCI HBA memory block.
+ * @param portno Port number.
+ */
+void ahci_queue_drain(ahci_hba_mem_t* abar, int portno);
+
+/**
+ * @brief Read or write sectors, split into commands which are kept in flight together.
+ * Data moves directly between the device and @p buf, which must be DMA-able
+ * (see ahci_queue_dma_capable()).
+ * @param abar AHCI HBA memory block.
+ * @param portno Port number.
+ * @param write true to write, false to read.
+ * @param lba Starting LBA.
+ * @param count Number of sectors, any size.
+ * @param buf Source or destination.
+ * @return true on success, false if any command failed.
+ */
+bool ahci_queue_rw(ahci_hba_mem_t* abar, int portno, bool write, uint64_t lba, uint32_t count, void* buf);
+
+/**
+ * @brief Check whether a buffer can be handed to the HBA as-is.
+ * It must be word aligned, identity mapped (not in the higher half, where the
+ * kernel image and boot stacks live) and, on 32-bit HBAs, below 4 GiB.
+ * @param abar AHCI HBA memory block.
+ * @param buf Buffer.
+ * @param bytes Buffer length.
+ * @return true if the buffer can be the target of a PRDT entry.
+ */
+bool ahci_queue_dma_capable(const ahci_hba_mem_t* abar, const void* buf, size_t bytes);
+
 /* ----------------------------- Forward decls ----------------------------- */
 
 /** @brief Opaque storage device descriptor used by higher layers. */
@@ -410,9 +510,10 @@ int find_cmdslot(ahci_hba_port_t *port, ahci_hba_mem_t *abar);
 
 /**
  * @brief Read from a SATA block device via DMA.
+ * Transfers straight into @p buf where possible, otherwise via the bounce buffer.
  * @param port AHCI port register block.
  * @param start Starting LBA.
- * @param count Number of sectors to read.
+ * @param count Number of sectors to read, any size.
  * @param buf Destination buffer (caller-managed).
  * @param abar AHCI HBA memory block.
  * @return true on success, false on error.
@@ -421,9 +522,10 @@ bool ahci_read(ahci_hba_port_t *port, uint64_t start, uint32_t count, char *buf,
 
 /**
  * @brief Write to a SATA block device via DMA.
+ * Transfers straight from @p buf where possible, otherwise via the bounce buffer.
  * @param port AHCI port register block.
  * @param start Starting LBA.
- * @param count Number of sectors to write.
+ * @param count Number of sectors to write, any size.
  * @param buf Source buffer (caller-managed).
  * @param abar AHCI HBA memory block.
  * @return true on success, false on error.
@@ -491,6 +593,17 @@ int storage_device_ahci_block_read(void* dev, uint64_t start, uint32_t bytes, un
  */
 int storage_device_ahci_block_write(void* dev, uint64_t start, uint32_t bytes, const unsigned char* buffer);
 
+/**
+ * @brief Start command processing on a port (set PxCMD.FRE and PxCMD.ST).
+ * @param port AHCI HBA port.
+ */
+void start_cmd(ahci_hba_port_t *port);
+/**
+ * @brief Stop command processing on a port and wait for the HBA to go idle.
+ * Clears PxCI and PxSACT, so any outstanding commands are abandoned.
+ * @param port AHCI HBA port.
+ */
+void stop_cmd(ahci_hba_port_t *port);
 /**
  * @brief Wait until the AHCI port and attached device are ready to accept a new command.
  * @param port AHCI HBA port.
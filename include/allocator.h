@@ -5,6 +5,10 @@
  * Provides aligned heap allocation and free operations with
  * low overhead. Intended for kernel use where predictable
  * allocation and fragmentation control are desirable.
+ *
+ * Free blocks are indexed by size in two-level segregated free lists,
+ * so allocation and free take bounded time however fragmented the heap
+ * becomes, and freed blocks are merged with both neighbours at once.
  */
 
 #pragma once
@@ -17,19 +21,41 @@
  * Each allocated or free block in a managed region begins with this
  * header. The allocator uses it to track block size, free state, and
  * linked list ordering. User pointers returned by allocator_alloc() point to
- * the memory immediately after this header.
+ * the memory immediately after this header. While a block is free, the
+ * start of its payload holds its links in a size-class free list.
  *
  * Fields:
  *  - size : Size of the usable payload in bytes (not including the header).
  *  - free : True if the block is available for allocation, false if in use.
  *  - next : Pointer to the next block header in address order.
+ *  - prev : Pointer to the previous block header in address order.
  */
 typedef struct allocator_header {
 	size_t size;		/**< Payload size in bytes (excludes header). */
 	bool free;		/**< Allocation status flag. */
 	struct allocator_header *next;	/**< Next block header in the linked list. */
+	struct allocator_header *prev;	/**< Previous block header in the linked list. */
 } allocator_header;
 
+/**
+ * Fragmentation and latency statistics for the allocator.
+ *
+ * Latencies are measured in TSC cycles around each call, excluding
+ * any locking done by the caller.
+ */
+typedef struct allocator_stats_t {
+	uint64_t free_bytes;		/**< Payload bytes in free blocks. */
+	uint64_t free_blocks;		/**< Number of free blocks. */
+	uint64_t largest_free;		/**< Payload size of the largest free block. */
+	uint64_t allocations;		/**< Successful calls to allocator_alloc(). */
+	uint64_t failures;		/**< Calls to allocator_alloc() which found no block. */
+	uint64_t frees;			/**< Calls to allocator_free(). */
+	uint64_t alloc_cycles;		/**< Total cycles spent in successful allocations. */
+	uint64_t alloc_cycles_max;	/**< Slowest single allocation. */
+	uint64_t free_cycles;		/**< Total cycles spent in frees. */
+	uint64_t free_cycles_max;	/**< Slowest single free. */
+} allocator_stats_t;
+
 
 /**
  * @brief Initialise the allocator heap.
@@ -82,7 +108,7 @@ size_t allocator_usable_size(void* ptr);
  * adjacent, they may be coalesced into a single larger free span when
  * blocks are freed.
  *
- * The first sizeof(ta_header) bytes of the supplied region are used for
+ * The first sizeof(allocator_header) bytes of the supplied region are used for
  * allocator metadata. The caller must ensure the region is suitably aligned
  * and large enough to contain at least one header and some usable space.
  *
@@ -93,3 +119,13 @@ size_t allocator_usable_size(void* ptr);
  *         is too small or invalid.
  */
 bool allocator_add_region(void *region, size_t size);
+
+/**
+ * @brief Get fragmentation and latency statistics for the allocator.
+ *
+ * The caller must hold whatever lock serialises allocator calls.
+ * Fragmentation can be judged by comparing largest_free to free_bytes.
+ *
+ * @param stats Receives the statistics.
+ */
+void allocator_get_stats(allocator_stats_t *stats);
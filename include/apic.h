@@ -71,6 +71,9 @@
 /** @brief MSR index for the x2APIC Interrupt Command Register (ICR). */
 #define IA32_X2APIC_ICR     0x830
 
+/** @brief MSR index for the GS segment base, which locates each CPU's cpu_local_t. */
+#define IA32_GS_BASE        0xC0000101
+
 /* -------------------------------------------------------------------------- */
 /* Miscellaneous constants                                                    */
 /* -------------------------------------------------------------------------- */
@@ -143,6 +146,36 @@ uint32_t cpu_id(void);
  */
 uint8_t logical_cpu_id(void);
 
+/**
+ * @brief Data private to one CPU, found through its GS base.
+ */
+typedef struct cpu_local_t {
+	uint8_t logical_id;	/**< logical_cpu_id() of the owning CPU */
+} cpu_local_t;
+
+/**
+ * @brief Point the calling CPU's GS base at its cpu_local_t.
+ *
+ * Must run on every CPU before it first calls this_cpu_id(), once the
+ * LAPIC to logical CPU mapping has been built.
+ */
+void cpu_local_init(void);
+
+/**
+ * @brief Logical CPU ID of the calling CPU, from its cpu_local_t.
+ *
+ * A single load rather than a LAPIC read and a mapping lookup, for fast
+ * paths. The caller must stop the process moving CPU for as long as the
+ * answer matters.
+ *
+ * @return uint8_t Logical CPU ID of the current CPU.
+ */
+static inline uint8_t this_cpu_id(void) {
+	uint8_t id;
+	__asm__ volatile ("movb %%gs:0, %0" : "=r"(id));
+	return id;
+}
+
 /**
  * @brief Get the physical address of the Local APIC MMIO region.
  *
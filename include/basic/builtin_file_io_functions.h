@@ -43,6 +43,24 @@ void delete_statement(struct basic_ctx* ctx);
  */
 void mkdir_statement(struct basic_ctx* ctx);
 
+/**
+ * @brief Handles the SYNC statement in BASIC.
+ *
+ * This function writes any data held in write-back disk caches to the disks.
+ *
+ * @param ctx BASIC interpreter context
+ */
+void sync_statement(struct basic_ctx* ctx);
+
+/**
+ * @brief Handles the WRITEBACK statement in BASIC.
+ *
+ * This function switches a disk's cache between write-through and write-back.
+ *
+ * @param ctx BASIC interpreter context
+ */
+void writeback_statement(struct basic_ctx* ctx);
+
 /**
  * @brief Handles the MOUNT statement in BASIC.
  *
@@ -142,6 +142,47 @@ typedef struct basic_ctx {
 	 */
 	enum token_t current_token;
 
+	/**
+	 * @brief Compiled token matching `current_token`, or NULL if it was lexed from text.
+	 */
+	const compiled_token_t* compiled_token;
+
+	/**
+	 * @brief Pre-lexed token stream for the program text, built by tokenizer_compile().
+	 */
+	compiled_token_t* tokens;
+
+	/**
+	 * @brief Number of entries in `tokens`.
+	 */
+	size_t token_count;
+
+	/**
+	 * @brief For each TOKEN_INDEX_BLOCK bytes of program text, the first entry in
+	 * `tokens` whose lookup position is in or after that block.
+	 *
+	 * Entries are in text order, so a lookup scans forward from here. This costs
+	 * a quarter of a byte per byte of program, rather than an entry per byte.
+	 */
+	uint32_t* token_index;
+
+	/**
+	 * @brief Number of bytes of program text covered by `token_index`.
+	 */
+	size_t compiled_length;
+
+	/**
+	 * @brief Terminators currently written into the program text by tokenizer_patch().
+	 *
+	 * While non-zero, a compiled token is only used if none of its bytes were overwritten.
+	 */
+	uint32_t text_patches;
+
+	/**
+	 * @brief Slot table resolving variable names in the program, shared with clones.
+	 */
+	struct variable_slots* variable_slots;
+
 	/**
 	 * @brief Current line number in the program.
 	 */
@@ -252,7 +293,7 @@ typedef struct basic_ctx {
 	/**
 	 * @brief Repeat stack for handling `REPEAT...UNTIL` loop control.
 	 *
-	 * Holds the return line numbers for each level of loop nesting.
+	 * Holds the program offset of the loop body for each level of loop nesting.
 	 */
 	uint64_t repeat_stack[MAX_LOOP_STACK_DEPTH];
 
@@ -264,7 +305,7 @@ typedef struct basic_ctx {
 	/**
 	 * @brief While stack for handling `WHILE...ENDWHILE` loop control.
 	 *
-	 * Holds the return line numbers for each level of loop nesting.
+	 * Holds the program offset of the `WHILE` line for each level of loop nesting.
 	 */
 	uint64_t while_stack[MAX_LOOP_STACK_DEPTH];
 
@@ -540,6 +581,17 @@ bool basic_finished(struct basic_ctx* ctx);
  */
 bool jump_linenum(int64_t linenum, struct basic_ctx* ctx);
 
+/**
+ * @brief Jump to an offset within the program text.
+ *
+ * Used for targets resolved ahead of time, such as loop bodies and linked
+ * jump sites, which need no line number lookup.
+ *
+ * @param offset Offset from the start of the program text.
+ * @param ctx The BASIC context.
+ */
+void jump_offset(uint64_t offset, struct basic_ctx* ctx);
+
 /**
  * @brief Parse and execute a line in the BASIC program.
  *
@@ -654,6 +706,18 @@ char basic_builtin_int_fn(const char* fn_name, struct basic_ctx* ctx, int64_t* r
  */
 struct ub_proc_fn_def* basic_find_fn(const char* name, struct basic_ctx* ctx);
 
+/**
+ * @brief Extract the procedure name following a PROC keyword.
+ *
+ * Reads up to an opening bracket or the end of the line, leaving out spaces,
+ * so that the jump linker and proc_statement() always agree on the name.
+ *
+ * @param p Program text just after the PROC keyword.
+ * @param name Receives the name, MAX_VARNAME bytes long.
+ * @return Number of characters of program text read.
+ */
+size_t basic_proc_name(const char* p, char* name);
+
 /**
  * @brief Initialize the local call stack for the current function or procedure.
  *
@@ -677,6 +741,24 @@ void free_local_heap(struct basic_ctx* ctx);
  */
 bool is_builtin_double_fn(const char* fn_name, size_t L);
 
+/**
+ * @brief Check if a function name corresponds to a built-in integer function.
+ *
+ * @param fn_name The name of the function to check.
+ * @param L Length of the function name
+ * @return True if the function is a built-in integer function, false otherwise.
+ */
+bool is_builtin_int_fn(const char* fn_name, size_t L);
+
+/**
+ * @brief Check if a function name corresponds to a built-in string function.
+ *
+ * @param fn_name The name of the function to check.
+ * @param L Length of the function name
+ * @return True if the function is a built-in string function, false otherwise.
+ */
+bool is_builtin_str_fn(const char* fn_name, size_t L);
+
 /**
  * @brief Free function definitions and associated resources in the BASIC context.
  *
@@ -218,3 +218,18 @@ void continue_statement(struct basic_ctx* ctx);
 bool new_stack_frame(struct basic_ctx* ctx);
 
 void pop_stack_frame(struct basic_ctx* ctx);
+
+/**
+ * @brief Resolve the jump targets of block structure in the compiled token stream.
+ *
+ * Links each block IF to its ELSE or ENDIF, each block ELSE and WHILE to the end
+ * of its block, CONTINUE FOR/REPEAT to the line of the loop's NEXT/UNTIL, and
+ * GOTO, GOSUB and PROC to the line they call, so that branches which are not
+ * taken never re-lex the text they skip. Sites which cannot be resolved are
+ * left unlinked and are handled by scanning the source as before.
+ *
+ * @param ctx The current BASIC program context, after tokenizer_compile() and
+ * with its line and PROC/FN tables built.
+ * @return false if the program has no compiled token stream or is out of memory.
+ */
+bool basic_link_jumps(struct basic_ctx* ctx);
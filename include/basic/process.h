@@ -134,4 +134,17 @@ void goto_statement(struct basic_ctx* ctx);
 
 void yield_statement(struct basic_ctx* ctx);
 
-int64_t basic_getproccpu(struct basic_ctx* ctx);
\ No newline at end of file
+void nice_statement(struct basic_ctx* ctx);
+
+int64_t basic_getproccpu(struct basic_ctx* ctx);
+
+/**
+ * @brief Get the nice value of a process.
+ *
+ * This function retrieves the scheduling priority of the process with the
+ * specified process ID.
+ *
+ * @param ctx The BASIC context.
+ * @return The nice value of the process, or 0 if it does not exist.
+ */
+int64_t basic_getprocnice(struct basic_ctx* ctx);
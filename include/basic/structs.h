@@ -68,11 +68,11 @@ typedef struct {
  * @brief State for a FOR...NEXT loop
  *
  * This structure stores the necessary state to manage a FOR loop, including
- * the line number to jump to after the loop ends, the loop variable, the "TO"
+ * where the loop body begins, the loop variable, the "TO"
  * value, and the "STEP" value for incrementing the loop variable.
  */
 typedef struct for_state {
-	int64_t line_after_for; ///< Line number to jump to after the FOR loop
+	uint64_t body_offset; ///< Program offset of the first line of the loop body
 	const char *for_variable; ///< The loop variable
 	size_t for_variable_len; ///< Length of for variable name
 	up_value to; ///< The "TO" value for the loop
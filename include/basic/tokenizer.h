@@ -25,6 +25,11 @@
  */
 #define MAX_VARNAME 50
 
+/**
+ * @brief Bytes of program text per entry of the compiled token index.
+ */
+#define TOKEN_INDEX_BLOCK 16
+
 /**
  * @brief List of all tokens recognized by the interpreter.
  *
@@ -231,12 +236,39 @@ typedef void (*keyword_handler_t)(struct basic_ctx*);
     T(LARGE, STMT, NULL)				/* 159 */ \
     T(HUGE, STMT, NULL)					/* 160 */ \
     T(DEVICES, STMT, devices_statement)			/* 161 */ \
+    T(NICE, STMT, nice_statement)			/* 162 */ \
+    T(SYNC, STMT, sync_statement)			/* 163 */ \
+    T(WRITEBACK, STMT, writeback_statement)		/* 164 */ \
 
 GENERATE_ENUM_LIST(TOKEN, token_t)
 
 /* Uniform handler type */
 typedef void (*keyword_handler_t)(struct basic_ctx *);
 
+/**
+ * @brief A token pre-lexed from the program text by tokenizer_compile().
+ *
+ * Offsets are relative to the start of the program text, so the stream stays
+ * valid for cloned contexts which share the same program.
+ */
+typedef struct compiled_token {
+	uint32_t start;		///< Offset of the lexeme (past the '&' of a hex number)
+	uint32_t next;		///< Offset of the character following the lexeme
+	uint16_t token;		///< Token type (enum token_t)
+	uint8_t name_length;	///< Length of the interned variable name, 0 if none
+	union {
+		struct {
+			int64_t integer;	///< Pre-parsed integer value of NUMBER/HEXNUMBER
+			double real;		///< Pre-parsed real value of NUMBER
+		} number;
+		const char* name;	///< Interned variable name of a VARIABLE
+		struct {
+			uint32_t target;	///< Offset to continue from when the jump is taken
+			bool linked;		///< Target resolved by basic_link_jumps()
+		} jump;				///< Jump target of IF, ELSE, WHILE, CONTINUE, GOTO, GOSUB and PROC
+	};
+} compiled_token_t;
+
 /* Build a flat handler table indexed by token id */
 #define GENERATE_HANDLER_ENTRY(NAME, FLAG, DISPATCHER) (keyword_handler_t)(DISPATCHER),
 
@@ -339,6 +371,66 @@ void tokenizer_error_printf(struct basic_ctx* ctx, const char* fmt, ...) PRINTF_
  */
 int get_next_token(struct basic_ctx* ctx);
 
+/**
+ * @brief Pre-lex the whole program into a compact token stream.
+ *
+ * Every position tokenizer_next() would visit during a straight read of the
+ * program is lexed once, with numeric literals pre-parsed and variable names
+ * pre-interned. get_next_token() then returns these without re-scanning the
+ * text, falling back to lexing for positions not in the stream (EVAL lines,
+ * tokens overlapping a tokenizer_patch(), or positions reached by
+ * hand-advancing ctx->ptr).
+ *
+ * Must be called again whenever the program text is replaced.
+ *
+ * @param ctx context
+ * @return false if memory for the stream could not be allocated, in which
+ * case the program still runs directly from its source text
+ */
+bool tokenizer_compile(struct basic_ctx* ctx);
+
+/**
+ * @brief Release the compiled token stream, reverting to lexing from source.
+ *
+ * Call before changing the program text in place.
+ *
+ * @param ctx context
+ */
+void tokenizer_discard(struct basic_ctx* ctx);
+
+/**
+ * @brief Temporarily terminate the program text at @p at.
+ *
+ * This is the only way program text may be modified in place while a program
+ * runs. Compiled tokens overlapping the terminator are not used until it is
+ * removed again with tokenizer_unpatch().
+ *
+ * @param ctx context
+ * @param at position in the program text
+ * @return the byte that was overwritten
+ */
+char tokenizer_patch(struct basic_ctx* ctx, char* at);
+
+/**
+ * @brief Restore a byte overwritten by tokenizer_patch().
+ *
+ * @param ctx context
+ * @param at position passed to tokenizer_patch()
+ * @param old byte it returned
+ */
+void tokenizer_unpatch(struct basic_ctx* ctx, char* at, char old);
+
+/**
+ * @brief Get the compiled token for the current token, if it has a linked jump target.
+ *
+ * Must be called while @p token is still the current token, before accepting it.
+ *
+ * @param ctx context
+ * @param token expected keyword at the current position
+ * @return compiled token with a valid jump target, or NULL to fall back to scanning the source
+ */
+const compiled_token_t* tokenizer_jump_site(struct basic_ctx* ctx, enum token_t token);
+
 /**
  * @brief Check if a decimal number is at the current
  * program pointer.
@@ -4,6 +4,88 @@
 
 struct basic_ctx;
 
+/**
+ * @brief Variable namespaces. Integer, real and string variables of the same
+ * name are distinct variables.
+ */
+typedef enum variable_kind {
+	VK_INT,
+	VK_DOUBLE,
+	VK_STRING,
+	VK_COUNT,
+} variable_kind_t;
+
+/**
+ * @brief Cached resolution of one variable name within one namespace.
+ *
+ * Valid only while `epoch` matches variable_slots::epoch. The item pointers
+ * point into the variable hashmaps, which only move their contents when an
+ * entry is added or a scope is pushed or popped, and those events advance
+ * the epoch.
+ */
+typedef struct variable_resolution {
+	uint64_t epoch;		///< Epoch this was resolved in, 0 if never resolved
+	void* item;		///< ub_var_* that a read resolves to, NULL if none
+	void* global_item;	///< ub_var_* in the global map, NULL if none
+	void* local_item;	///< ub_var_* in the current frame's map, NULL if none
+	bool plain;		///< Not shadowed by a builtin function, FN or array
+	bool valid;		///< Well formed name for this namespace
+} variable_resolution;
+
+/**
+ * @brief A variable slot, one per distinct variable name in the program.
+ */
+typedef struct variable_slot {
+	const char* name;				///< Interned variable name
+	size_t name_length;				///< Length of name
+	variable_resolution kind[VK_COUNT];		///< Per namespace resolution
+} variable_slot;
+
+/**
+ * @brief Open addressed index from interned name pointer to slot number.
+ */
+typedef struct variable_slot_key {
+	const char* name;	///< Interned variable name, NULL if empty
+	uint32_t slot;		///< Index into variable_slots::slots
+} variable_slot_key;
+
+/**
+ * @brief Slot table for all variable names appearing in the program.
+ *
+ * Built once from the compiled token stream. Because the names are interned,
+ * looking up a slot is a pointer hash rather than a string hash, and a
+ * resolved slot turns a variable read or write into a single indexed load or
+ * store. Names not in the program text (EVAL, names built at runtime) miss
+ * and take the hashmap path. Shared between a context and its clones.
+ */
+typedef struct variable_slots {
+	uint64_t epoch;			///< Bumped whenever any cached resolution may be stale
+	variable_slot_key* keys;	///< Index of name pointers
+	size_t key_mask;		///< Number of keys minus one (power of two)
+	variable_slot* slots;		///< Slot storage
+	size_t count;			///< Number of slots
+} variable_slots;
+
+/**
+ * @brief Build the variable slot table from the compiled token stream.
+ *
+ * @param ctx The current BASIC context, after tokenizer_compile().
+ * @return false if out of memory, in which case variables are always
+ * resolved through their hashmaps.
+ */
+bool basic_build_variable_slots(struct basic_ctx* ctx);
+
+/**
+ * @brief Invalidate all cached variable resolutions.
+ *
+ * Must be called whenever a variable or array is created, a variable map is
+ * modified other than by updating a value in place, or a local scope is
+ * pushed or popped.
+ *
+ * @param ctx The current BASIC context.
+ */
+void basic_variables_changed(struct basic_ctx* ctx);
+
 void *varmap_malloc(size_t size, void *udata);
 
 void *varmap_realloc(void *ptr, size_t size, void *udata);
@@ -3,17 +3,42 @@
  * @brief Per-device write-through block cache.
  * @copyright (c) Copyright 2012-2026
  *
- * This cache sits above block device drivers. It caches fixed-size sectors,
- * evicting the oldest (by last access) when full. Reads and writes are
- * write-through and counted as accesses. One cache instance is created
- * per storage device.
+ * This cache sits above block device drivers. It caches fixed-size sectors
+ * in multi-sector pages, evicting the oldest page (by last access) when
+ * full. Writes are write-through unless write-back mode is enabled for the
+ * device, and reads and writes are counted as accesses. One cache instance
+ * is created per storage device.
  */
 #pragma once
 #include <kernel.h>
 
+/**
+ * @brief Interval between flushes of write-back caches, in milliseconds.
+ */
+#define BLOCK_CACHE_FLUSH_MS 1000
+
 /* Forward declarations */
 typedef struct block_cache block_cache_t;
 
+/**
+ * @brief Read statistics for one cache, see block_cache_get_stats().
+ */
+typedef struct block_cache_stats_t {
+	uint64_t requests;         /**< Reads of at least one whole sector. */
+	uint64_t hit_sectors;      /**< Sectors served from memory. */
+	uint64_t miss_sectors;     /**< Sectors fetched from the device. */
+	uint64_t miss_runs;        /**< Device reads issued to fetch them. */
+	uint64_t longest_miss_run; /**< Most sectors fetched by one device read. */
+	uint64_t cached_pages;     /**< Pages currently held. */
+	uint64_t page_bytes;       /**< Size of each page. */
+	uint64_t sector_size;      /**< Device sector size. */
+	uint64_t absorbed_writes;  /**< Writes held in memory by write-back mode. */
+	uint64_t flush_writes;     /**< Device writes issued by flushes. */
+	uint64_t flushed_sectors;  /**< Sectors written back by flushes. */
+	uint64_t dirty_sectors;    /**< Sectors not yet written back. */
+	bool write_back;           /**< Cache is in write-back mode. */
+} block_cache_stats_t;
+
 /**
  * @brief Create a new cache for a storage device.
  *
@@ -33,8 +58,9 @@ void block_cache_destroy(block_cache_t **pcache);
  * @brief Read bytes from a cached device.
  *
  * Granularity is per sector; the cache works in multiples of the device’s
- * block size. Reads hitting the cache are served immediately; misses are
- * read from the device and then cached.
+ * block size. Sectors hitting the cache are served immediately. Missing
+ * sectors are coalesced into as few device reads as possible, read
+ * directly into @p out, and then cached.
  *
  * @param c      Cache instance.
  * @param lba    Starting sector number.
@@ -47,8 +73,10 @@ int block_cache_read(block_cache_t *c, uint64_t lba, uint32_t bytes, unsigned ch
 /**
  * @brief Write bytes through to a cached device.
  *
- * Writes are always passed to the device. The cache is updated (write-allocate)
- * so subsequent reads will hit.
+ * Called after the caller has written the device. The cache is updated
+ * (write-allocate) so subsequent reads will hit. In write-back mode the
+ * sectors are left dirty and a trailing partial sector is merged into any
+ * cached copy, so no unflushed data is lost.
  *
  * @param c      Cache instance.
  * @param lba    Starting sector number.
@@ -58,12 +86,72 @@ int block_cache_read(block_cache_t *c, uint64_t lba, uint32_t bytes, unsigned ch
  */
 int block_cache_write(block_cache_t *c, uint64_t lba, uint32_t bytes, const unsigned char *src);
 
+/**
+ * @brief Hold a write in the cache without writing the device.
+ *
+ * Only used in write-back mode. The sectors are marked dirty, and are written
+ * by the next flush, merged with any adjacent dirty sectors. If too many
+ * sectors are dirty, the caller flushes them first.
+ *
+ * @param c      Cache instance.
+ * @param lba    Starting sector number.
+ * @param bytes  Number of bytes to write, a whole number of sectors.
+ * @param src    Source buffer.
+ * @return       1 if the write was absorbed, 0 if the caller must write it
+ *               through to the device instead.
+ */
+int block_cache_write_back(block_cache_t *c, uint64_t lba, uint32_t bytes, const unsigned char *src);
+
+/**
+ * @brief Write every dirty sector to the device.
+ *
+ * Dirty sectors are sorted and adjacent ones are merged, so each run costs one
+ * device write of up to BLOCK_CACHE_FLUSH_SECTORS sectors. Safe to call while
+ * other writes continue; sectors changed during the flush stay dirty.
+ *
+ * @param c  Cache instance.
+ * @return   1 on success, 0 on failure (fs_set_error() is set).
+ */
+int block_cache_flush(block_cache_t *c);
+
+/**
+ * @brief Switch a cache between write-through and write-back.
+ *
+ * Turning write-back off flushes any dirty sectors.
+ *
+ * @param c       Cache instance.
+ * @param enable  true for write-back, false for write-through.
+ */
+void block_cache_set_write_back(block_cache_t *c, bool enable);
+
+/**
+ * @brief Check whether a cache is in write-back mode.
+ *
+ * @param c  Cache instance.
+ * @return   true if writes are held until flushed.
+ */
+bool block_cache_is_write_back(block_cache_t *c);
+
 /**
  * @brief Invalidate all entries in a cache.
  *
- * Useful when a device is reset or forcibly changed.
+ * Useful when a device is reset or forcibly changed. Dirty sectors are
+ * discarded without being written.
  *
  * @param c  Cache instance.
  */
 void block_cache_invalidate(block_cache_t *c);
 
+/**
+ * @brief Take a snapshot of a cache's statistics.
+ *
+ * @param c      Cache instance.
+ * @param stats  Receives the statistics.
+ */
+void block_cache_get_stats(block_cache_t *c, block_cache_stats_t *stats);
+
+/**
+ * @brief Register /devices/blockcache, showing statistics for every cached device.
+ */
+void init_block_cache_stats(void);
+
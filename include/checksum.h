@@ -0,0 +1,67 @@
+/**
+ * @file checksum.h
+ * @author Craig Edwards (craigedwards@brainbox.cc)
+ * @copyright Copyright (c) 2012-2026
+ */
+#pragma once
+
+#include "kernel.h"
+
+/* Buffers at least this long are summed with SSE2, shorter ones with scalar code */
+#define CSUM_SIMD_MIN	128
+
+/**
+ * @brief Add a buffer to a running Internet checksum (RFC 1071), in place.
+ *
+ * The data is summed as it lies in memory, with no copy and no byte swapping.
+ * Sums can be chained across several buffers, such as a pseudo-header and
+ * then a segment, but every buffer except the last must be an even length.
+ *
+ * @param data Bytes to sum, any alignment
+ * @param len Number of bytes
+ * @param sum Running sum, 0 to start
+ * @return New running sum, to pass to inet_csum_fold() when complete
+ */
+uint64_t inet_csum_partial(const void* data, size_t len, uint64_t sum);
+
+/**
+ * @brief Fold a running sum to 16 bits and complement it.
+ *
+ * @param sum Running sum from inet_csum_partial()
+ * @return Checksum in network byte order, ready to store in a header
+ */
+uint16_t inet_csum_fold(uint64_t sum);
+
+/**
+ * @brief Checksum a single buffer.
+ *
+ * @param data Bytes to sum, with the checksum field zeroed
+ * @param len Number of bytes
+ * @return Checksum in network byte order
+ */
+uint16_t inet_checksum(const void* data, size_t len);
+
+/**
+ * @brief Update a checksum after a 16 bit header field changes, without
+ * summing the rest of the packet again (RFC 1624, equation 3).
+ *
+ * All values are as stored in the packet, i.e. network byte order.
+ *
+ * @param check Current checksum
+ * @param old_value Previous value of the field
+ * @param new_value New value of the field
+ * @return Updated checksum
+ */
+uint16_t inet_csum_update16(uint16_t check, uint16_t old_value, uint16_t new_value);
+
+/**
+ * @brief Update a checksum after a 32 bit, 16 bit aligned, header field changes.
+ * @see inet_csum_update16()
+ */
+uint16_t inet_csum_update32(uint16_t check, uint32_t old_value, uint32_t new_value);
+
+/**
+ * @brief Register `/devices/checksum`, which measures checksum throughput
+ * over MTU sized and jumbo frame sized buffers each time it is read.
+ */
+void init_checksum_bench(void);
@@ -37,6 +37,17 @@ typedef struct ethernet_frame {
 	uint8_t data[];
 } __attribute__((packed)) ethernet_frame_t;
 
+/**
+ * @brief Where a driver must fill in a checksum the stack left to it,
+ * as byte offsets from the start of the ethernet frame
+ */
+typedef struct ethernet_tx_csum {
+	/** Offset of the first byte summed (the TCP header) */
+	uint16_t start;
+	/** Offset of the 16-bit checksum field, which holds the pseudo-header sum */
+	uint16_t offset;
+} ethernet_tx_csum_t;
+
 /**
  * @brief Send a raw ethernet packet to the network card driver
  * 
@@ -48,6 +59,33 @@ typedef struct ethernet_frame {
  */
 int ethernet_send_packet(const uint8_t* dst_mac_addr, const uint8_t* data, size_t len, uint16_t protocol);
 
+/**
+ * @brief Start a run of sends which share one transmit doorbell.
+ *
+ * Until the matching ethernet_tx_batch_end(), drivers are allowed to hold
+ * queued frames back from the hardware. Batches may nest.
+ */
+void ethernet_tx_batch_begin(void);
+
+/**
+ * @brief End a run of sends, ringing the device's doorbell once the
+ * outermost batch ends.
+ */
+void ethernet_tx_batch_end(void);
+
+/**
+ * @brief Find the checksum, if any, a driver must fill in for an outbound frame.
+ *
+ * Only returns true when the active device advertises the offload and the
+ * frame is one the stack left unchecksummed for it.
+ *
+ * @param frame outbound frame as passed to send_packet
+ * @param len frame length
+ * @param csum receives the offsets to program into the device
+ * @return true if the device must insert the checksum
+ */
+bool ethernet_tx_csum_offsets(const void* frame, uint16_t len, ethernet_tx_csum_t* csum);
+
 /**
  * @brief Handle inbound packet via interrupt from network card driver
  * 
@@ -53,6 +53,57 @@ typedef struct fat32_fs_info_t {
 	uint32_t trailsig;		// Must contain FAT32_SIGNATURE3
 } __attribute__((packed)) fat32_fs_info_t;
 
+/**
+ * @brief Bytes of the FAT held by each FAT cache window
+ * (rounded up to a whole number of device blocks)
+ */
+#define FAT32_FAT_WINDOW_BYTES	4096
+
+/**
+ * @brief Number of FAT cache windows per volume
+ */
+#define FAT32_FAT_WINDOWS	32
+
+/**
+ * @brief Number of cluster chains per volume with a cached extent map
+ */
+#define FAT32_EXTENT_MAPS	8
+
+/**
+ * @brief A window of consecutive FAT sectors cached in memory
+ */
+typedef struct fat32_fat_window_t {
+	uint32_t* entries;		// Raw FAT entries, NULL until first used
+	uint32_t first_entry;		// Cluster number of entries[0], or UINT32_MAX if empty
+	uint64_t last_used;		// LRU stamp from fat32_t::fat_tick
+	uint32_t writers;		// set_fat_entry() writes in flight, the window is not replaced while non-zero
+} fat32_fat_window_t;
+
+/**
+ * @brief A run of physically contiguous clusters in a chain
+ */
+typedef struct fat32_extent_t {
+	uint32_t cluster;		// First cluster of the run
+	uint32_t count;			// Number of clusters in the run
+} fat32_extent_t;
+
+/**
+ * @brief Contiguous runs making up a cluster chain, built lazily as
+ * the chain is read and discarded whenever the FAT changes
+ */
+typedef struct fat32_extent_map_t {
+	uint32_t first_cluster;		// First cluster of the chain, 0 if unused
+	uint32_t generation;		// fat32_t::fat_generation when built
+	fat32_extent_t* runs;		// Runs in chain order
+	uint32_t run_count;		// Runs in use
+	uint32_t run_capacity;		// Runs allocated
+	uint32_t clusters;		// Clusters covered by all runs
+	uint32_t hint_run;		// Run which satisfied the last lookup
+	uint32_t hint_base;		// Chain index of the first cluster of hint_run
+	bool complete;			// Runs reach the end of the chain
+	uint64_t last_used;		// LRU stamp from fat32_t::fat_tick
+} fat32_extent_map_t;
+
 /**
  * @brief FAT32 filesystem information, used internally
  * by the driver. This is a higher level version of FSINFO
@@ -70,6 +121,12 @@ typedef struct fat32_t {
 	uint32_t fatsize;		// Size of each FAT
 	uint32_t clustersize;		// Size of a cluster
 	fat32_fs_info_t* info;		// FSINFO
+	uint32_t fat_window_entries;	// FAT entries per cache window
+	fat32_fat_window_t fat_cache[FAT32_FAT_WINDOWS];	// Cached FAT windows
+	fat32_extent_map_t extent_maps[FAT32_EXTENT_MAPS];	// Cached chain extent maps
+	uint32_t fat_generation;	// Incremented on every FAT change
+	uint64_t fat_tick;		// LRU clock for the caches above
+	spinlock_t fat_lock;		// Protects FAT cache and extent maps, never held over device I/O
 } fat32_t;
 
 /**
@@ -161,6 +218,57 @@ void init_fat32();
 
 uint64_t cluster_to_lba(fat32_t* info, uint32_t cluster);
 uint32_t get_fat_entry(fat32_t* info, uint32_t cluster);
+
+/**
+ * @brief Prepare the in-memory FAT cache and extent maps of a newly read volume
+ *
+ * @param info FAT32 volume
+ * @param sd Storage device holding the volume
+ */
+void fat32_init_fat_cache(fat32_t* info, storage_device_t* sd);
+
+/**
+ * @brief Free the FAT cache windows and extent maps of a volume which is going away
+ *
+ * @param info FAT32 volume
+ */
+void fat32_free_fat_cache(fat32_t* info);
+
+/**
+ * @brief Read the FAT window holding a cluster's entry into the cache.
+ *
+ * Must be called without fat_lock held, as the device is read without it.
+ * The window may be replaced again before the caller next takes the lock,
+ * so callers look the entry up again and retry the load if it is missing.
+ *
+ * @param info FAT32 volume
+ * @param cluster Cluster number
+ * @return true if the window was loaded or already cached, false on error
+ */
+bool fat32_fat_load(fat32_t* info, uint32_t cluster);
+
+/**
+ * @brief Read a FAT entry from the FAT cache, with fat_lock held
+ *
+ * @param info FAT32 volume
+ * @param cluster Cluster number
+ * @param entry Receives the raw (unmasked) FAT entry
+ * @return true on success, false if the window holding the entry is not
+ *         cached; release fat_lock and call fat32_fat_load() before retrying
+ */
+bool fat32_fat_entry_locked(fat32_t* info, uint32_t cluster, uint32_t* entry);
+
+/**
+ * @brief Find the contiguous run holding a given cluster of a chain
+ *
+ * @param info FAT32 volume
+ * @param first_cluster First cluster of the chain
+ * @param index Zero based position of the wanted cluster within the chain
+ * @param run Receives the wanted cluster and the number of contiguous
+ *            clusters from it to the end of its run
+ * @return true if found, false if the chain ends before index
+ */
+bool fat32_extent_lookup(fat32_t* info, uint32_t first_cluster, uint32_t index, fat32_extent_t* run);
 bool set_fat_entry(fat32_t* info, uint32_t cluster, uint32_t value);
 bool fat32_read_file(void* file, uint64_t start, uint32_t length, unsigned char* buffer);
 int fat32_attach(const char* device_name, const char* path, int partition_index);
@@ -170,6 +278,15 @@ void amend_free_count(fat32_t* info, int adjustment);
 bool fat32_extend_file(void* f, uint32_t size);
 bool read_cluster(fat32_t* info, uint32_t cluster, void* buffer);
 bool write_cluster(fat32_t* info, uint32_t cluster, void* buffer);
+
+/**
+ * @brief Write out anything the volume's device is holding in a write-back cache.
+ * Called after creating, deleting or truncating, so that a crash does not
+ * leave the directories and FAT behind. Growing a file is not flushed.
+ * @param info FAT32 volume
+ * @return true on success, false on an I/O error (fs_set_error() is set)
+ */
+bool fat32_flush(fat32_t* info);
 char* parse_shitty_lfn_entry(char* nameptr, uint16_t* wide_chars, uint8_t n_wide_chars);
 void parse_short_name(directory_entry_t* entry, char* name, char* dotless);
 void build_lfn_chain(const char* filename, fs_directory_entry_t* current, directory_entry_t* short_entry, directory_entry_t** entries, size_t* entry_count);
@@ -15,6 +15,26 @@
  */
 #define IOBUFSZ 65536
 
+/**
+ * @brief Largest read-ahead window an open file grows to while it is read sequentially
+ */
+#define FS_READAHEAD_MAX (IOBUFSZ * 8)
+
+/**
+ * @brief Directories with at least this many entries get a hashed name index
+ */
+#define FS_DIR_INDEX_MIN 32
+
+/**
+ * @brief Number of slots in the cache of resolved paths
+ */
+#define FS_DCACHE_SLOTS 256
+
+/**
+ * @brief Longest path the cache of resolved paths will hold
+ */
+#define FS_DCACHE_PATH_MAX 128
+
 /* Used by _open() */
 #define _O_APPEND	0x00000001
 #define _O_CREAT	0x00000002
@@ -369,6 +389,7 @@ typedef struct fs_tree_t {
 	uint64_t size;			/* Directory size (usually meaningless except to drivers) */
 	void* opaque;			/* Opaque data (driver specific data) */
 	struct fs_tree_t* next;		/* Next entry for iterating as a linked list (enumerating child directories) */
+	struct hashmap* index;		/* Hashed index of files and child_dirs by name, NULL until built, see dir_index.c */
 } fs_tree_t;
 
 /**
@@ -402,13 +423,17 @@ typedef struct fs_handle_t {
 	fs_handle_type_t type;		/* Filehandle type */
 	uint8_t* inbuf;			/* Input buffer */
 	uint8_t* outbuf;		/* Output buffer */
-	size_t inbufpos;		/* Input buffer position */
-	size_t outbufpos;		/* Output buffer position */
+	size_t inbufpos;		/* File offset of the first byte in the input buffer */
+	size_t inbuflen;		/* Bytes of the file held in the input buffer */
+	size_t outbufpos;		/* File offset the first byte in the output buffer is written to */
+	size_t outbuflen;		/* Bytes waiting in the output buffer */
 	size_t outbufsize;		/* Output buffer size */
 	size_t inbufsize;		/* Input buffer size */
 	fs_directory_entry_t* file;	/* File which is open */
 	size_t seekpos;			/* Seek position within file */
-	bool cached;			/* Entire file is cached to ram */
+	size_t ra_window;		/* Read-ahead window, doubled while reads stay sequential */
+	size_t ra_next;			/* Offset the next read starts at if it is sequential */
+	uint64_t owner;			/* Process id of the opener, 0 for the kernel */
 } fs_handle_t;
 
 
@@ -631,6 +656,45 @@ int _write(int fd, void *buffer, unsigned int count);
  */
 int _close(uint32_t fd);
 
+/**
+ * @brief Write out any data waiting in an open file's output buffer.
+ *
+ * Writes to a file are combined in the handle's output buffer, which is
+ * written out when it fills, when the file is closed, seeked or truncated,
+ * and when the handle is read from.
+ *
+ * @param fd file descriptor
+ * @return true if nothing was waiting or it was all written
+ */
+bool flush_filehandle(uint32_t fd);
+
+/**
+ * @brief Flush the output buffer of every open file, see flush_filehandle().
+ *
+ * @return true if every buffer was written successfully
+ */
+bool flush_all_filehandles(void);
+
+/**
+ * @brief Flush the output buffer of every file a process has open.
+ *
+ * Only the owning process uses its handles, so it can call this without
+ * racing another process writing to them.
+ *
+ * @param owner process id
+ * @return true if every buffer was written successfully
+ */
+bool flush_process_filehandles(uint64_t owner);
+
+/**
+ * @brief Close every file a process still has open, flushing output first.
+ *
+ * Called when the process ends, so that nothing it wrote is left behind.
+ *
+ * @param owner process id
+ */
+void close_process_filehandles(uint64_t owner);
+
 /**
  * @brief POSIX _eof function.
  * 
@@ -778,3 +842,138 @@ bool storage_enable_cache(storage_device_t *device);
  */
 void storage_disable_cache(storage_device_t *sd);
 
+/**
+ * @brief Switch a device's cache between write-through and write-back.
+ *
+ * In write-back mode writes only update the cache. Dirty sectors are written
+ * to the device, adjacent ones merged into single writes, by a flusher every
+ * BLOCK_CACHE_FLUSH_MS, by storage_flush(), or when too many accumulate.
+ * Switching back to write-through flushes first. Devices start out in
+ * write-through mode and are switched by the WRITEBACK statement.
+ *
+ * @param sd      Storage device with a cache.
+ * @param enable  true for write-back, false for write-through.
+ * @return        false if the device has no cache, cannot be written, or is
+ *                optical media.
+ */
+bool storage_set_write_back(storage_device_t *sd, bool enable);
+
+/**
+ * @brief Write any dirty cached sectors of a device to the device.
+ *
+ * Filesystems call this where their on-disk state must be durable.
+ * Does nothing for a device without a write-back cache.
+ *
+ * @param sd  Storage device.
+ * @return    true on success, false on an I/O error (fs_set_error() is set).
+ */
+bool storage_flush(storage_device_t *sd);
+
+/**
+ * @brief Flush every storage device, see storage_flush().
+ *
+ * @return true if every device flushed successfully.
+ */
+bool storage_flush_all(void);
+
+/**
+ * @brief Case-insensitive hash of a file or path name, as used for VFS lookups.
+ *
+ * @param name   Name to hash
+ * @param seed0  First seed
+ * @param seed1  Second seed
+ * @return uint64_t hash, equal for names which compare equal with strcasecmp()
+ */
+uint64_t fs_name_hash(const char* name, uint64_t seed0, uint64_t seed1);
+
+/**
+ * @brief Look a name up in a directory's hashed index.
+ *
+ * The index is built on first use for directories with at least
+ * FS_DIR_INDEX_MIN entries, and smaller directories are not indexed.
+ *
+ * @param directory  Directory to search
+ * @param name       Name to find, compared case-insensitively
+ * @param is_dir     true to find a subdirectory, false to find a file
+ * @param entry      Receives the matching directory entry, or NULL
+ * @param node       Receives the matching child directory node, or NULL
+ * @return true if the directory is indexed and the results are valid,
+ * false if the caller should search the lists itself
+ */
+bool fs_dir_index_lookup(fs_tree_t* directory, const char* name, bool is_dir, fs_directory_entry_t** entry, fs_tree_t** node);
+
+/**
+ * @brief Add a newly created entry to its directory's index, if it has one.
+ *
+ * @param directory  Directory the entry was created in
+ * @param entry      New directory entry
+ * @param node       New child directory node if the entry is a directory, or NULL
+ */
+void fs_dir_index_add(fs_tree_t* directory, fs_directory_entry_t* entry, fs_tree_t* node);
+
+/**
+ * @brief Remove a deleted entry from its directory's index, if it has one.
+ * Also invalidates the resolved path cache.
+ *
+ * @param directory  Directory the entry was deleted from
+ * @param name       Name of the entry
+ * @param is_dir     true if the entry was a directory
+ */
+void fs_dir_index_remove(fs_tree_t* directory, const char* name, bool is_dir);
+
+/**
+ * @brief Discard a directory's index, before its contents are replaced or
+ * it is freed. Also invalidates the resolved path cache.
+ *
+ * @param directory  Directory node
+ */
+void fs_dir_index_drop(fs_tree_t* directory);
+
+/**
+ * @brief Find a directory node in the resolved path cache.
+ *
+ * @param path  Fully qualified path
+ * @return fs_tree_t* cached node, or NULL if not cached
+ */
+fs_tree_t* fs_dcache_find_dir(const char* path);
+
+/**
+ * @brief Find a file entry in the resolved path cache.
+ *
+ * @param path  Fully qualified path
+ * @return fs_directory_entry_t* cached entry, or NULL if not cached
+ */
+fs_directory_entry_t* fs_dcache_find_file(const char* path);
+
+/**
+ * @brief Current resolved path cache generation, to be taken before resolving
+ * a path which will be passed to fs_dcache_add_dir() or fs_dcache_add_file().
+ *
+ * @return uint64_t generation
+ */
+uint64_t fs_dcache_generation(void);
+
+/**
+ * @brief Remember the directory node a path resolved to. Nothing is stored
+ * if the cache was invalidated since @p generation was taken.
+ *
+ * @param path        Fully qualified path
+ * @param node        Directory node
+ * @param generation  Value of fs_dcache_generation() before the path was resolved
+ */
+void fs_dcache_add_dir(const char* path, fs_tree_t* node, uint64_t generation);
+
+/**
+ * @brief Remember the file entry a path resolved to. Nothing is stored
+ * if the cache was invalidated since @p generation was taken.
+ *
+ * @param path        Fully qualified path
+ * @param entry       File entry
+ * @param generation  Value of fs_dcache_generation() before the path was resolved
+ */
+void fs_dcache_add_file(const char* path, fs_directory_entry_t* entry, uint64_t generation);
+
+/**
+ * @brief Forget every resolved path, after entries have been removed or replaced.
+ */
+void fs_dcache_invalidate(void);
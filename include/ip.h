@@ -140,6 +140,13 @@ uint32_t str_to_ip(const char* ip_str);
  */
 uint16_t ip_calculate_checksum(ip_packet_t* packet);
 
+/**
+ * @brief Check whether an address is in 127.0.0.0/8 and never leaves the host
+ */
+static inline bool ip_is_loopback(const uint8_t *ip) {
+	return ip[3] == 127;
+}
+
 /**
  * @brief Send IP packet to the ethernet driver
  * 
@@ -104,6 +104,7 @@
 #include "taskswitch.h"
 #include "acpi.h"
 #include "net.h"
+#include "checksum.h"
 #include "arp.h"
 #include "ip.h"
 #include "ethernet.h"
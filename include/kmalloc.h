@@ -12,6 +12,8 @@
 
 #include <stddef.h>
 
+struct allocator_stats_t;
+
 /**
  * @brief Initialises the kernel’s dynamic memory and DMA-friendly “low heap”.
  *
@@ -70,10 +72,90 @@
  */
 void init_heap(void);
 
+/**
+ * @brief Number of size classes served by the per-CPU allocation caches.
+ *
+ * Classes are powers of two from KMALLOC_CACHE_MIN to KMALLOC_CACHE_MAX bytes.
+ * Requests in this range are rounded up to their class and served from a
+ * small stack of free blocks owned by the calling CPU, so the common case
+ * takes no lock. Larger requests go straight to the general allocator.
+ */
+#define KMALLOC_CACHE_CLASSES 6
+
+/**
+ * @brief Smallest size class of the per-CPU allocation caches, in bytes
+ */
+#define KMALLOC_CACHE_MIN 16
+
+/**
+ * @brief Largest size class of the per-CPU allocation caches, in bytes
+ */
+#define KMALLOC_CACHE_MAX 512
+
+/**
+ * @brief Free blocks each CPU may hold per size class before frees overflow
+ * back to the general allocator
+ */
+#define KMALLOC_CACHE_DEPTH 32
+
+/**
+ * @brief Blocks moved between a CPU cache and the general allocator on each
+ * refill or overflow, under a single acquisition of the allocator lock
+ */
+#define KMALLOC_CACHE_BATCH 16
+
+/**
+ * @brief Statistics for one size class of the per-CPU allocation caches,
+ * summed across all CPUs
+ */
+typedef struct kmalloc_class_stats_t {
+	uint64_t size;		/**< Size of blocks in this class, in bytes */
+	uint64_t hits;		/**< Allocations served from a CPU cache */
+	uint64_t misses;	/**< Allocations which had to refill from the general allocator */
+	uint64_t frees;		/**< Frees returned to a CPU cache */
+	uint64_t overflows;	/**< Times a full CPU cache returned a batch to the general allocator */
+	uint64_t cached;	/**< Free blocks currently held in CPU caches */
+} kmalloc_class_stats_t;
+
+/**
+ * @brief Enable the per-CPU allocation caches.
+ *
+ * Until this is called every allocation goes to the general allocator, as
+ * the caches find the calling CPU through its cpu_local_t, which this sets
+ * up for the BSP. Must be called after init_acpi() and init_interrupts(),
+ * and before any AP is started.
+ */
+void init_kmalloc_caches(void);
+
+/**
+ * @brief Register the `/devices/kmalloc` device, a text table of per-class
+ * allocation cache statistics. Should be called after init_devfs().
+ */
+void init_kmalloc_stats(void);
+
+/**
+ * @brief Get statistics for one size class of the per-CPU allocation caches
+ *
+ * @param class_index Size class, from 0 to KMALLOC_CACHE_CLASSES - 1
+ * @param stats Receives the statistics, summed across all CPUs
+ * @return true on success, false if the class index is out of range
+ */
+bool kmalloc_get_class_stats(uint8_t class_index, kmalloc_class_stats_t* stats);
+
+/**
+ * @brief Get fragmentation and latency statistics for the general heap.
+ *
+ * Blocks held in the per-CPU allocation caches count as allocated.
+ *
+ * @param stats Receives the statistics.
+ */
+void get_heap_stats(struct allocator_stats_t* stats);
+
 /**
  * @brief Allocate memory from the kernel heap.
  *
- * @param size Number of bytes to allocate.
+ * @param size Number of bytes to allocate. Zero still returns a unique
+ *             minimum sized block, which must be freed like any other.
  * @return Pointer to allocated memory, or NULL if allocation fails.
  */
 void* kmalloc(uint64_t size);
@@ -134,10 +216,23 @@ uint64_t get_free_memory(void);
 /**
  * @brief Get total amount of used memory.
  *
+ * Free blocks held in the per-CPU allocation caches are not counted as used.
+ *
  * @return Used heap space in bytes.
  */
 uint64_t get_used_memory(void);
 
+/**
+ * @brief Get the amount of memory held as free blocks in the per-CPU
+ * allocation caches.
+ *
+ * This memory is neither used nor free. Used, cached and free memory add up
+ * to get_total_memory().
+ *
+ * @return Cached heap space in bytes.
+ */
+uint64_t get_cached_memory(void);
+
 /**
  * @brief Get total available memory managed by the kernel heap.
  *
@@ -154,6 +249,31 @@ uint64_t get_total_memory(void);
  */
 _Noreturn void preboot_fail(const char* msg);
 
+#ifdef ALLOCATOR_STRESS_TEST
+#ifndef ALLOCATOR_STRESS_ROUNDS
+/**
+ * @brief Operations made by the boot time heap stress test
+ */
+#define ALLOCATOR_STRESS_ROUNDS 20000000
+#endif
+
+/**
+ * @brief Heap fragmentation stress test.
+ *
+ * Makes @p rounds random allocations and frees of mixed sizes through
+ * kmalloc() and kfree(), holding up to a few thousand blocks live at once,
+ * and checks every block for corruption before freeing it. Heap
+ * fragmentation and allocator latency are logged every tenth of the run,
+ * and a summary is printed to the console at the end.
+ *
+ * Built only when the ALLOCATOR_STRESS_TEST CMake option is enabled.
+ *
+ * @param rounds Number of allocate or free operations to perform
+ * @return true if no corruption was found and all memory was returned
+ */
+bool kmalloc_stress_test(uint64_t rounds);
+#endif
+
 void* kmalloc_aligned(uint64_t size, uint64_t align);
 
 void kfree_aligned(const void* ptr);
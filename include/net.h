@@ -62,6 +62,46 @@ typedef void (*net_get_mac)(uint8_t*);
 /** @brief Callback to send a packet through the device. */
 typedef bool (*net_send_packet)(void* data, uint16_t len);
 
+/** @brief Callback to hand any packets queued by send_packet to the hardware. */
+typedef void (*net_flush_tx)(void);
+
+/**
+ * @brief Most frames a driver's receive DPC passes up the stack before
+ * giving way to other work and queueing itself again.
+ */
+#define NET_RX_BUDGET 64
+
+/**
+ * @brief How often receive DPCs which could not be queued are looked for and
+ * run, see netdev_queue_rx_poll()
+ */
+#define NET_RX_RECOVER_MS 10
+
+/**
+ * @brief Receive counters kept by a driver, shown in /devices/netstats
+ */
+typedef struct netdev_rx_stats {
+	uint64_t packets;          /**< Frames passed up the stack. */
+	uint64_t dropped;          /**< Frames the device dropped for want of a free descriptor. */
+	uint64_t polls;            /**< Passes over the receive ring. */
+	uint64_t budget_hits;      /**< Passes which stopped at NET_RX_BUDGET with frames still waiting. */
+	uint32_t ring_size;        /**< Receive descriptors in the ring. */
+	uint32_t ring_used;        /**< Frames waiting at the start of the last pass. */
+	uint32_t ring_peak;        /**< Most frames seen waiting at the start of a pass. */
+	uint64_t rate;             /**< Frames per second, updated by /devices/netstats. */
+	uint64_t rate_packets;     /**< packets when rate was last updated. */
+	uint64_t rate_ticks;       /**< Ticks when rate was last updated. */
+	dpc_t rx_poll;             /**< Driver's receive DPC, set by netdev_queue_rx_poll(). */
+	volatile bool rx_poll_lost;/**< rx_poll could not be queued and is still to run. */
+} netdev_rx_stats_t;
+
+/**
+ * @brief Checksums a device can fill in on transmit, see netdev_t::offload
+ */
+typedef enum netdev_offload_t {
+	NETDEV_OFFLOAD_TCP_CSUM = 1, /**< TCP checksum over IPv4. The stack seeds the field with the pseudo-header sum. */
+} netdev_offload_t;
+
 /**
  * @brief Represents a physical Ethernet network device.
  *
@@ -78,7 +118,10 @@ typedef struct netdev {
 	netdev_flags_t flags;       /**< Flags from ::netdev_flags_t. */
 	uint16_t mtu;               /**< Maximum transmission unit. */
 	net_get_mac get_mac_addr;   /**< Retrieve MAC address. */
-	net_send_packet send_packet;/**< Send a packet via the interface. */
+	net_send_packet send_packet;/**< Send a packet via the interface. May only queue it until flush_tx. */
+	net_flush_tx flush_tx;      /**< Ring the transmit doorbell for queued packets, or NULL. */
+	uint32_t offload;           /**< Flags from ::netdev_offload_t. */
+	netdev_rx_stats_t* rx_stats;/**< Driver's receive counters, or NULL. */
 	struct netdev* next;        /**< Next device in the linked list. */
 } netdev_t;
 
@@ -173,6 +216,46 @@ netdev_t* find_network_device(const char* name);
  */
 netdev_t* get_active_network_device(void);
 
+/**
+ * @brief Check whether the active network device fills in a checksum on transmit.
+ * @param offload Flag from ::netdev_offload_t.
+ * @return true if the stack should leave that checksum to the device.
+ */
+bool network_device_offloads(netdev_offload_t offload);
+
+/**
+ * @brief Record the start of a pass over a receive ring.
+ * @param stats Driver's receive counters.
+ * @param waiting Frames waiting in the ring.
+ */
+void netdev_rx_poll_start(netdev_rx_stats_t* stats, uint32_t waiting);
+
+/**
+ * @brief Queue a driver's receive DPC, which runs with the device's receive
+ * interrupts masked until it finds the ring empty.
+ *
+ * If the DPC queue is full the poll is remembered instead, and run from a
+ * foreground idle within NET_RX_RECOVER_MS, so the device is never left
+ * masked. Safe from interrupt context.
+ *
+ * @param stats Driver's receive counters, as given in netdev_t::rx_stats.
+ * @param poll Receive DPC.
+ */
+void netdev_queue_rx_poll(netdev_rx_stats_t* stats, dpc_t poll);
+
+/**
+ * @brief End a receive pass which used all of NET_RX_BUDGET with frames
+ * still waiting, and queue the next one to carry on after other work.
+ * @param stats Driver's receive counters.
+ * @param poll Receive DPC.
+ */
+void netdev_rx_poll_yield(netdev_rx_stats_t* stats, dpc_t poll);
+
+/**
+ * @brief Register /devices/netstats, showing receive counters for every network device.
+ */
+void init_net_stats(void);
+
 /**
  * @brief Configure the active network interface from /system/config/network.conf
  *
@@ -61,6 +61,15 @@ typedef struct nvme_cqe_t {
 #define NVME_ID_CNS_NS                   0x00
 #define NVME_ID_CNS_NS_ACTIVE        0x02
 
+/* ---------- Direct I/O ---------- */
+#define NVME_PAGE_SIZE               4096
+/* Largest single command we build, further limited by the controller's MDTS */
+#define NVME_MAX_TRANSFER            (256 * 1024)
+/* PRP list entries needed for NVME_MAX_TRANSFER starting part way into a page */
+#define NVME_PRP_LIST_ENTRIES        (NVME_MAX_TRANSFER / NVME_PAGE_SIZE)
+/* Commands which may be outstanding on the I/O queue at once (one bit each in inflight) */
+#define NVME_MAX_INFLIGHT            32
+
 typedef struct nvme_dsm_range_t {
 	uint32_t cattr;   /* bit2 = deallocate */
 	uint32_t nlba;        /* number of native LBAs */
@@ -79,13 +88,21 @@ typedef struct nvme_dev_t {
 	uint16_t a_cqh;
 	uint8_t a_phase;
 
-	/* io queue (QD=1) */
+	/* io queue */
 	nvme_sqe_t *iosq;
 	nvme_cqe_t *iocq;
 	uint16_t io_qd;
 	uint16_t io_sqt;
 	uint16_t io_cqh;
 	uint8_t io_phase;
+	bool io_sq_dirty;      /* SQEs queued since the tail doorbell was last rung */
+
+	/* commands in flight, indexed by CID */
+	uint64_t *prp_lists;   /* NVME_PRP_LIST_ENTRIES per slot */
+	uint32_t inflight;     /* bitmap of busy slots */
+	uint16_t max_inflight; /* slots usable, never more than io_qd - 1 */
+	bool io_error;         /* a reaped command failed */
+	uint32_t max_transfer; /* bytes per command */
 
 	uint32_t nsid;
 	bool ns_is_4k;
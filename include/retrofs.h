@@ -50,9 +50,25 @@
  * @brief Filesystem identifier magic ("RetroFS1").
  *
  * Stored in the description block for on-disk format verification.
+ * Identifies a version 1 volume, where every file is a single extent.
  */
 #define RFS_ID (uint64_t)0x3153466f72746552ULL
 
+/**
+ * @brief Filesystem identifier magic for version 2 volumes ("RetroFS2").
+ *
+ * Version 2 files may have up to RFS_MAX_EXTENTS extents, the first in
+ * sector_start/sector_length as in version 1 and the rest in the directory
+ * entry's extents array. Older drivers refuse to mount these volumes rather
+ * than misread files. Version 1 volumes still mount, and keep every file in
+ * one extent so they stay readable by older drivers.
+ */
+#define RFS_ID_V2 (uint64_t)0x3253466f72746552ULL
+
+#define RFS_INLINE_EXTENTS 4                        /**< Extents held in a directory entry after the first. */
+#define RFS_MAX_EXTENTS (1 + RFS_INLINE_EXTENTS)   /**< Most extents a file can have before it is consolidated. */
+#define RFS_EXTENT_CACHE_SIZE 16                    /**< Files whose extent lists are cached per volume. */
+
 /**
  * @brief RetroFS GPT Partition Type GUID.
  *
@@ -92,6 +108,14 @@ typedef struct rfs_free_space_map_part_t {
 	uint64_t bits[RFS_FS_MAP_BITS_PER_SECTOR]; /**< Free/used sector flags. */
 } __attribute__((packed)) rfs_free_space_map_part_t;
 
+/**
+ * @brief On-disk extent, a contiguous run of sectors.
+ */
+typedef struct rfs_extent_t {
+	uint64_t start;                 /**< First sector of the extent. */
+	uint64_t sectors;               /**< Length of the extent in sectors, 0 if unused. */
+} __attribute__((packed)) rfs_extent_t;
+
 /**
  * @brief On-disk file entry structure for non-directory entries.
  */
@@ -104,9 +128,18 @@ typedef struct rfs_directory_entry_inner_t {
 	time_t created;                 /**< Creation timestamp (UTC). */
 	time_t modified;                /**< Last modification timestamp (UTC). */
 	uint64_t sequence;              /**< Incremented when file changes. */
+	rfs_extent_t extents[RFS_INLINE_EXTENTS]; /**< Version 2: extents following the first, in file order. Zero on version 1. */
 	char reserved[];                /**< Reserved for future use / alignment. */
 } __attribute__((packed)) rfs_directory_entry_inner_t;
 
+/**
+ * @brief In-memory list of a file's extents in file order.
+ */
+typedef struct rfs_file_extents_t {
+	uint64_t count;                         /**< Number of extents in use. */
+	rfs_extent_t extent[RFS_MAX_EXTENTS];   /**< Extents, the first starting at the file's lbapos. */
+} rfs_file_extents_t;
+
 /**
  * @brief On-disk directory start entry.
  *
@@ -143,6 +176,10 @@ typedef struct rfs_t {
 	uint64_t length;                     /**< Length of the filesystem in sectors. */
 	rfs_description_block_t *desc;       /**< Pointer to loaded description block. */
 	uint64_t total_sectors;              /**< Total sectors in this filesystem. */
+	uint32_t version;                    /**< On-disk format version, 1 or 2. */
+
+	rfs_file_extents_t extent_cache[RFS_EXTENT_CACHE_SIZE]; /**< Recently used extent lists, keyed by first sector. */
+	uint32_t extent_cache_next;          /**< Next extent cache slot to replace. */
 
 	void *cache_block;                  /**< Owning pointer for all L1/L2 arrays and build buffer. */
 	size_t cache_block_size;             /**< Allocated cache block size (for debugging). */
@@ -269,6 +306,17 @@ bool rfs_write_device(rfs_t *rfs, uint64_t start_sectors, uint64_t size_bytes, c
  */
 bool rfs_clear_device(rfs_t *rfs, uint64_t start_sectors, uint64_t size_bytes);
 
+/**
+ * @brief Write out anything the device is holding in a write-back cache.
+ *
+ * Called after creating, deleting or truncating. Writes which grow a file
+ * are left to close, SYNC or the periodic flush.
+ *
+ * @param rfs Filesystem context
+ * @return true on success, false on error
+ */
+bool rfs_flush(rfs_t *rfs);
+
 /**
  * @brief Find a contiguous extent of free sectors.
  *
@@ -296,6 +344,19 @@ bool rfs_find_free_extent(rfs_t *info, uint64_t need, uint64_t *out_start_sector
  */
 bool rfs_mark_extent(rfs_t *info, uint64_t start_sector, uint64_t length_sectors, bool mark_used);
 
+/**
+ * @brief Check whether every sector of an extent is free.
+ *
+ * Uses the L1 summaries where they decide the answer, reading only the
+ * free space map sectors of partly used groups.
+ *
+ * @param info          Filesystem context.
+ * @param start_sector  First sector of extent.
+ * @param length_sectors Number of sectors in extent.
+ * @return true if the whole extent lies within the volume and is free.
+ */
+bool rfs_extent_is_free(rfs_t *info, uint64_t start_sector, uint64_t length_sectors);
+
 /**
  * @brief Build L1/L2 cache structures from the on-disk free space map.
  *
@@ -502,6 +563,81 @@ uint64_t rfs_get_used_bytes(rfs_t *info);
  */
 uint64_t rfs_get_free_space(void* fs);
 
+/**
+ * @brief Build the extent list of an on-disk file entry.
+ *
+ * @param info  Filesystem context, which decides whether inline extents are honoured.
+ * @param entry On-disk entry.
+ * @param out   Receives the extent list.
+ */
+void rfs_entry_extents(const rfs_t *info, const rfs_directory_entry_inner_t *entry, rfs_file_extents_t *out);
+
+/**
+ * @brief Total sectors allocated to a file across all its extents.
+ *
+ * @param list Extent list.
+ * @return Allocated sectors.
+ */
+uint64_t rfs_extents_sectors(const rfs_file_extents_t *list);
+
+/**
+ * @brief Get the extent list of an open VFS file, from the volume's extent cache if possible.
+ *
+ * @param info  Filesystem context.
+ * @param file  VFS file entry.
+ * @param out   Receives the extent list.
+ * @return true on success, false if the entry could not be found.
+ */
+bool rfs_file_extents(rfs_t *info, fs_directory_entry_t *file, rfs_file_extents_t *out);
+
+/**
+ * @brief Update a file's length, and optionally its extent list, in its directory entry.
+ *
+ * Only the sector holding the entry is rewritten, not the whole directory block.
+ * A new extent list also replaces the file's slot in the extent cache.
+ *
+ * @param info   Filesystem context.
+ * @param tree   Directory containing the file.
+ * @param name   File name.
+ * @param list   New extent list, the first extent becoming sector_start/sector_length, or NULL to keep the current one.
+ * @param length New logical length in bytes.
+ * @return true on success, false on I/O error or if the entry is missing.
+ */
+bool rfs_update_file_entry(rfs_t *info, fs_tree_t *tree, const char *name, const rfs_file_extents_t *list, uint64_t length);
+
+/**
+ * @brief Drop a file's extent list from the volume's extent cache.
+ *
+ * @param info          Filesystem context.
+ * @param first_sector  First sector of the file's first extent.
+ */
+void rfs_forget_extents(rfs_t *info, uint64_t first_sector);
+
+/**
+ * @brief Read bytes of a file through its extent list.
+ *
+ * @param info   Filesystem context.
+ * @param list   Extent list.
+ * @param start  Byte offset within the file.
+ * @param length Number of bytes.
+ * @param buffer Destination.
+ * @return true on success, false on I/O error or if the range is not allocated.
+ */
+bool rfs_read_extents(rfs_t *info, const rfs_file_extents_t *list, uint64_t start, uint64_t length, unsigned char *buffer);
+
+/**
+ * @brief Write bytes of a file through its extent list, with read-modify-write
+ * of partial sectors at either end. A NULL @p buffer writes zeroes.
+ *
+ * @param info   Filesystem context.
+ * @param list   Extent list.
+ * @param start  Byte offset within the file.
+ * @param length Number of bytes.
+ * @param buffer Source, or NULL for zeroes.
+ * @return true on success, false on I/O error or if the range is not allocated.
+ */
+bool rfs_write_extents(rfs_t *info, const rfs_file_extents_t *list, uint64_t start, uint64_t length, const unsigned char *buffer);
+
 _Static_assert(sizeof(rfs_directory_entry_t) == (RFS_SECTOR_SIZE / 2), "Directory entry must be exactly half a sector");
 _Static_assert(sizeof(rfs_description_block_padded_t) == RFS_SECTOR_SIZE, "Description block must be exactly one sector");
 _Static_assert(RFS_MAP_READ_CHUNK_SECTORS * RFS_SECTOR_SIZE <= (4ULL * 1024 * 1024), "AHCI PRDT entry must be <= 4 MiB");
@@ -29,8 +29,84 @@ typedef uint64_t pid_t;
  */
 typedef uint8_t cpu_id_t;
 
+/**
+ * @brief Highest scheduling priority a process may be given
+ */
+#define PROC_NICE_MIN -20
+
+/**
+ * @brief Lowest scheduling priority a process may be given
+ */
+#define PROC_NICE_MAX 19
+
+/**
+ * @brief Number of BASIC lines a process at nice 0 may run back to back
+ * before the scheduler moves on to the next process on its CPU.
+ * Every five points of nice below zero doubles this, every five above
+ * zero halves it.
+ */
+#define PROC_QUANTUM_LINES 64
+
+/**
+ * @brief Upper bound on the length of a time slice at nice 0, in
+ * milliseconds. Scaled by nice in the same way as PROC_QUANTUM_LINES,
+ * and never less than one tick.
+ */
+#define PROC_QUANTUM_MS 2
+
+/**
+ * @brief How often each CPU recalculates the CPU usage of its processes,
+ * in milliseconds
+ */
+#define PROC_ACCOUNTING_MS 150
+
+/**
+ * @brief Number of distinct deferred procedure calls which may be
+ * pending at once
+ */
+#define PROC_DPC_QUEUE 32
+
+/**
+ * @brief Per-CPU run queue statistics.
+ *
+ * Refreshed by each CPU's scheduling loop every PROC_ACCOUNTING_MS, and
+ * adjusted immediately when the balancer moves a process between CPUs.
+ * Other CPUs read these without locking, so they are only a guide.
+ */
+typedef struct proc_cpu_stats_t {
+	bool		online;		/**< CPU has entered its scheduling loop */
+	uint32_t	processes;	/**< Processes in this CPU's run list */
+	uint32_t	runnable;	/**< Processes in the run list not waiting on an idle callback */
+	uint32_t	load_percent;	/**< Sum of the cpu_percent of this CPU's processes, capped at 100 */
+	uint64_t	lines;		/**< BASIC lines executed on this CPU */
+	uint64_t	steals;		/**< Processes this CPU has taken from other CPUs */
+	uint64_t	stolen;		/**< Processes other CPUs have taken from this one */
+} proc_cpu_stats_t;
+
 struct process_t;
 
+/**
+ * @brief Kinds of event a suspended process can sleep on, see proc_wait_on()
+ */
+typedef enum wait_channel_type_t {
+	WAIT_NONE,	/**< Not sleeping on a channel; the idle callback is polled every pass */
+	WAIT_PROCESS,	/**< Exit of the process with the given PID */
+	WAIT_KEYBOARD,	/**< A key arriving in the keyboard buffer */
+	WAIT_TIMER,	/**< The tick count reaching a deadline, see proc_wait_until() */
+	WAIT_TCP,	/**< Data, a state change or an acknowledgement on the TCP socket with the given fd */
+} wait_channel_type_t;
+
+/**
+ * @brief Build a wait channel from a wait_channel_type_t and an identifier
+ * such as a PID or file descriptor
+ */
+#define WAIT_CHANNEL(type, id) (((uint64_t)(type) << 56) | ((uint64_t)(id) & 0x00FFFFFFFFFFFFFFULL))
+
+/**
+ * @brief Number of hash buckets sleeping processes are spread across
+ */
+#define WAIT_BUCKETS 64
+
 /**
  * @typedef activity_callback_t
  * @brief Callback to determine if a process is still idle.
@@ -73,6 +149,15 @@ typedef struct process_t {
 	activity_callback_t	check_idle;	/**< If non-null, called to check if the process should remain idle */
 	void*			idle_context;	/**< Opaque context passed to the check_idle callback */
 	uint32_t		cpu_percent;	/**< Rolling average CPU usage percentage */
+	int8_t			nice;		/**< Scheduling priority, PROC_NICE_MIN (most favoured) to PROC_NICE_MAX */
+	uint32_t		quantum_left;	/**< Lines remaining in the current time slice, zeroed to end it early */
+	uint64_t		lines;		/**< Total BASIC lines executed */
+	uint64_t		run_cycles;	/**< TSC cycles spent running since the last CPU usage sample */
+	uint64_t		wait_channel;	/**< Channel to sleep on while check_idle is set, or 0 to keep polling check_idle */
+	uint64_t		wake_tick;	/**< Deadline for a WAIT_TIMER channel */
+	bool			parked;		/**< Off the run list, sleeping on wait_channel */
+	volatile bool		woken;		/**< wait_channel was signalled; return to the run list on the next pass */
+	struct process_t*	wait_next;	/**< Next process sleeping in the same wait bucket */
 } process_t;
 
 /**
@@ -111,9 +196,9 @@ typedef void (*proc_idle_timer_t)(void);
  * or other time-critical paths where the work cannot
  * safely be performed immediately.
  *
- * Internally this is implemented using the idle timer
- * system with a frequency of zero, causing the entry
- * to be removed after execution.
+ * Pending DPCs are held in a fixed queue of
+ * PROC_DPC_QUEUE entries, so queueing one never
+ * allocates and is safe from interrupt context.
  */
 typedef proc_idle_timer_t dpc_t;
 
@@ -153,6 +238,49 @@ process_t* proc_find(pid_t pid);
  */
 process_t* proc_cur(uint8_t logical_cpu);
 
+/**
+ * @brief Let a suspended process sleep until a wait channel is signalled.
+ *
+ * Call after proc_set_idle(). Rather than polling the idle callback on
+ * every pass, the scheduler takes the process off its CPU's run list and
+ * only polls the callback again once proc_wake() is called for the
+ * channel. The callback remains the test of readiness, so spurious wakeups
+ * are harmless. Cleared by proc_set_idle(proc, NULL, NULL).
+ *
+ * @param proc Process which has just been made idle
+ * @param channel Channel built with WAIT_CHANNEL()
+ */
+void proc_wait_on(process_t* proc, uint64_t channel);
+
+/**
+ * @brief Let a suspended process sleep until the tick count reaches a deadline.
+ *
+ * Equivalent to proc_wait_on() with the WAIT_TIMER channel, which every CPU
+ * signals once the earliest deadline of any sleeping process has passed.
+ *
+ * @param proc Process which has just been made idle
+ * @param tick Value of get_ticks() at which to poll its idle callback again
+ */
+void proc_wait_until(process_t* proc, uint64_t tick);
+
+/**
+ * @brief Wake every process sleeping on a wait channel.
+ *
+ * The producer of the event must make it visible (e.g. append received
+ * data) before calling this. Safe to call from interrupt context.
+ *
+ * @param channel Channel built with WAIT_CHANNEL()
+ */
+void proc_wake(uint64_t channel);
+
+/**
+ * @brief Wake every sleeping process on every channel.
+ *
+ * Used when an event may concern all of them, such as CTRL+ESC, which
+ * every BASIC idle callback checks. Safe to call from interrupt context.
+ */
+void proc_wake_all(void);
+
 /**
  * @brief Mark a process as waiting for another to complete.
  *
@@ -265,14 +393,20 @@ bool booted_from_cd(void);
  * sensitive paths where the work cannot be performed
  * immediately.
  *
- * Internally this is implemented using the idle timer
- * system with a frequency of zero, causing the callback
- * to be removed after execution.
+ * The BSP runs pending DPCs on every pass of its
+ * scheduling loop, not just once per tick. Queueing a
+ * handler which is already pending does nothing, so it
+ * still runs once; a handler may queue itself again to
+ * continue work on the next pass.
  *
  * @param handler Function to invoke during the next
  *                foreground idle processing cycle.
+ * @return false if PROC_DPC_QUEUE other handlers are
+ *         already pending and this one was not queued.
+ *         A caller which left its device quiet waiting
+ *         for the DPC must arrange to run it another way.
  */
-void proc_queue_dpc(dpc_t handler);
+bool proc_queue_dpc(dpc_t handler);
 
 /**
  * @brief Execute pending idle callbacks and deferred procedure calls.
@@ -323,4 +457,53 @@ process_t* proc_load_anonymous(const char* source, pid_t parent_pid, const char*
  */
 uint32_t proc_cpu_percent(pid_t pid);
 
+/**
+ * @brief Set the scheduling priority of a process
+ *
+ * Lower values give the process a longer time slice each time it is
+ * scheduled, so it receives a larger share of its CPU; higher values
+ * shorten it. The value is clamped to PROC_NICE_MIN..PROC_NICE_MAX and
+ * takes effect from the process's next time slice.
+ *
+ * @param pid The process ID to change
+ * @param nice New nice value
+ *
+ * @return true if the process was found, false if the PID is invalid
+ */
+bool proc_set_nice(pid_t pid, int64_t nice);
+
+/**
+ * @brief Get the scheduling priority of a process
+ *
+ * @param pid The process ID to query
+ *
+ * @return Nice value of the process, or 0 if the PID is invalid
+ */
+int64_t proc_get_nice(pid_t pid);
+
+/**
+ * @brief End the current time slice of a process early
+ *
+ * The line being executed completes, then the scheduler moves on to the
+ * next process on the CPU. Used by YIELD.
+ *
+ * @param proc Process whose slice should end
+ */
+void proc_yield(process_t* proc);
+
+/**
+ * @brief Get the run queue statistics for a logical CPU
+ *
+ * @param cpu Logical CPU ID
+ *
+ * @return Statistics for the CPU, or NULL if the CPU ID is out of range
+ */
+const proc_cpu_stats_t* proc_get_cpu_stats(uint8_t cpu);
+
+/**
+ * @brief Register the `/devices/sched` device, a text table of per-CPU
+ * run queue statistics.
+ */
+void init_sched_stats(void);
+
 bool is_basic(const char* buf, size_t size);
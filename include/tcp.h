@@ -10,7 +10,9 @@
 #define TCP_WINDOW_SIZE		65535
 #define TCP_ADVERTISED_WINDOW	16384
 #define TCP_PACKET_SIZE_OFF	5
-#define TCP_RECV_BUFFER_LIMIT	196608
+#define TCP_RECV_RING_SIZE	TCP_ADVERTISED_WINDOW	/* Receive ring capacity, whose free space is the window we advertise (power of two) */
+#define TCP_SEND_BUFFER_INITIAL	16384	/* Initial send ring capacity, doubled as needed (power of two) */
+#define TCP_INITIAL_CWND	10	/* Initial congestion window in segments (RFC 6928) */
 
 /* Set this to output or record a trace of the TCP I/O. This is very noisy! */
 #undef TCP_TRACE
@@ -172,9 +174,38 @@ typedef struct tcp_retx_entry {
 	uint64_t rto_ms;
 	uint8_t retries;
 	size_t len;
-	void *segment_copy; /* full TCP segment in host byte order, header + payload/options */
+	bool csum_offloaded; /* checksum field holds only the pseudo-header sum, for the device to complete */
+	void *segment_copy; /* full TCP segment in network byte order, header + payload/options */
 } tcp_retx_entry_t;
 
+/**
+ * @brief Per-connection timers kept on the TCP timer wheel
+ */
+typedef enum tcp_timer_kind_t {
+	TCP_TIMER_RETRANSMIT,          /**< Retransmission timeout of the oldest unacknowledged segment */
+	TCP_TIMER_TIME_WAIT,           /**< End of TIME-WAIT, when the TCB is freed */
+	TCP_TIMER_COUNT,
+} tcp_timer_kind_t;
+
+/**
+ * @brief Connection 4-tuple, which identifies a TCB in the timer wheel and ready list.
+ * TCBs live by value in a hashmap which moves them as it resizes, so these never point at one.
+ */
+typedef struct tcp_conn_key_t {
+	uint32_t local_addr;           /**< Local IPv4 address (host order) */
+	uint32_t remote_addr;          /**< Remote IPv4 address (host order) */
+	uint16_t local_port;           /**< Local TCP port (host order) */
+	uint16_t remote_port;          /**< Remote TCP port (host order) */
+} tcp_conn_key_t;
+
+/**
+ * @brief Called for each timer found expired by @ref tcp_timer_advance
+ * @param key Connection the timer was added for
+ * @param kind Which of its timers
+ * @param due Tick the timer was added for
+ */
+typedef void (*tcp_timer_handler_t)(const tcp_conn_key_t* key, tcp_timer_kind_t kind, uint64_t due);
+
 /**
  * @brief Error codes which can be returned by socket functions
  */
@@ -241,13 +272,20 @@ typedef struct tcp_conn_t {
 	int fd;                        /**< File descriptor (or -1 if none) */
 	int recv_eof_pos;              /**< Position of EOF in recv buffer, or -1 if not seen */
 	int send_eof_pos;              /**< Position of EOF in send buffer, or -1 if not set */
-	uint8_t* recv_buffer;          /**< High-level receive buffer (owned) */
-	size_t recv_buffer_len;        /**< Length of data in receive buffer (bytes) */
-	uint8_t* send_buffer;          /**< High-level send buffer (owned) */
-	size_t send_buffer_len;        /**< Length of data in send buffer (bytes) */
+	uint8_t* recv_buffer;          /**< High-level receive ring of in-order data not yet read (owned) */
+	size_t recv_buffer_len;        /**< Length of data in receive ring (bytes) */
+	size_t recv_buffer_start;      /**< Offset of the oldest unread byte in the receive ring */
+	size_t recv_buffer_size;       /**< Capacity of the receive ring, TCP_RECV_RING_SIZE or 0 if unallocated */
+	bool recv_window_update;       /**< Reading reopened a closing window, the peer should be told */
+	uint8_t* send_buffer;          /**< High-level send ring holding data not yet transmitted (owned) */
+	size_t send_buffer_len;        /**< Length of data in send ring (bytes) */
+	size_t send_buffer_start;      /**< Offset of the oldest unsent byte in the send ring */
+	size_t send_buffer_size;       /**< Capacity of the send ring, a power of two or 0 if unallocated */
 	spinlock_t recv_buffer_spinlock;/**< Lock guarding recv_buffer and length */
 	spinlock_t send_buffer_spinlock;/**< Lock guarding send_buffer and length */
-	uint32_t msl_time;             /**< TIME-WAIT expiry tick or 0 when not armed */
+	uint64_t timer_due[TCP_TIMER_COUNT];    /**< Tick each timer should fire at, or 0 when not armed */
+	uint64_t timer_queued[TCP_TIMER_COUNT]; /**< Due tick of the live timer wheel entry for each timer, or 0 if none */
+	bool tx_ready;                 /**< On the ready list, with data or a window update for tcp_idle() to send */
 	tcp_ordered_list_t* segment_list; /**< Head of out-of-order reassembly list (may be NULL) */
 	int backlog;                   /**< Backlog limit for LISTEN sockets (advisory) */
 	queue_t* pending;              /**< Pending inbound connections for LISTEN sockets */
@@ -259,6 +297,8 @@ typedef struct tcp_conn_t {
 	uint8_t snd_wscale;            /**< Sending window scale */
 	uint8_t rcv_wscale;            /**< Receiving window scale */
 	bool window_scaling;           /**< Window scaling enabled */
+	uint32_t cwnd;                 /**< Congestion window (bytes) */
+	uint32_t ssthresh;             /**< Slow start threshold (bytes) */
 	tcp_error_code_t close_code;   /**< Socket close reason. This is mirrored to state outside the TCB */
 } tcp_conn_t;
 
@@ -334,6 +374,21 @@ int send(int socket, const void* buffer, uint32_t length);
  */
 int recv(int socket, void* buffer, uint32_t maxlen, bool blocking, uint32_t timeout);
 
+/**
+ * @brief Receive data as an escaped BASIC string, without blocking.
+ *
+ * Bytes are escaped straight out of the socket's receive ring into @p buffer,
+ * NUL and STRING_ESCAPE_BYTE becoming two byte sequences, so that the result
+ * can be stored as a string variable. Only bytes whose escaped form fits are
+ * taken from the ring, the rest stay for the next read.
+ *
+ * @param socket Socket descriptor from @ref connect()
+ * @param buffer Destination, always NUL terminated
+ * @param size Size of @p buffer in bytes, including the terminator
+ * @return Number of bytes taken from the ring, 0 if none are buffered; negative @ref tcp_error_code_t on error
+ */
+int tcp_recv_escaped(int socket, char* buffer, size_t size);
+
 /**
  * @brief Check if a socket has data ready to be read.
  *
@@ -362,10 +417,53 @@ bool is_connected(int socket);
 const char* socket_error(int error_code);
 
 /**
- * @brief Idle loop called from timer ISR/scheduler to drive retransmit, send queues, and time-based events.
+ * @brief Idle loop called from the scheduler to run expired connection timers and send
+ * for connections on the ready list. Its cost follows the work due, not the number of connections.
  */
 void tcp_idle();
 
+/**
+ * @brief Start the timer wheel and ready list at the given tick
+ * @param now Current value of get_ticks()
+ */
+void tcp_timer_init(uint64_t now);
+
+/**
+ * @brief Add a timer to the wheel. Timers are never removed, the handler discards stale ones.
+ * @param key Connection 4-tuple
+ * @param kind Which timer
+ * @param due Tick to fire at; anything already past fires on the next advance
+ * @return false if out of memory
+ */
+bool tcp_timer_add(const tcp_conn_key_t* key, tcp_timer_kind_t kind, uint64_t due);
+
+/**
+ * @brief Turn the wheel forward to @p now, calling @p handler for every timer which
+ * came due. The handler may add timers.
+ * @param now Current value of get_ticks()
+ * @param handler Expiry callback
+ */
+void tcp_timer_advance(uint64_t now, tcp_timer_handler_t handler);
+
+/**
+ * @brief Append a connection to the ready list
+ * @param key Connection 4-tuple
+ * @return false if out of memory
+ */
+bool tcp_ready_push(const tcp_conn_key_t* key);
+
+/**
+ * @brief Take the oldest connection from the ready list
+ * @param key Receives the connection 4-tuple
+ * @return false if the list is empty
+ */
+bool tcp_ready_pop(tcp_conn_key_t* key);
+
+/**
+ * @brief Number of connections on the ready list
+ */
+size_t tcp_ready_count(void);
+
 /**
  * @brief Allocate a new empty queue
  * @return queue_t* Newly allocated queue, or NULL on failure
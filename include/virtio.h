@@ -63,9 +63,20 @@ typedef struct virtio_block_config_t {
 	uint32_t secure_erase_sector_alignment;
 } __attribute__((packed)) virtio_block_config_t;
 
+/* ===== Feature bits, as bit numbers; shift 1ULL by them for a mask ===== */
+#define VIRTIO_BLK_F_SIZE_MAX        1   /* size_max limits each data segment */
+#define VIRTIO_BLK_F_SEG_MAX         2   /* seg_max limits data segments per request */
+#define VIRTIO_RING_F_INDIRECT_DESC  28  /* a descriptor may point at a table of descriptors */
+#define VIRTIO_RING_F_EVENT_IDX      29  /* used_event/avail_event suppress notifications */
+#define VIRTIO_F_VERSION_1           32  /* modern device, must be accepted if offered */
+
 /* ===== Virtqueue data structures ===== */
-#define VIRTQ_DESC_F_NEXT   1
-#define VIRTQ_DESC_F_WRITE  2
+#define VIRTQ_DESC_F_NEXT      1
+#define VIRTQ_DESC_F_WRITE     2
+#define VIRTQ_DESC_F_INDIRECT  4
+
+#define VIRTQ_AVAIL_F_NO_INTERRUPT  1
+#define VIRTQ_USED_F_NO_NOTIFY      1
 
 typedef struct virtq_desc_t {
 	uint64_t addr;
@@ -105,6 +116,24 @@ typedef struct virtio_block_req_status_t {
 	uint8_t status;     /* 0 = OK */
 } __attribute__((packed)) virtio_block_req_status_t;
 
+/* Largest queue we ask for; devices offering more are shrunk to this */
+#define VIRTIO_BLOCK_QUEUE_MAX        256
+/* Sectors per request, each request being one header, its data segments and a status byte */
+#define VIRTIO_BLOCK_MAX_SECTORS_PER_REQ  1024
+/* Data segments per request, the indirect table holding these plus header and status */
+#define VIRTIO_BLOCK_MAX_SEGS         16
+#define VIRTIO_BLOCK_INDIRECT_ENTRIES (VIRTIO_BLOCK_MAX_SEGS + 2)
+/* Bounce buffer for callers whose buffers are not identity mapped */
+#define VIRTIO_BLOCK_BOUNCE_SECTORS   256
+
+/* Per request state, indexed by the request's head descriptor */
+typedef struct virtio_block_req_t {
+	virtio_block_req_hdr_t hdr;
+	virtio_block_req_status_t st;
+	uint8_t busy;       /* submitted and not yet reaped */
+	uint8_t pad[6];
+} __attribute__((packed)) virtio_block_req_t;
+
 /* ===== Storage device wiring ===== */
 typedef struct virtio_block_dev_t {
 	/* MMIO window */
@@ -115,6 +144,7 @@ typedef struct virtio_block_dev_t {
 	volatile virtio_pci_common_cfg_t *common;
 	volatile uint8_t *notify_base;
 	uint32_t notify_off_mul;
+	volatile uint16_t *doorbell; /* queue 0's notify address, resolved once */
 	volatile uint8_t *isr;
 	volatile virtio_block_config_t *device_cfg;
 
@@ -132,13 +162,28 @@ typedef struct virtio_block_dev_t {
 	uint64_t avail_phys;
 	uint64_t used_phys;
 
-	/* Descriptor state (single request at a time) */
-	uint16_t free_head; /* start of free list (we link sequentially) */
+	/* Negotiated features */
+	uint64_t features;
+	bool indirect;      /* VIRTIO_RING_F_INDIRECT_DESC */
+	bool event_idx;     /* VIRTIO_RING_F_EVENT_IDX */
+	uint32_t seg_bytes; /* largest data segment */
+	uint16_t max_segs;  /* data segments per request */
+
+	/* Descriptor state: unused descriptors are chained through next */
+	uint16_t free_head; /* first free descriptor */
+	uint16_t num_free;  /* descriptors on the free list */
+	uint16_t avail_idx; /* our copy of avail->idx */
+	uint16_t kicked_idx;/* avail->idx when the device was last notified */
 	uint16_t used_last; /* last seen used idx */
+	uint16_t inflight;  /* requests submitted and not yet reaped */
+	bool io_error;      /* a reaped request failed */
+
+	/* Request header/status per head descriptor, and indirect tables if negotiated */
+	virtio_block_req_t *reqs;
+	virtq_desc_t *indirect_tables; /* VIRTIO_BLOCK_INDIRECT_ENTRIES per head descriptor */
 
-	/* Scratch buffers for request header/footer */
-	virtio_block_req_hdr_t *hdr;
-	virtio_block_req_status_t *st;
+	/* Page aligned bounce for buffers the device cannot address directly */
+	uint8_t *bounce;
 
 	/* Device properties */
 	uint64_t capacity_512;  /* from device_cfg->capacity */
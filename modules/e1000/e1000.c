@@ -19,8 +19,16 @@ static e1000_rx_desc_t *rx_descs[E1000_NUM_RX_DESC];	// Receive Descriptor Buffe
 static e1000_tx_desc_t *tx_descs[E1000_NUM_TX_DESC];	// Transmit Descriptor Buffers
 static uint16_t rx_cur = 0;				// Current Receive Descriptor Buffer
 static uint16_t tx_cur = 0;				// Current Transmit Descriptor Buffer
+static uint16_t tx_clean = 0;				// Oldest descriptor not yet reclaimed
+static uint16_t tx_free = 0;				// Descriptors free for new frames
+static uint16_t tx_unposted = 0;			// Descriptors queued since the tail was last written
+static uint8_t tx_ctx_start = 0;			// TUCSS of the last context descriptor, 0 if none
+static uint8_t tx_ctx_offset = 0;			// TUCSO of the last context descriptor
+static bool tx_csum_capable = false;			// Device supports TCP/IP context descriptors
+static spinlock_t tx_lock = 0;
 
 static void *tx_buffers[E1000_NUM_TX_DESC];
+static netdev_rx_stats_t rx_stats = { .ring_size = E1000_NUM_RX_DESC };
 
 static uint16_t e1000_device_id = 0;
 
@@ -157,8 +165,8 @@ void e1000_transmit_init() {
 	}
 
 	for (int i = 0; i < E1000_NUM_TX_DESC; i++) {
-		uint8_t *raw = (uint8_t *) kmalloc_low(65536 + E1000_TX_ALIGN);
-		memset(raw, 0, 65536 + E1000_TX_ALIGN);
+		uint8_t *raw = (uint8_t *) kmalloc_low(E1000_MAX_PKT_SIZE + E1000_TX_ALIGN);
+		memset(raw, 0, E1000_MAX_PKT_SIZE + E1000_TX_ALIGN);
 		uintptr_t aligned_addr = ((uintptr_t) raw + E1000_TX_ALIGN - 1) & ~(E1000_TX_ALIGN - 1);
 		tx_buffers[i] = (void *) aligned_addr;
 		tx_descs[i]->addr = (uint64_t) (uintptr_t) tx_buffers[i];
@@ -176,8 +184,13 @@ void e1000_transmit_init() {
 
 	//setup numbers
 	e1000_write_command(REG_TXDESCHEAD, 0);
-	e1000_write_command(REG_TXDESCTAIL, E1000_NUM_TX_DESC - 1);
+	e1000_write_command(REG_TXDESCTAIL, 0);
 	tx_cur = 0;
+	tx_clean = 0;
+	tx_free = E1000_NUM_TX_DESC - 1; /* head == tail means empty, so one slot always stays unused */
+	tx_unposted = 0;
+	tx_ctx_start = 0;
+	tx_ctx_offset = 0;
 	e1000_write_command(REG_TCTRL, TCTL_EN
 				       | TCTL_PSP
 				       | (15 << TCTL_CT_SHIFT)
@@ -187,85 +200,199 @@ void e1000_transmit_init() {
 	e1000_write_command(REG_TIPG, 0x0060200A); // Enable inter-packet gaps
 }
 
-void e1000_handle_receive() {
-
-	if (!rx_descs[rx_cur]) {
-		dprintf("No rx_desc[rx_cur]\n");
-		return;
-	}
-	netdev_t *dev = get_active_network_device();
-	if (!dev || dev->deviceid != ((INTEL_VEND << 16) | e1000_device_id)) {
-		dprintf("invalid dev in handle receive\n");
-		return;
-	}
-
-	while (rx_descs[rx_cur]->status & 0x1) {
+/**
+ * @brief Pass up to @p budget received frames up the stack, handing each
+ * descriptor back to the device as it goes.
+ * @return number of frames processed
+ */
+static uint32_t e1000_handle_receive(uint32_t budget) {
+	uint32_t done = 0;
+	while (done < budget && (rx_descs[rx_cur]->status & RXD_STAT_DD)) {
 		uint8_t *buf = (uint8_t *) rx_descs[rx_cur]->addr;
 		uint16_t len = rx_descs[rx_cur]->length;
 		if (!buf) {
 			dprintf("No buf\n");
-			return;
+			break;
 		}
 
 		ethernet_handle_packet((ethernet_frame_t *) buf, len);
+		done++;
 
 		rx_descs[rx_cur]->status = 0;
 		uint16_t old_cur = rx_cur;
 		rx_cur = (rx_cur + 1) % E1000_NUM_RX_DESC;
 		e1000_write_command(REG_RXDESCTAIL, old_cur);
 	}
+	rx_stats.packets += done;
+	return done;
 }
 
-void e1000_check_link() {
-	uint32_t status = e1000_read_command(REG_STATUS);
-	dprintf("e1000: link is %s\n", (status & 2) ? "up" : "down");
+static bool e1000_rx_pending(void) {
+	return (rx_descs[rx_cur]->status & RXD_STAT_DD) != 0;
 }
 
-bool e1000_send_packet(void *p_data, uint16_t p_len) {
-	if (p_len > E1000_MAX_PKT_SIZE) {
-		dprintf("e1000: packet too large\n");
-		return false;
+static uint32_t e1000_rx_waiting(void) {
+	uint32_t waiting = 0;
+	while (waiting < E1000_NUM_RX_DESC && (rx_descs[(rx_cur + waiting) % E1000_NUM_RX_DESC]->status & RXD_STAT_DD)) {
+		waiting++;
 	}
-	if (!tx_descs[tx_cur] || !tx_buffers[tx_cur]) {
-		dprintf("e1000: Bad send buffer\n");
-		return false;
+	return waiting;
+}
+
+/**
+ * @brief Receive DPC. Runs with the device's receive interrupts masked, and
+ * unmasks them once it finds the ring empty.
+ */
+static void e1000_rx_poll(void) {
+	netdev_t *dev = get_active_network_device();
+	if (!dev || dev->deviceid != ((INTEL_VEND << 16) | e1000_device_id)) {
+		dprintf("invalid dev in handle receive\n");
+		e1000_write_command(REG_IMASK, E1000_RX_INTERRUPTS);
+		return;
 	}
 
-	// Check if descriptor is available
-	if (!(tx_descs[tx_cur]->status & TX_DD)) {
-		dprintf("e1000: TX ring full, dropping packet\n");
-		return false;
+	rx_stats.dropped += e1000_read_command(REG_MPC);
+	uint32_t waiting = e1000_rx_waiting();
+	netdev_rx_poll_start(&rx_stats, waiting);
+
+	if (e1000_handle_receive(NET_RX_BUDGET) == NET_RX_BUDGET && e1000_rx_pending()) {
+		netdev_rx_poll_yield(&rx_stats, e1000_rx_poll);
+		return;
 	}
 
-	// Copy the data into the pre-allocated <4GiB DMA-safe buffer
-	memcpy(tx_buffers[tx_cur], p_data, p_len);
+	e1000_write_command(REG_IMASK, E1000_RX_INTERRUPTS);
+	/* RXT0 for a descriptor written back before IMS was set may already have gone */
+	if (e1000_rx_pending()) {
+		e1000_write_command(REG_IMC, E1000_RX_INTERRUPTS);
+		netdev_queue_rx_poll(&rx_stats, e1000_rx_poll);
+	}
+}
 
-	tx_descs[tx_cur]->length = p_len;
-	tx_descs[tx_cur]->cso = 0;
-	tx_descs[tx_cur]->css = 0;
-	tx_descs[tx_cur]->special = 0;
-	tx_descs[tx_cur]->cmd = CMD_EOP | CMD_IFCS | CMD_RS;
-	tx_descs[tx_cur]->status = 0;
+void e1000_check_link() {
+	uint32_t status = e1000_read_command(REG_STATUS);
+	dprintf("e1000: link is %s\n", (status & 2) ? "up" : "down");
+}
 
-	// Advance the tail
-	uint16_t old_cur = tx_cur;
-	tx_cur = (tx_cur + 1) % E1000_NUM_TX_DESC;
-	e1000_write_command(REG_TXDESCTAIL, tx_cur);
+/**
+ * @brief Take back descriptors the device has finished sending.
+ * Every descriptor is queued with RS, so each one reports DD in turn.
+ * Caller holds tx_lock.
+ */
+static void e1000_tx_reclaim(void) {
+	while (tx_free < E1000_NUM_TX_DESC - 1 && (tx_descs[tx_clean]->status & TSTA_DD)) {
+		tx_clean = (tx_clean + 1) % E1000_NUM_TX_DESC;
+		tx_free++;
+	}
+}
 
-	[[maybe_unused]] volatile uint32_t flush = e1000_read_command(REG_STATUS);
+/**
+ * @brief Hand queued descriptors to the device with one tail write. Caller holds tx_lock.
+ */
+static void e1000_tx_post(void) {
+	if (tx_unposted) {
+		e1000_write_command(REG_TXDESCTAIL, tx_cur);
+		tx_unposted = 0;
+	}
+}
 
-	// Wait for descriptor to complete
+/**
+ * @brief Make sure @p need descriptors are free, only waiting on the device
+ * if the ring is full. Caller holds tx_lock.
+ */
+static bool e1000_tx_reserve(uint16_t need) {
+	e1000_tx_reclaim();
+	if (tx_free >= need) {
+		return true;
+	}
+	/* Nothing will complete until the device has seen what is queued */
+	e1000_tx_post();
 	time_t now = time(NULL);
-	while (!(tx_descs[old_cur]->status & TX_DD)) {
+	while (tx_free < need) {
 		if (time(NULL) - now > 1) {
 			dprintf("e1000: TX timeout\n");
 			return false;
 		}
+		e1000_tx_reclaim();
+	}
+	return true;
+}
+
+static void e1000_tx_advance(void) {
+	tx_cur = (tx_cur + 1) % E1000_NUM_TX_DESC;
+	tx_free--;
+	tx_unposted++;
+}
+
+bool e1000_send_packet(void *p_data, uint16_t p_len) {
+	if (p_len > E1000_MAX_PKT_SIZE) {
+		dprintf("e1000: packet too large\n");
+		return false;
+	}
+
+	ethernet_tx_csum_t csum;
+	bool offload = tx_csum_capable && ethernet_tx_csum_offsets(p_data, p_len, &csum);
+
+	uint64_t flags;
+	lock_spinlock_irq(&tx_lock, &flags);
+
+	/* The offsets stay programmed until the next context descriptor, so one is
+	 * only needed when they change, e.g. for a frame with IP options */
+	bool new_context = offload && (csum.start != tx_ctx_start || csum.offset != tx_ctx_offset);
+	if (!e1000_tx_reserve(new_context ? 2 : 1)) {
+		unlock_spinlock_irq(&tx_lock, flags);
+		return false;
 	}
 
+	if (new_context) {
+		e1000_tx_context_desc_t *ctx = (e1000_tx_context_desc_t *) tx_descs[tx_cur];
+		ctx->ipcss = 0;
+		ctx->ipcso = 0;
+		ctx->ipcse = 0;
+		ctx->tucss = csum.start;
+		ctx->tucso = csum.offset;
+		ctx->tucse = 0; /* to the end of the frame */
+		ctx->hdr_len = 0;
+		ctx->mss = 0;
+		ctx->status = 0;
+		ctx->cmd_and_length = (uint32_t) (TUCMD_DEXT | TUCMD_RS | TUCMD_TCP) << 24;
+		tx_ctx_start = csum.start;
+		tx_ctx_offset = csum.offset;
+		e1000_tx_advance();
+	}
+
+	/* Copy into the slot's <4GiB DMA-safe buffer; the caller's frame is reused as soon as we return */
+	e1000_tx_desc_t *desc = tx_descs[tx_cur];
+	memcpy(tx_buffers[tx_cur], p_data, p_len);
+	desc->addr = (uint64_t) (uintptr_t) tx_buffers[tx_cur]; /* a context descriptor may have used the slot */
+	desc->length = p_len;
+	desc->special = 0;
+	if (offload) {
+		desc->cso = TXD_DTYP_DATA;
+		desc->css = TXD_POPTS_TXSM;
+		desc->cmd = CMD_EOP | CMD_IFCS | CMD_RS | CMD_DEXT;
+	} else {
+		desc->cso = 0;
+		desc->css = 0;
+		desc->cmd = CMD_EOP | CMD_IFCS | CMD_RS;
+	}
+	desc->status = 0;
+	e1000_tx_advance();
+
+	/* Completion is picked up by the TXDW interrupt or the next send, not waited for here */
+	if (tx_unposted >= E1000_TX_BATCH) {
+		e1000_tx_post();
+	}
+	unlock_spinlock_irq(&tx_lock, flags);
 	return true;
 }
 
+void e1000_flush_tx(void) {
+	uint64_t flags;
+	lock_spinlock_irq(&tx_lock, &flags);
+	e1000_tx_post();
+	unlock_spinlock_irq(&tx_lock, flags);
+}
+
 void e1000_up() {
 }
 
@@ -275,8 +402,16 @@ void e1000_up() {
  */
 void e1000_handler(uint8_t isr, uint64_t error, uint64_t irq, void *opaque) {
 	uint32_t status = e1000_read_command(REG_ICR);
-	if (status & ICR_RXT0) {
-		e1000_handle_receive();
+	if (status & (ICR_RXT0 | ICR_RXDMT0 | ICR_RXO)) {
+		/* Mask receive causes until e1000_rx_poll() has emptied the ring */
+		e1000_write_command(REG_IMC, E1000_RX_INTERRUPTS);
+		netdev_queue_rx_poll(&rx_stats, e1000_rx_poll);
+	}
+	if (status & ICR_TXDW) {
+		uint64_t flags;
+		lock_spinlock_irq(&tx_lock, &flags);
+		e1000_tx_reclaim();
+		unlock_spinlock_irq(&tx_lock, flags);
 	}
 }
 
@@ -310,6 +445,8 @@ bool e1000_start(pci_dev_t *pci_device) {
 
 	// Cache actual detected device ID
 	e1000_device_id = pci_read(*pci_device, PCI_DEVICE_ID);
+	// The 82542 predates TCP/IP context descriptors
+	tx_csum_capable = (e1000_device_id != E1000_82542);
 
 	if ((e1000_device_id == E1000_82540EM || e1000_device_id == E1000_82541PI) && e1000_detect_eeprom()) {
 		if (!e1000_read_mac_address()) {
@@ -398,6 +535,9 @@ bool e1000_start(pci_dev_t *pci_device) {
 	net->speed = 1000;
 	net->get_mac_addr = e1000_get_mac_addr;
 	net->send_packet = e1000_send_packet;
+	net->flush_tx = e1000_flush_tx;
+	net->offload = tx_csum_capable ? NETDEV_OFFLOAD_TCP_CSUM : 0;
+	net->rx_stats = &rx_stats;
 	net->next = NULL;
 	register_network_device(net);
 
@@ -57,6 +57,7 @@
 #define REG_CTRL_EXT    0x0018
 #define REG_ICR		0x00C0
 #define REG_IMASK       0x00D0
+#define REG_IMC         0x00D8
 #define REG_RCTRL       0x0100
 #define REG_RXDESCLO    0x2800
 #define REG_RXDESCHI    0x2804
@@ -84,6 +85,7 @@
 #define REG_RXDCTL       0x3828 // RX Descriptor Control
 #define REG_RADV         0x282C // RX Int. Absolute Delay Timer
 #define REG_RSRPD        0x2C00 // RX Small Packet Detect Interrupt
+#define REG_MPC          0x4010 // Missed Packets Count, clears on read
 
 #define E1000_MAX_PKT_SIZE 2048
 #define E1000_TX_ALIGN 16
@@ -104,6 +106,9 @@
 #define IMS_INT_ASSERT (1 << 22)   // Interrupt Asserted (clears ICR)
 #define IMS_THSTAT     (1 << 24)   // Thermal Sensor Event
 #define IMS_TEMP       (1 << 25)   // Temperature Sensor Event
+
+// Causes masked while the receive DPC owns the ring
+#define E1000_RX_INTERRUPTS (IMS_RXT0 | IMS_RXDMT0 | IMS_RXO)
  
 #define REG_TIPG         0x0410      // Transmit Inter Packet Gap
 #define ECTRL_SLU        0x40        //set link up
@@ -154,6 +159,17 @@
 #define CMD_RPS                         (1 << 4)    // Report Packet Sent
 #define CMD_VLE                         (1 << 6)    // VLAN Packet Enable
 #define CMD_IDE                         (1 << 7)    // Interrupt Delay Enable
+#define CMD_DEXT                        (1 << 5)    // Extended (context or data) descriptor
+
+// Extended data descriptors reuse the legacy layout: the cso byte holds the
+// descriptor type and the css byte the packet options
+#define TXD_DTYP_DATA                   0x10        // Data descriptor, in the cso byte
+#define TXD_POPTS_TXSM                  0x02        // Insert TCP/UDP checksum, in the css byte
+
+// TCP/IP context descriptor command (TUCMD) bits
+#define TUCMD_TCP                       (1 << 0)    // Checksum is for TCP rather than UDP
+#define TUCMD_RS                        (1 << 3)    // Report Status
+#define TUCMD_DEXT                      (1 << 5)    // Extended descriptor
  
 // TCTL Register
  
@@ -170,7 +186,8 @@
 #define LSTA_TU                         (1 << 3)    // Transmit Under-run
 
 #define E1000_NUM_RX_DESC 32
-#define E1000_NUM_TX_DESC 8
+#define E1000_NUM_TX_DESC 64
+#define E1000_TX_BATCH 16	// Frames queued before the tail is written regardless of batching
  
 typedef struct e1000_rx_desc {
         volatile uint64_t addr;
@@ -191,8 +208,27 @@ typedef struct e1000_tx_desc {
         volatile uint16_t special;
 } __attribute__((packed)) e1000_tx_desc_t;
 
+/**
+ * TCP/IP context descriptor. Sets the checksum offsets used by the
+ * extended data descriptors which follow it, until the next context.
+ */
+typedef struct e1000_tx_context_desc {
+        volatile uint8_t ipcss;
+        volatile uint8_t ipcso;
+        volatile uint16_t ipcse;
+        volatile uint8_t tucss;
+        volatile uint8_t tucso;
+        volatile uint16_t tucse;
+        volatile uint32_t cmd_and_length;
+        volatile uint8_t status;
+        volatile uint8_t hdr_len;
+        volatile uint16_t mss;
+} __attribute__((packed)) e1000_tx_context_desc_t;
+
 void e1000_get_mac_addr(uint8_t* src_mac_addr);
 
 bool e1000_send_packet(void * p_data, uint16_t p_len);
 
+void e1000_flush_tx(void);
+
 void init_e1000();
@@ -20,7 +20,14 @@ static e1000e_rx_desc_t *rx_descs[E1000E_NUM_RX_DESC];
 static e1000e_tx_desc_t *tx_descs[E1000E_NUM_TX_DESC];
 static uint16_t rx_cur = 0;
 static uint16_t tx_cur = 0;
+static uint16_t tx_clean = 0;
+static uint16_t tx_free = 0;
+static uint16_t tx_unposted = 0;
+static uint8_t tx_ctx_start = 0;
+static uint8_t tx_ctx_offset = 0;
+static spinlock_t tx_lock = 0;
 static void *tx_buffers[E1000E_NUM_TX_DESC];
+static netdev_rx_stats_t rx_stats = { .ring_size = E1000E_NUM_RX_DESC };
 static uint16_t e1000e_device_id = 0;
 netdev_t *net = NULL;
 
@@ -277,6 +284,11 @@ static void e1000e_transmit_init(void) {
 	e1000e_write_flush();
 
 	tx_cur = 0;
+	tx_clean = 0;
+	tx_free = E1000E_NUM_TX_DESC - 1;
+	tx_unposted = 0;
+	tx_ctx_start = 0;
+	tx_ctx_offset = 0;
 
 	e1000e_write_command(
 		REG_TCTRL,
@@ -294,21 +306,20 @@ static void e1000e_transmit_init(void) {
 	e1000e_write_flush();
 }
 
-static void e1000e_handle_receive(void) {
-	netdev_t *dev;
+/**
+ * @brief Pass up to @p budget received frames up the stack, handing each
+ * descriptor back to the device as it goes.
+ * @return number of frames processed
+ */
+static uint32_t e1000e_handle_receive(uint32_t budget) {
+	uint32_t done = 0;
 
 	if (!rx_descs[rx_cur]) {
 		dprintf("e1000e: missing rx descriptor\n");
-		return;
-	}
-
-	dev = get_active_network_device();
-	if (!dev || dev->deviceid != ((INTEL_VEND << 16) | e1000e_device_id)) {
-		dprintf("e1000e: invalid network device in receive path\n");
-		return;
+		return 0;
 	}
 
-	while ((rx_descs[rx_cur]->status & 0x1) != 0) {
+	while (done < budget && (rx_descs[rx_cur]->status & RXD_STAT_DD) != 0) {
 		uint8_t *buf;
 		uint16_t len;
 		uint16_t old_cur;
@@ -318,16 +329,65 @@ static void e1000e_handle_receive(void) {
 
 		if (!buf) {
 			dprintf("e1000e: missing rx buffer\n");
-			return;
+			break;
 		}
 
 		ethernet_handle_packet((ethernet_frame_t *) buf, len);
+		done++;
 
 		rx_descs[rx_cur]->status = 0;
 		old_cur = rx_cur;
 		rx_cur = (rx_cur + 1) % E1000E_NUM_RX_DESC;
 		e1000e_write_command(REG_RXDESCTAIL, old_cur);
 	}
+
+	rx_stats.packets += done;
+	return done;
+}
+
+static bool e1000e_rx_pending(void) {
+	return (rx_descs[rx_cur]->status & RXD_STAT_DD) != 0;
+}
+
+static uint32_t e1000e_rx_waiting(void) {
+	uint32_t waiting = 0;
+
+	while (waiting < E1000E_NUM_RX_DESC && (rx_descs[(rx_cur + waiting) % E1000E_NUM_RX_DESC]->status & RXD_STAT_DD) != 0) {
+		waiting++;
+	}
+	return waiting;
+}
+
+/**
+ * @brief Receive DPC. Runs with the device's receive interrupts masked, and
+ * unmasks them once it finds the ring empty.
+ */
+static void e1000e_rx_poll(void) {
+	netdev_t *dev;
+	uint32_t waiting;
+
+	dev = get_active_network_device();
+	if (!dev || dev->deviceid != ((INTEL_VEND << 16) | e1000e_device_id)) {
+		dprintf("e1000e: invalid network device in receive path\n");
+		e1000e_write_command(REG_IMASK, E1000E_RX_INTERRUPTS);
+		return;
+	}
+
+	rx_stats.dropped += e1000e_read_command(REG_MPC);
+	waiting = e1000e_rx_waiting();
+	netdev_rx_poll_start(&rx_stats, waiting);
+
+	if (e1000e_handle_receive(NET_RX_BUDGET) == NET_RX_BUDGET && e1000e_rx_pending()) {
+		netdev_rx_poll_yield(&rx_stats, e1000e_rx_poll);
+		return;
+	}
+
+	e1000e_write_command(REG_IMASK, E1000E_RX_INTERRUPTS);
+	/* Catch a descriptor completed between the last drain and the unmask */
+	if (e1000e_rx_pending()) {
+		e1000e_write_command(REG_IMC, E1000E_RX_INTERRUPTS);
+		netdev_queue_rx_poll(&rx_stats, e1000e_rx_poll);
+	}
 }
 
 static void e1000e_check_link(void) {
@@ -359,49 +419,118 @@ static void e1000e_check_link(void) {
 	dprintf("e1000e: link is up (%u Mbps)\n", net->speed);
 }
 
+/* Every descriptor is queued with RS, so each reports DD in turn. Caller holds tx_lock. */
+static void e1000e_tx_reclaim(void) {
+	while (tx_free < E1000E_NUM_TX_DESC - 1 && (tx_descs[tx_clean]->status & TSTA_DD) != 0) {
+		tx_clean = (tx_clean + 1) % E1000E_NUM_TX_DESC;
+		tx_free++;
+	}
+}
+
+static void e1000e_tx_post(void) {
+	if (tx_unposted) {
+		e1000e_write_command(REG_TXDESCTAIL, tx_cur);
+		tx_unposted = 0;
+	}
+}
+
+static bool e1000e_tx_reserve(uint16_t need) {
+	e1000e_tx_reclaim();
+	if (tx_free >= need) {
+		return true;
+	}
+
+	/* Ring full, give the device what is queued and wait for it to drain */
+	e1000e_tx_post();
+	time_t start = time(NULL);
+	while (tx_free < need) {
+		if (time(NULL) - start > 1) {
+			dprintf("e1000e: tx timeout\n");
+			return false;
+		}
+		e1000e_tx_reclaim();
+	}
+	return true;
+}
+
+static void e1000e_tx_advance(void) {
+	tx_cur = (tx_cur + 1) % E1000E_NUM_TX_DESC;
+	tx_free--;
+	tx_unposted++;
+}
+
 bool e1000e_send_packet(void *p_data, uint16_t p_len) {
-	uint16_t old_cur;
+	ethernet_tx_csum_t csum;
+	e1000e_tx_desc_t *desc;
+	uint64_t flags;
+	bool offload;
+	bool new_context;
 
 	if (p_len > E1000E_MAX_PKT_SIZE) {
 		dprintf("e1000e: packet too large\n");
 		return false;
 	}
 
-	if (!tx_descs[tx_cur] || !tx_buffers[tx_cur]) {
-		dprintf("e1000e: missing tx buffer\n");
+	offload = ethernet_tx_csum_offsets(p_data, p_len, &csum);
+
+	lock_spinlock_irq(&tx_lock, &flags);
+
+	new_context = offload && (csum.start != tx_ctx_start || csum.offset != tx_ctx_offset);
+	if (!e1000e_tx_reserve(new_context ? 2 : 1)) {
+		unlock_spinlock_irq(&tx_lock, flags);
 		return false;
 	}
 
-	if ((tx_descs[tx_cur]->status & TX_DD) == 0) {
-		dprintf("e1000e: tx ring full, dropping packet\n");
-		return false;
+	if (new_context) {
+		e1000e_tx_context_desc_t *ctx = (e1000e_tx_context_desc_t *) tx_descs[tx_cur];
+		ctx->ipcss = 0;
+		ctx->ipcso = 0;
+		ctx->ipcse = 0;
+		ctx->tucss = csum.start;
+		ctx->tucso = csum.offset;
+		ctx->tucse = 0;
+		ctx->hdr_len = 0;
+		ctx->mss = 0;
+		ctx->status = 0;
+		ctx->cmd_and_length = (uint32_t) (TUCMD_DEXT | TUCMD_RS | TUCMD_TCP) << 24;
+		tx_ctx_start = csum.start;
+		tx_ctx_offset = csum.offset;
+		e1000e_tx_advance();
 	}
 
+	desc = tx_descs[tx_cur];
 	memcpy(tx_buffers[tx_cur], p_data, p_len);
+	desc->addr = (uint64_t) (uintptr_t) tx_buffers[tx_cur];
+	desc->length = p_len;
+	desc->special = 0;
+	if (offload) {
+		desc->cso = TXD_DTYP_DATA;
+		desc->css = TXD_POPTS_TXSM;
+		desc->cmd = CMD_EOP | CMD_IFCS | CMD_RS | CMD_DEXT;
+	} else {
+		desc->cso = 0;
+		desc->css = 0;
+		desc->cmd = CMD_EOP | CMD_IFCS | CMD_RS;
+	}
+	desc->status = 0;
+	e1000e_tx_advance();
 
-	tx_descs[tx_cur]->length = p_len;
-	tx_descs[tx_cur]->cso = 0;
-	tx_descs[tx_cur]->css = 0;
-	tx_descs[tx_cur]->special = 0;
-	tx_descs[tx_cur]->cmd = CMD_EOP | CMD_IFCS | CMD_RS;
-	tx_descs[tx_cur]->status = 0;
-
-	old_cur = tx_cur;
-	tx_cur = (tx_cur + 1) % E1000E_NUM_TX_DESC;
-	e1000e_write_command(REG_TXDESCTAIL, tx_cur);
-	e1000e_write_flush();
-
-	time_t start = time(NULL);
-	while ((tx_descs[old_cur]->status & TX_DD) == 0) {
-		if (time(NULL) - start > 1) {
-			dprintf("e1000e: tx timeout\n");
-			return false;
-		}
+	if (tx_unposted >= E1000E_TX_BATCH) {
+		e1000e_tx_post();
 	}
 
+	unlock_spinlock_irq(&tx_lock, flags);
 	return true;
 }
 
+void e1000e_flush_tx(void) {
+	uint64_t flags;
+
+	lock_spinlock_irq(&tx_lock, &flags);
+	e1000e_tx_post();
+	unlock_spinlock_irq(&tx_lock, flags);
+}
+
 static void e1000e_up(void) {
 	uint32_t ctrl;
 
@@ -424,7 +553,16 @@ static void e1000e_handler([[maybe_unused]] uint8_t isr, [[maybe_unused]] uint64
 	}
 
 	if ((status & (E1000E_ICR_RXT0 | E1000E_ICR_RXDMT0 | E1000E_ICR_RXO)) != 0) {
-		e1000e_handle_receive();
+		/* Frames are handed to the stack from e1000e_rx_poll(), with receive causes masked meanwhile */
+		e1000e_write_command(REG_IMC, E1000E_RX_INTERRUPTS);
+		netdev_queue_rx_poll(&rx_stats, e1000e_rx_poll);
+	}
+
+	if ((status & ICR_TXDW) != 0) {
+		uint64_t flags;
+		lock_spinlock_irq(&tx_lock, &flags);
+		e1000e_tx_reclaim();
+		unlock_spinlock_irq(&tx_lock, flags);
 	}
 }
 
@@ -499,6 +637,9 @@ static bool e1000e_start(pci_dev_t *pci_device) {
 	net->speed = 1000;
 	net->get_mac_addr = e1000e_get_mac_addr;
 	net->send_packet = e1000e_send_packet;
+	net->flush_tx = e1000e_flush_tx;
+	net->offload = NETDEV_OFFLOAD_TCP_CSUM;
+	net->rx_stats = &rx_stats;
 	net->next = NULL;
 	register_network_device(net);
 
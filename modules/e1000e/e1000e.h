@@ -54,6 +54,7 @@
 #define REG_RXDCTL 0x2828
 #define REG_RADV 0x282C
 #define REG_RSRPD 0x2C00
+#define REG_MPC 0x4010 /* Missed packets, clears on read */
 
 #define REG_TXDESCLO 0x3800
 #define REG_TXDESCHI 0x3804
@@ -112,6 +113,9 @@
 #define IMS_THSTAT (1 << 24)
 #define IMS_TEMP (1 << 25)
 
+/* Causes masked while the receive DPC owns the ring */
+#define E1000E_RX_INTERRUPTS (IMS_RXT0 | IMS_RXDMT0 | IMS_RXO)
+
 /* RX control */
 #define RCTL_EN (1 << 1)
 #define RCTL_SBP (1 << 2)
@@ -157,6 +161,17 @@
 #define CMD_RPS (1 << 4)
 #define CMD_VLE (1 << 6)
 #define CMD_IDE (1 << 7)
+#define CMD_DEXT (1 << 5)
+
+/* Extended data descriptors reuse the legacy layout: the cso byte holds the
+ * descriptor type and the css byte the packet options */
+#define TXD_DTYP_DATA 0x10
+#define TXD_POPTS_TXSM 0x02
+
+/* TCP/IP context descriptor command (TUCMD) bits */
+#define TUCMD_TCP (1 << 0)
+#define TUCMD_RS (1 << 3)
+#define TUCMD_DEXT (1 << 5)
 
 /* TX control */
 #define TCTL_EN (1 << 1)
@@ -180,7 +195,8 @@
 
 /* Driver-local policy */
 #define E1000E_NUM_RX_DESC 32
-#define E1000E_NUM_TX_DESC 8
+#define E1000E_NUM_TX_DESC 64
+#define E1000E_TX_BATCH 16
 #define E1000E_MAX_PKT_SIZE 16384
 #define E1000E_RX_BUFFER_SIZE 8192
 
@@ -217,8 +233,27 @@ typedef struct e1000e_tx_desc {
 	volatile uint16_t special;
 } __attribute__((packed)) e1000e_tx_desc_t;
 
+/**
+ * TCP/IP context descriptor, setting the checksum offsets used by the
+ * extended data descriptors which follow it
+ */
+typedef struct e1000e_tx_context_desc {
+	volatile uint8_t ipcss;
+	volatile uint8_t ipcso;
+	volatile uint16_t ipcse;
+	volatile uint8_t tucss;
+	volatile uint8_t tucso;
+	volatile uint16_t tucse;
+	volatile uint32_t cmd_and_length;
+	volatile uint8_t status;
+	volatile uint8_t hdr_len;
+	volatile uint16_t mss;
+} __attribute__((packed)) e1000e_tx_context_desc_t;
+
 void e1000e_get_mac_addr(uint8_t *src_mac_addr);
 
 bool e1000e_send_packet(void *p_data, uint16_t p_len);
 
+void e1000e_flush_tx(void);
+
 void init_e1000e(void);
\ No newline at end of file
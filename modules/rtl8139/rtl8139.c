@@ -325,6 +325,9 @@ void init_rtl8139() {
 	net->speed = 100;
 	net->get_mac_addr = rtl8139_get_mac_addr;
 	net->send_packet = rtl8139_send_packet;
+	net->flush_tx = NULL;
+	net->offload = 0;
+	net->rx_stats = NULL;
 	net->next = NULL;
 	register_network_device(net);
 
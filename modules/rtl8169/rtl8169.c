@@ -112,8 +112,14 @@ static void rtl8169_tx_reclaim(void) {
 	}
 }
 
-static void rtl8169_rx_drain(void) {
-	while ((rtl8169_dev.rx_ring[rtl8169_dev.rx_next].flags & RTL8169_DESCRIPTOR_OWN) == 0) {
+static bool rtl8169_rx_ready(uint16_t index) {
+	return (rtl8169_dev.rx_ring[index].flags & RTL8169_DESCRIPTOR_OWN) == 0;
+}
+
+/* Pass up to budget received frames up the stack, returning how many */
+static uint32_t rtl8169_rx_drain(uint32_t budget) {
+	uint32_t done = 0;
+	while (done < budget && rtl8169_rx_ready(rtl8169_dev.rx_next)) {
 		volatile rtl8169_descriptor_t* d = &rtl8169_dev.rx_ring[rtl8169_dev.rx_next];
 		void* buf = rtl8169_dev.rx_bufs[rtl8169_dev.rx_next];
 
@@ -121,6 +127,7 @@ static void rtl8169_rx_drain(void) {
 		if (buf && len >= sizeof(ethernet_frame_t) && len <= RTL8169_RX_BUFFER_SIZE) {
 			ethernet_handle_packet((ethernet_frame_t*)buf, len);
 		}
+		done++;
 
 		uint16_t eor = d->flags & RTL8169_DESCRIPTOR_EOR;
 		d->length = RTL8169_RX_BUFFER_SIZE;
@@ -132,6 +139,29 @@ static void rtl8169_rx_drain(void) {
 			rtl8169_dev.rx_next = 0;
 		}
 	}
+	rtl8169_dev.rx_stats.packets += done;
+	return done;
+}
+
+/* Receive DPC, run with the receive interrupts masked until the ring is found empty */
+static void rtl8169_rx_poll(void) {
+	uint32_t waiting = 0;
+	while (waiting < RTL8169_RX_DESCRIPTOR_COUNT && rtl8169_rx_ready((rtl8169_dev.rx_next + waiting) % RTL8169_RX_DESCRIPTOR_COUNT)) {
+		waiting++;
+	}
+	netdev_rx_poll_start(&rtl8169_dev.rx_stats, waiting);
+
+	if (rtl8169_rx_drain(NET_RX_BUDGET) == NET_RX_BUDGET && rtl8169_rx_ready(rtl8169_dev.rx_next)) {
+		netdev_rx_poll_yield(&rtl8169_dev.rx_stats, rtl8169_rx_poll);
+		return;
+	}
+
+	rtl8169_outw(RTL8169_REG_IRQ_MASK, RTL8169_IRQ_MASK_ALL);
+	/* The chip only raises ROK on a new frame, so look again at the next slot after unmasking */
+	if (rtl8169_rx_ready(rtl8169_dev.rx_next)) {
+		rtl8169_outw(RTL8169_REG_IRQ_MASK, RTL8169_IRQ_MASK_ALL & ~RTL8169_IRQ_MASK_RX);
+		netdev_queue_rx_poll(&rtl8169_dev.rx_stats, rtl8169_rx_poll);
+	}
 }
 
 static void rtl8169_handler([[maybe_unused]] uint8_t isr, [[maybe_unused]] uint64_t error, [[maybe_unused]] uint64_t irq, [[maybe_unused]] void* opaque) {
@@ -142,17 +172,30 @@ static void rtl8169_handler([[maybe_unused]] uint8_t isr, [[maybe_unused]] uint6
 		rtl8169_outw(RTL8169_REG_IRQ_STATUS, status);
 
 		if (status & (RTL8169_IRQ_STATUS_TX_OK | RTL8169_IRQ_STATUS_TX_ERROR)) {
+			uint64_t flags;
+			lock_spinlock_irq(&rtl8169_dev.tx_lock, &flags);
 			rtl8169_tx_reclaim();
+			unlock_spinlock_irq(&rtl8169_dev.tx_lock, flags);
 		}
 
 		if (status & (RTL8169_IRQ_STATUS_RX_OK | RTL8169_IRQ_STATUS_RX_ERROR)) {
-			rtl8169_rx_drain();
+			/* ROK/RER stay masked while rtl8169_rx_poll() works through the ring */
+			rtl8169_outw(RTL8169_REG_IRQ_MASK, RTL8169_IRQ_MASK_ALL & ~RTL8169_IRQ_MASK_RX);
+			netdev_queue_rx_poll(&rtl8169_dev.rx_stats, rtl8169_rx_poll);
 		}
 
 		status = rtl8169_inw(RTL8169_REG_IRQ_STATUS);
 	}
 }
 
+/* Poll the transmitter once for everything queued since the last doorbell. Caller holds tx_lock. */
+static void rtl8169_tx_post(void) {
+	if (rtl8169_dev.tx_unposted) {
+		rtl8169_outb(RTL8169_REG_TPP, RTL8169_TPP_NORMAL);
+		rtl8169_dev.tx_unposted = 0;
+	}
+}
+
 static bool rtl8169_send_packet(void* data, uint16_t len) {
 	if (!rtl8169_dev.active) {
 		return false;
@@ -162,7 +205,16 @@ static bool rtl8169_send_packet(void* data, uint16_t len) {
 		return false;
 	}
 
+	uint64_t flags;
+	lock_spinlock_irq(&rtl8169_dev.tx_lock, &flags);
+
+	/* Don't wait for the TX OK interrupt if the ring has filled */
+	if (rtl8169_dev.tx_free == 0) {
+		rtl8169_tx_reclaim();
+	}
 	if (rtl8169_dev.tx_free == 0) {
+		rtl8169_tx_post();
+		unlock_spinlock_irq(&rtl8169_dev.tx_lock, flags);
 		return false;
 	}
 
@@ -171,6 +223,7 @@ static bool rtl8169_send_packet(void* data, uint16_t len) {
 	void* buf = rtl8169_dev.tx_bufs[idx];
 
 	if (!buf) {
+		unlock_spinlock_irq(&rtl8169_dev.tx_lock, flags);
 		return false;
 	}
 
@@ -192,11 +245,22 @@ static bool rtl8169_send_packet(void* data, uint16_t len) {
 		rtl8169_dev.tx_next = 0;
 	}
 
-	rtl8169_outb(RTL8169_REG_TPP, RTL8169_TPP_NORMAL);
+	if (++rtl8169_dev.tx_unposted >= RTL8169_TX_BATCH) {
+		rtl8169_tx_post();
+	}
+
+	unlock_spinlock_irq(&rtl8169_dev.tx_lock, flags);
 
 	return true;
 }
 
+static void rtl8169_flush_tx(void) {
+	uint64_t flags;
+	lock_spinlock_irq(&rtl8169_dev.tx_lock, &flags);
+	rtl8169_tx_post();
+	unlock_spinlock_irq(&rtl8169_dev.tx_lock, flags);
+}
+
 static void rtl8169_free_rings(void) {
 	if (rtl8169_dev.tx_ring) {
 		kfree_aligned((void*)rtl8169_dev.tx_ring);
@@ -292,6 +356,7 @@ static bool rtl8169_setup_rings(void) {
 	rtl8169_dev.tx_clean = 0;
 	rtl8169_dev.rx_next = 0;
 	rtl8169_dev.tx_free = RTL8169_TX_DESCRIPTOR_COUNT;
+	rtl8169_dev.tx_unposted = 0;
 
 	return true;
 }
@@ -374,7 +439,7 @@ static bool rtl8169_start(pci_dev_t pdev) {
 
 	pci_setup_interrupt("rtl8169", pdev, logical_cpu_id(), rtl8169_handler, NULL);
 
-	rtl8169_outw(RTL8169_REG_IRQ_MASK, RTL8169_IRQ_MASK_RX_OK | RTL8169_IRQ_MASK_TX_OK | RTL8169_IRQ_MASK_TX_ERROR | RTL8169_IRQ_MASK_RX_ERROR);
+	rtl8169_outw(RTL8169_REG_IRQ_MASK, RTL8169_IRQ_MASK_ALL);
 
 	rtl8169_phy_bring_up();
 
@@ -396,6 +461,11 @@ static bool rtl8169_start(pci_dev_t pdev) {
 	net->speed = 1000;
 	net->get_mac_addr = rtl8169_get_mac_addr;
 	net->send_packet = rtl8169_send_packet;
+	net->flush_tx = rtl8169_flush_tx;
+	net->offload = 0;
+	/* The RTL8168 family has no reliable missed packet counter, so no drops are counted */
+	rtl8169_dev.rx_stats.ring_size = RTL8169_RX_DESCRIPTOR_COUNT;
+	net->rx_stats = &rtl8169_dev.rx_stats;
 	net->next = NULL;
 
 	register_network_device(net);
@@ -31,6 +31,8 @@
 #define RTL8169_IRQ_MASK_RX_ERROR 2
 #define RTL8169_IRQ_MASK_TX_OK 4
 #define RTL8169_IRQ_MASK_TX_ERROR 8
+#define RTL8169_IRQ_MASK_RX (RTL8169_IRQ_MASK_RX_OK | RTL8169_IRQ_MASK_RX_ERROR)
+#define RTL8169_IRQ_MASK_ALL (RTL8169_IRQ_MASK_RX | RTL8169_IRQ_MASK_TX_OK | RTL8169_IRQ_MASK_TX_ERROR)
 
 #define RTL8169_REG_IRQ_STATUS 0x3e
 #define RTL8169_IRQ_STATUS_RX_OK 1
@@ -68,6 +70,8 @@
 #define RTL8169_RX_DESCRIPTOR_COUNT 64
 #define RTL8169_TX_DESCRIPTOR_COUNT 64
 
+#define RTL8169_TX_BATCH 16
+
 #define RTL8169_RX_BUFFER_SIZE 1524
 #define RTL8169_TX_BUFFER_SIZE 1524
 
@@ -104,6 +108,11 @@ typedef struct rtl8169_dev {
 	uint16_t rx_next;
 
 	uint16_t tx_free;
+	uint16_t tx_unposted;
+
+	spinlock_t tx_lock;
+
+	netdev_rx_stats_t rx_stats;
 
 	char name[16];
 } rtl8169_dev_t;
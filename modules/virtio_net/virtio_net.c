@@ -2,6 +2,7 @@
 #include "virtio_net.h"
 
 buddy_allocator_t tx_buffer_allocator;
+static netdev_rx_stats_t rx_stats = { 0 };
 
 static bool virtio_net_hw_enable(pci_dev_t pdev) {
 	uint32_t bar4 = pci_read(pdev, PCI_BAR4);
@@ -185,7 +186,7 @@ static void virtq_free_desc(virtq_t *q, uint16_t idx) {
 	q->free_head = idx;
 }
 
-static inline void virtq_push_and_notify(virtq_t *q, uint16_t head_idx, uint16_t qid) {
+static inline void virtq_push(virtq_t *q, uint16_t head_idx) {
 	uint16_t mask = q->q_size - 1;
 
 	q->avail->ring[q->avail_idx & mask] = head_idx;
@@ -194,7 +195,10 @@ static inline void virtq_push_and_notify(virtq_t *q, uint16_t head_idx, uint16_t
 
 	q->avail->idx = q->avail_idx + 1;
 	q->avail_idx = q->avail_idx + 1;
+}
 
+static inline void virtq_push_and_notify(virtq_t *q, uint16_t head_idx, uint16_t qid) {
+	virtq_push(q, head_idx);
 	virtio_net_notify(qid);
 }
 
@@ -227,11 +231,21 @@ static int vnet_rx_prime_all(void) {
 	return 1;
 }
 
-static void vnet_rx_drain(void) {
+static bool vnet_rx_pending(void) {
+	return vnet.rxq.used_idx != *(volatile uint16_t *) &vnet.rxq.used->idx;
+}
+
+/**
+ * @brief Pass up to @p budget received frames up the stack, reposting each
+ * buffer and kicking the device once at the end.
+ * @return number of frames processed
+ */
+static uint32_t vnet_rx_drain(uint32_t budget) {
 	virtq_t *rq = &vnet.rxq;
 	uint16_t mask = rq->q_size - 1;
+	uint32_t done = 0;
 
-	while (rq->used_idx != rq->used->idx) {
+	while (done < budget && vnet_rx_pending()) {
 		virtq_used_elem_t e = rq->used->ring[rq->used_idx & mask];
 		uint16_t head = (uint16_t) e.id;
 		uint32_t len = e.len;
@@ -254,9 +268,72 @@ static void vnet_rx_drain(void) {
 		rq->desc[head].flags = VIRTQ_DESC_F_WRITE;
 		rq->desc[head].next = 0;
 
-		virtq_push_and_notify(rq, head, 0);
+		virtq_push(rq, head);
 
 		rq->used_idx = rq->used_idx + 1;
+		done++;
+	}
+
+	if (done) {
+		virtio_net_notify(0);
+	}
+	rx_stats.packets += done;
+	return done;
+}
+
+/**
+ * @brief Receive DPC. Runs with used buffer interrupts suppressed for the
+ * receive queue, and asks for them again once it finds the queue empty.
+ */
+static void vnet_rx_poll(void) {
+	virtq_t *rq = &vnet.rxq;
+	uint32_t waiting = (uint16_t) (*(volatile uint16_t *) &rq->used->idx - rq->used_idx);
+
+	netdev_rx_poll_start(&rx_stats, waiting);
+	if (vnet_rx_drain(NET_RX_BUDGET) == NET_RX_BUDGET && vnet_rx_pending()) {
+		netdev_rx_poll_yield(&rx_stats, vnet_rx_poll);
+		return;
+	}
+
+	rq->avail->flags &= ~VIRTQ_AVAIL_F_NO_INTERRUPT;
+	/* The device must see the flag cleared before we look for buffers it used without interrupting */
+	__asm__ volatile("mfence":: : "memory");
+	if (vnet_rx_pending()) {
+		rq->avail->flags |= VIRTQ_AVAIL_F_NO_INTERRUPT;
+		netdev_queue_rx_poll(&rx_stats, vnet_rx_poll);
+	}
+}
+
+/* Reclaim frames the device has sent. Caller holds tx_lock. */
+static void vnet_tx_complete(void) {
+	virtq_t* tq = &vnet.txq;
+	uint16_t mask = tq->q_size - 1;
+
+	while (tq->used_idx != tq->used->idx) {
+		virtq_used_elem_t e = tq->used->ring[tq->used_idx & mask];
+		uint16_t head = (uint16_t) e.id;
+
+		void* buf = (void *) (uintptr_t) tq->desc[head].addr;
+		if (buf) {
+			buddy_free_aligned(&tx_buffer_allocator, buf, 16);
+		}
+
+		virtq_free_desc(tq, head);
+		tq->used_idx = tq->used_idx + 1;
+	}
+}
+
+/* Ring the TX doorbell once for everything pushed since it was last rung. Caller holds tx_lock. */
+static void vnet_tx_post(void) {
+	if (!vnet.tx_unposted) {
+		return;
+	}
+	vnet.tx_unposted = 0;
+
+	/* The device must see the new avail idx before we read whether it wants a kick */
+	__asm__ volatile("mfence":: : "memory");
+	if ((vnet.txq.used->flags & VIRTQ_USED_F_NO_NOTIFY) == 0) {
+		virtio_net_notify(1);
 	}
 }
 
@@ -265,74 +342,62 @@ bool virtio_send_packet(void *data, uint16_t len) {
 		return false;
 	}
 	virtq_t* tq = &vnet.txq;
+	ethernet_tx_csum_t csum;
+	bool offload = ethernet_tx_csum_offsets(data, len, &csum);
+	uint64_t flags;
+
+	lock_spinlock_irq(&vnet.tx_lock, &flags);
 
 	int h = virtq_alloc_desc(tq);
 	if (h < 0) {
-		dprintf("virtio-net: TX ring full\n");
-		return false;
+		/* Don't wait for the interrupt if the ring has filled */
+		vnet_tx_complete();
+		h = virtq_alloc_desc(tq);
 	}
-	int p = virtq_alloc_desc(tq);
-	if (p < 0) {
-		virtq_free_desc(tq, (uint16_t) h);
+	if (h < 0) {
+		vnet_tx_post();
+		unlock_spinlock_irq(&vnet.tx_lock, flags);
 		dprintf("virtio-net: TX ring full\n");
 		return false;
 	}
 
-	void* hdr = vnet.tx_hdrs[h];
-	if (!hdr) {
-		hdr = kmalloc_aligned(VNET_HDR_SIZE, 16);
-		if (!hdr) {
-			virtq_free_desc(tq, (uint16_t) h);
-			virtq_free_desc(tq, (uint16_t) p);
-			return false;
-		}
-		vnet.tx_hdrs[h] = hdr;
-	}
-
-	memset(hdr, 0, VNET_HDR_SIZE);
-
-	void *pay = buddy_malloc_aligned(&tx_buffer_allocator, len, 16);
-	if (!pay) {
+	/* Header and frame share one buffer and descriptor, VIRTIO_F_VERSION_1 allows any layout */
+	uint8_t *buf = buddy_malloc_aligned(&tx_buffer_allocator, VNET_HDR_SIZE + len, 16);
+	if (!buf) {
 		virtq_free_desc(tq, (uint16_t) h);
-		virtq_free_desc(tq, (uint16_t) p);
+		unlock_spinlock_irq(&vnet.tx_lock, flags);
 		return false;
 	}
 
-	memcpy(pay, data, len);
+	virtio_net_hdr_t *hdr = (virtio_net_hdr_t *) buf;
+	memset(hdr, 0, VNET_HDR_SIZE);
+	if (offload) {
+		hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+		hdr->csum_start = csum.start;
+		hdr->csum_offset = csum.offset - csum.start;
+	}
+	memcpy(buf + VNET_HDR_SIZE, data, len);
 
-	tq->desc[h].addr = (uint64_t) (uintptr_t) hdr;
-	tq->desc[h].len = sizeof(virtio_net_hdr_t);
-	tq->desc[h].flags = VIRTQ_DESC_F_NEXT;
-	tq->desc[h].next = (uint16_t) p;
+	tq->desc[h].addr = (uint64_t) (uintptr_t) buf;
+	tq->desc[h].len = VNET_HDR_SIZE + len;
+	tq->desc[h].flags = 0;
+	tq->desc[h].next = 0;
 
-	tq->desc[p].addr = (uint64_t) (uintptr_t) pay;
-	tq->desc[p].len = len;
-	tq->desc[p].flags = 0;
-	tq->desc[p].next = 0;
+	virtq_push(tq, (uint16_t) h);
 
-	virtq_push_and_notify(tq, (uint16_t) h, 1);
+	if (++vnet.tx_unposted >= VNET_TX_BATCH) {
+		vnet_tx_post();
+	}
 
+	unlock_spinlock_irq(&vnet.tx_lock, flags);
 	return true;
 }
 
-static void vnet_tx_complete(void) {
-	virtq_t* tq = &vnet.txq;
-	uint16_t mask = tq->q_size - 1;
-
-	while (tq->used_idx != tq->used->idx) {
-		virtq_used_elem_t e = tq->used->ring[tq->used_idx & mask];
-		uint16_t head = (uint16_t) e.id;
-		uint16_t pay = tq->desc[head].next;
-
-		void* paybuf = (void *) (uintptr_t) tq->desc[pay].addr;
-		if (paybuf) {
-			buddy_free_aligned(&tx_buffer_allocator, paybuf, 16);
-		}
-
-		virtq_free_desc(tq, pay);
-		virtq_free_desc(tq, head);
-		tq->used_idx = tq->used_idx + 1;
-	}
+static void virtio_flush_tx(void) {
+	uint64_t flags;
+	lock_spinlock_irq(&vnet.tx_lock, &flags);
+	vnet_tx_post();
+	unlock_spinlock_irq(&vnet.tx_lock, flags);
 }
 
 static void virtio_net_isr(uint8_t isr, uint64_t error, uint64_t irq, void *opaque) {
@@ -341,8 +406,16 @@ static void virtio_net_isr(uint8_t isr, uint64_t error, uint64_t irq, void *opaq
 		/* acknowledge */
 		cause = vnet.isr->isr;
 	}
-	vnet_rx_drain();
+	/* vnet_rx_poll() turns used buffer notifications back on when the queue is empty */
+	if (vnet_rx_pending()) {
+		vnet.rxq.avail->flags |= VIRTQ_AVAIL_F_NO_INTERRUPT;
+		netdev_queue_rx_poll(&rx_stats, vnet_rx_poll);
+	}
+
+	uint64_t flags;
+	lock_spinlock_irq(&vnet.tx_lock, &flags);
 	vnet_tx_complete();
+	unlock_spinlock_irq(&vnet.tx_lock, flags);
 }
 
 static void virtio_get_mac_addr(uint8_t *dst) {
@@ -370,10 +443,13 @@ static bool virtio_net_start(pci_dev_t *pdev) {
 	vnet.common->device_feature_select = 1;
 	devf |= (uint64_t) vnet.common->device_feature << 32;
 
-	uint64_t want = VIRTIO_F_VERSION_1;
+	uint64_t want = 1ULL << VIRTIO_F_VERSION_1;
 	if (devf & VIRTIO_NET_F_MAC) {
 		want |= VIRTIO_NET_F_MAC;
 	}
+	if (devf & VIRTIO_NET_F_CSUM) {
+		want |= VIRTIO_NET_F_CSUM;
+	}
 
 	vnet.common->driver_feature_select = 0;
 	vnet.common->driver_feature = (uint32_t) want;
@@ -428,6 +504,11 @@ static bool virtio_net_start(pci_dev_t *pdev) {
 	net->speed = 1000;
 	net->get_mac_addr = virtio_get_mac_addr;
 	net->send_packet = virtio_send_packet;
+	net->flush_tx = virtio_flush_tx;
+	net->offload = (want & VIRTIO_NET_F_CSUM) ? NETDEV_OFFLOAD_TCP_CSUM : 0;
+	/* The device keeps no count of frames it had no buffer for */
+	rx_stats.ring_size = vnet.rxq.q_size;
+	net->rx_stats = &rx_stats;
 	net->next = NULL;
 
 	register_network_device(net);
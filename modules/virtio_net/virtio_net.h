@@ -33,18 +33,22 @@
 #define VIRTIO_PCI_CAP_DEVICE_CFG  4
 
 /**
- * @def VIRTIO_F_VERSION_1
- * @brief Feature bit indicating the device speaks modern virtio 1.x
- *
- * This lives in the upper 32-bit feature word; keep the constant 64-bit
+ * @def VIRTIO_NET_F_CSUM
+ * @brief Feature bit: device completes partial checksums on transmit
  */
-#define VIRTIO_F_VERSION_1         (1ULL << 32)
+#define VIRTIO_NET_F_CSUM          (1 << 0)
 /**
  * @def VIRTIO_NET_F_MAC
  * @brief Feature bit: device exposes a fixed MAC address in its config space
  */
 #define VIRTIO_NET_F_MAC           (1 << 5)
 
+/**
+ * @def VIRTIO_NET_HDR_F_NEEDS_CSUM
+ * @brief Header flag: checksum from `csum_start` to the end, stored at `csum_start + csum_offset`
+ */
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 1
+
 /**
  * @def VIRTQ_DESC_F_NEXT
  * @brief Virtqueue descriptor flag: this entry chains to `next`
@@ -61,6 +65,11 @@
  * @brief Driver’s requested queue size (clamped to device’s `queue_size`)
  */
 #define VNET_QSIZE                 256
+/**
+ * @def VNET_TX_BATCH
+ * @brief Frames queued on the TX ring before the doorbell is rung regardless of batching
+ */
+#define VNET_TX_BATCH              16
 /**
  * @def VNET_RX_BUF_SIZE
  * @brief Size of each posted RX buffer (must cover virtio header + frame)
@@ -85,14 +94,14 @@ typedef struct {
 } __attribute__((packed)) virtio_net_config_t;
 
 /**
- * @brief Minimal virtio-net per-packet header (no offloads negotiated)
+ * @brief Minimal virtio-net per-packet header (checksum offload only)
  *
  * This header precedes every TX and RX payload. All fields are little-endian
- * The driver zero-initialises it; the device may fill some fields on RX when
- * certain features are negotiated (not used here)
+ * The driver zero-initialises it, setting only the checksum fields on TX when
+ * @ref VIRTIO_NET_F_CSUM was negotiated
  */
 typedef struct {
-	/** Flags (eg. checksum present); unused in this minimal driver */
+	/** Flags, @ref VIRTIO_NET_HDR_F_NEEDS_CSUM on TX for a partial checksum */
 	uint8_t  flags;
 	/** GSO type (eg. TCPv4); unused in this minimal driver */
 	uint8_t  gso_type;
@@ -100,9 +109,9 @@ typedef struct {
 	uint16_t hdr_len;
 	/** GSO segment size; unused here */
 	uint16_t gso_size;
-	/** Checksum start offset; unused here */
+	/** Checksum start offset into the frame */
 	uint16_t csum_start;
-	/** Checksum offset from @ref csum_start; unused here */
+	/** Checksum field offset from @ref csum_start */
 	uint16_t csum_offset;
 	/** Number of buffers (mergeable RX); unused here */
 	uint16_t num_buffers;
@@ -158,8 +167,10 @@ static struct {
 	virtq_t txq;
 	/** Array of RX buffers posted to the device, indexed by descriptor id */
 	void *rx_bufs[VNET_QSIZE];
-	/** Per-descriptor TX header storage (optional; may be static in .c) */
-	void *tx_hdrs[VNET_QSIZE];
+	/** TX frames pushed to the avail ring since the doorbell was last rung */
+	uint16_t tx_unposted;
+	/** Serialises the TX ring and its buffer allocator between senders and the ISR */
+	spinlock_t tx_lock;
 	/** Driver’s in-memory copy of the active MAC address */
 	uint8_t mac[6];
 	/** Cached BAR base pointers by index (identity-mapped) */
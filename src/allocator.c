@@ -1,15 +1,46 @@
 #include "allocator.h"
 
-static size_t allocator_alignment = 0;
-static allocator_header *allocator_head = 0;
-/* Next-fit search hint: reduces average scan length without changing semantics */
-static allocator_header *allocator_cursor = 0;
-
-/* Optional: minimum remainder to allow a split (header + alignment) */
+/*
+ * Two-level segregated fit. Free blocks are kept in lists indexed first by
+ * the power of two of their size, then by one of ALLOCATOR_SL_COUNT equal
+ * subdivisions of that power of two. One bitmap per level finds the first
+ * non-empty list big enough for a request with two bit scans, so allocation
+ * and free take bounded time however fragmented the heap becomes. Every
+ * block also stays linked to its neighbours in address order, so a freed
+ * block merges with both sides immediately.
+ */
+#define ALLOCATOR_SL_BITS	4
+#define ALLOCATOR_SL_COUNT	(1 << ALLOCATOR_SL_BITS)
+/* Sizes below this are mapped linearly, 8 bytes per list, into first level 0 */
+#define ALLOCATOR_SMALL_SHIFT	(ALLOCATOR_SL_BITS + 3)
+#define ALLOCATOR_SMALL_SIZE	(1ULL << ALLOCATOR_SMALL_SHIFT)
+#define ALLOCATOR_FL_COUNT	(64 - ALLOCATOR_SMALL_SHIFT + 1)
+/* Largest request which can be mapped to a list without overflow */
+#define ALLOCATOR_MAX_REQUEST	(1ULL << 62)
+
+/**
+ * @brief Free list links, stored in the payload of each free block
+ */
+typedef struct allocator_free_links {
+	allocator_header *next_free;
+	allocator_header *prev_free;
+} allocator_free_links;
+
+/* Smallest payload, so a free block can hold its links */
+#define ALLOCATOR_MIN_PAYLOAD (sizeof(allocator_free_links))
+
+/* Optional: minimum remainder to allow a split (header + smallest payload) */
 #ifndef ALLOCATOR_MIN_SPLIT
-#define ALLOCATOR_MIN_SPLIT (sizeof(allocator_header) + allocator_alignment)
+#define ALLOCATOR_MIN_SPLIT (sizeof(allocator_header) + ALLOCATOR_MIN_PAYLOAD)
 #endif
 
+static size_t allocator_alignment = 0;
+static allocator_header *allocator_head = 0;
+static uint64_t allocator_fl_bitmap = 0;
+static uint32_t allocator_sl_bitmap[ALLOCATOR_FL_COUNT] = { 0 };
+static allocator_header *allocator_free_lists[ALLOCATOR_FL_COUNT][ALLOCATOR_SL_COUNT] = { 0 };
+static allocator_stats_t allocator_stats = { 0 };
+
 static inline size_t allocator_round_up(size_t v, size_t a) {
 	if (a == 0) {
 		return v;
@@ -17,10 +48,84 @@ static inline size_t allocator_round_up(size_t v, size_t a) {
 	return (v + (a - 1)) & ~(a - 1);
 }
 
+static inline allocator_free_links *allocator_links(allocator_header *h) {
+	return (allocator_free_links *) (h + 1);
+}
+
+static inline bool allocator_adjacent(const allocator_header *a, const allocator_header *b) {
+	return (const uint8_t *) a + sizeof(allocator_header) + a->size == (const uint8_t *) b;
+}
+
+/* Free list holding blocks of exactly this size */
+static inline void allocator_mapping(size_t size, size_t *fl, size_t *sl) {
+	if (size < ALLOCATOR_SMALL_SIZE) {
+		*fl = 0;
+		*sl = size >> 3;
+		return;
+	}
+	size_t f = 63 - __builtin_clzll(size);
+	*fl = f - ALLOCATOR_SMALL_SHIFT + 1;
+	*sl = (size >> (f - ALLOCATOR_SL_BITS)) - ALLOCATOR_SL_COUNT;
+}
+
+/* First free list in which every block is at least this size */
+static inline void allocator_mapping_search(size_t size, size_t *fl, size_t *sl) {
+	if (size >= ALLOCATOR_SMALL_SIZE) {
+		size_t f = 63 - __builtin_clzll(size);
+		size += (1ULL << (f - ALLOCATOR_SL_BITS)) - 1;
+	}
+	allocator_mapping(size, fl, sl);
+}
+
+static void allocator_list_insert(allocator_header *h) {
+	size_t fl, sl;
+	allocator_mapping(h->size, &fl, &sl);
+	allocator_free_links *links = allocator_links(h);
+	allocator_header *head = allocator_free_lists[fl][sl];
+	links->prev_free = 0;
+	links->next_free = head;
+	if (head) {
+		allocator_links(head)->prev_free = h;
+	}
+	allocator_free_lists[fl][sl] = h;
+	allocator_fl_bitmap |= 1ULL << fl;
+	allocator_sl_bitmap[fl] |= 1U << sl;
+	h->free = true;
+	allocator_stats.free_bytes += h->size;
+	allocator_stats.free_blocks++;
+}
+
+static void allocator_list_remove(allocator_header *h) {
+	size_t fl, sl;
+	allocator_mapping(h->size, &fl, &sl);
+	allocator_free_links *links = allocator_links(h);
+	if (links->prev_free) {
+		allocator_links(links->prev_free)->next_free = links->next_free;
+	} else {
+		allocator_free_lists[fl][sl] = links->next_free;
+	}
+	if (links->next_free) {
+		allocator_links(links->next_free)->prev_free = links->prev_free;
+	}
+	if (!allocator_free_lists[fl][sl]) {
+		allocator_sl_bitmap[fl] &= ~(1U << sl);
+		if (!allocator_sl_bitmap[fl]) {
+			allocator_fl_bitmap &= ~(1ULL << fl);
+		}
+	}
+	h->free = false;
+	allocator_stats.free_bytes -= h->size;
+	allocator_stats.free_blocks--;
+}
+
 static void allocator_insert_region(allocator_header *h) {
 	/* insert by address to keep list monotonic increasing */
 	if (allocator_head == 0 || (uintptr_t) h < (uintptr_t) allocator_head) {
+		h->prev = 0;
 		h->next = allocator_head;
+		if (allocator_head) {
+			allocator_head->prev = h;
+		}
 		allocator_head = h;
 		return;
 	}
@@ -30,121 +135,111 @@ static void allocator_insert_region(allocator_header *h) {
 		cur = cur->next;
 	}
 
+	h->prev = cur;
 	h->next = cur->next;
-	cur->next = h;
-}
-
-/* Full sweep coalesce */
-[[maybe_unused]] static void allocator_coalesce_all(void) {
-	allocator_header *cur = allocator_head;
-	while (cur) {
-		allocator_header *n = cur->next;
-		if (n && cur->free && n->free) {
-			uint8_t *cur_end = (uint8_t *) cur + sizeof(allocator_header) + cur->size;
-			if (cur_end == (uint8_t *) n) {
-				cur->size += sizeof(allocator_header) + n->size;
-				cur->next = n->next;
-				continue; /* try to merge the new neighbour as well */
-			}
-		}
-		cur = cur->next;
+	if (cur->next) {
+		cur->next->prev = h;
 	}
+	cur->next = h;
 }
 
-/* Find the node immediately prior to h (O(n)) */
-static allocator_header *allocator_find_prev(const allocator_header *h) {
-	allocator_header *cur = allocator_head;
-	allocator_header *prev = 0;
-	while (cur && cur != h) {
-		prev = cur;
-		cur = cur->next;
+/* Fold the block after h in address order into h */
+static void allocator_absorb_next(allocator_header *h) {
+	allocator_header *n = h->next;
+	h->size += sizeof(allocator_header) + n->size;
+	h->next = n->next;
+	if (h->next) {
+		h->next->prev = h;
 	}
-	return prev;
 }
 
-/* Local coalesce around a specific free block (no full sweep) */
-static void allocator_coalesce_local(allocator_header *h) {
-	allocator_header *prev = allocator_find_prev(h);
+/* Merge a block which is not on any free list with its free neighbours */
+static allocator_header *allocator_coalesce(allocator_header *h) {
 	allocator_header *next = h->next;
-
-	/* forward merge */
-	if (next && next->free) {
-		uint8_t *end = (uint8_t *) h + sizeof(*h) + h->size;
-		if (end == (uint8_t *) next) {
-			h->size += sizeof(*next) + next->size;
-			h->next = next->next;
-			next = h->next;
-		}
+	if (next && next->free && allocator_adjacent(h, next)) {
+		allocator_list_remove(next);
+		allocator_absorb_next(h);
 	}
 
-	/* backward merge */
-	if (prev && prev->free) {
-		uint8_t *end = (uint8_t *) prev + sizeof(*prev) + prev->size;
-		if (end == (uint8_t *) h) {
-			prev->size += sizeof(*h) + h->size;
-			prev->next = h->next;
-			h = prev;
-		}
-	}
-
-	/* keep the search cursor helpful */
-	if (allocator_cursor == 0 || allocator_cursor == next) {
-		allocator_cursor = h;
+	allocator_header *prev = h->prev;
+	if (prev && prev->free && allocator_adjacent(prev, h)) {
+		allocator_list_remove(prev);
+		allocator_absorb_next(prev);
+		h = prev;
 	}
+	return h;
 }
 
-/* Next-fit: scan from a hint, then wrap to head once if needed */
-static allocator_header *allocator_find_suitable(allocator_header *start, size_t size) {
-	allocator_header *cur = start;
-	while (cur) {
-		if (cur->free && cur->size >= size) {
-			return cur;
+/* Good fit: head of the first non-empty list whose blocks all fit */
+static allocator_header *allocator_find_suitable(size_t size) {
+	size_t fl, sl;
+	allocator_mapping_search(size, &fl, &sl);
+	if (fl >= ALLOCATOR_FL_COUNT) {
+		return 0;
+	}
+	uint32_t sl_map = allocator_sl_bitmap[fl] & (~0U << sl);
+	if (!sl_map) {
+		uint64_t fl_map = fl + 1 < 64 ? allocator_fl_bitmap & (~0ULL << (fl + 1)) : 0;
+		if (!fl_map) {
+			return 0;
 		}
-		cur = cur->next;
+		fl = __builtin_ctzll(fl_map);
+		sl_map = allocator_sl_bitmap[fl];
 	}
-	return 0;
+	return allocator_free_lists[fl][__builtin_ctz(sl_map)];
 }
 
 void allocator_init(void *heap, size_t size, size_t alignment) {
 	allocator_alignment = alignment;
+	allocator_fl_bitmap = 0;
+	memset(allocator_sl_bitmap, 0, sizeof(allocator_sl_bitmap));
+	memset(allocator_free_lists, 0, sizeof(allocator_free_lists));
+	memset(&allocator_stats, 0, sizeof(allocator_stats));
 
 	allocator_head = (allocator_header *) heap;
 	allocator_head->size = size - sizeof(allocator_header);
-	allocator_head->free = true;
 	allocator_head->next = 0;
+	allocator_head->prev = 0;
 
-	allocator_cursor = allocator_head;
+	allocator_list_insert(allocator_head);
 }
 
 void *allocator_alloc(size_t size) {
+	uint64_t start = rdtsc();
+	if (size > ALLOCATOR_MAX_REQUEST) {
+		allocator_stats.failures++;
+		return NULL;
+	}
 	size = allocator_round_up(size, (allocator_alignment ? allocator_alignment : sizeof(void *)));
-
-	allocator_header *start = (allocator_cursor ? allocator_cursor : allocator_head);
-	allocator_header *current = allocator_find_suitable(start, size);
-	if (!current && start != allocator_head) {
-		current = allocator_find_suitable(allocator_head, size); /* wrap once */
+	if (size < ALLOCATOR_MIN_PAYLOAD) {
+		size = ALLOCATOR_MIN_PAYLOAD;
 	}
+
+	allocator_header *current = allocator_find_suitable(size);
 	if (!current) {
+		allocator_stats.failures++;
 		return NULL; /* OOM */
 	}
-
-	size_t total_size = size + sizeof(allocator_header);
-
-	/* Only split if the remainder can hold a header plus aligned payload */
-	if (current->size >= total_size + ALLOCATOR_MIN_SPLIT) {
-		allocator_header *next = (allocator_header *) ((uint8_t *) current + total_size);
-		next->size = current->size - total_size;
-		next->free = true;
-		next->next = current->next;
-
+	allocator_list_remove(current);
+
+	/* Only split if the remainder can hold a header plus its free list links */
+	if (current->size >= size + ALLOCATOR_MIN_SPLIT) {
+		allocator_header *rest = (allocator_header *) ((uint8_t *) (current + 1) + size);
+		rest->size = current->size - size - sizeof(allocator_header);
+		rest->prev = current;
+		rest->next = current->next;
+		if (rest->next) {
+			rest->next->prev = rest;
+		}
 		current->size = size;
-		current->next = next;
+		current->next = rest;
+		allocator_list_insert(rest);
 	}
 
-	current->free = false;
-
-	/* advance next-fit cursor */
-	allocator_cursor = (current->next ? current->next : allocator_head);
+	uint64_t cycles = rdtsc() - start;
+	allocator_stats.allocations++;
+	allocator_stats.alloc_cycles += cycles;
+	allocator_stats.alloc_cycles_max = MAX(allocator_stats.alloc_cycles_max, cycles);
 
 	return (void *) (current + 1);
 }
@@ -153,15 +248,19 @@ size_t allocator_free(void *ptr) {
 	if (!ptr) {
 		return 0;
 	}
+	uint64_t start = rdtsc();
 	allocator_header *header = ((allocator_header *) ptr) - 1;
 	if (header->free) {
 		preboot_fail("Double free");
 	}
-	header->free = true;
 	size_t s = header->size; /* preserve existing return-value semantics */
 
-	/* Local coalesce only (adjacent blocks) */
-	allocator_coalesce_local(header);
+	allocator_list_insert(allocator_coalesce(header));
+
+	uint64_t cycles = rdtsc() - start;
+	allocator_stats.frees++;
+	allocator_stats.free_cycles += cycles;
+	allocator_stats.free_cycles_max = MAX(allocator_stats.free_cycles_max, cycles);
 	return s;
 }
 
@@ -174,22 +273,30 @@ size_t allocator_usable_size(void *ptr) {
 }
 
 bool allocator_add_region(void *region, size_t size) {
-	if (!region || size <= sizeof(allocator_header)) {
+	if (!region || size < sizeof(allocator_header) + ALLOCATOR_MIN_PAYLOAD) {
 		return false;
 	}
 
 	allocator_header *h = (allocator_header *) region;
 	h->size = size - sizeof(allocator_header);
-	h->free = true;
-	h->next = 0;
 
 	allocator_insert_region(h);
-	/* Merge only if this abuts neighbours; avoids a full sweep */
-	allocator_coalesce_local(h);
-
-	if (allocator_cursor == 0) {
-		allocator_cursor = allocator_head;
-	}
+	/* Merge only if this abuts neighbours */
+	allocator_list_insert(allocator_coalesce(h));
 
 	return true;
 }
+
+void allocator_get_stats(allocator_stats_t *stats) {
+	*stats = allocator_stats;
+	stats->largest_free = 0;
+	if (!allocator_fl_bitmap) {
+		return;
+	}
+	/* The largest block is somewhere in the highest non-empty list */
+	size_t fl = 63 - __builtin_clzll(allocator_fl_bitmap);
+	size_t sl = 31 - __builtin_clz(allocator_sl_bitmap[fl]);
+	for (allocator_header *h = allocator_free_lists[fl][sl]; h; h = allocator_links(h)->next_free) {
+		stats->largest_free = MAX(stats->largest_free, h->size);
+	}
+}
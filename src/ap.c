@@ -26,6 +26,7 @@ void kmain_ap(struct limine_smp_info *info) {
 	enable_fpu();
 	enable_sse();
 	adopt_cloned_tables_on_ap();
+	cpu_local_init();
 	load_ap_shared_interrupts();
 	wait_for_interpreter_start(info);
 	apic_setup_ap();
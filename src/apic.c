@@ -53,6 +53,15 @@ uint8_t logical_cpu_id(void) {
 	return get_cpu_id_from_lapic_id(cpu_id());
 }
 
+static cpu_local_t cpu_locals[MAX_CPUS] = { 0 };
+
+void cpu_local_init(void) {
+	/* An unmapped CPU gets the INVALID_CPU_ID slot, and so reads back INVALID_CPU_ID */
+	uint8_t id = logical_cpu_id();
+	cpu_locals[id].logical_id = id;
+	wrmsr(IA32_GS_BASE, (uint64_t)&cpu_locals[id]);
+}
+
 uint64_t rdmsr(uint32_t msr) {
 	uint32_t lo, hi;
 	__asm__ volatile ("rdmsr"
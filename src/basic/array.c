@@ -183,6 +183,7 @@ bool basic_dim_int_array(const char* var, int64_t size, struct basic_ctx* ctx, s
 
 	memset(new.values, 0, (uint64_t)size * sizeof(new.values[0]));
 
+	basic_variables_changed(ctx);
 	if (!hashmap_set(ctx->int_array_variables, &new) && hashmap_oom(ctx->int_array_variables)) {
 		tokenizer_error_printf(ctx, "Array '%s': Out of memory", var);
 		return false;
@@ -220,6 +221,7 @@ bool basic_dim_string_array(const char* var, int64_t size, struct basic_ctx* ctx
 	memset(new.values, 0, (uint64_t)size * sizeof(new.values[0]));
 	memset(new.value_lengths, 0, (uint64_t)size * sizeof(new.value_lengths[0]));
 
+	basic_variables_changed(ctx);
 	if (!hashmap_set(ctx->string_array_variables, &new) && hashmap_oom(ctx->string_array_variables)) {
 		tokenizer_error_printf(ctx, "Array '%s': Out of memory", var);
 		return false;
@@ -256,6 +258,7 @@ bool basic_dim_double_array(const char* var, int64_t size, struct basic_ctx* ctx
 
 	memset(new.values, 0, (uint64_t)size * sizeof(new.values[0]));
 
+	basic_variables_changed(ctx);
 	if (!hashmap_set(ctx->double_array_variables, &new) && hashmap_oom(ctx->double_array_variables)) {
 		tokenizer_error_printf(ctx, "Array '%s': Out of memory", var);
 		return false;
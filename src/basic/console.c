@@ -129,6 +129,7 @@ void input_statement(struct basic_ctx* ctx)
 	/* Poll for pending input */
 	if (kinput(ctx, &ctx->input) == 0) {
 		proc_set_idle(proc, check_input_in_progress, ctx);
+		proc_wait_on(proc, WAIT_CHANNEL(WAIT_KEYBOARD, 0));
 		jump_linenum(ctx->current_linenum, ctx);
 		proc->state = PROC_IO_BOUND;
 		return;
@@ -741,6 +742,7 @@ void kget_statement(struct basic_ctx* ctx)
 
 	if (!key_waiting()) {
 		proc_set_idle(proc, check_key_waiting, NULL);
+		proc_wait_on(proc, WAIT_CHANNEL(WAIT_KEYBOARD, 0));
 		jump_linenum(ctx->current_linenum, ctx);
 		proc->state = PROC_IO_BOUND;
 		return;
@@ -797,6 +799,7 @@ void sleep_statement(struct basic_ctx* ctx)
 	if (ctx->sleep_until == 0) {
 		ctx->sleep_until = get_ticks() + sleep_length;
 		proc_set_idle(proc, check_sleep_in_progress, NULL);
+		proc_wait_until(proc, ctx->sleep_until);
 		jump_linenum(ctx->current_linenum, ctx);
 		proc->state = PROC_SUSPENDED;
 		return;
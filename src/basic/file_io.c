@@ -291,6 +291,34 @@ void mkdir_statement(struct basic_ctx* ctx)
 	}
 }
 
+void sync_statement(struct basic_ctx* ctx)
+{
+	accept_or_return(SYNC, ctx);
+	accept_or_return(NEWLINE, ctx);
+	/* This program's buffered file writes go to the disk caches first, then the caches go to disk */
+	bool files = flush_process_filehandles(ctx->proc->pid);
+	if (!storage_flush_all() || !files) {
+		tokenizer_error_printf(ctx, "SYNC: %s", fs_strerror(fs_get_error()));
+	}
+}
+
+void writeback_statement(struct basic_ctx* ctx)
+{
+	accept_or_return(WRITEBACK, ctx);
+	const char* device = str_expr(ctx, NULL);
+	accept_or_return(COMMA, ctx);
+	bool enable = expr(ctx) != 0;
+	accept_or_return(NEWLINE, ctx);
+	storage_device_t* sd = find_storage_device(device);
+	if (!sd) {
+		tokenizer_error_printf(ctx, "WRITEBACK: No such device '%s'", device);
+		return;
+	}
+	if (!storage_set_write_back(sd, enable)) {
+		tokenizer_error_printf(ctx, "WRITEBACK: Device '%s' cannot use a write-back cache", device);
+	}
+}
+
 void mount_statement(struct basic_ctx* ctx) {
 	accept_or_return(MOUNT, ctx);
 	const char* path = make_full_path(ctx, str_expr(ctx, NULL));
@@ -13,12 +13,14 @@ bool new_stack_frame(struct basic_ctx* ctx) {
 		return false;
 	}
 	++ctx->call_stack_ptr;
+	basic_variables_changed(ctx);
 	return true;
 }
 
 void pop_stack_frame(struct basic_ctx* ctx) {
 	if (ctx->call_stack_ptr > 0) {
 		--ctx->call_stack_ptr;
+		basic_variables_changed(ctx);
 	}
 }
 
@@ -33,8 +35,14 @@ void else_statement(struct basic_ctx* ctx)
 	/* If we get to an ELSE, this means that we executed a THEN part of a block IF,
 	 * so we must skip it and any content up until the next ENDIF 
 	 */
+	const compiled_token_t* site = tokenizer_jump_site(ctx, ELSE);
 	accept_or_return(ELSE, ctx);
 	accept_or_return(NEWLINE, ctx);
+	if (site) {
+		/* Linked to just past the matching ENDIF */
+		jump_offset(site->jump.target, ctx);
+		return;
+	}
 	while (tokenizer_token(ctx) != ENDIF && !tokenizer_finished(ctx)) {
 		tokenizer_next(ctx);
 	}
@@ -97,6 +105,7 @@ void error_statement(struct basic_ctx* ctx)
 
 void if_statement(struct basic_ctx* ctx)
 {
+	const compiled_token_t* site = tokenizer_jump_site(ctx, IF);
 	accept_or_return(IF, ctx);
 	bool r = conditional(ctx);
 	accept_or_return(THEN, ctx);
@@ -111,6 +120,11 @@ void if_statement(struct basic_ctx* ctx)
 	} else {
 		if (tokenizer_token(ctx) == NEWLINE) {
 			/* --- multiline false-branch with nesting --- */
+			if (site) {
+				/* Linked to just past the matching ELSE or ENDIF */
+				jump_offset(site->jump.target, ctx);
+				return;
+			}
 			/* Enter the block and scan forward once, respecting nested multiline IFs */
 			accept_or_return(NEWLINE, ctx);
 
@@ -174,9 +188,14 @@ void if_statement(struct basic_ctx* ctx)
 		}
 
 		/* Single-line IF ... THEN <stmt> [ELSE <stmt>] */
-		do {
-			tokenizer_next(ctx);
-		} while (tokenizer_token(ctx) != ELSE && tokenizer_token(ctx) != NEWLINE && tokenizer_token(ctx) != ENDOFINPUT);
+		if (site) {
+			/* Linked to the ELSE, or the end of the line */
+			jump_offset(site->jump.target, ctx);
+		} else {
+			do {
+				tokenizer_next(ctx);
+			} while (tokenizer_token(ctx) != ELSE && tokenizer_token(ctx) != NEWLINE && tokenizer_token(ctx) != ENDOFINPUT);
+		}
 
 		if (tokenizer_token(ctx) == ELSE) {
 			tokenizer_next(ctx);
@@ -191,6 +210,7 @@ void gosub_statement(struct basic_ctx* ctx)
 {
 	int linenum;
 
+	const compiled_token_t* site = tokenizer_jump_site(ctx, GOSUB);
 	accept_or_return(GOSUB, ctx);
 	linenum = tokenizer_num(ctx, NUMBER);
 	accept_or_return(NUMBER, ctx);
@@ -206,7 +226,11 @@ void gosub_statement(struct basic_ctx* ctx)
 			return;
 		}
 		init_local_heap(ctx);
-		jump_linenum(linenum, ctx);
+		if (site) {
+			jump_offset(site->jump.target, ctx);
+		} else {
+			jump_linenum(linenum, ctx);
+		}
 	} else {
 		tokenizer_error_print(ctx, "GOSUB: stack exhausted");
 	}
@@ -220,9 +244,8 @@ void return_statement(struct basic_ctx* ctx)
 		free_local_heap(ctx);
 		pop_stack_frame(ctx);
 
-		while (ctx->for_stack_ptr > ctx->loop_state_stack[ctx->call_stack_ptr].for_stack_ptr) {
-			ctx->for_stack_ptr--;
-			buddy_free(ctx->allocator, ctx->for_stack[ctx->for_stack_ptr].for_variable);
+		if (ctx->for_stack_ptr > ctx->loop_state_stack[ctx->call_stack_ptr].for_stack_ptr) {
+			ctx->for_stack_ptr = ctx->loop_state_stack[ctx->call_stack_ptr].for_stack_ptr;
 		}
 
 		ctx->while_stack_ptr = ctx->loop_state_stack[ctx->call_stack_ptr].while_stack_ptr;
@@ -253,9 +276,8 @@ void next_statement(struct basic_ctx* ctx)
 			continue_loop = ((state->step.v.i > 0 && incr <= state->to.v.i) || (state->step.v.i < 0 && incr >= state->to.v.i));
 		}
 		if (continue_loop) {
-			jump_linenum(state->line_after_for, ctx);
+			jump_offset(state->body_offset, ctx);
 		} else {
-			buddy_free(ctx->allocator, state->for_variable);
 			ctx->for_stack_ptr--;
 			accept_or_return(NEWLINE, ctx);
 		}
@@ -273,9 +295,9 @@ void for_statement(struct basic_ctx* ctx)
 	bool is_double = false;
 	double double_end = 0.0, double_step = 1.0;
 	int64_t int_end = 0, int_step = 1;
-	const char* for_variable = buddy_strdup(ctx->allocator, tokenizer_variable_name(ctx, &var_length));
-	if (!for_variable) {
-		tokenizer_error_print(ctx, "FOR: Out of memory");
+	/* Variable names are interned, so the loop can hold on to the name */
+	const char* for_variable = tokenizer_variable_name(ctx, &var_length);
+	if (!var_length) {
 		return;
 	}
 	accept_or_return(VARIABLE, ctx);
@@ -290,25 +312,12 @@ void for_statement(struct basic_ctx* ctx)
 		basic_set_int_variable(for_variable, i, ctx, false, false, var_length);
 	}
 	accept_or_return(TO, ctx);
-	/* STEP needs special treatment, as it happens after an expression and is not separated by a comma */
-	char* marker = NULL;
-	for (char* n = (char*)ctx->ptr; *n && *n != '\n'; ++n) {
-		if (strncmp(n, " STEP ", 6) == 0) {
-			*n = '\n';
-			marker = n;
-			break;
-		}
-	}
-
+	/* The expression parser stops at the STEP keyword, as it is not an operator */
 	if (is_double) {
 		double_expr(ctx, &double_end);
 	} else {
 		int_end = expr(ctx);
 	}
-	tokenizer_next(ctx);
-	if (marker) {
-		*marker = ' ';
-	}
 	if (tokenizer_token(ctx) == STEP) {
 		accept_or_return(STEP, ctx);
 		if (is_double) {
@@ -316,12 +325,12 @@ void for_statement(struct basic_ctx* ctx)
 		} else {
 			int_step = expr(ctx);
 		}
-		accept_or_return(NEWLINE, ctx);
 	}
+	accept_or_return(NEWLINE, ctx);
 
 	if (ctx->for_stack_ptr < MAX_LOOP_STACK_DEPTH) {
 		for_state* state = &ctx->for_stack[ctx->for_stack_ptr];
-		state->line_after_for = tokenizer_num(ctx, NUMBER);
+		state->body_offset = ctx->ptr - ctx->program_ptr;
 		state->for_variable = for_variable;
 		state->for_variable_len = var_length;
 		if (is_double) {
@@ -333,14 +342,12 @@ void for_statement(struct basic_ctx* ctx)
 		}
 		if ((is_double && state->step.v.r == 0) || (!is_double && state->step.v.i == 0)) {
 			tokenizer_error_print(ctx, "FOR loop is infinite");
-			buddy_free(ctx->allocator, for_variable);
 			return;
 		}
 		state->variable_is_real = is_double;
 		ctx->for_stack_ptr++;
 	} else {
 		tokenizer_error_print(ctx, "Too many FOR");
-		buddy_free(ctx->allocator, for_variable);
 	}
 }
 
@@ -349,7 +356,7 @@ void repeat_statement(struct basic_ctx* ctx)
 	accept_or_return(REPEAT, ctx);
 	accept_or_return(NEWLINE, ctx);
 	if (ctx->repeat_stack_ptr < MAX_LOOP_STACK_DEPTH) {
-		ctx->repeat_stack[ctx->repeat_stack_ptr] = tokenizer_num(ctx, NUMBER);
+		ctx->repeat_stack[ctx->repeat_stack_ptr] = ctx->ptr - ctx->program_ptr;
 		ctx->repeat_stack_ptr++;
 	} else {
 		tokenizer_error_print(ctx, "REPEAT stack exhausted");
@@ -365,7 +372,7 @@ void until_statement(struct basic_ctx* ctx)
 
 	if (ctx->repeat_stack_ptr > 0) {
 		if (!done) {
-			jump_linenum(ctx->repeat_stack[ctx->repeat_stack_ptr - 1], ctx);
+			jump_offset(ctx->repeat_stack[ctx->repeat_stack_ptr - 1], ctx);
 		} else {
 			ctx->repeat_stack_ptr--;
 			ctx->repeat_stack[ctx->repeat_stack_ptr] = 0; // clear to aid debugging
@@ -428,17 +435,32 @@ static bool seek_to_matching_token(struct basic_ctx* ctx, enum token_t open_tok,
 	}
 }
 
+/**
+ * @brief Offset of the start of the line holding the current token
+ */
+static uint64_t current_line_offset(struct basic_ctx* ctx)
+{
+	const char* p = ctx->ptr;
+	while (p > ctx->program_ptr && *(p - 1) != '\n') {
+		--p;
+	}
+	return p - ctx->program_ptr;
+}
+
 void while_statement(struct basic_ctx* ctx)
 {
+	const compiled_token_t* site = tokenizer_jump_site(ctx, WHILE);
+	uint64_t line = current_line_offset(ctx);
 	accept_or_return(WHILE, ctx);
 	bool continue_loop = conditional(ctx);
 	accept_or_return(NEWLINE, ctx);
-	if (ctx->while_stack_ptr > 0 && ctx->while_stack[ctx->while_stack_ptr - 1] == (uint64_t)ctx->current_linenum) {
+	bool in_loop = ctx->while_stack_ptr > 0 && ctx->while_stack[ctx->while_stack_ptr - 1] == line;
+	if (in_loop) {
 		/* We are already in this while loop */
 	} else if (ctx->while_stack_ptr < MAX_LOOP_STACK_DEPTH) {
 		/* First time around this while loop */
 		if (continue_loop) {
-			ctx->while_stack[ctx->while_stack_ptr] = ctx->current_linenum;
+			ctx->while_stack[ctx->while_stack_ptr] = line;
 			ctx->while_stack_ptr++;
 		}
 	} else {
@@ -447,7 +469,14 @@ void while_statement(struct basic_ctx* ctx)
 	}
 	if (!continue_loop) {
 		/* conditional is false, jump to line AFTER the ENDWHILE */
-		ctx->while_stack_ptr--;
+		if (in_loop) {
+			ctx->while_stack_ptr--;
+		}
+		if (site) {
+			/* Linked to the end of the ENDWHILE line */
+			jump_offset(site->jump.target, ctx);
+			return;
+		}
 		if (!seek_to_matching_token(ctx, WHILE, ENDWHILE, "WHILE")) {
 			return;
 		}
@@ -463,12 +492,13 @@ void endwhile_statement(struct basic_ctx* ctx)
 	accept_or_return(NEWLINE, ctx);
 
 	if (ctx->while_stack_ptr > 0) {
-		jump_linenum(ctx->while_stack[ctx->while_stack_ptr - 1], ctx);
+		jump_offset(ctx->while_stack[ctx->while_stack_ptr - 1], ctx);
 	}
 }
 
 void continue_statement(struct basic_ctx* ctx)
 {
+	const compiled_token_t* site = tokenizer_jump_site(ctx, CONTINUE);
 	accept_or_return(CONTINUE, ctx);
 
 	enum token_t kind = tokenizer_token(ctx);
@@ -485,7 +515,7 @@ void continue_statement(struct basic_ctx* ctx)
 			return;
 		}
 		/* Your WHILE stack points at the WHILE line itself */
-		jump_linenum(ctx->while_stack[ctx->while_stack_ptr - 1], ctx);
+		jump_offset(ctx->while_stack[ctx->while_stack_ptr - 1], ctx);
 		return;
 	}
 
@@ -494,6 +524,10 @@ void continue_statement(struct basic_ctx* ctx)
 			tokenizer_error_print(ctx, "CONTINUE FOR used outside FOR");
 			return;
 		}
+		if (site) {
+			jump_offset(site->jump.target, ctx);
+			return;
+		}
 		if (!seek_to_matching_token(ctx, FOR, NEXT, "FOR")) {
 			return;
 		}
@@ -506,8 +540,185 @@ void continue_statement(struct basic_ctx* ctx)
 		tokenizer_error_print(ctx, "CONTINUE REPEAT used outside REPEAT");
 		return;
 	}
+	if (site) {
+		jump_offset(site->jump.target, ctx);
+		return;
+	}
 	if (!seek_to_matching_token(ctx, REPEAT, UNTIL, "REPEAT")) {
 		return;
 	}
 	/* We’re now positioned on UNTIL; its handler will execute next. */
 }
+
+static void link_jump(compiled_token_t* site, uint64_t target)
+{
+	site->jump.target = target;
+	site->jump.linked = true;
+}
+
+/**
+ * @brief Link a CONTINUE FOR/REPEAT to the start of the line holding the
+ * NEXT/UNTIL which closes the enclosing loop.
+ */
+static bool link_continue(struct basic_ctx* ctx, size_t site, enum token_t open_tok, enum token_t close_tok)
+{
+	compiled_token_t* tokens = ctx->tokens;
+	uint64_t line = 0;
+	int depth = 1;
+	for (size_t k = site + 2; k < ctx->token_count; ++k) {
+		enum token_t tok = tokens[k].token;
+		if (tok == NEWLINE) {
+			line = tokens[k].next;
+		} else if (tok == CONTINUE) {
+			/* The loop keyword after a CONTINUE does not open a loop */
+			++k;
+		} else if (tok == open_tok) {
+			depth++;
+		} else if (tok == close_tok && --depth == 0) {
+			if (line == 0) {
+				/* Closed on the same line, leave it to the runtime scan */
+				return false;
+			}
+			link_jump(&tokens[site], line);
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Link a GOTO, GOSUB or PROC to the start of a line
+ */
+static bool link_line(struct basic_ctx* ctx, compiled_token_t* site, int64_t linenum)
+{
+	ub_line_ref* line = hashmap_get(ctx->lines, &(ub_line_ref) {.line_number = linenum});
+	if (!line) {
+		return false;
+	}
+	link_jump(site, line->ptr - ctx->program_ptr);
+	return true;
+}
+
+bool basic_link_jumps(struct basic_ctx* ctx)
+{
+	compiled_token_t* tokens = ctx->tokens;
+	size_t count = ctx->token_count;
+	if (!tokens) {
+		return false;
+	}
+
+	/* Open block IFs (with their ELSE, or count if none yet) and WHILEs.
+	 * Blocks nested deeper than the runtime loop stacks are left unlinked.
+	 */
+	uint32_t* stacks = buddy_malloc(ctx->allocator, MAX_LOOP_STACK_DEPTH * 3 * sizeof(uint32_t));
+	if (!stacks) {
+		return false;
+	}
+	uint32_t* if_stack = stacks;
+	uint32_t* else_stack = stacks + MAX_LOOP_STACK_DEPTH;
+	uint32_t* while_stack = stacks + MAX_LOOP_STACK_DEPTH * 2;
+	size_t if_depth = 0, while_depth = 0, linked = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		compiled_token_t* t = &tokens[i];
+		switch (t->token) {
+			case IF: {
+				size_t then = i + 1;
+				while (then < count && tokens[then].token != THEN && tokens[then].token != NEWLINE) {
+					then++;
+				}
+				if (then >= count || tokens[then].token != THEN) {
+					break;
+				}
+				if (then + 1 < count && tokens[then + 1].token == NEWLINE) {
+					/* Block IF, linked when its ELSE or ENDIF is found */
+					if (if_depth < MAX_LOOP_STACK_DEPTH) {
+						if_stack[if_depth] = i;
+						else_stack[if_depth] = count;
+					}
+					if_depth++;
+					break;
+				}
+				/* Single line IF: the ELSE or end of line, after the first token of the THEN statement */
+				size_t k = then + 2;
+				while (k < count && tokens[k].token != ELSE && tokens[k].token != NEWLINE) {
+					k++;
+				}
+				link_jump(t, k < count ? tokens[k].start : ctx->compiled_length);
+				linked++;
+				break;
+			}
+			case ELSE:
+				if (i + 1 < count && tokens[i + 1].token == NEWLINE && if_depth > 0 && if_depth <= MAX_LOOP_STACK_DEPTH && else_stack[if_depth - 1] == count) {
+					else_stack[if_depth - 1] = i;
+					link_jump(&tokens[if_stack[if_depth - 1]], tokens[i + 1].next);
+					linked++;
+				}
+				break;
+			case ENDIF:
+				if (if_depth == 0) {
+					break;
+				}
+				if (if_depth <= MAX_LOOP_STACK_DEPTH && i + 1 < count && tokens[i + 1].token == NEWLINE) {
+					size_t site = else_stack[if_depth - 1] == count ? if_stack[if_depth - 1] : else_stack[if_depth - 1];
+					link_jump(&tokens[site], tokens[i + 1].next);
+					linked++;
+				}
+				if_depth--;
+				break;
+			case WHILE:
+				if (while_depth < MAX_LOOP_STACK_DEPTH) {
+					while_stack[while_depth] = i;
+				}
+				while_depth++;
+				break;
+			case ENDWHILE:
+				if (while_depth == 0) {
+					break;
+				}
+				if (while_depth <= MAX_LOOP_STACK_DEPTH) {
+					size_t k = i;
+					while (k < count && tokens[k].token != NEWLINE) {
+						k++;
+					}
+					link_jump(&tokens[while_stack[while_depth - 1]], k < count ? tokens[k].start : ctx->compiled_length);
+					linked++;
+				}
+				while_depth--;
+				break;
+			case CONTINUE:
+				if (i + 1 < count) {
+					if (tokens[i + 1].token == FOR) {
+						linked += link_continue(ctx, i, FOR, NEXT);
+					} else if (tokens[i + 1].token == REPEAT) {
+						linked += link_continue(ctx, i, REPEAT, UNTIL);
+					}
+					/* The loop keyword after a CONTINUE does not open a loop */
+					i++;
+				}
+				break;
+			case GOTO:
+			case GOSUB:
+				if (i + 1 < count && tokens[i + 1].token == NUMBER) {
+					linked += link_line(ctx, t, tokens[i + 1].number.integer);
+				}
+				break;
+			case PROC: {
+				/* proc_statement() reads the name from the next token the same way */
+				char procname[MAX_VARNAME];
+				basic_proc_name(ctx->program_ptr + t->next, procname);
+				struct ub_proc_fn_def* def = basic_find_fn(procname, ctx);
+				if (def) {
+					linked += link_line(ctx, t, def->line);
+				}
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	buddy_free(ctx->allocator, stacks);
+	dprintf("Linked %lu jump sites\n", linked);
+	return true;
+}
@@ -185,6 +185,7 @@ struct basic_int_fn builtin_int[] =
 	{ basic_decompress,          "DECOMPRESS"        },
 	{ basic_memfind,             "MEMFIND"           },
 	{ basic_volcount,            "VOLCOUNT"          },
+	{ basic_getprocnice,         "GETPROCNICE"       },
 	{ NULL,                      NULL                },
 };
 
@@ -391,7 +392,7 @@ bool extract_comma_list(struct ub_proc_fn_def* def, struct basic_ctx* ctx, int*
 		ctx->nextptr = *item_begin;
 		ctx->ptr = *item_begin;
 		ctx->current_token = get_next_token(ctx);
-		*oldptr = 0;
+		tokenizer_patch(ctx, oldptr);
 		if (*param && (*param)->name) {
 			size_t len = (*param)->name_len;
 			if ((*param)->name[len - 1] == '$') {
@@ -411,7 +412,7 @@ bool extract_comma_list(struct ub_proc_fn_def* def, struct basic_ctx* ctx, int*
 
 			*param = (*param)->next;
 		}
-		*oldptr = oldval;
+		tokenizer_unpatch(ctx, oldptr, oldval);
 		ctx->ptr = oldptr;
 		ctx->nextptr = oldnextptr;
 		ctx->current_token = oldct;
@@ -933,19 +934,36 @@ bool is_builtin_double_fn(const char* fn_name, size_t L)
 	return hashmap_get(builtin_double_map, &(struct builtin_double_entry){ .name = fn_name, .name_length = L, .handler = NULL }) != NULL;
 }
 
+bool is_builtin_int_fn(const char* fn_name, size_t L)
+{
+	return hashmap_get(builtin_int_map, &(struct builtin_int_entry){ .name = fn_name, .name_length = L, .handler = NULL }) != NULL;
+}
+
+bool is_builtin_str_fn(const char* fn_name, size_t L)
+{
+	return hashmap_get(builtin_str_map, &(struct builtin_str_entry){ .name = fn_name, .name_length = L, .handler = NULL }) != NULL;
+}
+
+size_t basic_proc_name(const char* p, char* name)
+{
+	const char* start = p;
+	size_t n = 0;
+	while (*p != '\n' && *p != 0 && *p != '(') {
+		if (*p != ' ' && *p != '\t' && n < MAX_VARNAME - 1) {
+			name[n++] = *p;
+		}
+		p++;
+	}
+	name[n] = 0;
+	return p - start;
+}
+
 void proc_statement(struct basic_ctx* ctx)
 {
 	char procname[MAX_VARNAME];
-	char* p = procname;
-	size_t procnamelen = 0;
+	const compiled_token_t* site = tokenizer_jump_site(ctx, PROC);
 	accept_or_return(PROC, ctx);
-	while (*ctx->ptr != '\n' && *ctx->ptr != 0  && *ctx->ptr != '(' && procnamelen < MAX_VARNAME - 1) {
-		if (*ctx->ptr != ' ') {
-			*(p++) = *(ctx->ptr++);
-		}
-		procnamelen++;
-	}
-	*p++ = 0;
+	ctx->ptr += basic_proc_name(ctx->ptr, procname);
 	struct ub_proc_fn_def* def = basic_find_fn(procname, ctx);
 	if (def) {
 		if (*ctx->ptr == '(' && *(ctx->ptr + 1) != ')') {
@@ -985,7 +1003,11 @@ void proc_statement(struct basic_ctx* ctx)
 			if (!new_stack_frame(ctx)) {
 				return;
 			}
-			jump_linenum(def->line, ctx);
+			if (site) {
+				jump_offset(site->jump.target, ctx);
+			} else {
+				jump_linenum(def->line, ctx);
+			}
 		} else {
 			tokenizer_error_print(ctx, "PROC: stack exhausted");
 		}
@@ -1050,9 +1072,8 @@ void endproc_statement(struct basic_ctx* ctx)
 
 		/* Now restore the *caller*'s return type. */
 		ctx->fn_type = ctx->fn_type_stack[ctx->call_stack_ptr];
-		while (ctx->for_stack_ptr > ctx->loop_state_stack[ctx->call_stack_ptr].for_stack_ptr) {
-			ctx->for_stack_ptr--;
-			buddy_free(ctx->allocator, ctx->for_stack[ctx->for_stack_ptr].for_variable);
+		if (ctx->for_stack_ptr > ctx->loop_state_stack[ctx->call_stack_ptr].for_stack_ptr) {
+			ctx->for_stack_ptr = ctx->loop_state_stack[ctx->call_stack_ptr].for_stack_ptr;
 		}
 		ctx->while_stack_ptr = ctx->loop_state_stack[ctx->call_stack_ptr].while_stack_ptr;
 		ctx->repeat_stack_ptr = ctx->loop_state_stack[ctx->call_stack_ptr].repeat_stack_ptr;
@@ -261,6 +261,15 @@ bool basic_hash_lines(struct basic_ctx *ctx, char **error) {
 			program++; // skip newline to start of next one
 		}
 	}
+	if (!tokenizer_compile(ctx)) {
+		dprintf("Not enough memory to compile program, running from source\n");
+	}
+	if (!basic_build_variable_slots(ctx)) {
+		dprintf("Variable slots unavailable, resolving variables by name\n");
+	}
+	if (!basic_link_jumps(ctx)) {
+		dprintf("Jump targets not linked, block structure will be scanned at runtime\n");
+	}
 	tokenizer_init(ctx->program_ptr, ctx);
 	return true;
 }
@@ -388,6 +397,22 @@ struct basic_ctx *basic_init(const char *program, uint32_t pid, const char *file
 void yield_statement(struct basic_ctx *ctx) {
 	accept_or_return(YIELD, ctx);
 	accept_or_return(NEWLINE, ctx);
+	proc_yield(ctx->proc);
+}
+
+void nice_statement(struct basic_ctx *ctx) {
+	accept_or_return(NICE, ctx);
+	int64_t pid = expr(ctx);
+	accept_or_return(COMMA, ctx);
+	int64_t nice = expr(ctx);
+	accept_or_return(NEWLINE, ctx);
+	if (nice < PROC_NICE_MIN || nice > PROC_NICE_MAX) {
+		tokenizer_error_printf(ctx, "NICE: Invalid nice value %ld", nice);
+		return;
+	}
+	if (!proc_set_nice(pid, nice)) {
+		tokenizer_error_printf(ctx, "NICE: No such process %ld", pid);
+	}
 }
 
 /**
@@ -469,6 +494,7 @@ void library_statement(struct basic_ctx *ctx) {
 	 * ctx->program_ptr invalidating ctx->ptr and ctx->next_ptr - the tokeinizer
 	 * must be reinitialised and the line hash rebuilt)
 	 */
+	tokenizer_discard(ctx);
 	ctx->program_ptr = buddy_realloc(ctx->allocator, ctx->program_ptr, strlen(ctx->program_ptr) + 5000 + library_len);
 	if (!ctx->program_ptr) {
 		tokenizer_error_printf(ctx, "Not enough memory to load library file '%s'", lib_file);
@@ -568,6 +594,14 @@ struct basic_ctx *basic_clone(struct basic_ctx *old) {
 	ctx->string_gc_storage_size = old->string_gc_storage_size;
 	ctx->string_gc_storage_next = old->string_gc_storage_next;
 	ctx->lines = old->lines;
+	ctx->tokens = old->tokens;
+	ctx->token_count = old->token_count;
+	ctx->token_index = old->token_index;
+	ctx->compiled_length = old->compiled_length;
+	/* Clones run while the caller may be part way through binding parameters */
+	ctx->text_patches = old->text_patches;
+	ctx->compiled_token = NULL;
+	ctx->variable_slots = old->variable_slots;
 	ctx->highest_line = old->highest_line;
 	ctx->debug_status = old->debug_status;
 	ctx->debug_breakpoints = old->debug_breakpoints;
@@ -609,6 +643,10 @@ struct basic_ctx *basic_clone(struct basic_ctx *old) {
 
 void basic_destroy(struct basic_ctx *ctx) {
 	assert(ctx != NULL, "basic_destroy: Null BASIC context");
+	if (ctx->proc) {
+		/* Files left open by the program are written out and closed */
+		close_process_filehandles(ctx->proc->pid);
+	}
 	ctx->string_gc_storage_next = NULL;
 	stream_list_free_all(ctx);
 	sound_list_free_all(ctx);
@@ -639,8 +677,18 @@ bool jump_linenum(int64_t linenum, struct basic_ctx *ctx) {
 	return true;
 }
 
+void jump_offset(uint64_t offset, struct basic_ctx *ctx) {
+	ctx->ptr = ctx->program_ptr + offset;
+	ctx->current_token = get_next_token(ctx);
+}
+
 void goto_statement(struct basic_ctx *ctx) {
+	const compiled_token_t* site = tokenizer_jump_site(ctx, GOTO);
 	accept_or_return(GOTO, ctx);
+	if (site) {
+		jump_offset(site->jump.target, ctx);
+		return;
+	}
 	jump_linenum(tokenizer_num(ctx, NUMBER), ctx);
 }
 
@@ -657,6 +705,7 @@ void free_local_heap(struct basic_ctx *ctx) {
 	ctx->local_string_variables[i] = NULL;
 	ctx->local_int_variables[i] = NULL;
 	ctx->local_double_variables[i] = NULL;
+	basic_variables_changed(ctx);
 }
 
 /**
@@ -669,6 +718,7 @@ void init_local_heap(struct basic_ctx *ctx) {
 	ctx->local_int_variables[i] = hashmap_new_with_allocator(varmap_malloc, varmap_realloc, varmap_free, sizeof(struct ub_var_int), 0, SEED0, SEED1, varmap_hash, varmap_compare, varmap_elfree_int, ctx->allocator);
 	ctx->local_string_variables[i] = hashmap_new_with_allocator(varmap_malloc, varmap_realloc, varmap_free, sizeof(struct ub_var_string), 0, SEED0, SEED1, varmap_hash, varmap_compare, varmap_elfree_string, ctx->allocator);
 	ctx->local_double_variables[i] = hashmap_new_with_allocator(varmap_malloc, varmap_realloc, varmap_free, sizeof(struct ub_var_double), 0, SEED0, SEED1, varmap_hash, varmap_compare, varmap_elfree_double, ctx->allocator);
+	basic_variables_changed(ctx);
 }
 
 void chain_statement(struct basic_ctx *ctx) {
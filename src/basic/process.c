@@ -50,6 +50,14 @@ int64_t basic_getproccpu(struct basic_ctx* ctx)
 	return proc_cpu_percent(intval);
 }
 
+int64_t basic_getprocnice(struct basic_ctx* ctx)
+{
+	PARAMS_START;
+	PARAMS_GET_ITEM(BIP_INT);
+	PARAMS_END("GETPROCNICE", 0);
+	return proc_get_nice(intval);
+}
+
 char* basic_getprocname(struct basic_ctx* ctx, size_t* out_len)
 {
 	PARAMS_START;
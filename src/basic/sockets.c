@@ -84,6 +84,8 @@ void sockread_statement(struct basic_ctx *ctx) {
 		/* Limit raw read size so worst-case escaping still fits in MAX_STRINGLEN */
 		bool ok = tls_read_fd(fd, input, MAX_STRINGLEN / 2, &want, &out_n, &err);
 		if (ok) {
+			input[out_n] = 0;
+			STRING_ESCAPE_INPLACE(input, out_n, MAX_STRINGLEN);
 			rv = out_n;
 		} else {
 			if (want == 1) {
@@ -93,12 +95,13 @@ void sockread_statement(struct basic_ctx *ctx) {
 			}
 		}
 	} else {
-		rv = recv(fd, input, MAX_STRINGLEN / 2, false, 100);
+		rv = tcp_recv_escaped(fd, input, sizeof(input));
 	}
 
 	if (rv == 0) {
 		/* Not ready yet, yield and retry later */
 		proc_set_idle(proc, check_sockread_ready, (void *) (uintptr_t) fd);
+		proc_wait_on(proc, WAIT_CHANNEL(WAIT_TCP, fd));
 		jump_linenum(ctx->current_linenum, ctx);
 		proc->state = PROC_IO_BOUND;
 		return;
@@ -112,12 +115,6 @@ void sockread_statement(struct basic_ctx *ctx) {
 		return;
 	}
 
-	if ((size_t) rv >= sizeof(input)) {
-		rv = (int) (sizeof(input) - 1);
-	}
-	input[rv] = 0; // Null-terminate string
-	STRING_ESCAPE_INPLACE(input, rv, MAX_STRINGLEN);
-
 	if (varname_is_int_array_access(ctx, var)) {
 		int64_t index = arr_target_index(ctx);
 		int64_t value = atoll(input, 10);
@@ -222,6 +219,7 @@ void sockbinread_statement(struct basic_ctx *ctx) {
 	if (rv == 0) {
 		// Not ready yet, yield and retry later
 		proc_set_idle(proc, check_sockread_ready, (void *) (uintptr_t) fd);
+		proc_wait_on(proc, WAIT_CHANNEL(WAIT_TCP, fd));
 		jump_linenum(ctx->current_linenum, ctx);
 		proc->state = PROC_IO_BOUND;
 		return;
@@ -845,6 +843,7 @@ void sockflush_statement(struct basic_ctx *ctx) {
 	if (!sock_sent((int) fd)) {
 		/* Not drained yet: park this process and retry the same line later */
 		proc_set_idle(proc, check_sockflush_ready, (void *) (uintptr_t) fd);
+		proc_wait_on(proc, WAIT_CHANNEL(WAIT_TCP, fd));
 		jump_linenum(ctx->current_linenum, ctx);
 		proc->state = PROC_IO_BOUND;
 		return;
@@ -291,24 +291,38 @@ static inline __attribute__((always_inline)) enum token_t singlechar(const char
 	return singlechar_tokens[(unsigned char)*p];
 }
 
-int get_next_token(struct basic_ctx* ctx)
+/**
+ * @brief Lex a single token from program text without touching any context.
+ *
+ * This is the pure core of get_next_token(), shared with tokenizer_compile()
+ * so that a pre-lexed token is guaranteed to be identical to one lexed at
+ * runtime from the same text.
+ *
+ * @param ptr Position to lex from (must not be the NUL terminator)
+ * @param start Receives the start of the lexeme (past the '&' of a hex number)
+ * @param next Receives the character after the lexeme, or NULL if the caller's
+ * next pointer should be left alone
+ * @param error Receives an error message, or NULL on success
+ * @return token type
+ */
+static enum token_t lex_token(const char *ptr, const char **start, const char **next, const char **error)
 {
 	enum token_t tok;
 
-	if (*ctx->ptr == 0) {
-		return ENDOFINPUT;
-	}
-	
-	if (isdigit(*ctx->ptr) || *ctx->ptr == '&' || *ctx->ptr == '.') {
-		if (*ctx->ptr == '&') {
-			ctx->ptr++;
+	*start = ptr;
+	*next = NULL;
+	*error = NULL;
+
+	if (isdigit(*ptr) || *ptr == '&' || *ptr == '.') {
+		if (*ptr == '&') {
+			*start = ++ptr;
 			for (int i = 0; i < MAX_NUMLEN; ++i) {
-				if (!isxdigit(ctx->ptr[i])) {
+				if (!isxdigit(ptr[i])) {
 					if (i > 1) {
-						ctx->nextptr = ctx->ptr + i;
+						*next = ptr + i;
 						return HEXNUMBER;
 					} else {
-						tokenizer_error_print(ctx, "Hexadecimal number too short");
+						*error = "Hexadecimal number too short";
 						return NO_TOKEN;
 					}
 				}
@@ -317,58 +331,56 @@ int get_next_token(struct basic_ctx* ctx)
 			/* Scan forwards up to MAX_NUMLEN characters */
 			for (int i = 0; i < MAX_NUMLEN; ++i) {
 				/* Until we find a character that isn't part of a number */
-				if (!isdigit(ctx->ptr[i]) && ctx->ptr[i] != '.') {
+				if (!isdigit(ptr[i]) && ptr[i] != '.') {
 					if (i > 0) {
-						ctx->nextptr = ctx->ptr + i;
+						*next = ptr + i;
 						return NUMBER;
 					} else {
-						tokenizer_error_print(ctx, "Number too short");
+						*error = "Number too short";
 						return NO_TOKEN;
 					}
 				}
 			}
 		}
-		tokenizer_error_print(ctx, "Number too long");
+		*error = "Number too long";
 		return NO_TOKEN;
-	} else if ((tok = singlechar(ctx->ptr)) != NO_TOKEN) {
-		ctx->nextptr = ctx->ptr + 1;
+	} else if ((tok = singlechar(ptr)) != NO_TOKEN) {
+		*next = ptr + 1;
 		return tok;
-	} else if (*ctx->ptr == '"') {
-		ctx->nextptr = ctx->ptr;
+	} else if (*ptr == '"') {
+		const char *p = ptr;
 		do {
-			++ctx->nextptr;
-			if (*ctx->nextptr == 0 || *ctx->nextptr == 13) {
-				tokenizer_error_printf(ctx, "Unterminated string constant");
+			++p;
+			if (*p == 0 || *p == 13) {
+				*error = "Unterminated string constant";
 				break;
 			}
-		} while (*ctx->nextptr != '"');
-		++ctx->nextptr;
+		} while (*p != '"');
+		*next = p + 1;
 		return STRING;
 	} else {
 		GENERATE_ENUM_STRING_NAMES(TOKEN, token_names)
 		GENERATE_ENUM_STRING_LENGTHS(TOKEN, token_name_lengths)
-		uint16_t key = prefix16(ctx->ptr);
-		int start = keyword_prefix_offsets[key];
+		uint16_t key = prefix16(ptr);
+		int first = keyword_prefix_offsets[key];
 		int end = keyword_prefix_offsets[key + 1];
-		for (int kt = start; kt < end; ++kt) {
+		for (int kt = first; kt < end; ++kt) {
 			tok = keywords[kt];
 			size_t len = token_name_lengths[tok];
 			/* First two characters already matched by prefix16 bucket.
 			 * Compare from byte 2 onwards; <=2 length is already a full match.
 			 * Ordering is preserved within the bucket, so early-exit still works.
 			 */
-			int comparison = len > 2 ? strncmp(ctx->ptr + 2, token_names[tok] + 2, len - 2) : 0;
+			int comparison = len > 2 ? strncmp(ptr + 2, token_names[tok] + 2, len - 2) : 0;
 			if (comparison == 0) {
-				const char *backup = ctx->nextptr;
-				ctx->nextptr = ctx->ptr + len;
-				bool next_is_varlike = (*ctx->nextptr == '_' || isalnum(*ctx->nextptr));
+				const char *after = ptr + len;
+				bool next_is_varlike = (*after == '_' || isalnum(*after));
 				if (!next_is_varlike || tok == PROC || tok == FN || tok == EQUALS) {
 					/* Only return the token if what follows the token is not continuation of a variable-name or keyword-name like sequence, e.g. "END -> ENDING"
 					 * Special case for PROC, FN, =, as PROC and FN can be immediately followed by the name of their subroutine. e.g. PROCfoo
 					 */
+					*next = after;
 					return tok;
-				} else {
-					ctx->nextptr = backup;
 				}
 			} else if (comparison < 0) {
 				/* We depend upon keyword_tokens being alphabetically sorted,
@@ -380,45 +392,128 @@ int get_next_token(struct basic_ctx* ctx)
 		}
 	}
 
-	if (isalpha(*ctx->ptr) || *ctx->ptr == '_') {
-		ctx->nextptr = ctx->ptr;
+	if (isalpha(*ptr) || *ptr == '_') {
+		const char *p = ptr;
 		int varl = 0;
 		while (
-			isalpha(*ctx->nextptr) ||
-			(*ctx->nextptr == '_') ||
-			(varl > 0 && *ctx->nextptr == '$') ||
-			(varl > 0 && *ctx->nextptr == '#') ||
-			(varl > 0 && *ctx->nextptr == '(') ||
-			(varl > 0 && isdigit(*ctx->nextptr))
+			isalpha(*p) ||
+			(*p == '_') ||
+			(varl > 0 && *p == '$') ||
+			(varl > 0 && *p == '#') ||
+			(varl > 0 && *p == '(') ||
+			(varl > 0 && isdigit(*p))
 		) {
-			ctx->nextptr++;
-			if (*ctx->nextptr == '(') {
+			p++;
+			if (*p == '(') {
 				int bracketdepth = 1;
 				do {
-					ctx->nextptr++;
-					if (*ctx->nextptr == '(') {
+					p++;
+					if (*p == '(') {
 						bracketdepth++;
 					}
-					else if (*ctx->nextptr == ')') {
+					else if (*p == ')') {
 						bracketdepth--;
 					}
 				}
-				while (bracketdepth > 1 && *ctx->nextptr != 0);
+				while (bracketdepth > 1 && *p != 0);
 			} else if (++varl > 60) {
-				tokenizer_error_print(ctx, "Variable name too long");
+				*error = "Variable name too long";
 				break;
 			}
 		}
-		if (*ctx->nextptr == '$' || *ctx->nextptr == '#') {
-			ctx->nextptr++;
+		if (*p == '$' || *p == '#') {
+			p++;
 		}
+		*next = p;
 		return VARIABLE;
 	}
 
-	ctx->nextptr++;
 	return NO_TOKEN;
 }
 
+/**
+ * @brief Offset a compiled token is looked up by, where get_next_token() starts lexing it
+ */
+static inline uint32_t compiled_token_at(const compiled_token_t* t)
+{
+	return t->start - (t->token == HEXNUMBER ? 1 : 0);
+}
+
+/**
+ * @brief Find the pre-lexed token for the current program position, if any.
+ *
+ * A hit requires a token to have been compiled at this position. While a
+ * terminator is patched into the text, the whole extent of the token must
+ * also be free of it, so a token cut short by the patch is lexed again from
+ * the live text.
+ */
+static inline __attribute__((always_inline)) const compiled_token_t* tokenizer_cached(struct basic_ctx* ctx)
+{
+	size_t offset = (size_t)(ctx->ptr - ctx->program_ptr);
+	if (ctx->token_index == NULL || offset >= ctx->compiled_length) {
+		return NULL;
+	}
+	for (uint32_t entry = ctx->token_index[offset / TOKEN_INDEX_BLOCK]; entry < ctx->token_count; entry++) {
+		const compiled_token_t* t = &ctx->tokens[entry];
+		uint32_t at = compiled_token_at(t);
+		if (at < offset) {
+			continue;
+		}
+		if (at > offset) {
+			return NULL;
+		}
+		if (ctx->text_patches && memchr(ctx->program_ptr + at, 0, t->next - at)) {
+			return NULL;
+		}
+		return t;
+	}
+	return NULL;
+}
+
+char tokenizer_patch(struct basic_ctx* ctx, char* at)
+{
+	char old = *at;
+	*at = 0;
+	ctx->text_patches++;
+	return old;
+}
+
+void tokenizer_unpatch(struct basic_ctx* ctx, char* at, char old)
+{
+	*at = old;
+	ctx->text_patches--;
+}
+
+int get_next_token(struct basic_ctx* ctx)
+{
+	if (*ctx->ptr == 0) {
+		ctx->compiled_token = NULL;
+		return ENDOFINPUT;
+	}
+
+	const compiled_token_t* cached = tokenizer_cached(ctx);
+	if (cached) {
+		ctx->ptr = ctx->program_ptr + cached->start;
+		ctx->nextptr = ctx->program_ptr + cached->next;
+		ctx->compiled_token = cached;
+		return cached->token;
+	}
+
+	const char *start, *next, *error;
+	enum token_t tok = lex_token(ctx->ptr, &start, &next, &error);
+	ctx->compiled_token = NULL;
+	ctx->ptr = start;
+	if (next) {
+		ctx->nextptr = next;
+	} else if (!error) {
+		ctx->nextptr++;
+	}
+	if (error) {
+		tokenizer_error_print(ctx, error);
+	}
+	return tok;
+}
+
 void tokenizer_init(const char *program, struct basic_ctx* ctx)
 {
 	ctx->ptr = program;
@@ -440,11 +535,20 @@ void tokenizer_next(struct basic_ctx* ctx)
 
 int64_t tokenizer_num(struct basic_ctx* ctx, enum token_t token)
 {
+	const compiled_token_t* cached = ctx->compiled_token;
+	if (cached && cached->token == token && ctx->program_ptr + cached->start == ctx->ptr) {
+		return cached->number.integer;
+	}
 	return token == NUMBER ? atoll(ctx->ptr, 10) : atoll(ctx->ptr, 16);
 }
 
 void tokenizer_fnum(struct basic_ctx* ctx, enum token_t token, double* f)
 {
+	const compiled_token_t* cached = ctx->compiled_token;
+	if (cached && cached->token == NUMBER && ctx->program_ptr + cached->start == ctx->ptr) {
+		*f = cached->number.real;
+		return;
+	}
 	atof(ctx->ptr, f);
 }
 
@@ -552,13 +656,20 @@ void tokenizer_error_print(struct basic_ctx* ctx, const char* error)
 	}
 }
 
-const char* tokenizer_variable_name(struct basic_ctx* ctx, size_t* count)
+/**
+ * @brief Scan a variable name from program text.
+ *
+ * @param p Start of the name
+ * @param varname Buffer of at least MAX_VARNAME + 1 bytes to receive the name
+ * @param count Receives the number of characters consumed
+ * @return false if the name is followed by an invalid suffix, e.g. "A$B"
+ */
+static bool scan_variable_name(const char *p, char *varname, size_t *count)
 {
-	char varname[MAX_VARNAME];
 	*count = 0;
 
-	while (*count < MAX_VARNAME && *ctx->ptr != 0) {
-		char c = *ctx->ptr;
+	while (*count < MAX_VARNAME && *p != 0) {
+		char c = *p;
 
 		if (*count == 0) {
 			if (!(isalpha(c) || c == '_')) {
@@ -567,13 +678,11 @@ const char* tokenizer_variable_name(struct basic_ctx* ctx, size_t* count)
 		} else {
 			if (c == '$' || c == '#') {
 				varname[(*count)++] = c;
-				ctx->ptr++;
+				p++;
 
-				if (*ctx->ptr != 0 && (isalnum(*ctx->ptr) || *ctx->ptr == '_' || *ctx->ptr == '$' || *ctx->ptr == '#')) {
+				if (*p != 0 && (isalnum(*p) || *p == '_' || *p == '$' || *p == '#')) {
 					varname[*count] = 0;
-					tokenizer_error_printf(ctx, "Invalid variable name '%s'", varname);
-					*count = 0;
-					return "";
+					return false;
 				}
 				break;
 			}
@@ -584,10 +693,31 @@ const char* tokenizer_variable_name(struct basic_ctx* ctx, size_t* count)
 		}
 
 		varname[(*count)++] = c;
-		ctx->ptr++;
+		p++;
 	}
 
 	varname[*count] = 0;
+	return true;
+}
+
+const char* tokenizer_variable_name(struct basic_ctx* ctx, size_t* count)
+{
+	char varname[MAX_VARNAME + 1];
+	const compiled_token_t* cached = ctx->compiled_token;
+
+	if (cached && cached->token == VARIABLE && cached->name_length && ctx->program_ptr + cached->start == ctx->ptr) {
+		*count = cached->name_length;
+		ctx->ptr += *count;
+		return cached->name;
+	}
+
+	if (!scan_variable_name(ctx->ptr, varname, count)) {
+		ctx->ptr += *count;
+		tokenizer_error_printf(ctx, "Invalid variable name '%s'", varname);
+		*count = 0;
+		return "";
+	}
+	ctx->ptr += *count;
 
 	const char* interned = intern_variable_name(varname, *count);
 	if (!interned) {
@@ -599,6 +729,142 @@ const char* tokenizer_variable_name(struct basic_ctx* ctx, size_t* count)
 	return interned;
 }
 
+/**
+ * @brief Walk the program text exactly as tokenizer_next() would, lexing each token once.
+ *
+ * When @p out is NULL the tokens are only counted. The contents of bracketed
+ * VARIABLE tokens (array subscripts, function parameters) are walked as well,
+ * as the parameter parsers re-enter the tokenizer just inside the bracket.
+ * REM, DATA and DATASET lines are not lexed beyond their keyword.
+ *
+ * @return number of tokens
+ */
+static size_t tokenizer_walk(const char *program, compiled_token_t *out)
+{
+	size_t count = 0;
+	const char *p = program;
+
+	while (*p) {
+		while (*p == ' ' || *p == '\t') {
+			++p;
+		}
+		if (*p == 0) {
+			break;
+		}
+
+		const char *start, *next, *error;
+		enum token_t tok = lex_token(p, &start, &next, &error);
+		if (error || !next || count >= UINT32_MAX - 1) {
+			/* Leave this position to the runtime lexer, which reports errors in context */
+			p++;
+			continue;
+		}
+
+		if (out) {
+			compiled_token_t *t = &out[count];
+			memset(t, 0, sizeof(*t));
+			t->start = start - program;
+			t->next = next - program;
+			t->token = tok;
+			if (tok == NUMBER) {
+				t->number.integer = atoll(start, 10);
+				atof(start, &t->number.real);
+			} else if (tok == HEXNUMBER) {
+				t->number.integer = atoll(start, 16);
+			} else if (tok == VARIABLE) {
+				char varname[MAX_VARNAME + 1];
+				size_t len;
+				if (scan_variable_name(start, varname, &len) && len) {
+					t->name = intern_variable_name(varname, len);
+					t->name_length = t->name ? len : 0;
+				}
+			}
+		}
+		count++;
+
+		if (tok == REM || tok == DATA || tok == DATASET) {
+			p = next;
+			while (*p && *p != '\n') {
+				++p;
+			}
+			continue;
+		}
+
+		if (tok == VARIABLE) {
+			const char *bracket = start;
+			while (bracket < next && *bracket != '(') {
+				++bracket;
+			}
+			if (bracket < next) {
+				p = bracket + 1;
+				continue;
+			}
+		}
+
+		p = next;
+	}
+
+	return count;
+}
+
+void tokenizer_discard(struct basic_ctx* ctx)
+{
+	if (ctx->tokens) {
+		buddy_free(ctx->allocator, ctx->tokens);
+	}
+	if (ctx->token_index) {
+		buddy_free(ctx->allocator, ctx->token_index);
+	}
+	ctx->tokens = NULL;
+	ctx->token_index = NULL;
+	ctx->token_count = 0;
+	ctx->compiled_length = 0;
+	ctx->compiled_token = NULL;
+	ctx->text_patches = 0;
+}
+
+bool tokenizer_compile(struct basic_ctx* ctx)
+{
+	tokenizer_discard(ctx);
+
+	size_t length = strlen(ctx->program_ptr);
+	size_t count = tokenizer_walk(ctx->program_ptr, NULL);
+	if (length == 0 || count == 0 || length >= UINT32_MAX) {
+		return true;
+	}
+
+	size_t blocks = length / TOKEN_INDEX_BLOCK + 1;
+	ctx->tokens = buddy_malloc(ctx->allocator, count * sizeof(compiled_token_t));
+	ctx->token_index = buddy_malloc(ctx->allocator, blocks * sizeof(uint32_t));
+	if (!ctx->tokens || !ctx->token_index) {
+		/* Not fatal, the program just runs from source text */
+		tokenizer_discard(ctx);
+		return false;
+	}
+
+	ctx->token_count = tokenizer_walk(ctx->program_ptr, ctx->tokens);
+	/* The walk emits tokens in text order, so each block starts where the last left off */
+	size_t entry = 0;
+	for (size_t b = 0; b < blocks; b++) {
+		while (entry < ctx->token_count && compiled_token_at(&ctx->tokens[entry]) < b * TOKEN_INDEX_BLOCK) {
+			entry++;
+		}
+		ctx->token_index[b] = entry;
+	}
+	ctx->compiled_length = length;
+	dprintf("Compiled %lu bytes of BASIC into %lu tokens\n", length, ctx->token_count);
+	return true;
+}
+
+const compiled_token_t* tokenizer_jump_site(struct basic_ctx* ctx, enum token_t token)
+{
+	const compiled_token_t* site = ctx->compiled_token;
+	if (site && site->token == token && site->jump.linked && ctx->program_ptr + site->start == ctx->ptr) {
+		return site;
+	}
+	return NULL;
+}
+
 bool tokenizer_decimal_number(struct basic_ctx* ctx)
 {
 	const char* ptr = ctx->ptr;
@@ -212,6 +212,200 @@ bool valid_int_var(const char* name, size_t var_length)
     return valid_suffix_var(name, '\0', var_length);
 }
 
+static inline char get_sigil(const char *v) {
+	if (!v || !*v) {
+		return 0;
+	}
+	// Walk to the null terminator
+	while (*v) {
+		v++;
+	}
+	// Look at the character immediately preceding the null
+	return *(v - 1);
+}
+
+/**
+ * @brief Returns true if 'varname' starts with FN
+ * (is a function call)
+ *
+ * @param varname variable name to check
+ * @return char 1 if variable name is a function call, 0 if it is not
+ */
+char varname_is_int_function(const char* varname) {
+	if (!varname || varname[0] != 'F' || varname[1] != 'N') {
+		return 0;
+	}
+	char s = get_sigil(varname);
+	return (s != '$' && s != '#');
+}
+
+char varname_is_string_function(const char* varname) {
+	return varname && varname[0] == 'F' && varname[1] == 'N' && get_sigil(varname) == '$';
+}
+
+char varname_is_double_function(const char* varname) {
+	return varname && varname[0] == 'F' && varname[1] == 'N' && get_sigil(varname) == '#';
+}
+
+static inline size_t variable_slot_hash(const char* name)
+{
+	return (size_t)(((uintptr_t)name >> 3) * 0x9E3779B97F4A7C15ull);
+}
+
+static variable_slot* variable_slot_find(const variable_slots* vs, const char* name)
+{
+	size_t i = variable_slot_hash(name) & vs->key_mask;
+	while (vs->keys[i].name) {
+		if (vs->keys[i].name == name) {
+			return &vs->slots[vs->keys[i].slot];
+		}
+		i = (i + 1) & vs->key_mask;
+	}
+	return NULL;
+}
+
+static void variable_slots_free(struct basic_ctx* ctx)
+{
+	variable_slots* vs = ctx->variable_slots;
+	if (!vs) {
+		return;
+	}
+	buddy_free(ctx->allocator, vs->keys);
+	buddy_free(ctx->allocator, vs->slots);
+	buddy_free(ctx->allocator, vs);
+	ctx->variable_slots = NULL;
+}
+
+bool basic_build_variable_slots(struct basic_ctx* ctx)
+{
+	variable_slots_free(ctx);
+	if (!ctx->tokens) {
+		return false;
+	}
+
+	/* Upper bound on distinct names is the number of named tokens */
+	size_t names = 0;
+	for (size_t i = 0; i < ctx->token_count; ++i) {
+		if (ctx->tokens[i].token == VARIABLE && ctx->tokens[i].name_length) {
+			names++;
+		}
+	}
+	size_t keys = 16;
+	while (keys < names * 2) {
+		keys <<= 1;
+	}
+
+	variable_slots* vs = buddy_malloc(ctx->allocator, sizeof(variable_slots));
+	if (!vs) {
+		return false;
+	}
+	vs->epoch = 1;
+	vs->count = 0;
+	vs->key_mask = keys - 1;
+	vs->keys = buddy_malloc(ctx->allocator, keys * sizeof(variable_slot_key));
+	vs->slots = names ? buddy_malloc(ctx->allocator, names * sizeof(variable_slot)) : NULL;
+	ctx->variable_slots = vs;
+	if (!vs->keys || (names && !vs->slots)) {
+		variable_slots_free(ctx);
+		return false;
+	}
+	memset(vs->keys, 0, keys * sizeof(variable_slot_key));
+
+	for (size_t i = 0; i < ctx->token_count; ++i) {
+		const compiled_token_t* t = &ctx->tokens[i];
+		if (t->token != VARIABLE || !t->name_length) {
+			continue;
+		}
+		size_t k = variable_slot_hash(t->name) & vs->key_mask;
+		while (vs->keys[k].name && vs->keys[k].name != t->name) {
+			k = (k + 1) & vs->key_mask;
+		}
+		if (vs->keys[k].name) {
+			continue;
+		}
+		variable_slot* slot = &vs->slots[vs->count];
+		memset(slot, 0, sizeof(variable_slot));
+		slot->name = t->name;
+		slot->name_length = t->name_length;
+		vs->keys[k].name = t->name;
+		vs->keys[k].slot = vs->count++;
+	}
+	dprintf("Variable slots: %lu names\n", vs->count);
+	return true;
+}
+
+void basic_variables_changed(struct basic_ctx* ctx)
+{
+	if (ctx->variable_slots) {
+		ctx->variable_slots->epoch++;
+	}
+}
+
+/**
+ * @brief Find the cached resolution of a variable name, re-resolving it
+ * against the hashmaps if anything has changed since it was last used.
+ *
+ * @param ctx BASIC context
+ * @param var Variable name, only names interned by the tokenizer can match
+ * @param kind Namespace to resolve in
+ * @return Resolution, or NULL if the name has no slot
+ */
+static variable_resolution* variable_resolve(struct basic_ctx* ctx, const char* var, variable_kind_t kind)
+{
+	variable_slots* vs = ctx->variable_slots;
+	if (!vs || !var) {
+		return NULL;
+	}
+	variable_slot* slot = variable_slot_find(vs, var);
+	if (!slot) {
+		return NULL;
+	}
+	variable_resolution* r = &slot->kind[kind];
+	if (r->epoch == vs->epoch) {
+		return r;
+	}
+
+	struct hashmap** frames;
+	struct hashmap* globals;
+	size_t len = slot->name_length;
+	switch (kind) {
+		case VK_INT:
+			frames = ctx->local_int_variables;
+			globals = ctx->int_variables;
+			r->valid = valid_int_var(var, len);
+			r->plain = !is_builtin_int_fn(var, len) && !varname_is_int_function(var) && !varname_is_int_array_access(ctx, var);
+			break;
+		case VK_DOUBLE:
+			frames = ctx->local_double_variables;
+			globals = ctx->double_variables;
+			r->valid = valid_double_var(var, len);
+			r->plain = !is_builtin_double_fn(var, len) && !varname_is_double_function(var) && !varname_is_double_array_access(ctx, var);
+			break;
+		default:
+			frames = ctx->local_string_variables;
+			globals = ctx->str_variables;
+			r->valid = valid_string_var(var, len);
+			r->plain = !is_builtin_str_fn(var, len) && !varname_is_string_function(var) && !varname_is_string_array_access(ctx, var);
+			break;
+	}
+
+	/* All variable types share the name layout, so one key fits every map */
+	const ub_var_int key = { .varname = var, .name_length = len };
+	r->global_item = hashmap_get(globals, &key);
+	r->local_item = frames[ctx->call_stack_ptr] ? hashmap_get(frames[ctx->call_stack_ptr], &key) : NULL;
+	r->item = NULL;
+	for (size_t j = ctx->call_stack_ptr; j > 0 && !r->item; --j) {
+		if (frames[j]) {
+			r->item = hashmap_get(frames[j], &key);
+		}
+	}
+	if (!r->item) {
+		r->item = r->global_item;
+	}
+	r->epoch = vs->epoch;
+	return r;
+}
+
 static void update_string(struct basic_ctx* ctx, ub_var_string* str, size_t len, bool propagate_global, const char* varname, const char* value, size_t value_len) {
 	if (!str || !varname || !value) {
 		return;
@@ -228,6 +422,22 @@ void basic_set_string_variable(const char* var, const char* value, struct basic_
 		return;
 	}
 
+	/* Same precedence as below: a LOCAL assignment updates the current frame first */
+	variable_resolution* r = variable_resolve(ctx, var, VK_STRING);
+	ub_var_string* existing = r && r->valid ? (local && r->local_item ? r->local_item : r->global_item) : NULL;
+	if (existing) {
+		char* copy = buddy_strdup(ctx->allocator, value);
+		if (!copy) {
+			tokenizer_error_print(ctx, "Out of memory");
+			return;
+		}
+		buddy_free(ctx->allocator, existing->value);
+		existing->value = copy;
+		existing->value_length = value_len;
+		existing->global = propagate_global;
+		return;
+	}
+
 	struct hashmap* locals = ctx->local_string_variables[ctx->call_stack_ptr];
 	struct hashmap* globals = ctx->str_variables;
 
@@ -255,6 +465,7 @@ void basic_set_string_variable(const char* var, const char* value, struct basic_
 		update_string(ctx, &new, len, propagate_global, var, value, value_len);
 		oom = !hashmap_set(target, &new) && hashmap_oom(target);
 	}
+	basic_variables_changed(ctx);
 	if (oom) {
 		tokenizer_error_print(ctx, "Out of memory");
 		return;
@@ -276,6 +487,15 @@ void basic_set_int_variable(const char* var, int64_t value, struct basic_ctx* ct
 		return;
 	}
 
+	/* Same precedence as below: a LOCAL assignment updates the current frame first */
+	variable_resolution* r = variable_resolve(ctx, var, VK_INT);
+	ub_var_int* existing = r && r->valid ? (local && r->local_item ? r->local_item : r->global_item) : NULL;
+	if (existing) {
+		existing->value = value;
+		existing->global = propagate_global;
+		return;
+	}
+
 	struct hashmap* locals = ctx->local_int_variables[ctx->call_stack_ptr];
 	struct hashmap* globals = ctx->int_variables;
 
@@ -305,6 +525,7 @@ void basic_set_int_variable(const char* var, int64_t value, struct basic_ctx* ct
 		update_int(ctx, &new, len, propagate_global, var, value);
 		oom = !hashmap_set(target, &new) && hashmap_oom(target);
 	}
+	basic_variables_changed(ctx);
 	if (oom) {
 		tokenizer_error_print(ctx, "Out of memory");
 		return;
@@ -326,6 +547,15 @@ void basic_set_double_variable(const char* var, double value, struct basic_ctx*
 		return;
 	}
 
+	/* Same precedence as below: a LOCAL assignment updates the current frame first */
+	variable_resolution* r = variable_resolve(ctx, var, VK_DOUBLE);
+	ub_var_double* existing = r && r->valid ? (local && r->local_item ? r->local_item : r->global_item) : NULL;
+	if (existing) {
+		existing->value = value;
+		existing->global = propagate_global;
+		return;
+	}
+
 	struct hashmap* locals = ctx->local_double_variables[ctx->call_stack_ptr];
 	struct hashmap* globals = ctx->double_variables;
 
@@ -351,52 +581,24 @@ void basic_set_double_variable(const char* var, double value, struct basic_ctx*
 		update_double(ctx, &new, len, propagate_global, var, value);
 		oom = !hashmap_set(target, &new) && hashmap_oom(target);
 	}
+	basic_variables_changed(ctx);
 	if (oom) {
 		tokenizer_error_print(ctx, "Out of memory");
 		return;
 	}
 }
 
-static inline char get_sigil(const char *v) {
-	if (!v || !*v) {
-		return 0;
-	}
-	// Walk to the null terminator
-	while (*v) {
-		v++;
-	}
-	// Look at the character immediately preceding the null
-	return *(v - 1);
-}
-
-/**
- * @brief Returns true if 'varname' starts with FN
- * (is a function call)
- *
- * @param varname variable name to check
- * @return char 1 if variable name is a function call, 0 if it is not
- */
-char varname_is_int_function(const char* varname) {
-	if (!varname || varname[0] != 'F' || varname[1] != 'N') {
-		return 0;
-	}
-	char s = get_sigil(varname);
-	return (s != '$' && s != '#');
-}
-
-char varname_is_string_function(const char* varname) {
-	return varname && varname[0] == 'F' && varname[1] == 'N' && get_sigil(varname) == '$';
-}
-
-char varname_is_double_function(const char* varname) {
-	return varname && varname[0] == 'F' && varname[1] == 'N' && get_sigil(varname) == '#';
-}
-
 const char* basic_get_string_variable(const char* var, struct basic_ctx* ctx, size_t* out_len, size_t var_name_len) {
 	if (!var) {
 		if (out_len) *out_len = 0;
 		return "";
 	}
+	variable_resolution* r = variable_resolve(ctx, var, VK_STRING);
+	if (r && r->plain && r->item) {
+		ub_var_string* found = r->item;
+		if (out_len) *out_len = found->value_length;
+		return found->value;
+	}
 	char* retv;
 	size_t ov;
 	if (basic_builtin_str_fn(var, ctx, &retv, &ov, var_name_len)) {
@@ -482,6 +684,10 @@ int64_t basic_get_int_variable(const char* var, struct basic_ctx* ctx, size_t va
 	if (!var) {
 		return 0;
 	}
+	variable_resolution* r = variable_resolve(ctx, var, VK_INT);
+	if (r && r->plain && r->item) {
+		return ((ub_var_int*)r->item)->value;
+	}
 	int64_t retv = 0;
 	if (basic_builtin_int_fn(var, ctx, &retv, var_len)) {
 		return retv;
@@ -510,6 +716,16 @@ bool basic_get_double_variable(const char* var, struct basic_ctx* ctx, double* r
 	if (!var || !res) {
 		return false;
 	}
+	variable_resolution* r = variable_resolve(ctx, var, VK_DOUBLE);
+	if (r && r->plain) {
+		if (r->item) {
+			*res = ((ub_var_double*)r->item)->value;
+			return true;
+		} else if (var[var_len - 1] != '#') {
+			/* An integer variable being tried as a real first */
+			return false;
+		}
+	}
 	if (basic_builtin_double_fn(var, ctx, res, var_len)) {
 		return true;
 	} else if (varname_is_double_function(var)) {
@@ -22,6 +22,8 @@ void ahci_handler(uint8_t isr, uint64_t error, uint64_t irq, void* opaque)
 		volatile ahci_hba_port_t* port = &abar->ports[p];
 		uint32_t pis = port->interrupt_status;
 		if (pis) {
+			// hand completions and errors to the port's queue before clearing them
+			ahci_queue_reap((ahci_hba_mem_t*)abar, p, pis);
 			port->interrupt_status = pis;  // clear interrupt status
 			(void)port->interrupt_status;  // flush posted write
 			//dprintf("AHCI IRQ: port %d, PxIS=%08x\n", p, pis);
@@ -174,7 +176,7 @@ void fill_reg_h2c(ahci_fis_reg_h2d_t* cmdfis, uint64_t start, uint16_t count) {
 }
 
 void issue_command_to_slot(ahci_hba_port_t *port, uint8_t slot) {
-	port->command_issue = 1 << slot;
+	port->command_issue = 1u << slot;
 }
 
 bool is_error(ahci_hba_port_t* port, const char* function) {
@@ -246,6 +248,7 @@ void probe_port(ahci_hba_mem_t *abar)
 				if (dt == AHCI_DEV_SATA) {
 					uint8_t id_page[512] = {0};
 					if (ahci_identify_page(&abar->ports[i], abar, id_page)) {
+						ahci_queue_init(abar, i, id_page);
 						build_sata_label(sd, id_page);
 						ahci_trim_caps* caps = kmalloc(sizeof(ahci_trim_caps));
 						if (caps) {
@@ -254,6 +257,7 @@ void probe_port(ahci_hba_mem_t *abar)
 							has_trim = caps->has_trim;
 						}
 					} else {
+						ahci_queue_init(abar, i, NULL);
 						char size_str[24] = {0};
 						humanise_capacity(size_str, sizeof(size_str), sd->size * sd->block_size);
 						snprintf(sd->ui.label, sizeof(sd->ui.label), "ATA Device - %s", size_str);
@@ -278,10 +282,12 @@ void probe_port(ahci_hba_mem_t *abar)
 }
 
 int find_cmdslot(ahci_hba_port_t *port, ahci_hba_mem_t *abar) {
+	// Non-queued commands may not be issued while queued ones are outstanding
+	ahci_queue_drain(abar, (int)(port - &abar->ports[0]));
 	// If not set in SACT and CI, the slot is free
 	port->interrupt_status = (uint32_t)-1;
 	uint32_t slots = (port->sata_active | port->command_issue);
-	int cmdslots = (abar->host_capabilities & 0x0f00) >> 8;
+	int cmdslots = ((abar->host_capabilities >> 8) & 0x1f) + 1;
 	for (int i=0; i<cmdslots; i++) {
 		if ((slots&1) == 0) {
 			return i;
@@ -293,7 +299,7 @@ int find_cmdslot(ahci_hba_port_t *port, ahci_hba_mem_t *abar) {
 }
 
 void setup_aligned_buffers(ahci_hba_mem_t* abar) {
-	uint64_t bounce_size = HDD_SECTOR_SIZE * 128 + 0x1000;
+	uint64_t bounce_size = HDD_SECTOR_SIZE * AHCI_BOUNCE_SECTORS + 0x1000;
 	aligned_read_buf  = ((uintptr_t)(allocate_ahci(abar, bounce_size)) + 0xFFF) & ~0xFFF;
 	aligned_write_buf = ((uintptr_t)(allocate_ahci(abar, bounce_size)) + 0xFFF) & ~0xFFF;
 }
@@ -0,0 +1,299 @@
+/**
+ * @file queue.c
+ * @brief Queued AHCI reads and writes
+ *
+ * A request is split into commands of up to AHCI_MAX_SECTORS_PER_CMD sectors.
+ * Each command gets its own command slot, with a PRDT pointing straight at
+ * the caller's buffer, and commands are issued back to back so the device
+ * always has the next one waiting. Devices with Native Command Queuing get
+ * READ/WRITE FPDMA QUEUED, tagged with their slot number, and may finish
+ * them in any order. Other devices get READ/WRITE DMA EXT, which the HBA
+ * runs in slot order.
+ *
+ * The interrupt handler notices completions and records them in the port's
+ * queue state, so waiters spin on memory. Waiters only read the port
+ * registers themselves every so often, in case interrupts are masked.
+ * An error is only noted by the handler; restarting the port and reading
+ * the NCQ error log waits on the device, so a waiter does it.
+ */
+#include <kernel.h>
+
+/* Spins between register polls while waiting for a completion */
+#define AHCI_POLL_INTERVAL 1024
+
+#define AHCI_PxIS_ERRORS (HBA_PxIS_TFES | HBA_PxIS_IFS | HBA_PxIS_HBDS | HBA_PxIS_HBFS)
+
+_Static_assert(AHCI_MAX_SECTORS_PER_CMD * HDD_SECTOR_SIZE <= AHCI_PRDT_ENTRIES * AHCI_PRD_MAX_BYTES, "command larger than its PRDT");
+_Static_assert(AHCI_MAX_SECTORS_PER_CMD <= 0xFFFF, "sector count must fit 16 bits");
+
+static ahci_port_queue_t queues[32] = { 0 };
+
+void ahci_queue_init(ahci_hba_mem_t* abar, int portno, const uint8_t* id_page) {
+	ahci_port_queue_t* q = &queues[portno];
+	memset(q, 0, sizeof(*q));
+
+	uint32_t ncs = ((abar->host_capabilities >> 8) & 0x1F) + 1;
+	q->slots = ncs >= 32 ? 0xFFFFFFFF : (1u << ncs) - 1;
+	q->depth = ncs;
+	q->s64a = (abar->host_capabilities & HBA_CAP_S64A) != 0;
+
+	if (id_page && (abar->host_capabilities & HBA_CAP_SNCQ)) {
+		const uint16_t* id = (const uint16_t*)id_page;
+		uint16_t sata_caps = id[ATA_IDENT_SATA_CAPS / 2];
+		/* 0x0000 and 0xFFFF mean the word is not reported */
+		if (sata_caps != 0xFFFF && (sata_caps & (1 << 8))) {
+			q->log = (uint8_t*)kmalloc_low(HDD_SECTOR_SIZE);
+			q->ncq = q->log != NULL;
+			q->depth = MIN(ncs, (uint32_t)(id[ATA_IDENT_QUEUE_DEPTH / 2] & 0x1F) + 1);
+		}
+	}
+
+	q->abar = abar;
+	q->port = &abar->ports[portno];
+	dprintf("AHCI port %d: %u command slots, %s, depth %u\n", portno, ncs, q->ncq ? "NCQ" : "no NCQ", q->depth);
+}
+
+bool ahci_queue_dma_capable(const ahci_hba_mem_t* abar, const void* buf, size_t bytes) {
+	uintptr_t addr = (uintptr_t)buf;
+	if ((addr & 1) != 0 || addr >= 0x0000800000000000ull) {
+		return false;
+	}
+	return (abar->host_capabilities & HBA_CAP_S64A) != 0 || addr + bytes <= 0x100000000ull;
+}
+
+/**
+ * @brief After an error has stopped the port, read the NCQ error log, which
+ * the device requires before it will accept further queued commands.
+ */
+static void ahci_queue_clear_ncq_error(ahci_port_queue_t* q) {
+	uint32_t free = q->slots & ~q->issued;
+	if (!free) {
+		dprintf("AHCI: no free slot to read the NCQ error log\n");
+		return;
+	}
+	int slot = __builtin_ctz(free);
+	ahci_hba_cmd_header_t* cmdheader = get_cmdheader_for_slot(q->port, slot, false, false, 1);
+	ahci_hba_cmd_tbl_t* cmdtbl = get_and_clear_cmdtbl(cmdheader);
+	fill_prdt(cmdtbl, 0, q->log, HDD_SECTOR_SIZE, true);
+	ahci_fis_reg_h2d_t* cmdfis = setup_reg_h2d(cmdtbl, FIS_TYPE_REG_H2D, ATA_CMD_READ_LOG_EXT, 0);
+	fill_reg_h2c(cmdfis, ATA_LOG_NCQ_ERROR, 1);
+	if (issue_and_wait(q->port, slot, "read ncq log")) {
+		dprintf("AHCI: NCQ error on tag %u\n", q->log[0] & 0x1F);
+	}
+	q->port->interrupt_status = (uint32_t)-1;
+}
+
+static void ahci_queue_reap_locked(ahci_port_queue_t* q, uint32_t pis) {
+	ahci_hba_port_t* port = q->port;
+	uint32_t outstanding = q->active & ~q->done;
+	if (!outstanding) {
+		return;
+	}
+
+	uint32_t busy = port->command_issue | (q->ncq ? port->sata_active : 0);
+	pis |= port->interrupt_status;
+	if (pis & AHCI_PxIS_ERRORS) {
+		fs_error_t fe = ahci_classify_error(port);
+		dprintf("Disk error [queued]: %s [IS=%08x TFD=%08x SERR=%08x CI=%08x SACT=%08x]\n", fs_strerror(fe), pis, port->task_file_data, port->sata_error, port->command_issue, port->sata_active);
+		/* Commands already gone from PxCI/PxSACT finished; the device abandons the rest */
+		q->failed |= outstanding & busy;
+		q->done |= outstanding;
+		q->recover = true;
+		return;
+	}
+	q->done |= outstanding & ~busy;
+}
+
+/**
+ * @brief Restart a port an error has stopped, if one has. Called by waiters,
+ * never by the interrupt handler. Nothing is issued until it is done.
+ */
+static void ahci_queue_recover(ahci_port_queue_t* q) {
+	if (!q->recover) {
+		return;
+	}
+	uint64_t flags;
+	lock_spinlock_irq(&q->lock, &flags);
+	bool mine = q->recover && !q->recovering;
+	if (mine) {
+		q->recover = false;
+		q->recovering = true;
+	}
+	unlock_spinlock_irq(&q->lock, flags);
+	if (!mine) {
+		return;
+	}
+
+	ahci_hba_port_t* port = q->port;
+	stop_cmd(port);
+	port->sata_error = (uint32_t)-1;
+	port->interrupt_status = (uint32_t)-1;
+	start_cmd(port);
+	if (q->ncq) {
+		ahci_queue_clear_ncq_error(q);
+	}
+
+	lock_spinlock_irq(&q->lock, &flags);
+	q->recovering = false;
+	unlock_spinlock_irq(&q->lock, flags);
+}
+
+void ahci_queue_reap(ahci_hba_mem_t* abar, int portno, uint32_t pis) {
+	ahci_port_queue_t* q = &queues[portno];
+	if (!q->port) {
+		return;
+	}
+	uint64_t flags;
+	lock_spinlock_irq(&q->lock, &flags);
+	ahci_queue_reap_locked(q, pis);
+	unlock_spinlock_irq(&q->lock, flags);
+}
+
+void ahci_queue_drain(ahci_hba_mem_t* abar, int portno) {
+	ahci_port_queue_t* q = &queues[portno];
+	if (!q->port) {
+		return;
+	}
+	while (q->issued) {
+		ahci_queue_reap(abar, portno, 0);
+		ahci_queue_recover(q);
+		__builtin_ia32_pause();
+	}
+	ahci_queue_recover(q);
+}
+
+/**
+ * @brief Claim a free slot, if the queue is not already at its depth.
+ * Slots busy with non-queued commands are skipped too.
+ */
+static int ahci_queue_claim(ahci_port_queue_t* q) {
+	int slot = -1;
+	uint64_t flags;
+	lock_spinlock_irq(&q->lock, &flags);
+	uint32_t free = q->slots & ~(q->issued | q->port->command_issue | q->port->sata_active);
+	if (free && (uint32_t)__builtin_popcount(q->issued) < q->depth) {
+		slot = __builtin_ctz(free);
+		q->issued |= 1u << slot;
+	}
+	unlock_spinlock_irq(&q->lock, flags);
+	return slot;
+}
+
+/**
+ * @brief Hand back whichever of the caller's slots have finished.
+ * @return false if any of them failed.
+ */
+static bool ahci_queue_release(ahci_port_queue_t* q, uint32_t* mine) {
+	uint64_t flags;
+	lock_spinlock_irq(&q->lock, &flags);
+	uint32_t finished = *mine & q->done;
+	bool ok = (q->failed & finished) == 0;
+	q->issued &= ~finished;
+	q->active &= ~finished;
+	q->done &= ~finished;
+	q->failed &= ~finished;
+	unlock_spinlock_irq(&q->lock, flags);
+	*mine &= ~finished;
+	return ok;
+}
+
+/**
+ * @brief Wait until at least one of the caller's slots has finished.
+ */
+static void ahci_queue_wait_any(ahci_port_queue_t* q, int portno, uint32_t mine) {
+	uint32_t spins = 0;
+	while ((q->done & mine) == 0) {
+		if (++spins % AHCI_POLL_INTERVAL == 0) {
+			ahci_queue_reap(q->abar, portno, 0);
+		}
+		__builtin_ia32_pause();
+	}
+	ahci_queue_recover(q);
+}
+
+static void ahci_queue_issue(ahci_port_queue_t* q, int slot, bool write, uint64_t lba, uint32_t count, uint8_t* buf) {
+	size_t bytes = (size_t)count * HDD_SECTOR_SIZE;
+	uint16_t prds = (bytes + AHCI_PRD_MAX_BYTES - 1) / AHCI_PRD_MAX_BYTES;
+
+	ahci_hba_cmd_header_t* cmdheader = get_cmdheader_for_slot(q->port, slot, write, false, prds);
+	cmdheader->prdbc = 0;
+	ahci_hba_cmd_tbl_t* cmdtbl = get_and_clear_cmdtbl(cmdheader);
+	for (uint16_t i = 0; i < prds; i++) {
+		uint32_t part = MIN(bytes, AHCI_PRD_MAX_BYTES);
+		fill_prdt(cmdtbl, i, buf, part, i == prds - 1);
+		buf += part;
+		bytes -= part;
+	}
+
+	if (q->ncq) {
+		ahci_fis_reg_h2d_t* cmdfis = setup_reg_h2d(cmdtbl, FIS_TYPE_REG_H2D, write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED, 0);
+		fill_reg_h2c(cmdfis, lba, 0);
+		/* FPDMA commands carry the sector count in the feature fields and the tag in the count field */
+		cmdfis->feature_low = count & 0xFF;
+		cmdfis->feature_high = (count >> 8) & 0xFF;
+		cmdfis->count_low = (uint8_t)(slot << 3);
+		cmdfis->count_high = 0;
+	} else {
+		ahci_fis_reg_h2d_t* cmdfis = setup_reg_h2d(cmdtbl, FIS_TYPE_REG_H2D, write ? ATA_CMD_WRITE_DMA_EX : ATA_CMD_READ_DMA_EX, 0);
+		fill_reg_h2c(cmdfis, lba, count);
+	}
+	__sync_synchronize();
+
+	/* Under the lock, so a reap never sees the slot active before PxCI has it */
+	uint64_t flags;
+	lock_spinlock_irq(&q->lock, &flags);
+	while (q->recover || q->recovering) {
+		/* Not onto a stopped port */
+		unlock_spinlock_irq(&q->lock, flags);
+		ahci_queue_recover(q);
+		__builtin_ia32_pause();
+		lock_spinlock_irq(&q->lock, &flags);
+	}
+	if (q->ncq) {
+		q->port->sata_active = 1u << slot;
+	}
+	issue_command_to_slot(q->port, slot);
+	q->active |= 1u << slot;
+	unlock_spinlock_irq(&q->lock, flags);
+}
+
+bool ahci_queue_rw(ahci_hba_mem_t* abar, int portno, bool write, uint64_t lba, uint32_t count, void* buf) {
+	ahci_port_queue_t* q = &queues[portno];
+	if (!q->port) {
+		fs_set_error(FS_ERR_NO_SUCH_DEVICE);
+		return false;
+	}
+
+	uint8_t* p = buf;
+	uint32_t mine = 0;
+	bool ok = true;
+	while (count && ok) {
+		int slot;
+		while ((slot = ahci_queue_claim(q)) < 0) {
+			if (mine) {
+				/* Recycle our own finished slots before anyone else's */
+				ahci_queue_wait_any(q, portno, mine);
+				ok = ahci_queue_release(q, &mine) && ok;
+			} else {
+				ahci_queue_reap(abar, portno, 0);
+				ahci_queue_recover(q);
+				__builtin_ia32_pause();
+			}
+		}
+		uint32_t n = MIN(count, AHCI_MAX_SECTORS_PER_CMD);
+		ahci_queue_issue(q, slot, write, lba, n, p);
+		mine |= 1u << slot;
+		lba += n;
+		p += (size_t)n * HDD_SECTOR_SIZE;
+		count -= n;
+	}
+
+	while (mine) {
+		ahci_queue_wait_any(q, portno, mine);
+		ok = ahci_queue_release(q, &mine) && ok;
+	}
+	if (!ok) {
+		fs_set_error(FS_ERR_IO);
+	}
+	return ok;
+}
@@ -4,38 +4,30 @@
 extern uint8_t* aligned_read_buf;
 
 bool ahci_read(ahci_hba_port_t *port, uint64_t start, uint32_t count, char *buf, ahci_hba_mem_t* abar) {
-
-	if (count > 128) {
-		preboot_fail("ahci_read > 128 clusters!");
-	}
-	uint32_t o_count = count;
-
-	GET_SLOT(port, abar);
-
-	ahci_hba_cmd_header_t* cmdheader = get_cmdheader_for_slot(port, slot, false, false, ((count - 1) >> 4) + 1);
-	ahci_hba_cmd_tbl_t* cmdtbl = get_and_clear_cmdtbl(cmdheader);
-
-	uint8_t *rd_buf = aligned_read_buf;
-
-	int i = 0;
-	for (i = 0; i < cmdheader->prdt_length_entries - 1; i++) {
-		fill_prdt(cmdtbl, i, rd_buf, 16 * HDD_SECTOR_SIZE, true);
-		rd_buf += 16 * HDD_SECTOR_SIZE;
-		count -= 16;
-	}
-	fill_prdt(cmdtbl, i, rd_buf, count * HDD_SECTOR_SIZE, true);
-
-	ahci_fis_reg_h2d_t* cmdfis = setup_reg_h2d(cmdtbl, FIS_TYPE_REG_H2D, ATA_CMD_READ_DMA_EX, 0);
-	fill_reg_h2c(cmdfis, start, o_count);
-
-	if (!issue_and_wait(port, slot, "read disk")) {
+	if (!buf) {
 		return false;
 	}
+	int portno = (int)(port - &abar->ports[0]);
+
+	if (ahci_queue_dma_capable(abar, buf, (size_t)count * HDD_SECTOR_SIZE)) {
+		if (!ahci_queue_rw(abar, portno, false, start, count, buf)) {
+			return false;
+		}
+		add_random_entropy(SAMPLE_FROM_BUFFER(buf));
+		return true;
+	}
 
-	if (!buf) {
-		return false;
+	/* Buffers the HBA cannot reach, e.g. on the boot stack, go through the bounce buffer */
+	while (count) {
+		uint32_t this_xfer = MIN(count, AHCI_BOUNCE_SECTORS);
+		if (!ahci_queue_rw(abar, portno, false, start, this_xfer, aligned_read_buf)) {
+			return false;
+		}
+		memcpy(buf, aligned_read_buf, this_xfer * HDD_SECTOR_SIZE);
+		start += this_xfer;
+		buf += this_xfer * HDD_SECTOR_SIZE;
+		count -= this_xfer;
 	}
-	memcpy(buf, aligned_read_buf, (o_count * HDD_SECTOR_SIZE));
 
 	add_random_entropy(SAMPLE_FROM_BUFFER(aligned_read_buf));
 
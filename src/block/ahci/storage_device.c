@@ -7,7 +7,6 @@ int storage_device_ahci_block_read(void* dev, uint64_t start, uint32_t bytes, un
 	}
 
 	uint32_t sectors = (bytes + sd->block_size - 1) / sd->block_size;
-	unsigned char* end = buffer + bytes;
 
 	ahci_hba_mem_t* abar = sd->opaque2;
 	ahci_hba_port_t* port = &abar->ports[sd->opaque1];
@@ -26,28 +25,12 @@ int storage_device_ahci_block_read(void* dev, uint64_t start, uint32_t bytes, un
 		}
 		return true;
 	} else {
-		while (sectors > 0) {
-			uint32_t this_xfer = (sectors > max_per_cmd) ? max_per_cmd : sectors;
-			uint32_t bytes_this = this_xfer * sd->block_size;
-
-			if (buffer + bytes_this > end) {
-				uint64_t bytes_left = (uint64_t)(end - buffer);
-				this_xfer = bytes_left / sd->block_size;
-				if (this_xfer == 0) {
-					break;
-				}
-				bytes_this = this_xfer * sd->block_size;
-			}
-
-			if (!ahci_read(port, start, this_xfer, (char*)buffer, abar)) {
-				return 0;
-			}
-
-			start += this_xfer;
-			buffer += bytes_this;
-			sectors -= this_xfer;
+		/* Whole sectors only; ahci_read() splits the request into commands itself */
+		sectors = bytes / sd->block_size;
+		if (sectors == 0) {
+			return 1;
 		}
-		return 1;
+		return ahci_read(port, start, sectors, (char*)buffer, abar) ? 1 : 0;
 	}
 }
 
@@ -85,17 +68,5 @@ int storage_device_ahci_block_write(void* dev, uint64_t start, uint32_t bytes, c
 	ahci_hba_mem_t* abar = sd->opaque2;
 	ahci_hba_port_t* port = &abar->ports[sd->opaque1];
 
-	const uint32_t max_per_cmd = 16;
-	while (sectors > 0) {
-		uint32_t this_xfer = (sectors > max_per_cmd) ? max_per_cmd : sectors;
-		if (!ahci_write(port, start, this_xfer, (char*)buffer, abar)) {
-			return false;
-		}
-		start   += this_xfer;
-		buffer  += this_xfer * sd->block_size;
-		sectors -= this_xfer;
-	}
-
-	return true;
+	return ahci_write(port, start, sectors, (char*)buffer, abar);
 }
-
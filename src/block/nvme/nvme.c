@@ -181,6 +181,128 @@ static int nvme_io_rw(nvme_dev_t *dev, bool write, uint64_t slba, uint16_t nbloc
 	return nvme_cqe_poll(dev, false, cid);
 }
 
+/* ---------- Direct I/O: PRPs built over the caller's buffer ---------- */
+
+/* Submit everything queued since the last doorbell with one tail write */
+static void nvme_io_kick(nvme_dev_t *dev) {
+	if (!dev->io_sq_dirty) {
+		return;
+	}
+	__asm__ volatile ("sfence":: : "memory");
+	nvme_db_write(dev->regs, dev->dstrd, 1, false, dev->io_sqt);
+	dev->io_sq_dirty = false;
+}
+
+/**
+ * @brief Reap every I/O completion currently posted, then write the CQ head doorbell once.
+ * If wait is set, spin until at least one command completes. Failures latch dev->io_error.
+ */
+static void nvme_io_reap(nvme_dev_t *dev, bool wait) {
+	nvme_io_kick(dev);
+	uint32_t reaped = 0;
+	for (;;) {
+		nvme_cqe_t *e = &dev->iocq[dev->io_cqh];
+		uint16_t st = *(volatile uint16_t *) &e->status;
+		if ((uint8_t) (st & 1) != dev->io_phase) {
+			if (wait && reaped == 0 && dev->inflight) {
+				__builtin_ia32_pause();
+				continue;
+			}
+			break;
+		}
+		uint16_t cid = *(volatile uint16_t *) &e->cid;
+		if (cid < NVME_MAX_INFLIGHT) {
+			dev->inflight &= ~(1u << cid);
+		}
+		dev->io_cqh = (uint16_t) ((dev->io_cqh + 1) & (dev->io_qd - 1));
+		if (dev->io_cqh == 0) {
+			dev->io_phase ^= 1;
+		}
+		uint8_t sc = (uint8_t) ((st >> 1) & 0xFF);
+		uint8_t sct = (uint8_t) ((st >> 9) & 0x7);
+		if (sc != 0 || sct != 0) {
+			dprintf("NVMe io error: CID=%u SCT=%u SC=%u DNR=%u\n", cid, sct, sc, (st >> 12) & 1);
+			dev->io_error = true;
+		}
+		reaped++;
+	}
+	if (reaped) {
+		nvme_db_write(dev->regs, dev->dstrd, 1, true, dev->io_cqh);
+	}
+}
+
+/**
+ * @brief Queue one read or write of native blocks straight to or from buf.
+ * PRP1 addresses the first (possibly partial) page, PRP2 either the second page or,
+ * for longer transfers, this slot's PRP list holding every page after the first.
+ * The doorbell is not rung here; see nvme_io_kick().
+ */
+static void nvme_io_submit(nvme_dev_t *dev, bool write, uint64_t slba, uint32_t nblocks, uint8_t *buf, size_t bytes) {
+	uint32_t all = dev->max_inflight >= 32 ? 0xFFFFFFFFu : ((1u << dev->max_inflight) - 1);
+	while ((dev->inflight & all) == all) {
+		nvme_io_reap(dev, true);
+	}
+	uint16_t slot = (uint16_t) __builtin_ctz(~dev->inflight);
+	uint16_t tail;
+	nvme_sqe_t *sqe = nvme_sqe_alloc(dev, false, &tail);
+	sqe->opc = write ? NVME_IO_WRITE : NVME_IO_READ;
+	sqe->cid = slot;
+	sqe->nsid = dev->nsid;
+
+	uintptr_t addr = (uintptr_t) buf;
+	size_t first = NVME_PAGE_SIZE - (addr & (NVME_PAGE_SIZE - 1));
+	sqe->prp1 = (uint64_t) addr;
+	if (bytes > first) {
+		uintptr_t next = addr + first;
+		size_t pages = (bytes - first + NVME_PAGE_SIZE - 1) / NVME_PAGE_SIZE;
+		if (pages == 1) {
+			sqe->prp2 = (uint64_t) next;
+		} else {
+			uint64_t *list = dev->prp_lists + (size_t) slot * NVME_PRP_LIST_ENTRIES;
+			for (size_t i = 0; i < pages; i++) {
+				list[i] = (uint64_t) (next + i * NVME_PAGE_SIZE);
+			}
+			sqe->prp2 = (uint64_t) (uintptr_t) list;
+		}
+	}
+	sqe->cdw10 = (uint32_t) (slba & 0xFFFFFFFF);
+	sqe->cdw11 = (uint32_t) (slba >> 32);
+	sqe->cdw12 = nblocks - 1;
+
+	dev->inflight |= 1u << slot;
+	dev->io_sq_dirty = true;
+	/* Let the controller start on a full batch while we build the next */
+	if ((dev->inflight & all) == all) {
+		nvme_io_kick(dev);
+	}
+}
+
+/**
+ * @brief Transfer whole native blocks between the device and a dword aligned buffer
+ * with no intermediate copy. The range is split at max_transfer and the pieces are
+ * kept in flight together, up to max_inflight at a time.
+ */
+static int nvme_io_direct(nvme_dev_t *dev, bool write, uint64_t slba, uint64_t nblocks, uint8_t *buf) {
+	uint32_t block = dev->ns_is_4k ? 4096 : 512;
+	uint32_t per_cmd = dev->max_transfer / block;
+	dev->io_error = false;
+	while (nblocks && !dev->io_error) {
+		uint32_t n = nblocks > per_cmd ? per_cmd : (uint32_t) nblocks;
+		nvme_io_submit(dev, write, slba, n, buf, (size_t) n * block);
+		slba += n;
+		buf += (size_t) n * block;
+		nblocks -= n;
+	}
+	while (dev->inflight) {
+		nvme_io_reap(dev, true);
+	}
+	if (dev->io_error) {
+		fs_set_error(FS_ERR_IO);
+		return 0;
+	}
+	return 1;
+}
+
 static int nvme_io_trim(nvme_dev_t *dev, uint64_t slba_native, uint32_t nlba_native) {
 	nvme_dsm_range_t *rng = nvme_page_alloc_4k();
 	if (!rng) {
@@ -289,6 +411,18 @@ static int nvme_identify_and_ioq(nvme_dev_t *dev) {
 	dev->io_cqh = 0;
 	dev->io_phase = 1;
 
+	/* The helpers clamped the queues to MQES+1; keep our own wrap arithmetic in step */
+	uint16_t max_q = (uint16_t) ((dev->regs->cap & 0xFFFF) + 1);
+	if (dev->io_qd > max_q) {
+		dev->io_qd = max_q;
+	}
+	/* One SQ slot always stays empty, so a full queue can be told from an empty one */
+	dev->max_inflight = (uint16_t) (dev->io_qd - 1 < NVME_MAX_INFLIGHT ? dev->io_qd - 1 : NVME_MAX_INFLIGHT);
+	dev->prp_lists = kmalloc_aligned(NVME_MAX_INFLIGHT * NVME_PRP_LIST_ENTRIES * sizeof(uint64_t), 4096);
+	if (!dev->prp_lists) {
+		return 0;
+	}
+
 	/* ---- Now do Identify path (ASM does it after queues) ---- */
 	void *page = nvme_page_alloc_4k();
 	if (!page) {
@@ -337,6 +471,18 @@ static int nvme_identify_and_ioq(nvme_dev_t *dev) {
 		dev->model[--n] = 0;
 	}
 
+	/* MDTS is a power of two in units of the minimum page size, zero meaning no limit */
+	uint8_t mdts = *(((uint8_t *) page) + 77);
+	uint32_t mpsmin = (uint32_t) ((dev->regs->cap >> 48) & 0xF);
+	dev->max_transfer = NVME_MAX_TRANSFER;
+	if (mdts != 0 && mdts + 12 + mpsmin < 32) {
+		uint32_t limit = (uint32_t) 1 << (mdts + 12 + mpsmin);
+		if (limit < dev->max_transfer) {
+			dev->max_transfer = limit;
+		}
+	}
+	dprintf("MDTS=%u max transfer=%u max in flight=%u\n", mdts, dev->max_transfer, dev->max_inflight);
+
 	uint32_t oncs = *(const uint32_t *) ((const uint8_t *) page + 256);
 	dev->has_trim = ((oncs & (1u << 2)) != 0);
 	dprintf("Has trim=%u\n", dev->has_trim);
@@ -362,8 +508,8 @@ static int nvme_identify_and_ioq(nvme_dev_t *dev) {
 	return 1;
 }
 
-/* ---------- 512-byte outward I/O (RMW on 4 KiB native) ---------- */
-static int nvme_read_512(nvme_dev_t *dev, uint64_t lba512, uint32_t count512, unsigned char *out) {
+/* ---------- 512-byte outward I/O via a bounce page (RMW on 4 KiB native) ---------- */
+static int nvme_read_512_bounce(nvme_dev_t *dev, uint64_t lba512, uint32_t count512, unsigned char *out) {
 	unsigned char *p = out;
 	void *page = nvme_page_alloc_4k();
 	if (!page) {
@@ -433,7 +579,7 @@ static int nvme_read_512(nvme_dev_t *dev, uint64_t lba512, uint32_t count512, un
 	return 1;
 }
 
-static int nvme_write_512(nvme_dev_t *dev, uint64_t lba512, uint32_t count512, const unsigned char *in) {
+static int nvme_write_512_bounce(nvme_dev_t *dev, uint64_t lba512, uint32_t count512, const unsigned char *in) {
 	const unsigned char *p = in;
 	void *page = nvme_page_alloc_4k();
 	if (!page) {
@@ -490,6 +636,67 @@ static int nvme_write_512(nvme_dev_t *dev, uint64_t lba512, uint32_t count512, c
 	return 1;
 }
 
+/* ---------- 512-byte outward I/O ---------- */
+/*
+ * Whole native blocks are transferred directly against the caller's buffer.
+ * Only a buffer which is not dword aligned (PRP entries require it), or the
+ * partial native blocks at either end of a range on a 4 KiB namespace, go
+ * through the bounce page.
+ */
+static int nvme_read_512(nvme_dev_t *dev, uint64_t lba512, uint32_t count512, unsigned char *out) {
+	if (((uintptr_t) out & 3) != 0) {
+		return nvme_read_512_bounce(dev, lba512, count512, out);
+	}
+	if (!dev->ns_is_4k) {
+		return nvme_io_direct(dev, false, lba512, count512, out);
+	}
+	uint32_t head = (uint32_t) ((8 - (lba512 & 7)) & 7);
+	if (head > count512) {
+		head = count512;
+	}
+	if (head && !nvme_read_512_bounce(dev, lba512, head, out)) {
+		return 0;
+	}
+	lba512 += head;
+	out += (size_t) head * 512;
+	count512 -= head;
+	uint32_t whole = count512 & ~7u;
+	if (whole && !nvme_io_direct(dev, false, lba512 >> 3, whole >> 3, out)) {
+		return 0;
+	}
+	lba512 += whole;
+	out += (size_t) whole * 512;
+	count512 -= whole;
+	return count512 ? nvme_read_512_bounce(dev, lba512, count512, out) : 1;
+}
+
+static int nvme_write_512(nvme_dev_t *dev, uint64_t lba512, uint32_t count512, const unsigned char *in) {
+	if (((uintptr_t) in & 3) != 0) {
+		return nvme_write_512_bounce(dev, lba512, count512, in);
+	}
+	if (!dev->ns_is_4k) {
+		return nvme_io_direct(dev, true, lba512, count512, (uint8_t *) in);
+	}
+	uint32_t head = (uint32_t) ((8 - (lba512 & 7)) & 7);
+	if (head > count512) {
+		head = count512;
+	}
+	if (head && !nvme_write_512_bounce(dev, lba512, head, in)) {
+		return 0;
+	}
+	lba512 += head;
+	in += (size_t) head * 512;
+	count512 -= head;
+	uint32_t whole = count512 & ~7u;
+	if (whole && !nvme_io_direct(dev, true, lba512 >> 3, whole >> 3, (uint8_t *) in)) {
+		return 0;
+	}
+	lba512 += whole;
+	in += (size_t) whole * 512;
+	count512 -= whole;
+	return count512 ? nvme_write_512_bounce(dev, lba512, count512, in) : 1;
+}
+
 int storage_device_nvme_block_read(void *dev_ptr, uint64_t start, uint32_t bytes, unsigned char *buffer) {
 	storage_device_t *sd = (storage_device_t *) dev_ptr;
 	if (!sd || !buffer || bytes == 0) {
@@ -502,29 +709,24 @@ int storage_device_nvme_block_read(void *dev_ptr, uint64_t start, uint32_t bytes
 		return 0;
 	}
 
-	uint32_t sectors = (bytes + sd->block_size - 1) / sd->block_size;
-	unsigned char *end = buffer + bytes;
-
-	while (sectors > 0) {
-		uint32_t this_xfer = sectors > 8 ? 8 : sectors; /* one PRP page worth for 512 native; RMW handles 4k */
-		uint32_t bytes_this = this_xfer * sd->block_size;
-
-		if (buffer + bytes_this > end) {
-			uint64_t bytes_left = (uint64_t) (end - buffer);
-			this_xfer = (uint32_t) (bytes_left / sd->block_size);
-			if (this_xfer == 0) {
-				break;
-			}
-			bytes_this = this_xfer * sd->block_size;
-		}
-
-		if (!nvme_read_512(dev, start, this_xfer, buffer)) {
+	/* Whole sectors go in one call; a trailing partial sector is read through a bounce */
+	uint32_t sectors = bytes / sd->block_size;
+	uint32_t tail = bytes % sd->block_size;
+	if (sectors && !nvme_read_512(dev, start, sectors, buffer)) {
+		return 0;
+	}
+	if (tail) {
+		unsigned char *partial = kmalloc(sd->block_size);
+		if (!partial) {
+			fs_set_error(FS_ERR_OUT_OF_MEMORY);
 			return 0;
 		}
-
-		start += this_xfer;
-		buffer += bytes_this;
-		sectors -= this_xfer;
+		int ok = nvme_read_512(dev, start + sectors, 1, partial);
+		if (ok) {
+			memcpy(buffer + (size_t) sectors * sd->block_size, partial, tail);
+		}
+		kfree(partial);
+		return ok;
 	}
 
 	return 1;
@@ -547,17 +749,7 @@ int storage_device_nvme_block_write(void *dev_ptr, uint64_t start, uint32_t byte
 		sectors = 1;
 	}
 
-	while (sectors > 0) {
-		uint32_t this_xfer = sectors > 8 ? 8 : sectors;
-		if (!nvme_write_512(dev, start, this_xfer, buffer)) {
-			return 0;
-		}
-		start += this_xfer;
-		buffer += (size_t) this_xfer * sd->block_size;
-		sectors -= this_xfer;
-	}
-
-	return 1;
+	return nvme_write_512(dev, start, sectors, buffer);
 }
 
 bool storage_device_nvme_block_clear(void *dev_ptr, uint64_t start, uint32_t bytes) {
@@ -3,8 +3,19 @@
 /* ============================================================
  * Virtio Block (Virtio 1.0+, modern only) - Complete Driver
  * BAR4-centric: capability offsets resolved against BAR4 base
+ *
+ * Requests are queued back to back across the whole virtqueue and
+ * reaped by polling the used ring. Each request is a header, the
+ * caller's buffer split into segments no larger than the device's
+ * size_max, and a status byte. With VIRTIO_RING_F_INDIRECT_DESC the
+ * chain lives in a per-request indirect table, so every request
+ * takes one ring descriptor. With VIRTIO_RING_F_EVENT_IDX the
+ * device's avail_event decides whether a batch needs a doorbell.
  * ============================================================ */
 
+/* Buffers at or above this address are not identity mapped (kernel image, boot stacks) */
+#define VIRTIO_BLOCK_DMA_LIMIT 0x0000800000000000ull
+
 static int virtio_block_hw_enable(virtio_block_dev_t *v, pci_dev_t pdev);
 
 static int virtio_block_probe_caps(virtio_block_dev_t *v, pci_dev_t device);
@@ -19,11 +30,6 @@ static int storage_device_virtio_block_read(void *dev_ptr, uint64_t start, uint3
 
 static int storage_device_virtio_block_write(void *dev_ptr, uint64_t start, uint32_t bytes, const unsigned char *buffer);
 
-/* single, page-aligned bounce buffer used when caller buffer isn't page-aligned */
-static uint8_t *virtio_blk_bounce = NULL;
-static size_t virtio_blk_bounce_sz = 0;
-
-
 /* ------------------------------------------------------------
  * Enable PCI device and identity-map BAR4 (MMIO)
  * ------------------------------------------------------------ */
@@ -147,10 +153,21 @@ static int virtio_block_probe_caps(virtio_block_dev_t *v, pci_dev_t device) {
 }
 
 static void virtio_block_notify(virtio_block_dev_t *v, uint16_t queue_id) {
-	v->common->queue_select = queue_id; /* ensure queue_notify_off reflects correct queue */
-	uint16_t notify_off = v->common->queue_notify_off;
-	volatile uint16_t *doorbell = (volatile uint16_t *) (v->notify_base + (uint32_t) notify_off * v->notify_off_mul);
-	*doorbell = queue_id; /* value is queue index or any write (virtio spec allows either); QEMU accepts write */
+	if (!v->doorbell) {
+		v->common->queue_select = queue_id; /* ensure queue_notify_off reflects correct queue */
+		uint16_t notify_off = v->common->queue_notify_off;
+		v->doorbell = (volatile uint16_t *) (v->notify_base + (uint32_t) notify_off * v->notify_off_mul);
+	}
+	*v->doorbell = queue_id; /* value is queue index or any write (virtio spec allows either); QEMU accepts write */
+}
+
+/* avail->ring[q_size] is used_event, used->ring[q_size] is avail_event */
+static inline volatile uint16_t *virtio_block_used_event(virtio_block_dev_t *v) {
+	return &v->avail->ring[v->q_size];
+}
+
+static inline volatile uint16_t *virtio_block_avail_event(virtio_block_dev_t *v) {
+	return (volatile uint16_t *) &v->used->ring[v->q_size];
 }
 
 static int virtio_block_setup_queue0(virtio_block_dev_t *v) {
@@ -163,18 +180,23 @@ static int virtio_block_setup_queue0(virtio_block_dev_t *v) {
 	/* ACK + DRIVER */
 	c->device_status = VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER;
 
-	/* Feature negotiation (we accept nothing fancy; plain block) */
+	/* Feature negotiation: take what we understand of what is offered */
 	c->device_feature_select = 0;
-	uint32_t devfeat0 = c->device_feature;
-	(void) devfeat0; /* ignore for now */
-	c->driver_feature_select = 0;
-	c->driver_feature = 0;
-
+	uint64_t offered = c->device_feature;
 	c->device_feature_select = 1;
-	uint32_t devfeat1 = c->device_feature;
-	(void) devfeat1;
+	offered |= (uint64_t) c->device_feature << 32;
+
+	const uint64_t understood = (1ull << VIRTIO_BLK_F_SIZE_MAX) | (1ull << VIRTIO_BLK_F_SEG_MAX) |
+				    (1ull << VIRTIO_RING_F_INDIRECT_DESC) | (1ull << VIRTIO_RING_F_EVENT_IDX) |
+				    (1ull << VIRTIO_F_VERSION_1);
+	v->features = offered & understood;
+	v->indirect = (v->features & (1ull << VIRTIO_RING_F_INDIRECT_DESC)) != 0;
+	v->event_idx = (v->features & (1ull << VIRTIO_RING_F_EVENT_IDX)) != 0;
+
+	c->driver_feature_select = 0;
+	c->driver_feature = (uint32_t) v->features;
 	c->driver_feature_select = 1;
-	c->driver_feature = 0;
+	c->driver_feature = (uint32_t) (v->features >> 32);
 
 	c->device_status = VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK;
 	if ((c->device_status & VIRTIO_STATUS_FEATURES_OK) == 0) {
@@ -190,15 +212,20 @@ static int virtio_block_setup_queue0(virtio_block_dev_t *v) {
 		dprintf("virtio-block: queue0 size = 0\n");
 		return 0;
 	}
-	/* Clamp to sane minimum; power-of-two typical */
+	/* Split queues are a power of two, and the driver may ask for fewer entries */
+	if (qs > VIRTIO_BLOCK_QUEUE_MAX) {
+		qs = VIRTIO_BLOCK_QUEUE_MAX;
+		c->queue_size = qs;
+	}
 	v->q_size = qs;
 	v->q_mask = (uint16_t) (qs - 1);
 
-	/* Allocate rings: desc[qs], avail(4 + 2*qs), used(4 + 8*qs).
+	/* Allocate rings: desc[qs], avail(6 + 2*qs), used(6 + 8*qs), the
+	   trailing uint16_t of each being used_event/avail_event.
 	   Round each to 4K for simplicity. */
 	size_t desc_bytes = sizeof(virtq_desc_t) * qs;
-	size_t avail_bytes = sizeof(virtq_avail_t) + sizeof(uint16_t) * qs; /* flags+idx+ring */
-	size_t used_bytes = sizeof(virtq_used_t) + sizeof(virtq_used_elem_t) * qs;
+	size_t avail_bytes = sizeof(virtq_avail_t) + sizeof(uint16_t) * qs + sizeof(uint16_t); /* flags+idx+ring+used_event */
+	size_t used_bytes = sizeof(virtq_used_t) + sizeof(virtq_used_elem_t) * qs + sizeof(uint16_t);
 
 	size_t desc_sz = (desc_bytes + 4095) & ~4095u;
 	size_t avail_sz = (avail_bytes + 4095) & ~4095u;
@@ -224,127 +251,273 @@ static int virtio_block_setup_queue0(virtio_block_dev_t *v) {
 	c->queue_driver = v->avail_phys;
 	c->queue_device = v->used_phys;
 
-	/* Enable queue */
-	c->queue_enable = 1;
-
-	/* Scratch request header/footer (aligned 4K is overkill but easy) */
-	v->hdr = (virtio_block_req_hdr_t *) kmalloc_aligned(4096, 4096);
-	v->st = (virtio_block_req_status_t *) kmalloc_aligned(4096, 4096);
-	if (!v->hdr || !v->st) {
+	/* Request header/status for every possible head descriptor, plus indirect tables */
+	size_t reqs_sz = (sizeof(virtio_block_req_t) * qs + 4095) & ~4095u;
+	v->reqs = (virtio_block_req_t *) kmalloc_aligned(reqs_sz, 4096);
+	if (!v->reqs) {
 		dprintf("virtio-block: req buffers alloc failed\n");
 		return 0;
 	}
-
-	/* Allocate a single 4K-aligned bounce buffer sized for our max transfer (256 * 512 = 128KiB) */
-	if (!virtio_blk_bounce) {
-		virtio_blk_bounce_sz = 256u * 512u;
-		virtio_blk_bounce = (uint8_t *) kmalloc_aligned(virtio_blk_bounce_sz, 4096);
-		if (!virtio_blk_bounce) {
-			dprintf("virtio-block: bounce alloc failed (%u bytes)\n", (unsigned) virtio_blk_bounce_sz);
-			return 0;
+	memset(v->reqs, 0, reqs_sz);
+	if (v->indirect) {
+		size_t tables_sz = sizeof(virtq_desc_t) * VIRTIO_BLOCK_INDIRECT_ENTRIES * qs;
+		v->indirect_tables = (virtq_desc_t *) kmalloc_aligned(tables_sz, 4096);
+		if (!v->indirect_tables) {
+			dprintf("virtio-block: indirect tables alloc failed, using direct chains\n");
+			v->indirect = false;
 		}
-		dprintf("virtio-block: bounce buffer ready (%u bytes @ 4K aligned)\n", (unsigned) virtio_blk_bounce_sz);
 	}
 
-	/* Free list implicit: we use 3 descriptors (hdr, data, status) as a fixed chain starting at 0 */
+	/* Page-aligned bounce, only for buffers the device cannot address */
+	v->bounce = (uint8_t *) kmalloc_aligned(VIRTIO_BLOCK_BOUNCE_SECTORS * 512u, 4096);
+	if (!v->bounce) {
+		dprintf("virtio-block: bounce alloc failed (%u bytes)\n", VIRTIO_BLOCK_BOUNCE_SECTORS * 512u);
+		return 0;
+	}
+
+	/* Every descriptor starts on the free list, chained through next */
+	for (uint16_t i = 0; i < qs; i++) {
+		v->desc[i].next = (uint16_t) (i + 1);
+	}
 	v->free_head = 0;
+	v->num_free = qs;
+	v->avail_idx = 0;
+	v->kicked_idx = 0;
 	v->used_last = 0;
+	v->inflight = 0;
+
+	/* We poll the used ring, so ask not to be interrupted */
+	if (v->event_idx) {
+		*virtio_block_used_event(v) = (uint16_t) (v->used_last + 0x8000);
+	} else {
+		v->avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+	}
+
+	/* Enable queue */
+	c->queue_enable = 1;
 
 	/* Read block config */
 	v->capacity_512 = v->device_cfg->capacity;
 	v->logical_block = (v->device_cfg->block_size == 0) ? 512u : v->device_cfg->block_size;
 
+	/* Segment limits: size_max bounds one data descriptor, seg_max the data descriptors per request */
+	v->seg_bytes = VIRTIO_BLOCK_MAX_SECTORS_PER_REQ * 512u;
+	if ((v->features & (1ull << VIRTIO_BLK_F_SIZE_MAX)) && v->device_cfg->size_max >= 512) {
+		v->seg_bytes = MIN(v->seg_bytes, v->device_cfg->size_max & ~511u);
+	}
+	v->max_segs = VIRTIO_BLOCK_MAX_SEGS;
+	if ((v->features & (1ull << VIRTIO_BLK_F_SEG_MAX)) && v->device_cfg->seg_max != 0) {
+		v->max_segs = (uint16_t) MIN(v->max_segs, v->device_cfg->seg_max);
+	}
+	if (!v->indirect) {
+		/* A direct chain also needs a header and status descriptor */
+		v->max_segs = (uint16_t) MIN(v->max_segs, qs - 2);
+	}
+
 	/* Driver ready */
 	c->device_status = VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK | VIRTIO_STATUS_DRIVER_OK;
 
-	dprintf("virtio-block: Q0 size=%u  capacity=%lu*512  block_size=%u\n", v->q_size, v->capacity_512, v->logical_block);
+	dprintf("virtio-block: Q0 size=%u  capacity=%lu*512  block_size=%u indirect=%u event_idx=%u segs=%u seg_bytes=%u\n",
+		v->q_size, v->capacity_512, v->logical_block, v->indirect, v->event_idx, v->max_segs, v->seg_bytes);
 	return 1;
 }
 
-static int virtio_block_rw(virtio_block_dev_t *v, bool write, uint64_t lba512, uint32_t count512, void *buf) {
-	/* We operate in 512-byte units as exposed by virtio-block sector */
-	if (count512 == 0) {
-		return 1;
+/**
+ * @brief Publish everything queued since the last doorbell, ringing it only
+ * if the device has not said (via avail_event or VIRTQ_USED_F_NO_NOTIFY)
+ * that it does not need one.
+ */
+static void virtio_block_kick(virtio_block_dev_t *v) {
+	if (v->avail_idx == v->kicked_idx) {
+		return;
 	}
+	/* avail->idx must be visible before the device's suppression state is read */
+	__asm__ volatile("mfence":: : "memory");
+	bool notify;
+	if (v->event_idx) {
+		uint16_t event = *virtio_block_avail_event(v);
+		notify = (uint16_t) (v->avail_idx - event - 1) < (uint16_t) (v->avail_idx - v->kicked_idx);
+	} else {
+		notify = (*(volatile uint16_t *) &v->used->flags & VIRTQ_USED_F_NO_NOTIFY) == 0;
+	}
+	v->kicked_idx = v->avail_idx;
+	if (notify) {
+		virtio_block_notify(v, 0);
+	}
+}
 
-	/* Ensure DMA-safe buffer: use the static 4K-aligned bounce if caller buffer isn't page-aligned */
-	size_t total_bytes = count512 * 512u;
-	void *dma_buf = buf;
-	bool used_bounce = false;
+/**
+ * @brief Return a reaped request's descriptors to the free list. Chains are
+ * built from the free list in order without relinking, so the whole chain
+ * goes back by pointing its tail at the old head.
+ */
+static void virtio_block_free_chain(virtio_block_dev_t *v, uint16_t head) {
+	uint16_t tail = head;
+	uint16_t count = 1;
+	while (v->desc[tail].flags & VIRTQ_DESC_F_NEXT) {
+		tail = v->desc[tail].next;
+		count++;
+	}
+	v->desc[tail].next = v->free_head;
+	v->free_head = head;
+	v->num_free = (uint16_t) (v->num_free + count);
+}
 
-	if (((uintptr_t) buf & 0xFFFu) != 0) {
-		if (!virtio_blk_bounce || virtio_blk_bounce_sz < total_bytes) {
-			dprintf("virtio-block: bounce not available or too small (need=%u have=%u)\n",
-				(unsigned) total_bytes, (unsigned) virtio_blk_bounce_sz);
-			return 0;
+/**
+ * @brief Reap every completed request currently in the used ring.
+ * If wait is set, spin until at least one completes. Failures latch v->io_error.
+ */
+static void virtio_block_reap(virtio_block_dev_t *v, bool wait) {
+	virtio_block_kick(v);
+	uint16_t reaped = 0;
+	for (;;) {
+		uint16_t uidx = *(volatile uint16_t *) &v->used->idx;
+		if (uidx == v->used_last) {
+			if (wait && reaped == 0 && v->inflight) {
+				__builtin_ia32_pause();
+				continue;
+			}
+			break;
 		}
-		if (write) {
-			memcpy(virtio_blk_bounce, buf, total_bytes);
+		/* used->idx is read before the element it covers */
+		__asm__ volatile("":: : "memory");
+		uint16_t head = (uint16_t) v->used->ring[v->used_last & v->q_mask].id;
+		v->used_last = (uint16_t) (v->used_last + 1);
+		if (head >= v->q_size || !v->reqs[head].busy) {
+			dprintf("virtio-block: device completed unknown descriptor %u\n", head);
+			v->io_error = true;
+			continue;
 		}
-		dma_buf = virtio_blk_bounce;
-		used_bounce = true;
-		dprintf("virtio-block: using bounce for %s (bytes=%u)\n", write ? "write" : "read", (unsigned) total_bytes);
-	}
-
-	/* Build 3-descriptor chain: [hdr] -> [data] -> [status] */
-	uint16_t i_hdr = 0;
-	uint16_t i_dat = 1;
-	uint16_t i_st = 2;
-
-	/* Header */
-	memset(v->hdr, 0, sizeof(*v->hdr));
-	v->hdr->type = write ? VIRTIO_BLOCK_T_OUT : VIRTIO_BLOCK_T_IN;
-	v->hdr->sector = lba512;
-
-	v->desc[i_hdr].addr = (uint64_t) (uintptr_t) v->hdr;
-	v->desc[i_hdr].len = sizeof(*v->hdr);
-	v->desc[i_hdr].flags = VIRTQ_DESC_F_NEXT;
-	v->desc[i_hdr].next = i_dat;
-
-	/* Data */
-	v->desc[i_dat].addr = (uint64_t) (uintptr_t) dma_buf;
-	v->desc[i_dat].len = total_bytes;
-	v->desc[i_dat].flags = (write ? 0 : VIRTQ_DESC_F_WRITE) | VIRTQ_DESC_F_NEXT;
-	v->desc[i_dat].next = i_st;
-
-	/* Status (device writes 0 for success) */
-	v->desc[i_st].addr = (uint64_t) (uintptr_t) v->st;
-	v->desc[i_st].len = sizeof(*v->st);
-	v->desc[i_st].flags = VIRTQ_DESC_F_WRITE;
-	v->desc[i_st].next = 0;
-
-	/* Avail */
-	uint16_t aidx = v->avail->idx;
-	v->avail->ring[aidx & v->q_mask] = i_hdr;
-	__asm__ volatile("sfence":: : "memory");
-	v->avail->idx = (uint16_t) (aidx + 1);
+		virtio_block_req_t *req = &v->reqs[head];
+		if (req->st.status != 0) {
+			dprintf("virtio-block: I/O status=%u (lba=%lu)\n", req->st.status, req->hdr.sector);
+			v->io_error = true;
+		}
+		req->busy = 0;
+		virtio_block_free_chain(v, head);
+		v->inflight--;
+		reaped++;
+	}
+	if (reaped && v->event_idx) {
+		/* Keep the interrupt threshold out of reach while we poll */
+		*virtio_block_used_event(v) = (uint16_t) (v->used_last + 0x8000);
+	}
+}
 
-	/* Notify */
-	virtio_block_notify(v, 0);
+static inline void virtio_block_fill_desc(virtq_desc_t *d, uint64_t addr, uint32_t len, uint16_t flags) {
+	d->addr = addr;
+	d->len = len;
+	d->flags = flags;
+}
 
-	/* Poll Used for completion */
-	for (;;) {
-		uint16_t uidx = v->used->idx;
-		if (uidx != v->used_last) {
-			uint16_t slot = v->used_last & v->q_mask;
-			virtq_used_elem_t e = v->used->ring[slot];
-			v->used_last = (uint16_t) (v->used_last + 1);
-			(void) e;
-			break;
+/**
+ * @brief Queue one request for count512 sectors to or from an identity mapped buffer.
+ * The descriptors are [header] [data segment]... [status], either as a chain
+ * taken from the free list or written to the head descriptor's indirect table.
+ * The doorbell is not rung here; see virtio_block_kick().
+ */
+static void virtio_block_submit(virtio_block_dev_t *v, bool write, uint64_t lba512, uint32_t count512, uint8_t *buf) {
+	const uint32_t bytes = count512 * 512u;
+	const uint16_t segs = (uint16_t) ((bytes + v->seg_bytes - 1) / v->seg_bytes);
+	const uint16_t ndesc = (uint16_t) (segs + 2);
+	const uint16_t needed = v->indirect ? 1 : ndesc;
+	while (v->num_free < needed) {
+		virtio_block_reap(v, true);
+	}
+
+	const uint16_t head = v->free_head;
+	virtio_block_req_t *req = &v->reqs[head];
+	req->hdr.type = write ? VIRTIO_BLOCK_T_OUT : VIRTIO_BLOCK_T_IN;
+	req->hdr.reserved = 0;
+	req->hdr.sector = lba512;
+	req->st.status = 0xFF; /* device writes 0 for success */
+	req->busy = 1;
+
+	const uint16_t data_flags = write ? 0 : VIRTQ_DESC_F_WRITE;
+	if (v->indirect) {
+		virtq_desc_t *table = v->indirect_tables + (size_t) head * VIRTIO_BLOCK_INDIRECT_ENTRIES;
+		for (uint16_t i = 0; i < ndesc; i++) {
+			table[i].next = (uint16_t) (i + 1);
+		}
+		virtio_block_fill_desc(&table[0], (uint64_t) (uintptr_t) &req->hdr, sizeof(req->hdr), VIRTQ_DESC_F_NEXT);
+		for (uint16_t i = 0; i < segs; i++) {
+			uint32_t off = (uint32_t) i * v->seg_bytes;
+			virtio_block_fill_desc(&table[1 + i], (uint64_t) (uintptr_t) (buf + off), MIN(v->seg_bytes, bytes - off), data_flags | VIRTQ_DESC_F_NEXT);
+		}
+		virtio_block_fill_desc(&table[ndesc - 1], (uint64_t) (uintptr_t) &req->st, sizeof(req->st), VIRTQ_DESC_F_WRITE);
+		virtio_block_fill_desc(&v->desc[head], (uint64_t) (uintptr_t) table, sizeof(virtq_desc_t) * ndesc, VIRTQ_DESC_F_INDIRECT);
+		v->free_head = v->desc[head].next;
+	} else {
+		/* Free descriptors are already linked through next, so only addr/len/flags change */
+		uint16_t idx = head;
+		virtio_block_fill_desc(&v->desc[idx], (uint64_t) (uintptr_t) &req->hdr, sizeof(req->hdr), VIRTQ_DESC_F_NEXT);
+		for (uint16_t i = 0; i < segs; i++) {
+			uint32_t off = (uint32_t) i * v->seg_bytes;
+			idx = v->desc[idx].next;
+			virtio_block_fill_desc(&v->desc[idx], (uint64_t) (uintptr_t) (buf + off), MIN(v->seg_bytes, bytes - off), data_flags | VIRTQ_DESC_F_NEXT);
 		}
-		__builtin_ia32_pause();
+		idx = v->desc[idx].next;
+		virtio_block_fill_desc(&v->desc[idx], (uint64_t) (uintptr_t) &req->st, sizeof(req->st), VIRTQ_DESC_F_WRITE);
+		v->free_head = v->desc[idx].next;
 	}
+	v->num_free = (uint16_t) (v->num_free - needed);
 
-	if (v->st->status != 0) {
-		dprintf("virtio-block: I/O status=%u\n", v->st->status);
-		return 0;
+	v->avail->ring[v->avail_idx & v->q_mask] = head;
+	v->avail_idx = (uint16_t) (v->avail_idx + 1);
+	__asm__ volatile("sfence":: : "memory");
+	v->avail->idx = v->avail_idx;
+	v->inflight++;
+}
+
+/**
+ * @brief Transfer sectors between the device and an identity mapped buffer
+ * with no intermediate copy. The range is split into requests of up to
+ * max_segs segments, which are all kept in flight together.
+ */
+static int virtio_block_io(virtio_block_dev_t *v, bool write, uint64_t lba512, uint32_t count512, uint8_t *buf) {
+	const uint32_t per_req = MIN(VIRTIO_BLOCK_MAX_SECTORS_PER_REQ, (uint32_t) v->max_segs * (v->seg_bytes / 512u));
+	v->io_error = false;
+	while (count512 && !v->io_error) {
+		uint32_t n = MIN(count512, per_req);
+		virtio_block_submit(v, write, lba512, n, buf);
+		lba512 += n;
+		buf += (size_t) n * 512u;
+		count512 -= n;
+	}
+	while (v->inflight) {
+		virtio_block_reap(v, true);
+	}
+	return !v->io_error;
+}
+
+static int virtio_block_rw(virtio_block_dev_t *v, bool write, uint64_t lba512, uint32_t count512, void *buf) {
+	/* We operate in 512-byte units as exposed by virtio-block sector */
+	if (count512 == 0) {
+		return 1;
 	}
 
-	/* Copy back from bounce on reads */
-	if (used_bounce && !write) {
-		memcpy(buf, virtio_blk_bounce, total_bytes);
+	/* Heap buffers are identity mapped, so the device can use them whatever their alignment */
+	if ((uintptr_t) buf < VIRTIO_BLOCK_DMA_LIMIT) {
+		return virtio_block_io(v, write, lba512, count512, (uint8_t *) buf);
 	}
 
+	uint8_t *p = (uint8_t *) buf;
+	while (count512) {
+		uint32_t n = MIN(count512, VIRTIO_BLOCK_BOUNCE_SECTORS);
+		size_t bytes = (size_t) n * 512u;
+		if (write) {
+			memcpy(v->bounce, p, bytes);
+		}
+		if (!virtio_block_io(v, write, lba512, n, v->bounce)) {
+			return 0;
+		}
+		if (!write) {
+			memcpy(p, v->bounce, bytes);
+		}
+		lba512 += n;
+		p += bytes;
+		count512 -= n;
+	}
 	return 1;
 }
 
@@ -370,10 +543,6 @@ static int storage_device_virtio_block_read(void *dev_ptr, uint64_t start, uint3
 	}
 
 	uint32_t sectors = (bytes + 511) / 512;
-	if (sectors == 0) {
-		dprintf("virtio-block: read zero sectors (bytes=%u) - nothing to do\n", bytes);
-		return 1;
-	}
 	if (start > v->capacity_512 || sectors > v->capacity_512 - start) {
 		fs_set_error(FS_ERR_INVALID_ARG);
 		dprintf("virtio-block: read out of range (lba=%lu count=%u cap=%lu)\n",
@@ -381,42 +550,10 @@ static int storage_device_virtio_block_read(void *dev_ptr, uint64_t start, uint3
 		return 0;
 	}
 
-	unsigned char *p = buffer;
-	uint64_t begin_lba = start;
-	uint32_t total = sectors;
-
-	while (sectors) {
-		uint32_t this512 = (sectors > 256) ? 256 : sectors;
-
-		uint32_t pre_csum = 0;
-		size_t probe = (this512 * 512 < 16) ? (this512 * 512) : 16;
-		for (size_t i = 0; i < probe; i++) {
-			pre_csum = (pre_csum << 5) - pre_csum + p[i];
-		}
-
-		if (!virtio_block_rw(v, false, start, this512, p)) {
-			fs_set_error(FS_ERR_IO);
-			dprintf("virtio-block: read I/O error (lba=%lu count=%u chunk=%u/%u start=%lu)\n",
-				start, this512, this512, total, begin_lba);
-			return 0;
-		}
-
-		uint32_t post_csum = 0;
-		for (size_t i = 0; i < probe; i++) {
-			post_csum = (post_csum << 5) - post_csum + p[i];
-		}
-
-		if (post_csum == pre_csum) {
-			dprintf("virtio-block: read suspicious (buffer unchanged) at lba=%lu count=%u probe16=0x%08x\n",
-				start, this512, post_csum);
-		} else {
-			dprintf("virtio-block: read ok (lba=%lu count=%u) data[0..1]=%02x %02x probe16=0x%08x\n",
-				start, this512, p[0], p[1], post_csum);
-		}
-
-		start += this512;
-		p += this512 * 512;
-		sectors -= this512;
+	if (!virtio_block_rw(v, false, start, sectors, buffer)) {
+		fs_set_error(FS_ERR_IO);
+		dprintf("virtio-block: read I/O error (lba=%lu count=%u)\n", start, sectors);
+		return 0;
 	}
 
 	return 1;
@@ -453,17 +590,10 @@ static int storage_device_virtio_block_write(void *dev_ptr, uint64_t start, uint
 		return 0;
 	}
 
-	const unsigned char *p = buffer;
-	while (sectors) {
-		uint32_t this512 = (sectors > 256) ? 256 : sectors;
-		if (!virtio_block_rw(v, true, start, this512, (void *) p)) {
-			/* virtio_block_rw already dprintf’ed status/timeout; map to FS error */
-			fs_set_error(FS_ERR_IO);
-			return 0;
-		}
-		start += this512;
-		p += (size_t) this512 * 512u;
-		sectors -= this512;
+	if (!virtio_block_rw(v, true, start, sectors, (void *) buffer)) {
+		/* virtio_block_reap already dprintf’ed the status; map to FS error */
+		fs_set_error(FS_ERR_IO);
+		return 0;
 	}
 	return 1;
 }
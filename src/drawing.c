@@ -1,4 +1,5 @@
 #include <kernel.h>
+#include <emmintrin.h>
 
 void swap(int64_t* first, int64_t* second)
 {
@@ -52,6 +53,44 @@ void draw_line(int64_t from_x, int64_t from_y, int64_t to_x, int64_t to_y, uint3
 	}
 }
 
+/**
+ * @brief Fill count pixels starting at p with colour. Pixels up to the first
+ * 16 byte boundary are written singly, then 64 bytes at a time with aligned
+ * SSE2 stores, then the remainder singly.
+ *
+ * @param p first pixel of the span in the back buffer
+ * @param count number of pixels
+ * @param colour RGB colour to fill with
+ */
+static void fill_span(uint32_t *p, int64_t count, uint32_t colour)
+{
+	while (((uintptr_t)p & 15) && count > 0) {
+		*p++ = colour;
+		count--;
+	}
+	const __m128i v = _mm_set1_epi32((int)colour);
+	for (; count >= 16; count -= 16, p += 16) {
+		_mm_store_si128((__m128i *)(p + 0), v);
+		_mm_store_si128((__m128i *)(p + 4), v);
+		_mm_store_si128((__m128i *)(p + 8), v);
+		_mm_store_si128((__m128i *)(p + 12), v);
+	}
+	for (; count >= 4; count -= 4, p += 4) {
+		_mm_store_si128((__m128i *)p, v);
+	}
+	while (count-- > 0) {
+		*p++ = colour;
+	}
+}
+
+/**
+ * @brief Fill from_x to to_x inclusive on row y, all of which must be on screen
+ */
+static void fill_row(int64_t from_x, int64_t to_x, int64_t y, uint32_t colour)
+{
+	fill_span((uint32_t *)(framebuffer_address() + pixel_address(from_x, y)), to_x - from_x + 1, colour);
+}
+
 void draw_horizontal_line(int64_t from_x, int64_t to_x, int64_t y, uint32_t colour)
 {
 	if (from_x > to_x) {
@@ -69,14 +108,10 @@ void draw_horizontal_line(int64_t from_x, int64_t to_x, int64_t y, uint32_t colo
 		return;
 	}
 
-	volatile uint32_t *addr = (volatile uint32_t *)(framebuffer_address() + pixel_address(from_x, y));
-
-	for (; from_x <= to_x; from_x++) {
-		*addr++ = colour;
-	}
-
+	fill_row(from_x, to_x, y, colour);
 	set_video_dirty_area(y, y);
 }
+
 void draw_horizontal_rectangle(int64_t from_x, int64_t from_y, int64_t to_x, int64_t to_y, uint32_t colour)
 {
 	if (from_x > to_x) {
@@ -89,12 +124,13 @@ void draw_horizontal_rectangle(int64_t from_x, int64_t from_y, int64_t to_x, int
 	to_y = MIN(screen_get_height() - 1, to_y);
 	from_x = MAX(0, from_x);
 	to_x = MIN(screen_get_width() - 1, to_x);
-	if (from_x > to_x || from_y > to_y) {
+	if (from_x > to_x || from_y >= to_y) {
 		return;
 	}
-	for (; from_y != to_y; ++from_y) {
-		draw_horizontal_line(from_x, to_x, from_y, colour);
+	for (int64_t y = from_y; y != to_y; ++y) {
+		fill_row(from_x, to_x, y, colour);
 	}
+	set_video_dirty_area(from_y, to_y - 1);
 }
 
 /**
@@ -136,47 +172,70 @@ static int64_t max3(int64_t x, int64_t y, int64_t z)
 }
 
 /**
- * @brief Line intersection algorithm to determine if a point is within a polygon
- * 
- * @param ax polygon first coordinate x
- * @param ay polygon first coordinate y
- * @param bx polygon second coordinate x
- * @param by polygon second coordinate y
- * @param cx polygon third coordinate x
- * @param cy polygon third coordinate y
- * @param x point x
- * @param y point y
- * @return true if point is within the three sided polygon
+ * @brief Floor of a / b for b > 0
  */
-static bool triangle_contains(int64_t ax, int64_t ay, int64_t bx, int64_t by, int64_t cx, int64_t cy, int64_t x, int64_t y)
+static int64_t floor_div(int64_t a, int64_t b)
 {
-	int64_t det = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
-	return  det * ((bx - ax) * (y - ay) - (by - ay) * (x - ax)) >= 0 &&
-		det * ((cx - bx) * (y - by) - (cy - by) * (x - bx)) >= 0 &&
-		det * ((ax - cx) * (y - cy) - (ay - cy) * (x - cx)) >= 0;
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/**
+ * @brief Narrow [*lo, *hi] to the x values on row y which are on the inner
+ * side of (or on) the edge from (px, py) to (qx, qy), the inner side being
+ * to the left when walking the edge with y increasing downwards.
+ *
+ * The edge function (qx - px) * (y - py) - (qy - py) * (x - px) is linear
+ * in x, so each edge bounds the span from one side only, or not at all
+ * for a horizontal edge.
+ */
+static void clip_span_to_edge(int64_t px, int64_t py, int64_t qx, int64_t qy, int64_t y, int64_t *lo, int64_t *hi)
+{
+	int64_t dy = qy - py;
+	int64_t c = (qx - px) * (y - py) + dy * px;
+	if (dy == 0) {
+		if (c < 0) {
+			*hi = *lo - 1;
+		}
+	} else if (dy > 0) {
+		*hi = MIN(*hi, floor_div(c, dy));
+	} else {
+		*lo = MAX(*lo, -floor_div(c, -dy));
+	}
 }
 
 void draw_triangle(int64_t x1, int64_t y1, int64_t x2, int64_t y2, int64_t x3, int64_t y3, uint32_t colour)
 {
-	int64_t bx1 = min3(x1, x2, x3);
-	int64_t by1 = min3(y1, y2, y3);
-	int64_t bx2 = max3(x1, x2, x3);
-	int64_t by2 = max3(y1, y2, y3);
+	int64_t det = (x2 - x1) * (y3 - y1) - (y2 - y1) * (x3 - x1);
+	if (det == 0) {
+		/* All three corners are on one line */
+		draw_line(x1, y1, x2, y2, colour);
+		draw_line(x2, y2, x3, y3, colour);
+		draw_line(x3, y3, x1, y1, colour);
+		return;
+	}
+	if (det < 0) {
+		/* Wind the corners one way round so every edge keeps the inside on the same side */
+		swap(&x2, &x3);
+		swap(&y2, &y3);
+	}
 
-	bx1 = MAX(0, bx1);
-	by1 = MAX(0, by1);
-	bx2 = MIN(screen_get_width() - 1, bx2);
-	by2 = MIN(screen_get_height() - 1, by2);
+	int64_t bx1 = MAX(0, min3(x1, x2, x3));
+	int64_t by1 = MAX(0, min3(y1, y2, y3));
+	int64_t bx2 = MIN(screen_get_width() - 1, max3(x1, x2, x3));
+	int64_t by2 = MIN(screen_get_height() - 1, max3(y1, y2, y3));
 
 	if (bx1 > bx2 || by1 > by2) {
 		return;
 	}
 
+	/* Each row is one span: the pixels whose centres are inside or on all three edges */
 	for (int64_t y = by1; y <= by2; ++y) {
-		for (int64_t x = bx1; x <= bx2; ++x) {
-			if (triangle_contains(x1, y1, x2, y2, x3, y3, x, y)) {
-				*((volatile uint32_t*)(framebuffer_address() + pixel_address(x, y))) = colour;
-			}
+		int64_t lo = bx1, hi = bx2;
+		clip_span_to_edge(x1, y1, x2, y2, y, &lo, &hi);
+		clip_span_to_edge(x2, y2, x3, y3, y, &lo, &hi);
+		clip_span_to_edge(x3, y3, x1, y1, y, &lo, &hi);
+		if (lo <= hi) {
+			fill_row(lo, hi, y, colour);
 		}
 	}
 
@@ -220,8 +279,46 @@ void draw_chord(int64_t xc, int64_t yc, int64_t x, int64_t y, bool fill, uint32_
 	putpixel_clamped(xc - y, yc - x, colour);
 }
 
+/**
+ * @brief Draw a filled circle as the same spans draw_chord() would, but each row once.
+ * Rows yc +/- x are only visited once, rows yc +/- y are revisited with a wider
+ * span for as long as y holds, so only the widest is drawn, as y is about to change.
+ */
+static void fill_circle(int64_t x_centre, int64_t y_centre, int64_t radius, uint32_t colour)
+{
+	int64_t x = 0, y = radius;
+	int64_t delta = 3 - 2 * radius;
+	for (;;) {
+		draw_horizontal_line(x_centre - y, x_centre + y, y_centre + x, colour);
+		draw_horizontal_line(x_centre - y, x_centre + y, y_centre - x, colour);
+		bool more = y >= x;
+		int64_t next_y = y;
+		if (more) {
+			if (delta > 0) {
+				next_y--;
+				delta += 4 * (x + 1 - next_y) + 10;
+			} else {
+				delta += 4 * (x + 1) + 6;
+			}
+		}
+		if (!more || next_y != y) {
+			draw_horizontal_line(x_centre - x, x_centre + x, y_centre + y, colour);
+			draw_horizontal_line(x_centre - x, x_centre + x, y_centre - y, colour);
+		}
+		if (!more) {
+			break;
+		}
+		x++;
+		y = next_y;
+	}
+}
+
 void draw_circle(int64_t x_centre, int64_t y_centre, int64_t radius, bool fill, uint32_t colour)
 {
+	if (fill) {
+		fill_circle(x_centre, y_centre, radius, colour);
+		return;
+	}
 	int64_t x = 0, y = radius;
 	int64_t delta = 3 - 2 * radius;
 	draw_chord(x_centre, y_centre, x, y, fill, colour);
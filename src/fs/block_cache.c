@@ -7,12 +7,21 @@
  * (for eviction ordering).
  *
  * ## Design
- * - Each cached LBA is stored in a hashmap for O(1) lookup.
+ * - Sectors are held in pages of BLOCK_CACHE_PAGE_BYTES, each with a bitmap
+ *   of which of its sectors are present. Each cached page is stored in a
+ *   hashmap for O(1) lookup.
+ * - Reads are served sector by sector from whatever is present. Missing
+ *   sectors are gathered into runs, bridging short gaps of hits, and each
+ *   run is fetched from the device with a single call.
  * - The eviction policy is Least Recently Used (LRU).
- * - Instead of maintaining a "perfect" LRU list, the queue only stores LBA
- *   values. When an LBA is re-inserted, a new entry is appended to the tail
+ * - In write-back mode, writes only mark sectors dirty. Dirty pages are never
+ *   evicted; block_cache_flush() sorts them and writes each run of adjacent
+ *   dirty sectors with a single device write. The flusher idle task does this
+ *   for every write-back cache each BLOCK_CACHE_FLUSH_MS.
+ * - Instead of maintaining a "perfect" LRU list, the queue only stores page
+ *   numbers. When a page is re-used, a new entry is appended to the tail
  *   of the list; the old entry is left in place. On eviction, the cache
- *   checks if the LBA still exists in the hashmap before removing it.
+ *   checks if the page still exists in the hashmap before removing it.
  *
  * ## Complexity
  * - Cache store (insert): O(1)
@@ -39,37 +48,66 @@
  */
 #include <kernel.h>
 #include <buddy_allocator.h>
+#include <block_cache.h>
 
 #ifndef BLOCK_CACHE_SECTOR_CAP
 /**
  * @brief Global per-device cache capacity in sectors.
  *
  * This limit is applied to every cache instance. Increase with care; it
- * impacts memory consumption linearly (one sector buffer per entry).
+ * impacts memory consumption linearly (one page buffer per
+ * BLOCK_CACHE_PAGE_BYTES of sectors).
  */
 #define BLOCK_CACHE_SECTOR_CAP 8192
 #endif
 
+/**
+ * @brief Size of one cache page. Devices with larger sectors get one
+ * sector per page.
+ */
+#define BLOCK_CACHE_PAGE_BYTES 4096
+
+/**
+ * @brief Longest run of cached sectors between two misses which is read
+ * again from the device, so that both misses are fetched in one call.
+ */
+#define BLOCK_CACHE_MERGE_GAP 8
+
+/**
+ * @brief Most sectors written back by a single device write.
+ */
+#define BLOCK_CACHE_FLUSH_SECTORS 256
+
+/**
+ * @brief Dirty sectors a write-back cache may hold before a writer has to
+ * flush them itself.
+ */
+#define BLOCK_CACHE_DIRTY_LIMIT (BLOCK_CACHE_SECTOR_CAP / 4)
+
 /* Hash seeds (arbitrary constants) */
 #define CACHE_HASH_SEED0  1469598103934665603ULL
 #define CACHE_HASH_SEED1  1099511628211ULL
 
 /**
- * @brief A single cached sector entry.
+ * @brief A single cached page entry.
  *
- * Represents one device sector held in the cache. Each entry tracks its LBA,
- * sector buffer, and recency information. Entries are stored in the cache's
- * hashmap. The LRU queue stores LBAs only to avoid stale pointers.
+ * Holds up to page_sectors consecutive device sectors. Each entry tracks its
+ * page number, page buffer, which sectors of the page are valid, and recency
+ * information. Entries are stored in the cache's hashmap. The LRU queue
+ * stores page numbers only to avoid stale pointers.
  */
 typedef struct block_cache_entry {
-	uint64_t lba;          /**< Absolute sector number on the device. */
-	uint8_t *buf;          /**< Pointer to sector-sized buffer containing data. */
+	uint64_t page;         /**< First LBA of the page divided by page_sectors. */
+	uint8_t *buf;          /**< Page buffer, page_sectors sectors long. */
+	uint64_t valid;        /**< Bit n set when sector n of the page is cached. */
+	uint64_t dirty;        /**< Bit n set when sector n is newer than the device. */
+	uint32_t generation;   /**< Bumped on every store into the page. */
 	uint64_t last_used;    /**< Monotonic tick value; updated on every access. */
 } block_cache_entry_t;
 
-/* LRU node carries only the LBA (no pointer to cache entry). */
+/* LRU node carries only the page number (no pointer to cache entry). */
 typedef struct lru_node {
-	uint64_t lba;
+	uint64_t page;
 	struct lru_node *prev;
 	struct lru_node *next;
 } lru_node_t;
@@ -78,29 +116,35 @@ typedef struct lru_node {
  * @brief Per-device block cache.
  *
  * A cache instance attached to a storage device. Holds a bounded number of
- * sector entries in a hashmap for O(1) lookup and in an LRU queue for O(1)
+ * page entries in a hashmap for O(1) lookup and in an LRU queue for O(1)
  * eviction. Tracks recency using a monotonically increasing tick counter.
- * All access is synchronised by a spinlock.
+ * All access is synchronised by a spinlock, which is never held across
+ * device I/O.
  */
 typedef struct block_cache {
 	storage_device_t *dev;         /**< Backing storage device. */
 	uint32_t sector_size;          /**< Sector size in bytes. */
-	uint32_t cap;                  /**< Maximum cache size in sectors. */
-	struct hashmap *map;           /**< Maps LBA -> entry pointer. */
+	uint32_t page_sectors;         /**< Sectors per cache page. */
+	uint32_t cap;                  /**< Maximum cache size in pages. */
+	struct hashmap *map;           /**< Maps page -> entry pointer. */
 
-	/* LRU queue (nodes store only LBA) */
+	/* LRU queue (nodes store only page numbers) */
 	lru_node_t *lru_head;          /**< Oldest entry (eviction candidate). */
 	lru_node_t *lru_tail;          /**< Most recently used entry. */
 	uint32_t    lru_count;         /**< Current number of nodes in the LRU list. */
 
 	uint64_t tick;                 /**< Monotonic counter for recency stamps. */
+	uint64_t writes;               /**< Bumped by every write, to detect races with fills. */
+	bool write_back;               /**< Writes are held dirty until flushed. */
+	uint64_t dirty_sectors;        /**< Sectors held dirty. */
+	block_cache_stats_t stats;     /**< Read statistics. */
 	spinlock_t lock;               /**< Spinlock protecting cache state. */
 } block_cache_t;
 
 static buddy_allocator_t cache_allocator = {};   /**< Buddy allocator for content */
 
 /**
- * @brief Compare two cache entries by LBA (hashmap comparator).
+ * @brief Compare two cache entries by page (hashmap comparator).
  *
  * Expects pointers to @ref block_cache_entry_t. Returns negative, zero, or
  * positive according to standard qsort-style ordering.
@@ -114,19 +158,19 @@ static int cache_compare(const void *a, const void *b, [[maybe_unused]]
 __attribute__((unused)) void *udata) {
 	const block_cache_entry_t *ea = a;
 	const block_cache_entry_t *eb = b;
-	if (ea->lba < eb->lba) {
+	if (ea->page < eb->page) {
 		return -1;
 	}
-	if (ea->lba > eb->lba) {
+	if (ea->page > eb->page) {
 		return 1;
 	}
 	return 0;
 }
 
 /**
- * @brief Hash a cache entry by LBA (hashmap hasher).
+ * @brief Hash a cache entry by page (hashmap hasher).
  *
- * Uses SipHash over the 64-bit LBA stored in the entry.
+ * Uses SipHash over the 64-bit page number stored in the entry.
  *
  * @param item   Entry to hash (points to @ref block_cache_entry_t).
  * @param seed0  Primary seed.
@@ -135,15 +179,15 @@ __attribute__((unused)) void *udata) {
  */
 static uint64_t cache_hash(const void *item, uint64_t seed0, uint64_t seed1) {
 	const block_cache_entry_t *e = item;
-	return hashmap_sip(&e->lba, sizeof(e->lba), seed0, seed1);
+	return hashmap_sip(&e->page, sizeof(e->page), seed0, seed1);
 }
 
-static inline lru_node_t *lru_alloc_node(uint64_t lba) {
+static inline lru_node_t *lru_alloc_node(uint64_t page) {
 	lru_node_t *n = buddy_malloc(&cache_allocator, sizeof(lru_node_t));
 	if (!n) {
 		return NULL;
 	}
-	n->lba = lba;
+	n->page = page;
 	n->prev = n->next = NULL;
 	return n;
 }
@@ -171,16 +215,20 @@ static void lru_unlink(block_cache_t *c, lru_node_t *n) {
 	c->lru_count--;
 }
 
-/* Move existing LBA to tail; if not present, create a node and append.
- * LAZY variant: never search; always append a fresh node (duplicates allowed).
+/* Move existing page to tail; if not present, create a node and append.
+ * LAZY variant: never search; always append a fresh node (duplicates allowed),
+ * unless the page is already the most recent, as on every sequential access.
  * Returns 1 on success, 0 on OOM.
  */
-static int lru_touch(block_cache_t *c, uint64_t lba) {
+static int lru_touch(block_cache_t *c, uint64_t page) {
+	if (c->lru_tail && c->lru_tail->page == page) {
+		return 1;
+	}
 	lru_node_t *n = buddy_malloc(&cache_allocator, sizeof(lru_node_t));
 	if (!n) {
 		return 0;
 	}
-	n->lba = lba;
+	n->page = page;
 	n->prev = c->lru_tail;
 	n->next = NULL;
 	if (c->lru_tail) {
@@ -209,34 +257,47 @@ static lru_node_t *lru_pop_head(block_cache_t *c) {
  * @brief Evict the globally oldest entry from the cache.
  *
  * Pops the LRU head, removes the entry from the hashmap if present, and frees
- * its sector buffer. No-op if the LRU is empty.
+ * its page buffer. Unless @p force is set, pages holding dirty sectors are
+ * moved back to the MRU end instead, as only a flush may retire them.
  *
- * @param c  Cache instance.
+ * @param c      Cache instance.
+ * @param force  Evict dirty pages too, discarding their unwritten data.
+ * @return       true if a page was evicted, false if the LRU is empty or
+ *               every page is dirty.
  */
-static void evict_one(block_cache_t *c)
+static bool evict_one(block_cache_t *c, bool force)
 {
+	uint32_t requeued = 0;
 	for (;;) {
 		lru_node_t *n = lru_pop_head(c);
 		if (!n) {
-			return; /* nothing to evict */
+			return false; /* nothing to evict */
 		}
-		uint64_t lba = n->lba;
+		uint64_t page = n->page;
 		lru_free_node(n);
 
-		block_cache_entry_t key = { .lba = lba };
+		block_cache_entry_t key = { .page = page };
 		block_cache_entry_t *e = hashmap_get(c->map, &key);
 		if (!e) {
 			/* stale node; keep scanning */
 			continue;
 		}
 
+		if (e->dirty && !force) {
+			if (!lru_touch(c, page) || ++requeued > c->lru_count) {
+				return false;
+			}
+			continue;
+		}
+
 		/* live entry: evict it */
+		c->dirty_sectors -= __builtin_popcountll(e->dirty);
 		if (e->buf) {
 			buddy_free(&cache_allocator, e->buf);
 			e->buf = NULL;
 		}
 		hashmap_delete(c->map, &key);
-		return;
+		return true;
 	}
 }
 
@@ -264,7 +325,15 @@ block_cache_t *block_cache_create(storage_device_t *dev) {
 
 	c->dev = dev;
 	c->sector_size = dev->block_size;
-	c->cap = BLOCK_CACHE_SECTOR_CAP;
+	c->page_sectors = dev->block_size < BLOCK_CACHE_PAGE_BYTES ? BLOCK_CACHE_PAGE_BYTES / dev->block_size : 1;
+	if (c->page_sectors > 64) {
+		c->page_sectors = 64; /* one valid bit per sector */
+	}
+	c->cap = BLOCK_CACHE_SECTOR_CAP / c->page_sectors;
+	c->writes = 0;
+	c->write_back = false;
+	c->dirty_sectors = 0;
+	memset(&c->stats, 0, sizeof(c->stats));
 	c->lru_head = NULL;
 	c->lru_tail = NULL;
 	c->lru_count = 0;
@@ -294,7 +363,7 @@ void block_cache_destroy(block_cache_t **pcache) {
 	lock_spinlock_irq(&c->lock, &flags);
 
 	while (c->lru_count > 0) {
-		evict_one(c);
+		evict_one(c, true);
 	}
 
 	unlock_spinlock_irq(&c->lock, flags);
@@ -309,17 +378,102 @@ void block_cache_destroy(block_cache_t **pcache) {
 }
 
 /**
- * @brief Compute a sector count that covers a byte length.
+ * @brief Find the cached copy of one sector, caller holds the lock.
  *
- * Rounds up @p bytes to a whole number of @p sector_size units. Used to
- * iterate multi-sector operations at sector granularity.
+ * @param c    Cache instance.
+ * @param lba  Sector number.
+ * @param e    Receives the page entry holding the sector, NULL if the page is not cached.
+ * @return     Pointer to the sector data, or NULL if the sector is not cached.
+ */
+static uint8_t *cache_sector(block_cache_t *c, uint64_t lba, block_cache_entry_t **e) {
+	block_cache_entry_t find = { .page = lba / c->page_sectors };
+	*e = hashmap_get(c->map, &find);
+	uint32_t index = (uint32_t) (lba % c->page_sectors);
+	if (!*e || !((*e)->valid & (1ULL << index))) {
+		return NULL;
+	}
+	return (*e)->buf + (size_t) index * c->sector_size;
+}
+
+/**
+ * @brief Store one sector, creating its page if needed; caller holds the lock.
  *
- * @param sector_size  Device sector size in bytes.
- * @param bytes        Requested byte length.
- * @return             Number of sectors covering @p bytes (at least 1).
+ * @param c      Cache instance.
+ * @param lba    Sector number.
+ * @param src    Sector data.
+ * @param dirty  true if the device does not have this data yet.
+ * @return       1 on success, 0 on failure (fs_set_error() is set).
+ */
+static int cache_store(block_cache_t *c, uint64_t lba, const unsigned char *src, bool dirty) {
+	uint64_t page = lba / c->page_sectors;
+	uint32_t index = (uint32_t) (lba % c->page_sectors);
+	block_cache_entry_t find = { .page = page };
+	block_cache_entry_t *e = hashmap_get(c->map, &find);
+
+	if (!e) {
+		/* Ensure capacity before inserting a new entry. */
+		while (c->lru_count >= c->cap && evict_one(c, false)) {
+		}
+
+		block_cache_entry_t temp = {0};
+		temp.page = page;
+		temp.buf = buddy_malloc(&cache_allocator, (size_t) c->page_sectors * c->sector_size);
+		if (!temp.buf) {
+			fs_set_error(FS_ERR_OUT_OF_MEMORY);
+			return 0;
+		}
+		hashmap_set(c->map, &temp);
+
+		/* Get the stable, hashmap-owned pointer to confirm insert. */
+		e = hashmap_get(c->map, &find);
+		if (!e) {
+			dprintf("BUG: hashed page not stored in cache\n");
+			buddy_free(&cache_allocator, temp.buf);
+			fs_set_error(FS_ERR_INTERNAL);
+			return 0;
+		}
+	}
+
+	memcpy(e->buf + (size_t) index * c->sector_size, src, c->sector_size);
+	bool created = e->valid == 0;
+	uint64_t bit = 1ULL << index;
+	e->valid |= bit;
+	if (dirty && !(e->dirty & bit)) {
+		e->dirty |= bit;
+		c->dirty_sectors++;
+	} else if (!dirty && (e->dirty & bit)) {
+		e->dirty &= ~bit;
+		c->dirty_sectors--;
+	}
+	e->generation++;
+	e->last_used = ++c->tick;
+
+	/* Place page at MRU. */
+	if (!lru_touch(c, page) && created) {
+		/* Out of memory creating the LRU node; roll back the new page. */
+		c->dirty_sectors -= __builtin_popcountll(e->dirty);
+		buddy_free(&cache_allocator, e->buf);
+		(void)hashmap_delete(c->map, &find);
+		fs_set_error(FS_ERR_OUT_OF_MEMORY);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief Drop one sector from the cache, if present; caller holds the lock.
  */
-static uint32_t sectors_for_len(uint32_t sector_size, uint32_t bytes) {
-	return (bytes + sector_size - 1) / sector_size + (bytes == 0);
+static void cache_forget(block_cache_t *c, uint64_t lba) {
+	block_cache_entry_t *e;
+	if (cache_sector(c, lba, &e)) {
+		uint64_t bit = 1ULL << (lba % c->page_sectors);
+		e->valid &= ~bit;
+		if (e->dirty & bit) {
+			e->dirty &= ~bit;
+			c->dirty_sectors--;
+		}
+		e->generation++;
+	}
 }
 
 int block_cache_read(block_cache_t *c, uint64_t lba, uint32_t bytes, unsigned char *out)
@@ -327,38 +481,105 @@ int block_cache_read(block_cache_t *c, uint64_t lba, uint32_t bytes, unsigned ch
 	if (!c || !c->dev || !out) {
 		return 0;
 	}
+	if (bytes == 0) {
+		return 1;
+	}
 
-	uint64_t flags;
-
-	uint32_t nsec = sectors_for_len(c->sector_size, bytes);
-	if (lba + nsec > c->dev->size) {
+	const uint32_t ss = c->sector_size;
+	const uint32_t nsec = bytes / ss;
+	const uint32_t tail = bytes % ss;
+	if (lba + nsec + (tail ? 1 : 0) > c->dev->size) {
 		fs_set_error(FS_ERR_OUT_OF_BOUNDS);
 		return 0;
 	}
 
-	for (uint32_t i = 0; i < nsec; i++) {
-		uint64_t sector_lba = lba + i;
-		unsigned char *dst = out + i * c->sector_size;
+	uint64_t flags;
+	uint32_t i = 0;
+	while (i < nsec) {
+		block_cache_entry_t *e, *last = NULL;
+		uint8_t *src;
 
 		lock_spinlock_irq(&c->lock, &flags);
+		if (i == 0) {
+			c->stats.requests++;
+		}
 
-		block_cache_entry_t find = { .lba = sector_lba };
-		block_cache_entry_t *e = hashmap_get(c->map, &find);
-
-		if (e) {
-			e->last_used = c->tick + 1;
-			c->tick = e->last_used;
+		/* Serve the leading run of hits straight from memory */
+		while (i < nsec && (src = cache_sector(c, lba + i, &e))) {
+			if (e != last) {
+				e->last_used = ++c->tick;
+				(void)lru_touch(c, e->page);
+				last = e;
+			}
+			memcpy(out + (size_t) i * ss, src, ss);
+			c->stats.hit_sectors++;
+			i++;
+		}
+		if (i == nsec) {
+			unlock_spinlock_irq(&c->lock, flags);
+			break;
+		}
 
-			/* Move this LBA to MRU; if missing from LRU due to prior drift, append it. */
-			(void)lru_touch(c, sector_lba);
+		/* Gather the following misses into one run, reading through short gaps of hits */
+		uint32_t run_start = i, run_end = i, j = i;
+		while (j < nsec) {
+			if (!cache_sector(c, lba + j, &e)) {
+				run_end = ++j;
+				continue;
+			}
+			uint32_t k = j;
+			while (k < nsec && k - j < BLOCK_CACHE_MERGE_GAP && cache_sector(c, lba + k, &e)) {
+				k++;
+			}
+			if (k == nsec || k - j >= BLOCK_CACHE_MERGE_GAP) {
+				break;
+			}
+			j = k;
+		}
+		uint64_t writes = c->writes;
+		unlock_spinlock_irq(&c->lock, flags);
 
-			memcpy(dst, e->buf, c->sector_size);
-			unlock_spinlock_irq(&c->lock, flags);
-			continue;
+		uint32_t count = run_end - run_start;
+		if (!c->dev->blockread(c->dev, lba + run_start, count * ss, out + (size_t) run_start * ss)) {
+			return 0;
 		}
 
+		lock_spinlock_irq(&c->lock, &flags);
+		c->stats.miss_runs++;
+		c->stats.miss_sectors += count;
+		c->stats.longest_miss_run = MAX(c->stats.longest_miss_run, count);
+		/*
+		 * Sectors cached meanwhile, or bridged over as part of a gap, may be
+		 * newer than the device (dirty in write-back mode), so the cached copy
+		 * wins. A write which raced with the device read may have made what we
+		 * read stale, so nothing is cached then.
+		 */
+		bool store = writes == c->writes;
+		for (uint32_t s = run_start; s < run_end; s++) {
+			src = cache_sector(c, lba + s, &e);
+			if (src) {
+				memcpy(out + (size_t) s * ss, src, ss);
+			} else if (store && !cache_store(c, lba + s, out + (size_t) s * ss, false)) {
+				store = false;
+			}
+		}
 		unlock_spinlock_irq(&c->lock, flags);
-		return 0;
+		i = run_end;
+	}
+
+	if (tail) {
+		/* The last sector only partly fits the caller's buffer */
+		unsigned char *partial = kmalloc(ss);
+		if (!partial) {
+			fs_set_error(FS_ERR_OUT_OF_MEMORY);
+			return 0;
+		}
+		int ok = block_cache_read(c, lba + nsec, ss, partial);
+		if (ok) {
+			memcpy(out + (size_t) nsec * ss, partial, tail);
+		}
+		kfree_null(&partial);
+		return ok;
 	}
 
 	return 1;
@@ -370,81 +591,278 @@ int block_cache_write(block_cache_t *c, uint64_t lba, uint32_t bytes, const unsi
 		return 0;
 	}
 
-	uint32_t nsec = sectors_for_len(c->sector_size, bytes);
-	if (lba + nsec > c->dev->size) {
+	const uint32_t nsec = bytes / c->sector_size;
+	const uint32_t tail = bytes % c->sector_size;
+	if (lba + nsec + (tail ? 1 : 0) > c->dev->size) {
 		fs_set_error(FS_ERR_OUT_OF_BOUNDS);
 		return 0;
 	}
 
 	uint64_t flags;
-
+	int ok = 1;
+	lock_spinlock_irq(&c->lock, &flags);
+	c->writes++;
+	/*
+	 * In write-back mode a flush already under way can land an older copy of
+	 * these sectors on the device after this write did, so they are kept
+	 * dirty and a later flush writes them again.
+	 */
+	bool dirty = c->write_back;
 	for (uint32_t i = 0; i < nsec; i++) {
-		uint64_t sector_lba = lba + i;
-		const unsigned char *seg = src + i * c->sector_size;
-
-		lock_spinlock_irq(&c->lock, &flags);
+		if (!cache_store(c, lba + i, src + (size_t) i * c->sector_size, dirty)) {
+			/* Only fails for a sector with no cached page, so nothing older is left behind */
+			ok = 0;
+		}
+	}
+	if (tail) {
+		block_cache_entry_t *e;
+		uint8_t *sector = cache_sector(c, lba + nsec, &e);
+		if (sector && c->write_back) {
+			/* Merge the known part into the cached copy, which may be newer than the device */
+			uint64_t bit = 1ULL << ((lba + nsec) % c->page_sectors);
+			memcpy(sector, src + (size_t) nsec * c->sector_size, tail);
+			if (!(e->dirty & bit)) {
+				e->dirty |= bit;
+				c->dirty_sectors++;
+			}
+			e->generation++;
+		} else {
+			/* Only part of this sector is known, the cached copy is now stale */
+			cache_forget(c, lba + nsec);
+		}
+	}
+	unlock_spinlock_irq(&c->lock, flags);
 
-		block_cache_entry_t find = { .lba = sector_lba };
-		block_cache_entry_t *e = hashmap_get(c->map, &find);
+	return ok;
+}
 
-		if (e) {
-			memcpy(e->buf, seg, c->sector_size);
-			e->last_used = c->tick + 1;
-			c->tick = e->last_used;
+int block_cache_write_back(block_cache_t *c, uint64_t lba, uint32_t bytes, const unsigned char *src)
+{
+	if (!c || !c->dev || !src || !c->write_back || bytes % c->sector_size) {
+		/* A partial sector has to be written through */
+		return 0;
+	}
 
-			/* Touch MRU position for this LBA. */
-			lru_touch(c, sector_lba);
+	const uint32_t nsec = bytes / c->sector_size;
+	if (nsec == 0 || nsec > BLOCK_CACHE_DIRTY_LIMIT) {
+		return 0;
+	}
+	if (lba + nsec > c->dev->size) {
+		fs_set_error(FS_ERR_OUT_OF_BOUNDS);
+		return 0;
+	}
 
+	uint64_t flags;
+	lock_spinlock_irq(&c->lock, &flags);
+	while (c->write_back && c->dirty_sectors + nsec > BLOCK_CACHE_DIRTY_LIMIT) {
+		/* Too much unwritten data, the writer pays for a flush */
+		unlock_spinlock_irq(&c->lock, flags);
+		if (!block_cache_flush(c)) {
+			return 0;
+		}
+		lock_spinlock_irq(&c->lock, &flags);
+	}
+	if (!c->write_back) {
+		/* Switched to write-through since the check above */
+		unlock_spinlock_irq(&c->lock, flags);
+		return 0;
+	}
+	c->writes++;
+	for (uint32_t i = 0; i < nsec; i++) {
+		if (!cache_store(c, lba + i, src + (size_t) i * c->sector_size, true)) {
+			/*
+			 * Sectors stored so far are dirty and correct. The caller writes
+			 * the whole range through, which makes the rest safe too.
+			 */
 			unlock_spinlock_irq(&c->lock, flags);
-			continue;
+			return 0;
 		}
+	}
+	c->stats.absorbed_writes++;
+	unlock_spinlock_irq(&c->lock, flags);
+	return 1;
+}
 
-		/* Ensure capacity before inserting a new entry. */
-		while (c->lru_count >= c->cap) {
-			evict_one(c);
-		}
+/**
+ * @brief A run of adjacent dirty sectors being gathered for one device write.
+ */
+typedef struct flush_run {
+	uint64_t lba;          /**< First sector of the run. */
+	uint32_t count;        /**< Sectors gathered so far. */
+	uint8_t *buf;          /**< BLOCK_CACHE_FLUSH_SECTORS sectors of data. */
+	struct {
+		uint64_t page;         /**< Page a part of the run was copied from. */
+		uint64_t mask;         /**< Sectors of that page in the run. */
+		uint32_t generation;   /**< Page generation at the time of the copy. */
+	} pages[BLOCK_CACHE_FLUSH_SECTORS + 1];
+	uint32_t page_count;   /**< Entries used in pages. */
+} flush_run_t;
 
-		block_cache_entry_t temp = {0};
-		temp.lba = sector_lba;
-		temp.buf = buddy_malloc(&cache_allocator, c->sector_size);
-		if (!temp.buf) {
-			unlock_spinlock_irq(&c->lock, flags);
-			return 0;
+/**
+ * @brief Write a gathered run to the device, then mark it clean.
+ *
+ * Sectors of a page stored into since the copy was taken stay dirty, as what
+ * reached the device may already be out of date.
+ */
+static int flush_run_write(block_cache_t *c, flush_run_t *run) {
+	if (!run->count) {
+		return 1;
+	}
+	int ok = c->dev->blockwrite(c->dev, run->lba, run->count * c->sector_size, run->buf);
+
+	uint64_t flags;
+	lock_spinlock_irq(&c->lock, &flags);
+	if (ok) {
+		for (uint32_t i = 0; i < run->page_count; i++) {
+			block_cache_entry_t find = { .page = run->pages[i].page };
+			block_cache_entry_t *e = hashmap_get(c->map, &find);
+			if (e && e->generation == run->pages[i].generation) {
+				uint64_t clean = e->dirty & run->pages[i].mask;
+				e->dirty &= ~clean;
+				c->dirty_sectors -= __builtin_popcountll(clean);
+			}
 		}
+		c->stats.flush_writes++;
+		c->stats.flushed_sectors += run->count;
+	}
+	unlock_spinlock_irq(&c->lock, flags);
 
-		memcpy(temp.buf, seg, c->sector_size);
-		temp.last_used = c->tick + 1;
-		c->tick = temp.last_used;
+	run->count = 0;
+	run->page_count = 0;
+	return ok;
+}
 
-		hashmap_set(c->map, &temp);
+static int compare_pages(const void *a, const void *b) {
+	uint64_t pa = *(const uint64_t *) a, pb = *(const uint64_t *) b;
+	return pa < pb ? -1 : (pa > pb ? 1 : 0);
+}
 
-		/* Get the stable, hashmap-owned pointer to confirm insert. */
-		block_cache_entry_t *stored = hashmap_get(c->map, &find);
-		if (!stored) {
-			dprintf("BUG: hashed sector not stored in cache\n");
-			buddy_free(&cache_allocator, temp.buf);
-			unlock_spinlock_irq(&c->lock, flags);
-			fs_set_error(FS_ERR_INTERNAL);
-			return 0;
+int block_cache_flush(block_cache_t *c)
+{
+	if (!c || !c->dev || !c->dev->blockwrite) {
+		return 0;
+	}
+
+	uint64_t flags;
+	lock_spinlock_irq(&c->lock, &flags);
+	if (c->dirty_sectors == 0) {
+		unlock_spinlock_irq(&c->lock, flags);
+		return 1;
+	}
+	size_t capacity = hashmap_count(c->map), count = 0, iter = 0;
+	uint64_t *pages = kmalloc(capacity * sizeof(uint64_t));
+	if (!pages) {
+		unlock_spinlock_irq(&c->lock, flags);
+		fs_set_error(FS_ERR_OUT_OF_MEMORY);
+		return 0;
+	}
+	void *item;
+	while (count < capacity && hashmap_iter(c->map, &iter, &item)) {
+		const block_cache_entry_t *e = item;
+		if (e->dirty) {
+			pages[count++] = e->page;
 		}
+	}
+	unlock_spinlock_irq(&c->lock, flags);
 
-		stored->last_used = temp.last_used;
+	/* Ascending page order, so adjacent dirty sectors meet in the same run */
+	qsort(pages, count, sizeof(uint64_t), compare_pages);
+
+	const size_t page_bytes = (size_t) c->page_sectors * c->sector_size;
+	flush_run_t *run = kmalloc(sizeof(flush_run_t));
+	uint8_t *stage = kmalloc(page_bytes);
+	uint8_t *buf = kmalloc((size_t) BLOCK_CACHE_FLUSH_SECTORS * c->sector_size);
+	if (!run || !stage || !buf) {
+		kfree_null(&pages);
+		kfree_null(&run);
+		kfree_null(&stage);
+		kfree_null(&buf);
+		fs_set_error(FS_ERR_OUT_OF_MEMORY);
+		return 0;
+	}
+	run->buf = buf;
+	run->count = 0;
+	run->page_count = 0;
 
-		/* Place LBA at MRU; if node is somehow already present, it'll be moved. */
-		if (!lru_touch(c, sector_lba)) {
-			/* Out of memory creating the LRU node; roll back map insert. */
-			block_cache_entry_t key = { .lba = sector_lba };
-			(void)hashmap_delete(c->map, &key);
-			buddy_free(&cache_allocator, stored->buf);
+	int ok = 1;
+	for (size_t p = 0; p < count; p++) {
+		lock_spinlock_irq(&c->lock, &flags);
+		block_cache_entry_t find = { .page = pages[p] };
+		block_cache_entry_t *e = hashmap_get(c->map, &find);
+		if (!e || !e->dirty) {
 			unlock_spinlock_irq(&c->lock, flags);
-			fs_set_error(FS_ERR_OUT_OF_MEMORY);
-			return 0;
+			continue;
 		}
-
+		uint64_t dirty = e->dirty;
+		uint32_t generation = e->generation;
+		memcpy(stage, e->buf, page_bytes);
 		unlock_spinlock_irq(&c->lock, flags);
+
+		for (uint32_t s = 0; s < c->page_sectors; s++) {
+			if (!(dirty & (1ULL << s))) {
+				continue;
+			}
+			uint64_t lba = pages[p] * c->page_sectors + s;
+			if (run->count && (lba != run->lba + run->count || run->count == BLOCK_CACHE_FLUSH_SECTORS)) {
+				ok &= flush_run_write(c, run);
+			}
+			if (!run->count) {
+				run->lba = lba;
+			}
+			memcpy(run->buf + (size_t) run->count * c->sector_size, stage + (size_t) s * c->sector_size, c->sector_size);
+			run->count++;
+			if (!run->page_count || run->pages[run->page_count - 1].page != pages[p]) {
+				run->pages[run->page_count].page = pages[p];
+				run->pages[run->page_count].mask = 0;
+				run->pages[run->page_count].generation = generation;
+				run->page_count++;
+			}
+			run->pages[run->page_count - 1].mask |= 1ULL << s;
+		}
 	}
+	ok &= flush_run_write(c, run);
+
+	kfree_null(&pages);
+	kfree_null(&run);
+	kfree_null(&stage);
+	kfree_null(&buf);
+	if (!ok) {
+		fs_set_error(FS_ERR_IO);
+	}
+	return ok;
+}
 
-	return 1;
+void block_cache_set_write_back(block_cache_t *c, bool enable) {
+	if (!c) {
+		return;
+	}
+	uint64_t flags;
+	lock_spinlock_irq(&c->lock, &flags);
+	c->write_back = enable;
+	unlock_spinlock_irq(&c->lock, flags);
+	if (!enable) {
+		/* No more writes are absorbed, so retire what is already held */
+		block_cache_flush(c);
+	}
+}
+
+bool block_cache_is_write_back(block_cache_t *c) {
+	return c && c->write_back;
+}
+
+void block_cache_get_stats(block_cache_t *c, block_cache_stats_t *stats) {
+	if (!c || !stats) {
+		return;
+	}
+	uint64_t flags;
+	lock_spinlock_irq(&c->lock, &flags);
+	*stats = c->stats;
+	stats->cached_pages = hashmap_count(c->map);
+	stats->dirty_sectors = c->dirty_sectors;
+	stats->write_back = c->write_back;
+	stats->page_bytes = (uint64_t) c->page_sectors * c->sector_size;
+	stats->sector_size = c->sector_size;
+	unlock_spinlock_irq(&c->lock, flags);
 }
 
 void block_cache_invalidate(block_cache_t *c) {
@@ -454,7 +872,67 @@ void block_cache_invalidate(block_cache_t *c) {
 	uint64_t flags;
 	lock_spinlock_irq(&c->lock, &flags);
 	while (c->lru_count > 0) {
-		evict_one(c);
+		evict_one(c, true);
 	}
 	unlock_spinlock_irq(&c->lock, flags);
 }
+
+/**
+ * @brief Render the per-device cache statistics table for /devices/blockcache.
+ * Columns are fixed width so the size of the file only changes when a device
+ * comes or goes. Returns a kmalloc'd string which the caller must free.
+ */
+static char *block_cache_stats_text(void)
+{
+	const size_t row = 224;
+	size_t rows = 1;
+	for (const storage_device_t *sd = get_all_storage_devices(); sd; sd = sd->next) {
+		rows += sd->cache ? 1 : 0;
+	}
+	const size_t size = row * rows;
+	char *text = kmalloc(size);
+	if (!text) {
+		return NULL;
+	}
+	size_t len = snprintf(text, size, "DEVICE                 HITS               MISSES          DEVICE READS AVG RUN MAX RUN HIT%%          BYTES SAVED  PAGES MODE    ABSORBED WRITES     FLUSH WRITES    DIRTY\n");
+	for (const storage_device_t *sd = get_all_storage_devices(); sd; sd = sd->next) {
+		if (!sd->cache) {
+			continue;
+		}
+		block_cache_stats_t s;
+		block_cache_get_stats(sd->cache, &s);
+		uint64_t sectors = s.hit_sectors + s.miss_sectors;
+		len += snprintf(text + len, size - len, "%-8s %18lu %20lu %21lu %7lu %7lu %4lu %20lu %6lu %-4s %19lu %16lu %8lu\n", sd->name, s.hit_sectors, s.miss_sectors, s.miss_runs,
+				s.miss_runs ? s.miss_sectors / s.miss_runs : 0, s.longest_miss_run, sectors ? s.hit_sectors * 100 / sectors : 0,
+				s.hit_sectors * s.sector_size, s.cached_pages, s.write_back ? "WB" : "WT", s.absorbed_writes, s.flush_writes, s.dirty_sectors);
+	}
+	return text;
+}
+
+static void block_cache_stats_update_cb(fs_directory_entry_t *ent) {
+	char *text = block_cache_stats_text();
+	ent->size = text ? strlen(text) : 0;
+	kfree_null(&text);
+}
+
+static bool block_cache_stats_read_cb(uint64_t start, uint32_t length, unsigned char *buffer) {
+	char *text = block_cache_stats_text();
+	if (!text) {
+		fs_set_error(FS_ERR_OUT_OF_MEMORY);
+		return false;
+	}
+	uint64_t text_length = strlen(text);
+
+	if (start + length > text_length) {
+		kfree_null(&text);
+		fs_set_error(FS_ERR_SEEK_PAST_END);
+		return false;
+	}
+	memcpy(buffer, text + start, length);
+	kfree_null(&text);
+	return true;
+}
+
+void init_block_cache_stats(void) {
+	devfs_register_text("blockcache", block_cache_stats_update_cb, block_cache_stats_read_cb);
+}
@@ -1,4 +1,5 @@
 #include <kernel.h>
+#include <block_cache.h>
 
 static filesystem_t *devfs = NULL;
 static devfs_node_t *devfs_head = NULL;
@@ -75,6 +76,11 @@ void init_devfs(void) {
 
 	/* Built-in /devices/debug device */
 	init_debuglog();
+	init_sched_stats();
+	init_kmalloc_stats();
+	init_block_cache_stats();
+	init_checksum_bench();
+	init_net_stats();
 
 	/* Periodically update sizes */
 	proc_register_idle(devfs_update_sizes, IDLE_FOREGROUND, 100);
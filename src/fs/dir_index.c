@@ -0,0 +1,215 @@
+/**
+ * @file dir_index.c
+ * @brief Hashed directory indexes and the resolved path cache
+ *
+ * Directory contents are held as linked lists of fs_directory_entry_t, with
+ * subdirectories also linked as fs_tree_t children. Once a directory holds
+ * FS_DIR_INDEX_MIN or more entries, its first lookup builds a hashmap from
+ * (name, is directory) to the entry and child node, which create and delete
+ * keep up to date, so lookups no longer walk the lists.
+ *
+ * On top of this, a direct-mapped cache remembers which directory node or
+ * file entry recently resolved full paths led to, so repeated opens of the
+ * same path skip walking the tree altogether. Entries only become invalid
+ * when they are freed or replaced, so any removal bumps a generation number
+ * which makes every cached path stale at once.
+ */
+#include <kernel.h>
+
+typedef struct fs_dir_index_item_t {
+	const char* name;		/* Entry or node name, owned by the entry or node */
+	bool is_dir;			/* Directory rather than file */
+	fs_directory_entry_t* entry;	/* Entry in the directory's files list, if any */
+	fs_tree_t* node;		/* Node in the directory's child_dirs list, if any */
+} fs_dir_index_item_t;
+
+typedef struct fs_dcache_slot_t {
+	uint64_t generation;		/* Valid only while equal to dcache_generation */
+	bool is_dir;			/* target is an fs_tree_t rather than an fs_directory_entry_t */
+	void* target;			/* What the path resolved to */
+	char path[FS_DCACHE_PATH_MAX];	/* Fully qualified path */
+} fs_dcache_slot_t;
+
+static fs_dcache_slot_t dcache[FS_DCACHE_SLOTS] = { 0 };
+static uint64_t dcache_generation = 1;
+static spinlock_t dcache_lock = 0;
+
+static uint64_t dir_index_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+	const fs_dir_index_item_t* i = item;
+	return fs_name_hash(i->name, seed0, seed1) ^ i->is_dir;
+}
+
+static int dir_index_compare(const void *a, const void *b, [[maybe_unused]] void *udata) {
+	const fs_dir_index_item_t* ia = a;
+	const fs_dir_index_item_t* ib = b;
+	if (ia->is_dir != ib->is_dir) {
+		return ia->is_dir ? 1 : -1;
+	}
+	return strcasecmp(ia->name, ib->name);
+}
+
+/**
+ * @brief Return a directory's index, building it if the directory is big enough
+ */
+static struct hashmap* dir_index_get(fs_tree_t* directory) {
+	if (directory->index) {
+		return directory->index;
+	}
+
+	size_t count = 0;
+	for (fs_directory_entry_t* e = directory->files; e && count < FS_DIR_INDEX_MIN; e = e->next) {
+		count++;
+	}
+	if (count < FS_DIR_INDEX_MIN) {
+		return NULL;
+	}
+
+	struct hashmap* index = hashmap_new(sizeof(fs_dir_index_item_t), 0, 7432519843, 982347123, dir_index_hash, dir_index_compare, NULL, NULL);
+	if (!index) {
+		return NULL;
+	}
+
+	/* Where names repeat, the first in list order wins, as with a linear search */
+	for (fs_directory_entry_t* e = directory->files; e; e = e->next) {
+		fs_dir_index_item_t item = { .name = e->filename, .is_dir = (e->flags & FS_DIRECTORY) != 0, .entry = e, .node = NULL };
+		if (!e->filename || hashmap_get(index, &item)) {
+			continue;
+		}
+		hashmap_set(index, &item);
+		if (hashmap_oom(index)) {
+			hashmap_free(index);
+			return NULL;
+		}
+	}
+	for (fs_tree_t* child = directory->child_dirs; child; child = child->next) {
+		fs_dir_index_item_t item = { .name = child->name, .is_dir = true, .entry = NULL, .node = child };
+		if (!child->name) {
+			continue;
+		}
+		fs_dir_index_item_t* existing = hashmap_get(index, &item);
+		if (existing) {
+			if (!existing->node) {
+				existing->node = child;
+			}
+			continue;
+		}
+		hashmap_set(index, &item);
+		if (hashmap_oom(index)) {
+			hashmap_free(index);
+			return NULL;
+		}
+	}
+
+	directory->index = index;
+	return index;
+}
+
+bool fs_dir_index_lookup(fs_tree_t* directory, const char* name, bool is_dir, fs_directory_entry_t** entry, fs_tree_t** node) {
+	struct hashmap* index = dir_index_get(directory);
+	if (!index) {
+		return false;
+	}
+	const fs_dir_index_item_t* item = hashmap_get(index, &(fs_dir_index_item_t){ .name = name, .is_dir = is_dir });
+	*entry = item ? item->entry : NULL;
+	*node = item ? item->node : NULL;
+	return true;
+}
+
+void fs_dir_index_add(fs_tree_t* directory, fs_directory_entry_t* entry, fs_tree_t* node) {
+	if (!directory || !directory->index || !entry || !entry->filename) {
+		return;
+	}
+	fs_dir_index_item_t item = { .name = entry->filename, .is_dir = (entry->flags & FS_DIRECTORY) != 0, .entry = entry, .node = node };
+	/* New entries go on the head of the lists, so they are found first */
+	hashmap_set(directory->index, &item);
+	if (hashmap_oom(directory->index)) {
+		/* A stale index is worse than none, searches fall back to the lists */
+		hashmap_free(directory->index);
+		directory->index = NULL;
+	}
+}
+
+void fs_dir_index_remove(fs_tree_t* directory, const char* name, bool is_dir) {
+	fs_dcache_invalidate();
+	if (!directory || !directory->index || !name) {
+		return;
+	}
+	hashmap_delete(directory->index, &(fs_dir_index_item_t){ .name = name, .is_dir = is_dir });
+}
+
+void fs_dir_index_drop(fs_tree_t* directory) {
+	fs_dcache_invalidate();
+	if (directory && directory->index) {
+		hashmap_free(directory->index);
+		directory->index = NULL;
+	}
+}
+
+static fs_dcache_slot_t* dcache_slot(const char* path, bool is_dir) {
+	return &dcache[(fs_name_hash(path, 0, 0) ^ is_dir) % FS_DCACHE_SLOTS];
+}
+
+static void* dcache_find(const char* path, bool is_dir) {
+	if (!path || strlen(path) >= FS_DCACHE_PATH_MAX) {
+		return NULL;
+	}
+	fs_dcache_slot_t* slot = dcache_slot(path, is_dir);
+	void* target = NULL;
+	uint64_t flags;
+	lock_spinlock_irq(&dcache_lock, &flags);
+	if (slot->generation == dcache_generation && slot->is_dir == is_dir && !strcasecmp(slot->path, path)) {
+		target = slot->target;
+	}
+	unlock_spinlock_irq(&dcache_lock, flags);
+	return target;
+}
+
+static void dcache_add(const char* path, bool is_dir, void* target, uint64_t generation) {
+	if (!path || !target || strlen(path) >= FS_DCACHE_PATH_MAX) {
+		return;
+	}
+	fs_dcache_slot_t* slot = dcache_slot(path, is_dir);
+	uint64_t flags;
+	lock_spinlock_irq(&dcache_lock, &flags);
+	if (generation != dcache_generation) {
+		/* Something was removed while the path was being resolved */
+		unlock_spinlock_irq(&dcache_lock, flags);
+		return;
+	}
+	strlcpy(slot->path, path, FS_DCACHE_PATH_MAX);
+	slot->is_dir = is_dir;
+	slot->target = target;
+	slot->generation = generation;
+	unlock_spinlock_irq(&dcache_lock, flags);
+}
+
+fs_tree_t* fs_dcache_find_dir(const char* path) {
+	return dcache_find(path, true);
+}
+
+fs_directory_entry_t* fs_dcache_find_file(const char* path) {
+	return dcache_find(path, false);
+}
+
+void fs_dcache_add_dir(const char* path, fs_tree_t* node, uint64_t generation) {
+	dcache_add(path, true, node, generation);
+}
+
+void fs_dcache_add_file(const char* path, fs_directory_entry_t* entry, uint64_t generation) {
+	dcache_add(path, false, entry, generation);
+}
+
+uint64_t fs_dcache_generation(void) {
+	uint64_t flags;
+	lock_spinlock_irq(&dcache_lock, &flags);
+	uint64_t generation = dcache_generation;
+	unlock_spinlock_irq(&dcache_lock, flags);
+	return generation;
+}
+
+void fs_dcache_invalidate(void) {
+	uint64_t flags;
+	lock_spinlock_irq(&dcache_lock, &flags);
+	dcache_generation++;
+	unlock_spinlock_irq(&dcache_lock, flags);
+}
@@ -28,6 +28,15 @@ bool write_cluster(fat32_t* info, uint32_t cluster, void* buffer)
 	return write_storage_device(info->device_name, lba, info->clustersize, buffer);
 }
 
+bool fat32_flush(fat32_t* info)
+{
+	if (!info) {
+		fs_set_error(FS_ERR_VFS_DATA);
+		return false;
+	}
+	return storage_flush(find_storage_device(info->device_name));
+}
+
 uint64_t cluster_to_lba(fat32_t* info, uint32_t cluster)
 {
 	if (!info) {
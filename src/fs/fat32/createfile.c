@@ -257,5 +257,9 @@ uint64_t fat32_internal_create_file(void* dir, const char* name, size_t size, ui
 
 uint64_t fat32_create_file(void* dir, const char* name, size_t size)
 {
-	return fat32_internal_create_file(dir, name, size, 0);
+	uint64_t cluster = fat32_internal_create_file(dir, name, size, 0);
+	if (cluster == 0 || !fat32_flush((fat32_t*)((fs_tree_t*)dir)->opaque)) {
+		return 0;
+	}
+	return cluster;
 }
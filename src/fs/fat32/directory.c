@@ -232,7 +232,7 @@ uint64_t fat32_create_directory(void* dir, const char* name)
 	entry->size = 0;
 	entry->first_cluster_hi = (parent_dir_cluster >> 16) & 0xffff;
 	entry->first_cluster_lo = parent_dir_cluster & 0xffff;
-	if (!write_cluster(info, cluster, buffer)) {
+	if (!write_cluster(info, cluster, buffer) || !fat32_flush(info)) {
 		return 0;
 	}
 
@@ -0,0 +1,137 @@
+#include "kernel.h"
+
+/**
+ * @brief Find or claim the extent map for a chain, caller holds fat_lock.
+ * A map built before the last FAT change is emptied and rebuilt.
+ */
+static fat32_extent_map_t* fat32_extent_map(fat32_t* info, uint32_t first_cluster)
+{
+	fat32_extent_map_t* victim = &info->extent_maps[0];
+	fat32_extent_map_t* map = NULL;
+	for (size_t i = 0; i < FAT32_EXTENT_MAPS; ++i) {
+		fat32_extent_map_t* m = &info->extent_maps[i];
+		if (m->first_cluster == first_cluster) {
+			map = m;
+			break;
+		}
+		if (m->last_used < victim->last_used) {
+			victim = m;
+		}
+	}
+	if (!map) {
+		map = victim;
+		map->first_cluster = first_cluster;
+		map->generation = info->fat_generation - 1;
+	}
+	if (map->generation != info->fat_generation) {
+		map->generation = info->fat_generation;
+		map->run_count = 0;
+		map->clusters = 0;
+		map->hint_run = 0;
+		map->hint_base = 0;
+		map->complete = false;
+	}
+	map->last_used = ++info->fat_tick;
+	return map;
+}
+
+/**
+ * @brief Follow the chain past the end of the map until it covers index or ends.
+ * Stops early if a FAT window it needs is not cached, setting @p missing to a
+ * cluster in that window. The map keeps what was found so far, and the caller
+ * can load the window and carry on.
+ */
+static bool fat32_extent_map_extend(fat32_t* info, fat32_extent_map_t* map, uint32_t index, uint32_t* missing)
+{
+	uint32_t cluster;
+	if (map->run_count == 0) {
+		cluster = map->first_cluster;
+	} else {
+		fat32_extent_t* last = &map->runs[map->run_count - 1];
+		uint32_t entry;
+		if (!fat32_fat_entry_locked(info, last->cluster + last->count - 1, &entry)) {
+			*missing = last->cluster + last->count - 1;
+			return false;
+		}
+		cluster = entry & 0x0FFFFFFF;
+	}
+
+	while (map->clusters <= index) {
+		if (cluster < 2 || cluster >= CLUSTER_BAD) {
+			map->complete = true;
+			return true;
+		}
+		fat32_extent_t* last = map->run_count ? &map->runs[map->run_count - 1] : NULL;
+		if (last && last->cluster + last->count == cluster) {
+			last->count++;
+		} else {
+			if (map->run_count == map->run_capacity) {
+				uint32_t capacity = map->run_capacity ? map->run_capacity * 2 : 8;
+				fat32_extent_t* runs = krealloc(map->runs, capacity * sizeof(fat32_extent_t));
+				if (!runs) {
+					return false;
+				}
+				map->runs = runs;
+				map->run_capacity = capacity;
+			}
+			map->runs[map->run_count].cluster = cluster;
+			map->runs[map->run_count].count = 1;
+			map->run_count++;
+		}
+		map->clusters++;
+
+		uint32_t entry;
+		if (!fat32_fat_entry_locked(info, cluster, &entry)) {
+			*missing = cluster;
+			return false;
+		}
+		cluster = entry & 0x0FFFFFFF;
+	}
+	return true;
+}
+
+bool fat32_extent_lookup(fat32_t* info, uint32_t first_cluster, uint32_t index, fat32_extent_t* run)
+{
+	if (first_cluster < 2 || first_cluster >= CLUSTER_BAD) {
+		return false;
+	}
+	lock_spinlock(&info->fat_lock);
+	fat32_extent_map_t* map;
+	for (;;) {
+		/* Found again each time round, another CPU may reuse it while the lock is dropped */
+		map = fat32_extent_map(info, first_cluster);
+		uint32_t missing = UINT32_MAX;
+		if (index < map->clusters || map->complete || fat32_extent_map_extend(info, map, index, &missing)) {
+			break;
+		}
+		unlock_spinlock(&info->fat_lock);
+		if (missing == UINT32_MAX || !fat32_fat_load(info, missing)) {
+			return false;
+		}
+		lock_spinlock(&info->fat_lock);
+	}
+	if (index >= map->clusters) {
+		unlock_spinlock(&info->fat_lock);
+		return false;
+	}
+
+	/* Sequential reads land in the last run used or a later one, so start there */
+	uint32_t i = 0, base = 0;
+	if (map->hint_run < map->run_count && index >= map->hint_base) {
+		i = map->hint_run;
+		base = map->hint_base;
+	}
+	for (; i < map->run_count; ++i) {
+		if (index < base + map->runs[i].count) {
+			map->hint_run = i;
+			map->hint_base = base;
+			run->cluster = map->runs[i].cluster + (index - base);
+			run->count = map->runs[i].count - (index - base);
+			unlock_spinlock(&info->fat_lock);
+			return true;
+		}
+		base += map->runs[i].count;
+	}
+	unlock_spinlock(&info->fat_lock);
+	return false;
+}
@@ -1,32 +1,188 @@
 #include "kernel.h"
 
-bool set_fat_entry(fat32_t* info, uint32_t cluster, uint32_t value)
+void fat32_init_fat_cache(fat32_t* info, storage_device_t* sd)
+{
+	uint32_t window_bytes = (FAT32_FAT_WINDOW_BYTES + sd->block_size - 1) / sd->block_size * sd->block_size;
+	info->fat_window_entries = window_bytes / sizeof(uint32_t);
+	for (size_t i = 0; i < FAT32_FAT_WINDOWS; ++i) {
+		info->fat_cache[i].entries = NULL;
+		info->fat_cache[i].first_entry = UINT32_MAX;
+		info->fat_cache[i].last_used = 0;
+		info->fat_cache[i].writers = 0;
+	}
+	memset(info->extent_maps, 0, sizeof(info->extent_maps));
+	info->fat_generation = 0;
+	info->fat_tick = 0;
+	init_spinlock(&info->fat_lock);
+}
+
+void fat32_free_fat_cache(fat32_t* info)
+{
+	for (size_t i = 0; i < FAT32_FAT_WINDOWS; ++i) {
+		kfree_null(&info->fat_cache[i].entries);
+		info->fat_cache[i].first_entry = UINT32_MAX;
+	}
+	for (size_t i = 0; i < FAT32_EXTENT_MAPS; ++i) {
+		kfree_null(&info->extent_maps[i].runs);
+	}
+	memset(info->extent_maps, 0, sizeof(info->extent_maps));
+}
+
+/**
+ * @brief Find the cached window holding a FAT entry. Caller holds fat_lock.
+ * @return Window, or NULL if it must first be loaded by fat32_fat_load()
+ */
+static fat32_fat_window_t* fat32_fat_window(fat32_t* info, uint32_t cluster)
+{
+	uint32_t first = cluster - (cluster % info->fat_window_entries);
+	for (size_t i = 0; i < FAT32_FAT_WINDOWS; ++i) {
+		fat32_fat_window_t* w = &info->fat_cache[i];
+		if (w->first_entry == first) {
+			w->last_used = ++info->fat_tick;
+			return w;
+		}
+	}
+	return NULL;
+}
+
+bool fat32_fat_load(fat32_t* info, uint32_t cluster)
 {
 	storage_device_t* sd = find_storage_device(info->device_name);
 	if (!sd) {
 		return false;
 	}
-	uint32_t* buffer = kmalloc(sd->block_size);
-	if (!buffer) {
+	uint32_t first = cluster - (cluster % info->fat_window_entries);
+	uint64_t fat_bytes = (uint64_t)info->fatsize * sd->block_size;
+	uint64_t offset = (uint64_t)first * sizeof(uint32_t);
+	if (offset >= fat_bytes) {
+		return false;
+	}
+	uint32_t window_bytes = info->fat_window_entries * sizeof(uint32_t);
+	uint32_t bytes = offset + window_bytes > fat_bytes ? (uint32_t)(fat_bytes - offset) : window_bytes;
+	uint32_t* entries = kmalloc(window_bytes);
+	if (!entries) {
 		return false;
 	}
-	uint32_t fat_entry_sector = info->start + info->reservedsectors + ((cluster * 4) / sd->block_size);
-	uint32_t fat_entry_offset = (uint32_t) (cluster % (sd->block_size / 4));
+	/* Anything past the end of the FAT reads as end of chain, never as free */
+	for (uint32_t t = bytes / sizeof(uint32_t); t < info->fat_window_entries; ++t) {
+		entries[t] = CLUSTER_END;
+	}
 
-	if (!read_storage_device(info->device_name, fat_entry_sector, sd->block_size, (uint8_t*)buffer)) {
-		dprintf("Read failure in set_fat_entry cluster=%08x\n", cluster);
-		kfree_null(&buffer);
+	for (;;) {
+		lock_spinlock(&info->fat_lock);
+		uint32_t generation = info->fat_generation;
+		bool cached = fat32_fat_window(info, cluster) != NULL;
+		unlock_spinlock(&info->fat_lock);
+		if (cached) {
+			kfree_null(&entries);
+			return true;
+		}
+
+		/* The device is read without fat_lock, so other CPUs keep using the cache */
+		if (!read_storage_device(info->device_name, info->start + info->reservedsectors + offset / sd->block_size, bytes, (uint8_t*)entries)) {
+			dprintf("Read failure loading FAT window at cluster=%08x\n", first);
+			kfree_null(&entries);
+			return false;
+		}
+
+		lock_spinlock(&info->fat_lock);
+		if (info->fat_generation != generation) {
+			/* An entry changed during the read, which may not have seen it */
+			unlock_spinlock(&info->fat_lock);
+			continue;
+		}
+		if (fat32_fat_window(info, cluster)) {
+			/* Another CPU loaded it first */
+			unlock_spinlock(&info->fat_lock);
+			kfree_null(&entries);
+			return true;
+		}
+		/* Windows with a write in flight stay put */
+		fat32_fat_window_t* victim = NULL;
+		for (size_t i = 0; i < FAT32_FAT_WINDOWS; ++i) {
+			fat32_fat_window_t* w = &info->fat_cache[i];
+			if (!w->writers && (!victim || w->last_used < victim->last_used)) {
+				victim = w;
+			}
+		}
+		if (!victim) {
+			unlock_spinlock(&info->fat_lock);
+			kfree_null(&entries);
+			return false;
+		}
+		uint32_t* old = victim->entries;
+		victim->entries = entries;
+		victim->first_entry = first;
+		victim->last_used = ++info->fat_tick;
+		unlock_spinlock(&info->fat_lock);
+		kfree_null(&old);
+		return true;
+	}
+}
+
+bool fat32_fat_entry_locked(fat32_t* info, uint32_t cluster, uint32_t* entry)
+{
+	fat32_fat_window_t* w = fat32_fat_window(info, cluster);
+	if (!w) {
 		return false;
 	}
-	buffer[fat_entry_offset] = value & 0x0FFFFFFF;
-	if (!write_storage_device(info->device_name, fat_entry_sector, sd->block_size, (uint8_t*)buffer)) {
-		dprintf("Write failure in set_fat_entry cluster=%08x to %08x\n", cluster, value);
-		kfree_null(&buffer);
+	*entry = w->entries[cluster - w->first_entry];
+	return true;
+}
+
+bool set_fat_entry(fat32_t* info, uint32_t cluster, uint32_t value)
+{
+	storage_device_t* sd = find_storage_device(info->device_name);
+	if (!sd) {
+		return false;
+	}
+	uint32_t per_sector = sd->block_size / sizeof(uint32_t);
+	uint32_t sector_first = cluster - (cluster % per_sector);
+	uint64_t fat_entry_sector = info->start + info->reservedsectors + ((uint64_t)cluster * 4) / sd->block_size;
+	uint8_t* sector = kmalloc(sd->block_size);
+	if (!sector) {
 		return false;
 	}
 
-	kfree_null(&buffer);
-	return true;
+	lock_spinlock(&info->fat_lock);
+	fat32_fat_window_t* w;
+	while (!(w = fat32_fat_window(info, cluster))) {
+		unlock_spinlock(&info->fat_lock);
+		if (!fat32_fat_load(info, cluster)) {
+			dprintf("Read failure in set_fat_entry cluster=%08x\n", cluster);
+			kfree_null(&sector);
+			return false;
+		}
+		lock_spinlock(&info->fat_lock);
+	}
+	w->entries[cluster - w->first_entry] = value & 0x0FFFFFFF;
+	info->fat_generation++;
+
+	/*
+	 * Write through: only the one sector holding the entry goes to disk. The
+	 * write is made without fat_lock, with the window pinned so it cannot be
+	 * replaced. If another CPU changed the sector meanwhile its write may have
+	 * landed first, so the sector is written again until the disk has caught up.
+	 */
+	const uint32_t* cached = w->entries + (sector_first - w->first_entry);
+	bool written;
+	w->writers++;
+	do {
+		memcpy(sector, cached, sd->block_size);
+		unlock_spinlock(&info->fat_lock);
+		written = write_storage_device(info->device_name, fat_entry_sector, sd->block_size, sector);
+		lock_spinlock(&info->fat_lock);
+	} while (written && memcmp(sector, cached, sd->block_size) != 0);
+	w->writers--;
+	if (!written) {
+		dprintf("Write failure in set_fat_entry cluster=%08x to %08x\n", cluster, value);
+		/* The window no longer matches the disk */
+		w->first_entry = UINT32_MAX;
+		w->last_used = 0;
+	}
+	unlock_spinlock(&info->fat_lock);
+	kfree_null(&sector);
+	return written;
 }
 
 void amend_free_count(fat32_t* info, int adjustment)
@@ -52,30 +208,33 @@ uint32_t find_next_free_fat_entry(fat32_t* info)
 	if (!sd) {
 		return CLUSTER_END;
 	}
-	uint32_t* buffer = kmalloc(sd->block_size);
-	if (!buffer) {
-		return CLUSTER_END;
+	uint64_t total = (uint64_t)info->fatsize * (sd->block_size / sizeof(uint32_t));
+	if (total > UINT32_MAX) {
+		total = UINT32_MAX;
 	}
-	uint32_t offset = 0;
-	uint32_t count = 0;
-	uint32_t fat_entry_sector = info->start + info->reservedsectors;
 
-	while (offset < info->fatsize) {
-		if (!read_storage_device(info->device_name, fat_entry_sector + offset, sd->block_size, (uint8_t*)buffer)) {
-			dprintf("Failed to read sector %x\n", fat_entry_sector + offset);
-			kfree_null(&buffer);
-			return CLUSTER_END;
+	/* fat_lock is only held while scanning a window already in the cache */
+	uint32_t cluster = 0;
+	while (cluster < total) {
+		lock_spinlock(&info->fat_lock);
+		fat32_fat_window_t* w = fat32_fat_window(info, cluster);
+		if (!w) {
+			unlock_spinlock(&info->fat_lock);
+			if (!fat32_fat_load(info, cluster)) {
+				dprintf("Failed to read FAT at cluster %x\n", cluster);
+				return CLUSTER_END;
+			}
+			continue;
 		}
-		for (size_t t = 0; t < sd->block_size / sizeof(uint32_t); ++t) {
-			if (buffer[t] == CLUSTER_FREE) {
-				kfree_null(&buffer);
-				return count & 0x0FFFFFFF;
+		for (uint32_t t = 0; t < info->fat_window_entries && cluster + t < total; ++t) {
+			if (w->entries[t] == CLUSTER_FREE) {
+				unlock_spinlock(&info->fat_lock);
+				return (cluster + t) & 0x0FFFFFFF;
 			}
-			++count;
 		}
-		++offset;
+		unlock_spinlock(&info->fat_lock);
+		cluster += info->fat_window_entries;
 	}
-	kfree_null(&buffer);
 	dprintf("No free clusters :(\n");
 	return CLUSTER_END;
 }
@@ -85,26 +244,19 @@ uint32_t get_fat_entry(fat32_t* info, uint32_t cluster)
 	if (!info) {
 		return 0xffffffff;
 	}
-	storage_device_t* sd = find_storage_device(info->device_name);
-	if (!sd) {
-		return 0x0fffffff;
-	}
-
-	uint32_t* buffer = kmalloc(sd->block_size);
-	if (!buffer) {
-		return 0x0fffffff;
-	}
-	uint32_t fat_entry_sector = info->start + info->reservedsectors + ((cluster * 4) / sd->block_size);
-	uint32_t fat_entry_offset = (uint32_t) (cluster % (sd->block_size / 4));
-
-	if (!read_storage_device(info->device_name, fat_entry_sector, sd->block_size, (uint8_t*)buffer)) {
-		kprintf("Read failure in get_fat_entry cluster=%08x\n", cluster);
-		kfree_null(&buffer);
-		return 0x0fffffff;
+	uint32_t entry;
+	for (;;) {
+		lock_spinlock(&info->fat_lock);
+		bool cached = fat32_fat_entry_locked(info, cluster, &entry);
+		unlock_spinlock(&info->fat_lock);
+		if (cached) {
+			return entry & 0x0FFFFFFF;
+		}
+		if (!fat32_fat_load(info, cluster)) {
+			kprintf("Read failure in get_fat_entry cluster=%08x\n", cluster);
+			return 0x0fffffff;
+		}
 	}
-	uint32_t entry = buffer[fat_entry_offset] & 0x0FFFFFFF;
-	kfree_null(&buffer);
-	return entry;
 }
 
 /**
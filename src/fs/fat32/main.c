@@ -75,6 +75,7 @@ int read_fat(fat32_t* info)
 	}
 
 	add_random_entropy(par->serialnumber);
+	fat32_init_fat_cache(info, sd);
 
 	read_fs_info(info);
 	kfree_null(&buffer);
@@ -145,6 +146,10 @@ int fat32_attach(const char* device_name, const char* path, int partition_index)
 		int attached = attach_filesystem(path, fat32_fs, fat32fs);
 		if (attached) {
 			dprintf("fat32: free space on '%s': %lu bytes\n", path, fs_get_free_space(path));
+		} else {
+			fat32_free_fat_cache(fat32fs);
+			kfree_null(&fat32fs->info);
+			kfree_null(&fat32fs);
 		}
 		return attached;
 	}
@@ -1,5 +1,66 @@
 #include "kernel.h"
 
+/**
+ * @brief Read len bytes starting offset bytes into the device block at lba.
+ * Whole blocks are read straight into the caller's buffer in one transfer,
+ * only partial blocks at either end go through a bounce block.
+ */
+static bool fat32_read_span(fat32_t* info, storage_device_t* sd, uint64_t lba, uint64_t offset, uint32_t len, unsigned char* buffer)
+{
+	lba += offset / sd->block_size;
+	offset %= sd->block_size;
+	unsigned char* bounce = NULL;
+
+	if (offset) {
+		bounce = kmalloc(sd->block_size);
+		if (!bounce) {
+			fs_set_error(FS_ERR_OUT_OF_MEMORY);
+			return false;
+		}
+		uint32_t part = sd->block_size - offset;
+		if (part > len) {
+			part = len;
+		}
+		if (!read_storage_device(info->device_name, lba, sd->block_size, bounce)) {
+			kfree_null(&bounce);
+			return false;
+		}
+		memcpy(buffer, bounce + offset, part);
+		buffer += part;
+		len -= part;
+		lba++;
+	}
+
+	uint32_t whole = len / sd->block_size * sd->block_size;
+	if (whole) {
+		if (!read_storage_device(info->device_name, lba, whole, buffer)) {
+			kfree_null(&bounce);
+			return false;
+		}
+		buffer += whole;
+		len -= whole;
+		lba += whole / sd->block_size;
+	}
+
+	if (len) {
+		if (!bounce) {
+			bounce = kmalloc(sd->block_size);
+			if (!bounce) {
+				fs_set_error(FS_ERR_OUT_OF_MEMORY);
+				return false;
+			}
+		}
+		if (!read_storage_device(info->device_name, lba, sd->block_size, bounce)) {
+			kfree_null(&bounce);
+			return false;
+		}
+		memcpy(buffer, bounce, len);
+	}
+
+	kfree_null(&bounce);
+	return true;
+}
+
 bool fat32_read_file(void* f, uint64_t start, uint32_t length, unsigned char* buffer)
 {
 	if (!f || !buffer) {
@@ -9,53 +70,41 @@ bool fat32_read_file(void* f, uint64_t start, uint32_t length, unsigned char* bu
 	fs_directory_entry_t* file = (fs_directory_entry_t*)f;
 	fs_tree_t* tree = (fs_tree_t*)file->directory;
 	fat32_t* info = (fat32_t*)tree->opaque;
-
-	uint32_t cluster = file->lbapos;
-	uint32_t clustercount = 0;
-	uint32_t first = 1;
-	uint32_t amount_read = 0;
-	unsigned char clbuf[info->clustersize];
-
-	dprintf("fat32_read_file: lbapos=%08x\n", cluster);
-
-	// Advance to start when start != 0, for fseek()
-	while ((clustercount++ < start / info->clustersize) && cluster < CLUSTER_BAD) {
-		cluster = get_fat_entry(info, cluster);
-	}
-
-	if (cluster >= CLUSTER_BAD) {
-		fs_set_error(FS_ERR_BAD_CLUSTER);
+	storage_device_t* sd = find_storage_device(info->device_name);
+	if (!sd) {
+		fs_set_error(FS_ERR_NO_SUCH_DEVICE);
 		return false;
 	}
 
-	while (true) {
-		if (!read_cluster(info, cluster, clbuf)) {
-			return false;
-		}
+	dprintf("fat32_read_file: lbapos=%08lx\n", file->lbapos);
 
-		int to_read = length;
-		if (length > info->clustersize) {
-			to_read = info->clustersize;
+	/* One device transfer per run of contiguous clusters, found via the chain's extent map */
+	bool first = true;
+	while (length) {
+		uint64_t index = start / info->clustersize;
+		uint64_t offset = start % info->clustersize;
+		fat32_extent_t run;
+		if (index > UINT32_MAX || !fat32_extent_lookup(info, (uint32_t)file->lbapos, (uint32_t)index, &run)) {
+			if (first) {
+				fs_set_error(FS_ERR_BAD_CLUSTER);
+				return false;
+			}
+			break;
 		}
-		if (first == 1) {
-			/* Special case where start != 0 */
-			memcpy(buffer, clbuf + (start % info->clustersize), to_read);
-		} else {
-			memcpy(buffer, clbuf, to_read);
+		uint64_t lba = cluster_to_lba(info, run.cluster);
+		if (lba == 0) {
+			return false;
 		}
-
-		buffer += to_read;
-		amount_read += to_read;
-		first = 0;
-
-		cluster = get_fat_entry(info, cluster);
-
-		if (cluster >= CLUSTER_BAD || amount_read >= length) {
-			break;
+		uint64_t span = (uint64_t)run.count * info->clustersize - offset;
+		uint32_t to_read = span < length ? (uint32_t)span : length;
+		if (!fat32_read_span(info, sd, lba, offset, to_read, buffer)) {
+			return false;
 		}
+		buffer += to_read;
+		start += to_read;
+		length -= to_read;
+		first = false;
 	}
 
-
 	return true;
 }
-
@@ -39,7 +39,7 @@ bool fat32_truncate_file(void* f, size_t length)
 				entry->size = length;
 				file->size = length;
 				write_cluster(info, cluster, buffer);
-				return true;
+				return fat32_flush(info);
 			}
 			bufferoffset += sizeof(directory_entry_t);
 			entry = (directory_entry_t*)(buffer + bufferoffset);
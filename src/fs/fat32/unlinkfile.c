@@ -78,7 +78,7 @@ bool fat32_unlink_file(void* dir, const char* name)
 							}
 							write_cluster(info, cluster, buffer);
 							free_fat32_directory(parsed_dir);
-							return true;
+							return fat32_flush(info);
 						}
 						entry_lfn_start = NULL;
 					}
@@ -97,5 +97,5 @@ bool fat32_unlink_file(void* dir, const char* name)
 		}
 	}
 	free_fat32_directory(parsed_dir);
-	return true;
+	return fat32_flush(info);
 }
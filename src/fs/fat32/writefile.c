@@ -43,5 +43,6 @@ bool fat32_write_file(void* f, uint64_t start, uint32_t length, unsigned char* b
 		cluster = get_fat_entry(info, cluster);
 		current_pos += info->clustersize;
 	}
+	/* Clusters added for an append reach the disk on close, SYNC or the next flush */
 	return true;
 }
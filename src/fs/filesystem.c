@@ -149,13 +149,10 @@ __attribute__((unused)) void *udata) {
 	return strcasecmp(ua->path, ub->path);
 }
 
-/* ASCII-only, case-insensitive path hash.
+/* ASCII-only, case-insensitive name hash.
  * Must mirror the semantics of strcasecmp() used in path_compare().
  */
-uint64_t path_hash(const void *item, uint64_t seed0, uint64_t seed1) {
-	const vfs_tree_t* a = (const vfs_tree_t*)item;
-	const char* s = a->path;
-
+uint64_t fs_name_hash(const char* s, uint64_t seed0, uint64_t seed1) {
 	/* FNV-1a 64-bit offset basis, perturbed by seed0. */
 	uint64_t h = 1469598103934665603ULL ^ seed0;
 
@@ -172,6 +169,11 @@ uint64_t path_hash(const void *item, uint64_t seed0, uint64_t seed1) {
 	return h;
 }
 
+uint64_t path_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+	const vfs_tree_t* a = (const vfs_tree_t*)item;
+	return fs_name_hash(a->path, seed0, seed1);
+}
+
 
 bool vfs_path_add_child(const char* path, const char* child) {
 	struct vfs_tree_t* exists = hashmap_get(vfs_hash, &(vfs_tree_t){ .path = path });
@@ -344,9 +346,44 @@ void storage_disable_cache(storage_device_t *sd) {
 	if (!sd || !sd->cache) {
 		return;
 	}
+	block_cache_set_write_back(sd->cache, false);
 	block_cache_destroy(&sd->cache);
 }
 
+bool storage_set_write_back(storage_device_t *sd, bool enable) {
+	if (!sd || !sd->cache || !sd->blockwrite || (enable && sd->ui.is_optical)) {
+		return false;
+	}
+	block_cache_set_write_back(sd->cache, enable);
+	return true;
+}
+
+bool storage_flush(storage_device_t *sd) {
+	if (!sd) {
+		fs_set_error(FS_ERR_NO_SUCH_DEVICE);
+		return false;
+	}
+	if (!sd->cache || !block_cache_is_write_back(sd->cache)) {
+		return true;
+	}
+	return block_cache_flush(sd->cache);
+}
+
+bool storage_flush_all(void) {
+	bool ok = true;
+	for (storage_device_t *sd = storagedevices; sd; sd = sd->next) {
+		ok = storage_flush(sd) && ok;
+	}
+	return ok;
+}
+
+/**
+ * @brief Foreground idle task which writes back write-back caches
+ */
+static void storage_flusher(void) {
+	storage_flush_all();
+}
+
 storage_device_t* find_storage_device(const char* name)
 {
 	storage_device_t* cur = storagedevices;
@@ -391,17 +428,8 @@ int read_storage_device(const char* name, uint64_t start_block, uint32_t bytes,
 	}
 
 	if (cur->cache) {
-		if (block_cache_read(cur->cache, start_block, bytes, data)) {
-			return 1;
-		}
-
-		if (!cur->blockread(cur, start_block, bytes, data)) {
-			return 0;
-		}
-
-		/* Prime the cache with what we just read; ignore result */
-		block_cache_write(cur->cache, start_block, bytes, data);
-		return 1;
+		/* Serves what it holds and fetches only the missing sectors */
+		return block_cache_read(cur->cache, start_block, bytes, data);
 	}
 
 	if (!cur->blockread(cur, start_block, bytes, data)) {
@@ -419,7 +447,12 @@ int write_storage_device(const char* name, uint64_t start_block, uint32_t bytes,
 		return 0;
 	}
 
-	/* Always write the device first */
+	/* In write-back mode the cache holds the write until the next flush */
+	if (cur->cache && block_cache_write_back(cur->cache, start_block, bytes, data)) {
+		return 1;
+	}
+
+	/* Otherwise write the device first */
 	if (!cur->blockwrite(cur, start_block, bytes, data)) {
 		return 0;
 	}
@@ -457,7 +490,13 @@ int alloc_filehandle(fs_handle_type_t type, fs_directory_entry_t* file, uint32_t
 			filehandles[fd_last]->inbufsize = ibufsz;
 			filehandles[fd_last]->outbufsize = obufsz;
 			filehandles[fd_last]->inbufpos = 0;
+			filehandles[fd_last]->inbuflen = 0;
 			filehandles[fd_last]->outbufpos = 0;
+			filehandles[fd_last]->outbuflen = 0;
+			filehandles[fd_last]->ra_window = ibufsz;
+			filehandles[fd_last]->ra_next = 0;
+			process_t* proc = proc_cur(logical_cpu_id());
+			filehandles[fd_last]->owner = proc ? proc->pid : 0;
 			if (ibufsz) {
 				filehandles[fd_last]->inbuf = kmalloc(ibufsz);
 			} else {
@@ -468,6 +507,10 @@ int alloc_filehandle(fs_handle_type_t type, fs_directory_entry_t* file, uint32_t
 			} else {
 				filehandles[fd_last]->outbuf = NULL;
 			}
+			if (!filehandles[fd_last]->outbuf) {
+				/* Without an output buffer, writes go straight to the driver */
+				filehandles[fd_last]->outbufsize = 0;
+			}
 
 			fd_alloc++;
 			int ret = (int)fd_last;
@@ -601,6 +644,7 @@ fs_directory_entry_t* fs_create_file(const char* pathandfile, size_t bytes)
 			new_entry->next = directory->files;
 			new_entry->size = bytes;
 			directory->files = new_entry;
+			fs_dir_index_add(directory, new_entry, NULL);
 		}
 	}
 	kfree_null(&pathname);
@@ -704,7 +748,9 @@ fs_directory_entry_t* fs_create_directory(const char* pathandfile)
 			new_dir->opaque = directory->opaque;
 			new_dir->responsible_driver = directory->responsible_driver;
 			new_dir->size = 0;
+			new_dir->index = NULL;
 			directory->child_dirs = new_dir;
+			fs_dir_index_add(directory, new_entry, new_dir);
 		}
 	}
 	kfree_null(&pathname);
@@ -754,38 +800,86 @@ int _open(const char* filename, int oflag)
 
 	/* Allocate a file handle.
 	 */
-	int fd = alloc_filehandle(type, file, IOBUFSZ, 0);
+	int fd = alloc_filehandle(type, file, IOBUFSZ, type == file_input ? 0 : IOBUFSZ);
 	if (fd == -1) {
 		fs_set_error(FS_ERR_NO_MORE_FDS);
 		dprintf("_open: out of descriptors opening %s\n", filename);
 		return -1;
 	}
 
-	filehandles[fd]->cached = 0;
 	if (type == file_random || type == file_input) {
 		/* Read an initial buffer into the structure up to fd->inbufsize in size */
-		if (!fs_read_file(filehandles[fd]->file, filehandles[fd]->seekpos, file->size <= filehandles[fd]->inbufsize ? file->size : filehandles[fd]->inbufsize, filehandles[fd]->inbuf)) {
+		size_t initial = file->size <= filehandles[fd]->inbufsize ? file->size : filehandles[fd]->inbufsize;
+		if (!fs_read_file(filehandles[fd]->file, filehandles[fd]->seekpos, initial, filehandles[fd]->inbuf)) {
 			/* If we couldn't get the initial buffer, there is something wrong.
 			* Give up the filehandle and return error.
 			*/
 			destroy_filehandle(fd);
 			dprintf("_open: failed to read initial buffer for %s\n", filename);
 			return -1;
-		} else {
-			if (file->size <= filehandles[fd]->inbufsize) {
-				filehandles[fd]->cached = 1;
-			}
 		}
+		filehandles[fd]->inbuflen = initial;
 	}
 
 	/* Return the allocated file descriptor */
 	return fd;
 }
 
-/* Write out buffered data to a file open for writing */
-void flush_filehandle([[maybe_unused]] uint32_t descriptor)
+bool flush_filehandle(uint32_t descriptor)
 {
-	/* Until we have writeable filesystems this is a stub */
+	if (descriptor >= FD_MAX || filehandles[descriptor] == NULL) {
+		fs_set_error(FS_ERR_INVALID_FD);
+		return false;
+	}
+
+	fs_handle_t* handle = filehandles[descriptor];
+	if (handle->outbuflen == 0) {
+		return true;
+	}
+
+	size_t length = handle->outbuflen;
+	if (!fs_write_file(handle->file, handle->outbufpos, length, handle->outbuf)) {
+		/* Kept buffered, so a later flush or close can try again */
+		return false;
+	}
+	handle->outbuflen = 0;
+
+	if (handle->outbufpos + length > handle->file->size) {
+		/* Underlying driver will extend file too */
+		handle->file->size = handle->outbufpos + length;
+	}
+	return true;
+}
+
+bool flush_all_filehandles(void)
+{
+	bool ok = true;
+	for (uint32_t fd = 0; fd < FD_MAX; ++fd) {
+		if (filehandles[fd] && filehandles[fd]->outbuflen) {
+			ok = flush_filehandle(fd) && ok;
+		}
+	}
+	return ok;
+}
+
+bool flush_process_filehandles(uint64_t owner)
+{
+	bool ok = true;
+	for (uint32_t fd = 0; fd < FD_MAX; ++fd) {
+		if (filehandles[fd] && filehandles[fd]->owner == owner && filehandles[fd]->outbuflen) {
+			ok = flush_filehandle(fd) && ok;
+		}
+	}
+	return ok;
+}
+
+void close_process_filehandles(uint64_t owner)
+{
+	for (uint32_t fd = 0; fd < FD_MAX; ++fd) {
+		if (filehandles[fd] && filehandles[fd]->owner == owner && _close(fd) < 0) {
+			dprintf("Closing fd %u of process %lu: %s\n", fd, owner, fs_strerror(fs_get_error()));
+		}
+	}
 }
 
 /* Close an open file descriptor */
@@ -798,11 +892,14 @@ int _close(uint32_t descriptor)
 	}
 
 	/* Flush any files that arent readonly */
+	bool flushed = true;
 	if (filehandles[descriptor]->type != file_input) {
-		flush_filehandle(descriptor);
+		/* A closed file is also written out of any write-back disk cache */
+		flushed = flush_filehandle(descriptor) && storage_flush_all();
 	}
 
-	return destroy_filehandle(descriptor) ? 0 : -1;
+	/* The handle is released even if the flush failed, but the error is reported */
+	return destroy_filehandle(descriptor) && flushed ? 0 : -1;
 }
 
 int64_t _lseek(int fd, uint64_t offset, uint64_t origin)
@@ -810,20 +907,23 @@ int64_t _lseek(int fd, uint64_t offset, uint64_t origin)
 	if (fd < 0 || fd >= FD_MAX || filehandles[fd] == NULL) {
 		return -1;
 	} else {
+		/* Flush output before seeking, so the file size is current */
+		if (!flush_filehandle(fd)) {
+			return -1;
+		}
 		if (origin > filehandles[fd]->file->size || offset > filehandles[fd]->file->size - origin) {
 			/* Do not allow seeking past end */
 			fs_set_error(FS_ERR_SEEK_PAST_END);
 			return -1;
 		} else {
-			filehandles[fd]->seekpos = offset + origin;
-			/* Flush output before seeking */
-			flush_filehandle(fd);
-			/* Refresh input buffer */
-			if (filehandles[fd]->type != file_output && filehandles[fd]->seekpos < filehandles[fd]->file->size) {
-				if (!fs_read_file(filehandles[fd]->file, filehandles[fd]->seekpos, filehandles[fd]->inbufsize, filehandles[fd]->inbuf)) {
-					return -1;
-				}
+			/* A real seek ends any sequential run, so read-ahead starts again
+			 * from the smallest window. The input buffer is kept, as the new
+			 * position may still fall within it, and is refilled on demand.
+			 */
+			if (offset + origin != filehandles[fd]->seekpos) {
+				filehandles[fd]->ra_window = IOBUFSZ;
 			}
+			filehandles[fd]->seekpos = offset + origin;
 			return filehandles[fd]->seekpos;
 		}
 	}
@@ -838,6 +938,43 @@ int64_t _tell(int fd)
 	return (fd < 0 || fd >= FD_MAX || filehandles[fd] == NULL) ? -1 : (int64_t)filehandles[fd]->seekpos;
 }
 
+/**
+ * @brief Refill a handle's input buffer with the file data starting at pos.
+ * A read which carries on from where the previous one ended doubles the
+ * read-ahead window, up to FS_READAHEAD_MAX, so a streaming reader makes
+ * ever fewer and larger requests of the filesystem driver. Any other read
+ * drops the window back to IOBUFSZ.
+ */
+static bool fill_filehandle(fs_handle_t* handle, size_t pos)
+{
+	if (pos == handle->ra_next) {
+		handle->ra_window = MIN(handle->ra_window * 2, FS_READAHEAD_MAX);
+	} else {
+		handle->ra_window = IOBUFSZ;
+	}
+
+	if (handle->ra_window > handle->inbufsize) {
+		/* The old contents are about to be replaced, so there is nothing to copy */
+		uint8_t* grown = kmalloc(handle->ra_window);
+		if (grown) {
+			kfree_null(&handle->inbuf);
+			handle->inbuf = grown;
+			handle->inbufsize = handle->ra_window;
+		} else {
+			handle->ra_window = handle->inbufsize;
+		}
+	}
+
+	size_t length = MIN(handle->ra_window, handle->file->size - pos);
+	handle->inbuflen = 0;
+	if (!fs_read_file(handle->file, pos, length, handle->inbuf)) {
+		return false;
+	}
+	handle->inbufpos = pos;
+	handle->inbuflen = length;
+	return true;
+}
+
 /* Read bytes from an open file */
 int _read(int fd, void *buffer, unsigned int count)
 {
@@ -847,66 +984,58 @@ int _read(int fd, void *buffer, unsigned int count)
 		return -1;
 	}
 
+	fs_handle_t* handle = filehandles[fd];
+
 	/* can't read from a write-only handle */
-	if (filehandles[fd]->type == file_output) {
+	if (handle->type == file_output) {
 		fs_set_error(FS_ERR_NOT_OPEN_FOR_INPUT);
 		return -1;
 	}
 
-	if (filehandles[fd]->seekpos >= filehandles[fd]->file->size) {
+	/* Anything written through this handle must be read back */
+	if (!flush_filehandle(fd)) {
+		return -1;
+	}
+
+	if (handle->seekpos >= handle->file->size) {
 		return 0;
 	}
 
 	/* Check that the size of the request and current position
 	 * don't place any part of the buffer past the bounds of the file
 	 */
-	if ((filehandles[fd]->seekpos + count) > filehandles[fd]->file->size) {
+	if ((handle->seekpos + count) > handle->file->size) {
 		/* Request too large, truncate it to EOF */
-		count = filehandles[fd]->file->size - filehandles[fd]->seekpos;
-	}
-
-	if (((filehandles[fd]->seekpos % filehandles[fd]->inbufsize) + count) > filehandles[fd]->inbufsize) {
-		/* The requested buffer size is too large to read in one operation.
-		 * Continually read into the input buffer in filehandles[fd]->inbufsize
-		 * chunks maximum until all data is read.
-		 */
-		int readbytes = 0;
-		while (count > 0) {
-			int rb;
-			if (count > filehandles[fd]->inbufsize) {
-				rb = filehandles[fd]->inbufsize;
-			} else {
-				rb = count;
+		count = handle->file->size - handle->seekpos;
+	}
+
+	unsigned char* out = (unsigned char*)buffer;
+	size_t remaining = count;
+	while (remaining > 0) {
+		if (handle->seekpos < handle->inbufpos || handle->seekpos >= handle->inbufpos + handle->inbuflen) {
+			if (remaining >= handle->ra_window) {
+				/* At least a whole window is wanted, so read it straight into
+				 * the caller's buffer rather than copying through ours.
+				 */
+				if (!fs_read_file(handle->file, handle->seekpos, remaining, out)) {
+					return -1;
+				}
+				handle->seekpos += remaining;
+				break;
 			}
-			if (!fs_read_file(filehandles[fd]->file, filehandles[fd]->seekpos, rb, filehandles[fd]->inbuf)) {
+			if (!fill_filehandle(handle, handle->seekpos)) {
 				return -1;
 			}
-
-			memcpy(((unsigned char*)buffer) + readbytes, filehandles[fd]->inbuf, rb);
-
-			filehandles[fd]->seekpos += rb;
-			readbytes += rb;
-			count -= rb;
 		}
-		count = readbytes;
-
-
-	} else {
-		/* we can do the entire read from only the current IO buffer */
-
-		/* Read the entire lot in one go */
-		if (filehandles[fd]->cached == 0) {
-			if (!fs_read_file(filehandles[fd]->file, filehandles[fd]->seekpos, count, filehandles[fd]->inbuf)) {
-				return -1;
-			}
-			memcpy(buffer, filehandles[fd]->inbuf, count);
-		} else {
-			memcpy(buffer, filehandles[fd]->inbuf + filehandles[fd]->seekpos, count);
-		}
-
-		filehandles[fd]->seekpos += count;
+		size_t offset = handle->seekpos - handle->inbufpos;
+		size_t part = MIN(remaining, handle->inbuflen - offset);
+		memcpy(out, handle->inbuf + offset, part);
+		out += part;
+		handle->seekpos += part;
+		remaining -= part;
 	}
 
+	handle->ra_next = handle->seekpos;
 	return count;
 }
 
@@ -924,6 +1053,10 @@ int ftruncate(int fd, uint32_t length)
 		return -1;
 	}
 
+	if (!flush_filehandle(fd)) {
+		return -1;
+	}
+
 	if (length > filehandles[fd]->file->size) {
 		fs_set_error(FS_ERR_TRUNCATE_BEYOND_LENGTH);
 		return -1;
@@ -934,6 +1067,7 @@ int ftruncate(int fd, uint32_t length)
 	}
 
 	filehandles[fd]->file->size = length;
+	filehandles[fd]->inbuflen = 0;
 
 	if (filehandles[fd]->seekpos > filehandles[fd]->file->size) {
 		filehandles[fd]->seekpos = filehandles[fd]->file->size;
@@ -952,22 +1086,42 @@ int _write(int fd, void *buffer, unsigned int count)
 		return -1;
 	}
 
+	fs_handle_t* handle = filehandles[fd];
+
 	/* can't write to a read-only handle */
-	if (filehandles[fd]->type == file_input) {
+	if (handle->type == file_input) {
 		fs_set_error(FS_ERR_NOT_OPEN_FOR_OUTPUT);
 		return -1;
 	}
 
-	if (!fs_write_file(filehandles[fd]->file, filehandles[fd]->seekpos, count, buffer)) {
-		return -1;
+	/* Anything read ahead may now be stale */
+	handle->inbuflen = 0;
+
+	/* Only a write carrying straight on from the buffered data can join it */
+	if (handle->outbuflen && (handle->seekpos != handle->outbufpos + handle->outbuflen || handle->outbuflen + count > handle->outbufsize)) {
+		if (!flush_filehandle(fd)) {
+			return -1;
+		}
 	}
 
-	if (filehandles[fd]->seekpos >= filehandles[fd]->file->size) {
-		/* Underlying driver will extend file too */
-		filehandles[fd]->file->size = filehandles[fd]->seekpos + count;
+	if (count >= handle->outbufsize) {
+		/* Too big to be worth buffering, the driver gets it in one go */
+		if (!fs_write_file(handle->file, handle->seekpos, count, buffer)) {
+			return -1;
+		}
+		if (handle->seekpos + count > handle->file->size) {
+			/* Underlying driver will extend file too */
+			handle->file->size = handle->seekpos + count;
+		}
+	} else {
+		if (handle->outbuflen == 0) {
+			handle->outbufpos = handle->seekpos;
+		}
+		memcpy(handle->outbuf + handle->outbuflen, buffer, count);
+		handle->outbuflen += count;
 	}
 
-	filehandles[fd]->seekpos += count;
+	handle->seekpos += count;
 	return count;
 }
 
@@ -975,8 +1129,12 @@ int _eof(int fd)
 {
 	if (fd < 0 || fd >= FD_MAX || filehandles[fd] == NULL) {
 		fs_set_error(FS_ERR_INVALID_FD);
+		return -1;
 	}
-	return (fd < 0 || fd >= FD_MAX || filehandles[fd] == NULL) ? -1 : (filehandles[fd]->seekpos >= filehandles[fd]->file->size);
+	/* Buffered writes past the end have not reached the file size yet */
+	const fs_handle_t* handle = filehandles[fd];
+	size_t size = MAX(handle->file->size, handle->outbufpos + handle->outbuflen);
+	return handle->seekpos >= size;
 }
 
 void retrieve_node_from_driver(fs_tree_t* node)
@@ -1001,6 +1159,8 @@ void retrieve_node_from_driver(fs_tree_t* node)
 		return;
 	}
 
+	/* The entries are about to be replaced */
+	fs_dir_index_drop(node);
 	node->files = driver->getdir(node);
 	node->dirty = 0;
 	node->child_dirs = NULL;
@@ -1038,6 +1198,7 @@ void retrieve_node_from_driver(fs_tree_t* node)
 			newnode->dirty = 1;
 			newnode->parent = node;
 			newnode->responsible_driver = node->responsible_driver;
+			newnode->index = NULL;
 
 			newnode->next = node->child_dirs;
 			node->child_dirs = newnode;
@@ -1072,6 +1233,11 @@ fs_tree_t* walk_to_node_internal(fs_tree_t* current_node, dirstack_t* dir_stack)
 	   Only consider immediate children named like the next segment.
 	   Do NOT recurse into non-matching branches (prevents /a from
 	   “finding” /x/.../a by DFS). */
+	fs_directory_entry_t* entry;
+	fs_tree_t* indexed;
+	if (dir_stack->name && fs_dir_index_lookup(current_node, dir_stack->name, true, &entry, &indexed)) {
+		return indexed ? walk_to_node_internal(indexed, dir_stack->next) : NULL;
+	}
 	for (fs_tree_t *child = current_node->child_dirs; child; child = child->next) {
 		if (child->name && dir_stack->name && strcasecmp(child->name, dir_stack->name) == 0) {
 			/* consume exactly one segment and descend */
@@ -1105,6 +1271,14 @@ fs_tree_t* walk_to_node(fs_tree_t* current_node, const char* path)
 	if (!strcmp(path, "/")) {
 		return fs_tree;
 	}
+	/* Paths from the root are looked up in the resolved path cache first */
+	uint64_t generation = fs_dcache_generation();
+	if (current_node == fs_tree) {
+		fs_tree_t* cached = fs_dcache_find_dir(path);
+		if (cached) {
+			return cached;
+		}
+	}
 	/* First build the dir stack */
 	dirstack_t* ds = kmalloc(sizeof(dirstack_t));
 	if (!ds) {
@@ -1141,6 +1315,9 @@ fs_tree_t* walk_to_node(fs_tree_t* current_node, const char* path)
 		kfree_null(&ds);
 		ds = next;
 	}
+	if (result && current_node == fs_tree) {
+		fs_dcache_add_dir(path, result, generation);
+	}
 	return result;
 }
 
@@ -1150,7 +1327,12 @@ fs_directory_entry_t* find_file_in_dir(fs_tree_t* directory, const char* filenam
 		return NULL;
 	}
 
-	fs_directory_entry_t* entry = (fs_directory_entry_t*)directory->files;
+	fs_directory_entry_t* entry;
+	fs_tree_t* node;
+	if (fs_dir_index_lookup(directory, filename, false, &entry, &node)) {
+		return entry;
+	}
+	entry = (fs_directory_entry_t*)directory->files;
 	for (; entry; entry = entry->next) {
 		/* Don't find directories, only files */
 		if (((entry->flags & FS_DIRECTORY) == 0) && (!strcasecmp(filename, entry->filename))) {
@@ -1167,7 +1349,12 @@ fs_directory_entry_t* find_dir_in_dir(fs_tree_t* directory, const char* filename
 		return NULL;
 	}
 
-	fs_directory_entry_t* entry = (fs_directory_entry_t*)directory->files;
+	fs_directory_entry_t* entry;
+	fs_tree_t* node;
+	if (fs_dir_index_lookup(directory, filename, true, &entry, &node)) {
+		return entry;
+	}
+	entry = (fs_directory_entry_t*)directory->files;
 	for (; entry; entry = entry->next) {
 		/* Don't find directories, only files */
 		if ((entry->flags & FS_DIRECTORY) && (!strcasecmp(filename, entry->filename)))
@@ -1218,6 +1405,7 @@ void delete_tree_node(fs_tree_t** head_ref, const char* name)
 
 	if (temp != NULL && !strcasecmp(temp->name, name)) {
 		*head_ref = temp->next;
+		fs_dir_index_drop(temp);
 		kfree_null(&temp);
 		return;
 	}
@@ -1233,6 +1421,7 @@ void delete_tree_node(fs_tree_t** head_ref, const char* name)
 	if (prev) {
 		prev->next = temp->next;
 	}
+	fs_dir_index_drop(temp);
 	kfree_null(&temp);
 }
 
@@ -1318,6 +1507,7 @@ bool fs_delete_file(const char* pathandfile)
 			rv = directory->responsible_driver->rm(directory, filename);
 			/* Remove the deleted file from the fs_tree_t */
 			if (rv) {
+				fs_dir_index_remove(directory, filename, false);
 				delete_file_node(&(directory->files), filename);
 			}
 		} else {
@@ -1384,6 +1574,7 @@ bool fs_delete_directory(const char* pathandfile)
 			rv = directory->responsible_driver->rmdir(directory, filename);
 			/* Remove the deleted file from the fs_tree_t */
 			if (rv) {
+				fs_dir_index_remove(directory, filename, true);
 				delete_file_node(&(directory->files), filename);
 				delete_tree_node(&(directory->child_dirs), filename);
 			}
@@ -1415,6 +1606,12 @@ fs_directory_entry_t* fs_get_file_info(const char* pathandfile)
 		return NULL;
 	}
 
+	uint64_t generation = fs_dcache_generation();
+	fs_directory_entry_t* cached = fs_dcache_find_file(pathandfile);
+	if (cached) {
+		return cached;
+	}
+
 	/* First, split the path and file components */
 	uint32_t namelen = strlen(pathandfile);
 	char* pathinfo = strdup(pathandfile);
@@ -1447,6 +1644,9 @@ fs_directory_entry_t* fs_get_file_info(const char* pathandfile)
 		return NULL;
 	}
 	fs_directory_entry_t* fileinfo = find_file_in_dir(directory, filename);
+	if (fileinfo) {
+		fs_dcache_add_file(pathandfile, fileinfo, generation);
+	}
 	kfree_null(&pathname);
 	kfree_null(&filename);
 	return fileinfo;
@@ -1461,6 +1661,7 @@ int attach_filesystem(const char* virtual_path, filesystem_t* fs, void* opaque)
 		fs_set_error(FS_ERR_NO_SUCH_DIRECTORY);
 		return 0;
 	}
+	fs_dir_index_drop(item);
 	item->responsible_driver = (void*)fs;
 	item->name = !strcmp(virtual_path, "/") ? strdup("/") : fs_get_name_part(virtual_path);
 	item->opaque = opaque;
@@ -1505,8 +1706,11 @@ void init_filesystem()
 	fs_tree->files = NULL;
 	fs_tree->dirty = 0;
 	fs_tree->opaque = NULL;
+	fs_tree->index = NULL;
 
 	attach_filesystem("/", filesystems, NULL);
+
+	proc_register_idle(storage_flusher, IDLE_FOREGROUND, BLOCK_CACHE_FLUSH_MS);
 }
 
 fs_directory_entry_t* fs_get_items(const char* pathname)
@@ -1546,16 +1750,10 @@ bool fs_is_directory(const char* path)
 		kfree_null(&pathname);
 		return false;
 	}
-	for (fs_directory_entry_t* ent = item->files; ent; ent = ent->next) {
-		if (strcasecmp(ent->filename, filename) == 0) {
-			kfree_null(&filename);
-			kfree_null(&pathname);
-			return (ent->flags & FS_DIRECTORY) != 0;
-		}
-	}
+	bool is_dir = find_dir_in_dir(item, filename) != NULL;
 	kfree_null(&filename);
 	kfree_null(&pathname);
-	return false;
+	return is_dir;
 }
 
 int filesystem_mount(const char* pathname, const char* device, const char* filesystem_driver, int partition_index)
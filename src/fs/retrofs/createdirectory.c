@@ -104,6 +104,10 @@ uint64_t rfs_create_directory(void *dir, const char *name) {
 		}
 	}
 
+	if (!rfs_flush(info)) {
+		return 0;
+	}
+
 	/* Return on-disk address of new directory */
 	return start_sector;
 }
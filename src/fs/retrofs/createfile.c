@@ -91,6 +91,11 @@ fs_directory_entry_t *rfs_upsert_directory_entry(fs_directory_entry_t *file, uin
 				/* Update existing entry; preserve case from file->filename */
 				memset(e->filename, 0, RFS_MAX_NAME);
 				strlcpy(e->filename, file->filename, RFS_MAX_NAME);
+				if (e->sector_start != file->lbapos || e->sector_length != sector_extent) {
+					/* Replacing the first extent replaces the whole list */
+					memset(e->extents, 0, sizeof(e->extents));
+					rfs_forget_extents(info, e->sector_start);
+				}
 				e->sector_start = file->lbapos;
 				e->length = file->size;
 				e->sector_length = sector_extent;
@@ -131,6 +136,7 @@ fs_directory_entry_t *rfs_upsert_directory_entry(fs_directory_entry_t *file, uin
 		e->sector_start = file->lbapos;
 		e->length = file->size;
 		e->sector_length = sector_extent;
+		memset(e->extents, 0, sizeof(e->extents));
 		e->flags = 0;
 		if ((file->flags & FS_DIRECTORY) != 0) {
 			e->flags |= RFS_FLAG_DIRECTORY;
@@ -278,7 +284,9 @@ uint64_t rfs_create_file(void *dir, const char *name, size_t size) {
 		dprintf("Invalid reservation (would trample root)\n");
 		return 0;
 	}
-	/* 4) Zero the allocated extent (security) */
+	/* 4) Zero the sectors the initial size exposes (security); the rest of
+	 * the reservation is zeroed by whichever write or truncate exposes it. */
+	const uint64_t exposed_sectors = rfs_bytes_to_sectors(size);
 	const uint64_t chunk_sectors = RFS_MAP_READ_CHUNK_SECTORS; /* 128 sectors = 64 KiB */
 	const size_t chunk_bytes = (size_t) (chunk_sectors * RFS_SECTOR_SIZE);
 	unsigned char *zero = (unsigned char *) kmalloc(chunk_bytes);
@@ -293,7 +301,7 @@ uint64_t rfs_create_file(void *dir, const char *name, size_t size) {
 		return 0;
 	}
 
-	uint64_t remaining = reserve_sectors, pos = start_sector;
+	uint64_t remaining = exposed_sectors, pos = start_sector;
 	while (remaining) {
 		uint64_t this_sectors = (remaining > chunk_sectors) ? chunk_sectors : remaining;
 		uint64_t this_bytes = this_sectors * RFS_SECTOR_SIZE;
@@ -321,6 +329,10 @@ uint64_t rfs_create_file(void *dir, const char *name, size_t size) {
 		return 0;
 	}
 
+	if (!rfs_flush(info)) {
+		return 0;
+	}
+
 	/* VFS contract: return on-disk address */
 	return start_sector;
 }
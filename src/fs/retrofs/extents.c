@@ -0,0 +1,290 @@
+/**
+ * @file extents.c
+ * @brief RetroFS file extent lists
+ *
+ * A version 1 file is a single run of sectors, sector_start/sector_length in
+ * its directory entry. Version 2 entries can also list up to
+ * RFS_INLINE_EXTENTS more runs which carry on the file in order, so a file
+ * that outgrows its reservation can take another free run rather than
+ * being copied somewhere bigger. This file maps byte ranges of a file
+ * through its extent list to device I/O, and keeps a small per-volume cache
+ * of extent lists, keyed by the file's first sector, so the read and write
+ * paths usually do not need to search the directory.
+ */
+#include <kernel.h>
+#include <retrofs.h>
+
+void rfs_entry_extents(const rfs_t *info, const rfs_directory_entry_inner_t *entry, rfs_file_extents_t *out) {
+	memset(out, 0, sizeof(*out));
+	if (entry->sector_length == 0) {
+		return;
+	}
+	out->extent[0].start = entry->sector_start;
+	out->extent[0].sectors = entry->sector_length;
+	out->count = 1;
+	if (info->version < 2) {
+		/* Version 1 kept nothing defined in the rest of the entry */
+		return;
+	}
+	for (size_t i = 0; i < RFS_INLINE_EXTENTS && entry->extents[i].sectors != 0; i++) {
+		out->extent[out->count++] = entry->extents[i];
+	}
+}
+
+uint64_t rfs_extents_sectors(const rfs_file_extents_t *list) {
+	uint64_t total = 0;
+	for (uint64_t i = 0; i < list->count; i++) {
+		total += list->extent[i].sectors;
+	}
+	return total;
+}
+
+static rfs_file_extents_t *rfs_extent_cache_find(rfs_t *info, uint64_t first_sector) {
+	if (first_sector == 0) {
+		return NULL;
+	}
+	for (size_t i = 0; i < RFS_EXTENT_CACHE_SIZE; i++) {
+		rfs_file_extents_t *c = &info->extent_cache[i];
+		if (c->count != 0 && c->extent[0].start == first_sector) {
+			return c;
+		}
+	}
+	return NULL;
+}
+
+static void rfs_extent_cache_store(rfs_t *info, const rfs_file_extents_t *list) {
+	if (list->count == 0) {
+		return;
+	}
+	rfs_file_extents_t *slot = rfs_extent_cache_find(info, list->extent[0].start);
+	if (!slot) {
+		slot = &info->extent_cache[info->extent_cache_next];
+		info->extent_cache_next = (info->extent_cache_next + 1) % RFS_EXTENT_CACHE_SIZE;
+	}
+	*slot = *list;
+}
+
+void rfs_forget_extents(rfs_t *info, uint64_t first_sector) {
+	rfs_file_extents_t *c = rfs_extent_cache_find(info, first_sector);
+	if (c) {
+		c->count = 0;
+	}
+}
+
+bool rfs_file_extents(rfs_t *info, fs_directory_entry_t *file, rfs_file_extents_t *out) {
+	rfs_file_extents_t *c = rfs_extent_cache_find(info, file->lbapos);
+	if (c) {
+		*out = *c;
+		return true;
+	}
+
+	rfs_directory_entry_inner_t ent;
+	if (!rfs_locate_entry(info, (fs_tree_t *) file->directory, file->filename, NULL, NULL, &ent)) {
+		fs_set_error(FS_ERR_NO_SUCH_FILE);
+		return false;
+	}
+	if ((ent.flags & RFS_FLAG_DIRECTORY) != 0) {
+		fs_set_error(FS_ERR_NOT_A_FILE);
+		return false;
+	}
+	rfs_entry_extents(info, &ent, out);
+	rfs_extent_cache_store(info, out);
+	return true;
+}
+
+bool rfs_update_file_entry(rfs_t *info, fs_tree_t *tree, const char *name, const rfs_file_extents_t *list, uint64_t length) {
+	uint64_t blk_sector = 0;
+	size_t blk_index = 0;
+	if (!rfs_locate_entry(info, tree, name, &blk_sector, &blk_index, NULL)) {
+		fs_set_error(FS_ERR_NO_SUCH_FILE);
+		return false;
+	}
+
+	/* Entry i of a block is its (i + 1)th half-sector, after the block's start entry */
+	const uint64_t offset = (blk_index + 1) * sizeof(rfs_directory_entry_t);
+	const uint64_t sector = blk_sector + offset / RFS_SECTOR_SIZE;
+	rfs_directory_entry_t halves[RFS_SECTOR_SIZE / sizeof(rfs_directory_entry_t)];
+	if (!rfs_read_device(info, sector, RFS_SECTOR_SIZE, halves)) {
+		return false;
+	}
+
+	rfs_directory_entry_inner_t *e = &halves[(offset % RFS_SECTOR_SIZE) / sizeof(rfs_directory_entry_t)].entry;
+	const uint64_t old_first = e->sector_start;
+	e->length = length;
+	if (list) {
+		e->sector_start = list->count ? list->extent[0].start : 0;
+		e->sector_length = list->count ? list->extent[0].sectors : 0;
+		for (size_t i = 0; i < RFS_INLINE_EXTENTS; i++) {
+			e->extents[i] = (i + 1 < list->count) ? list->extent[i + 1] : (rfs_extent_t) {0};
+		}
+	}
+	if (!rfs_write_device(info, sector, RFS_SECTOR_SIZE, halves)) {
+		return false;
+	}
+
+	if (list) {
+		rfs_forget_extents(info, old_first);
+		rfs_extent_cache_store(info, list);
+	}
+	return true;
+}
+
+/**
+ * @brief Find the device sector holding byte @p pos of a file, and how many
+ * bytes from there to the end of its extent.
+ */
+static bool rfs_map_offset(const rfs_file_extents_t *list, uint64_t pos, uint64_t *sector, uint64_t *run_bytes) {
+	uint64_t base = 0;
+	for (uint64_t i = 0; i < list->count; i++) {
+		const uint64_t bytes = list->extent[i].sectors * RFS_SECTOR_SIZE;
+		if (pos < base + bytes) {
+			*sector = list->extent[i].start + (pos - base) / RFS_SECTOR_SIZE;
+			*run_bytes = base + bytes - pos;
+			return true;
+		}
+		base += bytes;
+	}
+	return false;
+}
+
+/**
+ * @brief Read @p length bytes from contiguous sectors starting @p offset bytes into @p sector.
+ * Whole sectors go straight into the caller's buffer, partial ones at either end via a bounce sector.
+ */
+static bool rfs_read_span(rfs_t *info, uint64_t sector, size_t offset, uint64_t length, unsigned char *buffer) {
+	unsigned char bounce[RFS_SECTOR_SIZE];
+
+	if (offset || length < RFS_SECTOR_SIZE) {
+		const size_t part = MIN(RFS_SECTOR_SIZE - offset, length);
+		if (!rfs_read_device(info, sector, RFS_SECTOR_SIZE, bounce)) {
+			return false;
+		}
+		memcpy(buffer, bounce + offset, part);
+		buffer += part;
+		length -= part;
+		sector++;
+	}
+
+	while (length >= RFS_SECTOR_SIZE) {
+		const uint64_t secs = MIN(length / RFS_SECTOR_SIZE, RFS_MAP_READ_CHUNK_SECTORS);
+		if (!rfs_read_device(info, sector, secs * RFS_SECTOR_SIZE, buffer)) {
+			return false;
+		}
+		buffer += secs * RFS_SECTOR_SIZE;
+		length -= secs * RFS_SECTOR_SIZE;
+		sector += secs;
+	}
+
+	if (length) {
+		if (!rfs_read_device(info, sector, RFS_SECTOR_SIZE, bounce)) {
+			return false;
+		}
+		memcpy(buffer, bounce, length);
+	}
+	return true;
+}
+
+/**
+ * @brief Write @p length bytes to contiguous sectors starting @p offset bytes into @p sector,
+ * reading back partial sectors at either end. A NULL @p buffer writes from @p zero instead,
+ * which must hold RFS_MAP_READ_CHUNK_SECTORS zeroed sectors if any whole sectors are covered.
+ */
+static bool rfs_write_span(rfs_t *info, uint64_t sector, size_t offset, uint64_t length, const unsigned char *buffer, const unsigned char *zero) {
+	unsigned char bounce[RFS_SECTOR_SIZE];
+
+	if (offset || length < RFS_SECTOR_SIZE) {
+		const size_t part = MIN(RFS_SECTOR_SIZE - offset, length);
+		if (!rfs_read_device(info, sector, RFS_SECTOR_SIZE, bounce)) {
+			return false;
+		}
+		if (buffer) {
+			memcpy(bounce + offset, buffer, part);
+			buffer += part;
+		} else {
+			memset(bounce + offset, 0, part);
+		}
+		if (!rfs_write_device(info, sector, RFS_SECTOR_SIZE, bounce)) {
+			return false;
+		}
+		length -= part;
+		sector++;
+	}
+
+	while (length >= RFS_SECTOR_SIZE) {
+		const uint64_t secs = MIN(length / RFS_SECTOR_SIZE, RFS_MAP_READ_CHUNK_SECTORS);
+		if (!rfs_write_device(info, sector, secs * RFS_SECTOR_SIZE, buffer ? buffer : zero)) {
+			return false;
+		}
+		if (buffer) {
+			buffer += secs * RFS_SECTOR_SIZE;
+		}
+		length -= secs * RFS_SECTOR_SIZE;
+		sector += secs;
+	}
+
+	if (length) {
+		if (!rfs_read_device(info, sector, RFS_SECTOR_SIZE, bounce)) {
+			return false;
+		}
+		if (buffer) {
+			memcpy(bounce, buffer, length);
+		} else {
+			memset(bounce, 0, length);
+		}
+		if (!rfs_write_device(info, sector, RFS_SECTOR_SIZE, bounce)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool rfs_read_extents(rfs_t *info, const rfs_file_extents_t *list, uint64_t start, uint64_t length, unsigned char *buffer) {
+	while (length) {
+		uint64_t sector, run;
+		if (!rfs_map_offset(list, start, &sector, &run)) {
+			fs_set_error(FS_ERR_SEEK_PAST_END);
+			return false;
+		}
+		const uint64_t take = MIN(run, length);
+		if (!rfs_read_span(info, sector, start % RFS_SECTOR_SIZE, take, buffer)) {
+			return false;
+		}
+		buffer += take;
+		start += take;
+		length -= take;
+	}
+	return true;
+}
+
+bool rfs_write_extents(rfs_t *info, const rfs_file_extents_t *list, uint64_t start, uint64_t length, const unsigned char *buffer) {
+	unsigned char *zero = NULL;
+	if (!buffer && length >= RFS_SECTOR_SIZE) {
+		zero = kcalloc(1, RFS_MAP_READ_CHUNK_SECTORS * RFS_SECTOR_SIZE);
+		if (!zero) {
+			fs_set_error(FS_ERR_OUT_OF_MEMORY);
+			return false;
+		}
+	}
+
+	while (length) {
+		uint64_t sector, run;
+		if (!rfs_map_offset(list, start, &sector, &run)) {
+			fs_set_error(FS_ERR_SEEK_PAST_END);
+			kfree_null(&zero);
+			return false;
+		}
+		const uint64_t take = MIN(run, length);
+		if (!rfs_write_span(info, sector, start % RFS_SECTOR_SIZE, take, buffer, zero)) {
+			kfree_null(&zero);
+			return false;
+		}
+		if (buffer) {
+			buffer += take;
+		}
+		start += take;
+		length -= take;
+	}
+
+	kfree_null(&zero);
+	return true;
+}
@@ -16,7 +16,7 @@ bool rfs_format(rfs_t *info) {
 	}
 
 	rfs_description_block_padded_t description_block = {0};
-	description_block.desc.identifier = RFS_ID;
+	description_block.desc.identifier = RFS_ID_V2;
 	description_block.desc.sequence = 1;
 	description_block.desc.creation_time = time(NULL);
 	description_block.desc.free_space_map_checksum = 0;
@@ -77,6 +77,8 @@ bool rfs_format(rfs_t *info) {
 		return false;
 	}
 	memcpy(info->desc, &description_block, sizeof(rfs_description_block_padded_t));
+	info->version = 2;
+	memset(info->extent_cache, 0, sizeof(info->extent_cache));
 
 	if (!rfs_build_level_caches(info)) {
 		kprintf("Failed to build L1/L2 free space map cache\n");
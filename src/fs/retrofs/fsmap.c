@@ -631,6 +631,44 @@ bool rfs_find_free_extent(rfs_t *info, uint64_t need, uint64_t *out_start_sector
 	return false;
 }
 
+bool rfs_extent_is_free(rfs_t *info, uint64_t start_sector, uint64_t length_sectors) {
+	if (!info || !info->desc || length_sectors == 0) {
+		return false;
+	}
+	if (start_sector >= info->total_sectors || length_sectors > info->total_sectors - start_sector) {
+		return false;
+	}
+
+	const uint64_t G = RFS_L1_GROUP_SECTORS;
+	uint64_t pos = start_sector;
+	const uint64_t end = start_sector + length_sectors;
+
+	while (pos < end) {
+		const uint64_t g = pos / G;
+		const uint64_t gs = rfs_group_size(info, g);
+		const uint64_t local = pos - g * G;
+		const uint64_t span = MIN(gs - local, end - pos);
+
+		if (!bitset_get(info->l1_not_full, g)) {
+			return false;
+		}
+		if (!bitset_get(info->l1_all_free, g)) {
+			// Mixed: the answer is in this group's L0 sector
+			uint8_t l0[RFS_SECTOR_SIZE];
+			if (!rfs_load_group_sector(info, g, l0)) {
+				return false;
+			}
+			for (uint64_t b = local; b < local + span; ++b) {
+				if ((l0[b >> 3] >> (b & 7)) & 1u) {
+					return false;
+				}
+			}
+		}
+		pos += span;
+	}
+	return true;
+}
+
 static void rfs_free_level_caches(rfs_t *info) {
 	if (!info) {
 		return;
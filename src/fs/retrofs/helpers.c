@@ -58,6 +58,10 @@ bool rfs_clear_device(rfs_t *rfs, uint64_t start_sectors, uint64_t size_bytes) {
 	return storage_device_clear_blocks(rfs->dev, volume_start + start_sectors, size_bytes);
 }
 
+bool rfs_flush(rfs_t *rfs) {
+	return storage_flush(rfs->dev);
+}
+
 
 bool rfs_locate_entry(rfs_t *info, fs_tree_t *tree, const char *name, uint64_t *out_sector, size_t *out_index, rfs_directory_entry_inner_t *out_entry_copy) {
 	if (info == NULL || tree == NULL || name == NULL || name[0] == '\0') {
@@ -22,8 +22,13 @@ bool read_rfs_description_block(rfs_t *info) {
 		kfree_null(&description_block);
 		return false;
 	}
-	if (description_block->desc.identifier != RFS_ID) {
-		dprintf("Identifier %lx is not %lx (\"RetroFS1\")\n", description_block->desc.identifier, RFS_ID);
+	if (description_block->desc.identifier == RFS_ID_V2) {
+		info->version = 2;
+	} else if (description_block->desc.identifier == RFS_ID) {
+		/* Files stay single-extent, so the volume remains readable by older drivers */
+		info->version = 1;
+	} else {
+		dprintf("Identifier %lx is not %lx (\"RetroFS2\") or %lx (\"RetroFS1\")\n", description_block->desc.identifier, RFS_ID_V2, RFS_ID);
 		kfree_null(&description_block);
 		return false;
 	}
@@ -45,78 +45,10 @@ bool rfs_read_file(void* f, uint64_t start, uint32_t length, unsigned char* buff
 		return false;
 	}
 
-	/* Work out sectors to touch */
-	uint64_t file_start_sector = file->lbapos; /* start of file's extent */
-	uint64_t end_pos           = start + length;
-
-	uint64_t first_sector = file_start_sector + (start        / RFS_SECTOR_SIZE);
-	uint64_t last_sector  = file_start_sector + ((end_pos - 1) / RFS_SECTOR_SIZE);
-	size_t   head_off     = (start % RFS_SECTOR_SIZE);
-
-	/* Single-sector read (entire request within one sector) */
-	if (first_sector == last_sector) {
-		unsigned char* sector_buf = (unsigned char*)kmalloc(RFS_SECTOR_SIZE);
-		if (!sector_buf) {
-			fs_set_error(FS_ERR_OUT_OF_MEMORY);
-			return false;
-		}
-		if (!rfs_read_device(info, first_sector, RFS_SECTOR_SIZE, sector_buf)) {
-			kfree(sector_buf);
-			return false;
-		}
-		memcpy(buffer, sector_buf + head_off, length);
-		kfree(sector_buf);
-		return true;
-	}
-
-	/* Multi-sector read: head partial, middle full, tail partial */
-	unsigned char* sector_buf = (unsigned char*)kmalloc(RFS_SECTOR_SIZE);
-	if (!sector_buf) {
-		fs_set_error(FS_ERR_OUT_OF_MEMORY);
+	/* The range may cross from one extent into the next */
+	rfs_file_extents_t list;
+	if (!rfs_file_extents(info, file, &list)) {
 		return false;
 	}
-
-	/* Head partial */
-	size_t head_bytes = RFS_SECTOR_SIZE - head_off;
-	if (!rfs_read_device(info, first_sector, RFS_SECTOR_SIZE, sector_buf)) {
-		kfree(sector_buf);
-		return false;
-	}
-	memcpy(buffer, sector_buf + head_off, head_bytes);
-
-	/* Middle full sectors: read directly into the user's buffer slice */
-	uint64_t cur_sector = first_sector + 1;
-	uint64_t bytes_done = head_bytes;
-	uint64_t full_bytes_remaining = length - head_bytes;
-	uint64_t full_sectors = full_bytes_remaining / RFS_SECTOR_SIZE;
-
-	while (full_sectors) {
-		uint64_t batch_secs  = full_sectors;
-		if (batch_secs > RFS_MAP_READ_CHUNK_SECTORS) {
-			batch_secs = RFS_MAP_READ_CHUNK_SECTORS;
-		}
-		size_t batch_bytes = (batch_secs * RFS_SECTOR_SIZE);
-
-		if (!rfs_read_device(info, cur_sector, batch_bytes, buffer + bytes_done)) {
-			kfree(sector_buf);
-			return false;
-		}
-
-		cur_sector += batch_secs;
-		bytes_done += batch_bytes;
-		full_sectors -= batch_secs;
-	}
-
-	/* Tail partial (only if not sector-aligned end) */
-	size_t tail_bytes = ((start + length) % RFS_SECTOR_SIZE);
-	if (tail_bytes != 0) {
-		if (!rfs_read_device(info, last_sector, RFS_SECTOR_SIZE, sector_buf)) {
-			kfree(sector_buf);
-			return false;
-		}
-		memcpy(buffer + bytes_done, sector_buf, tail_bytes);
-	}
-
-	kfree(sector_buf);
-	return true;
+	return rfs_read_extents(info, &list, start, length, buffer);
 }
@@ -136,15 +136,19 @@ bool rfs_unlink_file(void *dir, const char *name) {
 		return false;
 	}
 
-	/* Now just call the existing delete */
+	/* Now just call the existing delete, then free every extent */
 	bool done = rfs_delete_directory_entry(&target);
-	if (done && on_disk.sector_length > 0) {
-		if (!rfs_mark_extent(info, on_disk.sector_start, on_disk.sector_length, false)) {
-			return false;
+	if (done) {
+		rfs_file_extents_t list;
+		rfs_entry_extents(info, &on_disk, &list);
+		rfs_forget_extents(info, on_disk.sector_start);
+		for (uint64_t i = 0; i < list.count; i++) {
+			if (!rfs_mark_extent(info, list.extent[i].start, list.extent[i].sectors, false)) {
+				return false;
+			}
+			rfs_clear_device(info, list.extent[i].start, list.extent[i].sectors * RFS_SECTOR_SIZE);
 		}
-		rfs_clear_device(info, on_disk.sector_start, on_disk.sector_length * RFS_SECTOR_SIZE);
-
 	}
-	return done;
+	return done && rfs_flush(info);
 }
 
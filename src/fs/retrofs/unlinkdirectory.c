@@ -108,5 +108,5 @@ bool rfs_unlink_dir(void *dir, const char *name) {
 		}
 	}
 
-	return true;
+	return rfs_flush(info);
 }
@@ -1,156 +1,118 @@
 #include <kernel.h>
 #include <retrofs.h>
 
-/* Extend-and-move: allocate a new extent big enough for min_bytes, zero it,
- * copy old logical bytes across, free old extent, update dir entry & VFS node. */
-static bool rfs_extend_and_move(fs_tree_t *tree, rfs_t *info, fs_directory_entry_t *file, uint64_t min_bytes_required) {
-	/* Locate current on-disk entry */
-	uint64_t blk_sector = 0;
-	size_t blk_index = 0;
-	rfs_directory_entry_inner_t ent;
-	if (!rfs_locate_entry(info, tree, file->filename, &blk_sector, &blk_index, &ent)) {
-		fs_set_error(FS_ERR_NO_SUCH_FILE);
-		return false;
-	}
-	if ((ent.flags & RFS_FLAG_DIRECTORY) != 0) {
-		fs_set_error(FS_ERR_NOT_A_FILE);
-		return false;
-	}
-
-	const uint64_t old_start = ent.sector_start;
-	const uint64_t old_sectors = ent.sector_length;
-	const uint64_t old_bytes = ent.length;
-
-	const uint64_t new_sectors = rfs_bytes_to_sectors(
-		min_bytes_required + rfs_get_default_reservation(ent.filename));
+/* Last resort when a file can neither grow in place nor gain an extent:
+ * allocate one extent big enough for everything, copy the file's sectors
+ * across, then free the old extents. Only sectors holding logical bytes are
+ * copied; the rest of the new extent is zeroed when writes expose it. */
+static bool rfs_consolidate(fs_tree_t *tree, rfs_t *info, fs_directory_entry_t *file, rfs_file_extents_t *list, uint64_t want_sectors, uint64_t min_sectors) {
+	uint64_t new_sectors = want_sectors;
 	uint64_t new_start = 0;
 
-	/* Buffers: one zero buffer for zero-fill, one bulk buffer for copying */
-	const uint64_t chunk_sectors = RFS_MAP_READ_CHUNK_SECTORS;
-	const size_t chunk_bytes = (size_t) (chunk_sectors * RFS_SECTOR_SIZE);
-
-	unsigned char *zero = (unsigned char *) kmalloc(chunk_bytes);
-	if (!zero) {
-		fs_set_error(FS_ERR_OUT_OF_MEMORY);
+	/* FIXME(locks): racy between find_free_extent() and mark_extent(). */
+	if (!rfs_find_free_extent(info, new_sectors, &new_start)) {
+		new_sectors = min_sectors;
+		if (!rfs_find_free_extent(info, new_sectors, &new_start)) {
+			fs_set_error(FS_ERR_NO_SPACE);
+			return false;
+		}
+	}
+	if (!rfs_mark_extent(info, new_start, new_sectors, true)) {
 		return false;
 	}
-	memset(zero, 0, chunk_bytes);
 
-	unsigned char *bulk = (unsigned char *) kmalloc(chunk_bytes);
+	const uint64_t chunk_sectors = RFS_MAP_READ_CHUNK_SECTORS;
+	unsigned char *bulk = (unsigned char *) kmalloc(chunk_sectors * RFS_SECTOR_SIZE);
 	if (!bulk) {
 		fs_set_error(FS_ERR_OUT_OF_MEMORY);
-		kfree(zero);
+		rfs_mark_extent(info, new_start, new_sectors, false);
 		return false;
 	}
 
-	/* FIXME(locks): racy between find_free_extent() and mark_extent(). */
-	if (!rfs_find_free_extent(info, new_sectors, &new_start)) {
-		fs_set_error(FS_ERR_NO_SPACE);
-		kfree(bulk);
-		kfree(zero);
-		return false;
+	const uint64_t used_sectors = rfs_bytes_to_sectors(file->size);
+	for (uint64_t done = 0; done < used_sectors;) {
+		const uint64_t this_secs = MIN(used_sectors - done, chunk_sectors);
+		const uint64_t this_bytes = this_secs * RFS_SECTOR_SIZE;
+		if (!rfs_read_extents(info, list, done * RFS_SECTOR_SIZE, this_bytes, bulk) ||
+		    !rfs_write_device(info, new_start + done, this_bytes, bulk)) {
+			kfree(bulk);
+			rfs_mark_extent(info, new_start, new_sectors, false);
+			return false;
+		}
+		done += this_secs;
 	}
-	if (!rfs_mark_extent(info, new_start, new_sectors, true)) {
-		kfree(bulk);
-		kfree(zero);
+	kfree(bulk);
+
+	rfs_file_extents_t moved = {0};
+	moved.count = 1;
+	moved.extent[0].start = new_start;
+	moved.extent[0].sectors = new_sectors;
+	if (!rfs_update_file_entry(info, tree, file->filename, &moved, file->size)) {
+		dprintf("rfs: consolidate: entry update failed after copy\n");
+		rfs_mark_extent(info, new_start, new_sectors, false);
 		return false;
 	}
 
-	/* Zero-fill the new extent */
-	{
-		uint64_t remaining = new_sectors, pos = new_start;
-		while (remaining) {
-			const uint64_t this_secs = (remaining > chunk_sectors) ? chunk_sectors : remaining;
-			const size_t this_bytes = (size_t) (this_secs * RFS_SECTOR_SIZE);
-			if (!rfs_write_device(info, pos, this_bytes, zero)) {
-				/* Leave marked; better a space leak than dangling refs. */
-				kfree(bulk);
-				kfree(zero);
-				return false;
-			}
-			pos += this_secs;
-			remaining -= this_secs;
-		}
+	/* The entry now points at the copy, so the old extents can go (best-effort) */
+	for (uint64_t i = 0; i < list->count; i++) {
+		rfs_mark_extent(info, list->extent[i].start, list->extent[i].sectors, false);
+		rfs_clear_device(info, list->extent[i].start, list->extent[i].sectors * RFS_SECTOR_SIZE);
 	}
 
-	/* Copy existing logical bytes old -> new */
-	if (old_bytes != 0 && old_sectors != 0) {
-		uint64_t bytes_left = old_bytes;
-
-		/* Bulk full sectors first */
-		const uint64_t full_secs_total = bytes_left / RFS_SECTOR_SIZE;
-		uint64_t src_sector = old_start;
-		uint64_t dst_sector = new_start;
-		uint64_t secs_remaining = full_secs_total;
-
-		while (secs_remaining) {
-			const uint64_t this_secs = (secs_remaining > chunk_sectors) ? chunk_sectors : secs_remaining;
-			const size_t this_bytes = (size_t) (this_secs * RFS_SECTOR_SIZE);
+	*list = moved;
+	file->lbapos = new_start;
+	return true;
+}
 
-			if (!rfs_read_device(info, src_sector, this_bytes, bulk)) {
-				kfree(bulk);
-				kfree(zero);
-				return false;
+/* Make room for at least min_bytes. Growth is geometric, by at least the
+ * current allocation or the file type's default reservation, so a file that
+ * is appended to a little at a time is only grown O(log n) times. In order of
+ * preference: claim the free sectors straight after the last extent, add a
+ * new extent (version 2 only), or consolidate into one bigger extent. */
+static bool rfs_grow_file(fs_tree_t *tree, rfs_t *info, fs_directory_entry_t *file, rfs_file_extents_t *list, uint64_t min_bytes) {
+	const uint64_t allocated = rfs_extents_sectors(list);
+	const uint64_t need = rfs_bytes_to_sectors(min_bytes) - allocated;
+	const uint64_t reserve = rfs_bytes_to_sectors(rfs_get_default_reservation(file->filename));
+	const uint64_t want = MAX(need, MAX(allocated, reserve));
+
+	if (list->count != 0) {
+		rfs_extent_t *last = &list->extent[list->count - 1];
+		const uint64_t end = last->start + last->sectors;
+		const uint64_t tries[2] = { want, need };
+		for (size_t t = 0; t < 2; t++) {
+			if (rfs_extent_is_free(info, end, tries[t]) && rfs_mark_extent(info, end, tries[t], true)) {
+				last->sectors += tries[t];
+				return rfs_update_file_entry(info, tree, file->filename, list, file->size);
 			}
-			if (!rfs_write_device(info, dst_sector, this_bytes, bulk)) {
-				kfree(bulk);
-				kfree(zero);
-				return false;
-			}
-
-			src_sector += this_secs;
-			dst_sector += this_secs;
-			secs_remaining -= this_secs;
 		}
+	}
 
-		/* Tail partial sector (if any) */
-		const size_t tail_bytes = (size_t) (bytes_left % RFS_SECTOR_SIZE);
-		if (tail_bytes) {
-			unsigned char src_sec[RFS_SECTOR_SIZE];
-			unsigned char dst_sec[RFS_SECTOR_SIZE];
-			memset(dst_sec, 0, sizeof(dst_sec));
-
-			if (!rfs_read_device(info, src_sector, RFS_SECTOR_SIZE, src_sec)) {
-				kfree(bulk);
-				kfree(zero);
-				return false;
-			}
-			memcpy(dst_sec, src_sec, tail_bytes);
-			if (!rfs_write_device(info, dst_sector, RFS_SECTOR_SIZE, dst_sec)) {
-				kfree(bulk);
-				kfree(zero);
+	/* Version 1 volumes keep files in one extent, for drivers which know no better */
+	if ((info->version >= 2 || list->count == 0) && list->count < RFS_MAX_EXTENTS) {
+		uint64_t start = 0, sectors = want;
+		if (!rfs_find_free_extent(info, sectors, &start)) {
+			sectors = need;
+			if (!rfs_find_free_extent(info, sectors, &start)) {
+				fs_set_error(FS_ERR_NO_SPACE);
 				return false;
 			}
 		}
-	}
-
-	kfree(bulk);
-	kfree(zero);
-
-	/* Free the old extent (best-effort) */
-	if (old_sectors > 0) {
-		rfs_mark_extent(info, old_start, old_sectors, false);
-		rfs_clear_device(info, old_start, old_sectors * RFS_SECTOR_SIZE);
-	}
-
-	/* Update dir entry on disk (new start + sector_length, preserve size) */
-	{
-		fs_directory_entry_t de = (fs_directory_entry_t) {0};
-		de.directory = tree;
-		de.filename = file->filename;
-		de.lbapos = new_start;
-		de.flags = 0;           /* file */
-		de.size = old_bytes;   /* logical bytes unchanged by move */
-		if (!rfs_upsert_directory_entry(&de, new_sectors)) {
-			dprintf("rfs: extend_move: upsert failed after move (metadata mismatch risk)\n");
-			/* We keep the new extent as best-effort. */
+		if (!rfs_mark_extent(info, start, sectors, true)) {
+			return false;
 		}
+		list->extent[list->count].start = start;
+		list->extent[list->count].sectors = sectors;
+		list->count++;
+		if (!rfs_update_file_entry(info, tree, file->filename, list, file->size)) {
+			list->count--;
+			rfs_mark_extent(info, start, sectors, false);
+			return false;
+		}
+		file->lbapos = list->extent[0].start;
+		return true;
 	}
 
-	/* Update VFS node */
-	file->lbapos = new_start;
-
-	return true;
+	return rfs_consolidate(tree, info, file, list, allocated + want, allocated + need);
 }
 
 bool rfs_write_file(void *f, uint64_t start, uint32_t length, unsigned char *buffer) {
@@ -174,132 +136,39 @@ bool rfs_write_file(void *f, uint64_t start, uint32_t length, unsigned char *buf
 		return false;
 	}
 
-	/* Get on-disk capacity (sector_length) and sanity-check it's a file */
-	uint64_t blk_sector = 0;
-	size_t blk_index = 0;
-	rfs_directory_entry_inner_t ent;
-	if (!rfs_locate_entry(info, tree, file->filename, &blk_sector, &blk_index, &ent)) {
-		fs_set_error(FS_ERR_NO_SUCH_FILE);
-		return false;
-	}
-	if ((ent.flags & RFS_FLAG_DIRECTORY) != 0) {
-		fs_set_error(FS_ERR_NOT_A_FILE);
+	rfs_file_extents_t list;
+	if (!rfs_file_extents(info, file, &list)) {
 		return false;
 	}
 
 	/* End position of the write in bytes */
-	uint64_t end_pos = start + (uint64_t) length;
+	const uint64_t end_pos = start + (uint64_t) length;
+	const uint64_t old_length = file->size;
 
-	/* Ensure capacity: move if we exceed reserved bytes */
-	uint64_t reserved_bytes = ent.sector_length * (uint64_t) RFS_SECTOR_SIZE;
-	if (end_pos > reserved_bytes) {
-		/* Extend + move to at least end_pos bytes */
-		if (!rfs_extend_and_move(tree, info, file, end_pos)) {
-			return false;
-		}
-		/* Refresh metadata */
-		if (!rfs_locate_entry(info, tree, file->filename, &blk_sector, &blk_index, &ent)) {
-			fs_set_error(FS_ERR_FILE_HAS_VANISHED);
+	if (end_pos > rfs_extents_sectors(&list) * RFS_SECTOR_SIZE) {
+		if (!rfs_grow_file(tree, info, file, &list, end_pos)) {
 			return false;
 		}
 	}
 
-	/* Now perform the write with RMW at edges */
-	uint64_t file_start_sector = file->lbapos;
-	uint64_t first_sector = file_start_sector + (start / RFS_SECTOR_SIZE);
-	uint64_t last_sector = file_start_sector + ((end_pos - 1) / RFS_SECTOR_SIZE);
-	size_t head_off = (size_t) (start % RFS_SECTOR_SIZE);
-
-	unsigned char *sector_buf = (unsigned char *) kmalloc(RFS_SECTOR_SIZE);
-	if (!sector_buf) {
-		fs_set_error(FS_ERR_OUT_OF_MEMORY);
+	/* Sectors past the old length may hold anything, zero any gap this write exposes */
+	if (start > old_length && !rfs_write_extents(info, &list, old_length, start - old_length, NULL)) {
 		return false;
 	}
 
-	/* Single-sector write */
-	if (first_sector == last_sector) {
-		if (!rfs_read_device(info, first_sector, RFS_SECTOR_SIZE, sector_buf)) {
-			kfree(sector_buf);
-			return false;
-		}
-		memcpy(sector_buf + head_off, buffer, length);
-		if (!rfs_write_device(info, first_sector, RFS_SECTOR_SIZE, sector_buf)) {
-			kfree(sector_buf);
-			return false;
-		}
-		kfree(sector_buf);
-	} else {
-		/* Head partial */
-		size_t head_bytes = RFS_SECTOR_SIZE - head_off;
-		if (!rfs_read_device(info, first_sector, RFS_SECTOR_SIZE, sector_buf)) {
-			kfree(sector_buf);
-			return false;
-		}
-		memcpy(sector_buf + head_off, buffer, head_bytes);
-		if (!rfs_write_device(info, first_sector, RFS_SECTOR_SIZE, sector_buf)) {
-			kfree(sector_buf);
-			return false;
-		}
-
-		/* Middle full sectors */
-		uint64_t cur_sector = first_sector + 1;
-		uint64_t full_bytes_remaining = (uint64_t) length - head_bytes;
-		uint64_t full_sectors = (full_bytes_remaining / RFS_SECTOR_SIZE);
-		const uint64_t chunk_sectors = RFS_MAP_READ_CHUNK_SECTORS;
-
-		const unsigned char *cur_buf = buffer + head_bytes;
-
-		while (full_sectors) {
-			uint64_t this_secs = (full_sectors > chunk_sectors) ? chunk_sectors : full_sectors;
-			size_t this_bytes = (size_t) (this_secs * RFS_SECTOR_SIZE);
-			if (!rfs_write_device(info, cur_sector, this_bytes, cur_buf)) {
-				kfree(sector_buf);
-				return false;
-			}
-			cur_sector += this_secs;
-			cur_buf += this_bytes;
-			full_sectors -= this_secs;
-		}
-
-		/* Tail partial */
-		size_t tail_bytes = ((start + length) % RFS_SECTOR_SIZE);
-		if (tail_bytes == 0) {
-			tail_bytes = RFS_SECTOR_SIZE;
-		}
-		/* tail_bytes currently equals bytes that land in the last sector;
-		   but if the write ends exactly on a sector boundary, the above sets
-		   to full sector; we only need to RMW when there's a partial tail. */
-		if (((start + length) % RFS_SECTOR_SIZE) != 0) {
-			if (!rfs_read_device(info, last_sector, RFS_SECTOR_SIZE, sector_buf)) {
-				kfree(sector_buf);
-				return false;
-			}
-			size_t remaining_tail = ((start + length) % RFS_SECTOR_SIZE);
-			memcpy(sector_buf, cur_buf, remaining_tail);
-			if (!rfs_write_device(info, last_sector, RFS_SECTOR_SIZE, sector_buf)) {
-				kfree(sector_buf);
-				return false;
-			}
-		}
-		kfree(sector_buf);
+	if (!rfs_write_extents(info, &list, start, length, buffer)) {
+		return false;
 	}
 
-	/* Update logical size if extended (preserve sector_length) */
-	if (end_pos > ent.length) {
-		fs_directory_entry_t de = {0};
-		de.directory = tree;
-		de.filename = file->filename;
-		de.lbapos = file->lbapos;     /* may have changed if we moved */
-		de.flags = 0;                /* file */
-		de.size = end_pos;          /* new logical size */
-
-		if (!rfs_upsert_directory_entry(&de, ent.sector_length)) {
+	/* Update logical size if extended */
+	if (end_pos > old_length) {
+		if (!rfs_update_file_entry(info, tree, file->filename, NULL, end_pos)) {
 			dprintf("rfs: write_file: warning: size update failed\n");
 			/* Not fatal for the write itself; data is on disk. */
 		}
-
 		file->size = end_pos; /* reflect in VFS node */
 	}
 
+	/* Not flushed here, so appending to a file stays in a write-back cache until close or SYNC */
 	return true;
 }
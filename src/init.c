@@ -8,7 +8,7 @@ spinlock_t debug_console_spinlock = 0;
 init_func_t init_funcs[] = {
 	init_memtrace, init_profiler,
 	validate_limine_page_tables_and_gdt, init_heap, init_console,
-	init_acpi, init_interrupts, boot_aps, init_pci, init_realtime_clock,
+	init_acpi, init_interrupts, init_kmalloc_caches, boot_aps, init_pci, init_realtime_clock,
 	init_devicenames, init_keyboard, init_ide, init_ahci, init_nvme,
 	init_virtio_block, init_filesystem, init_devfs, init_iso9660, init_udf,
 	init_adfs, init_dfs, init_fat32, init_ext2, init_rfs, init_modules, network_up, audio_init,
@@ -18,7 +18,7 @@ init_func_t init_funcs[] = {
 char* init_funcs_names[] = {
 	"memtrace",	"profiler",
 	"gdt",		"heap",		"console",	"acpi",
-	"interrupts",	"cpus",		"pci",		"clock",
+	"interrupts",	"kcache",	"cpus",		"pci",		"clock",
 	"devicenames",	"keyboard",	"ide",		"ahci",	
 	"nvme", 	"virtio-block",	"filesystem",	"devfs",
 	"iso9660",	"udf",		"adfs",		"dfs",
@@ -38,6 +38,9 @@ void init()
 		(*func)();
 		dprintf("Initialisation of %s done!\n", init_funcs_names[n++]);
 	}
+#ifdef ALLOCATOR_STRESS_TEST
+	kmalloc_stress_test(ALLOCATOR_STRESS_ROUNDS);
+#endif
 #ifdef PROFILE_KERNEL
 	setforeground(COLOUR_LIGHTGREEN);
 	kprintf("THIS IS A PROFILING BUILD - Expect things to run slower!\n");
@@ -470,6 +470,13 @@ static void push_to_buffer(char x) {
 
 	keyboard_buffer[buffer_write_ptr] = x;
 	buffer_write_ptr = next;
+
+	if (x == 27) {
+		/* Every sleeping BASIC program checks for CTRL+ESC */
+		proc_wake_all();
+	} else {
+		proc_wake(WAIT_CHANNEL(WAIT_KEYBOARD, 0));
+	}
 }
 
 void keyboard_process_scancode_input(uint8_t sc) {
@@ -628,6 +635,10 @@ unsigned char kgetc() {
 }
 
 _Noreturn void reboot(void) {
+	/* Open files and write-back caches may still hold data the disks have not seen */
+	flush_all_filehandles();
+	storage_flush_all();
+
 	__asm__ volatile ("cli");
 
 	if (acpi_reset()) {
@@ -16,6 +16,32 @@ static uint64_t allocated = 0;
 static uint32_t low_mem_cur = 0;
 static spinlock_t allocator_lock = 0;
 
+/**
+ * @brief Free blocks of one size class owned by one CPU, used as a stack
+ * so the most recently freed (cache-warm) block is handed out first.
+ */
+typedef struct kmalloc_magazine_t {
+	void* blocks[KMALLOC_CACHE_DEPTH];
+	uint32_t count;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t frees;
+	uint64_t overflows;
+} kmalloc_magazine_t;
+
+/**
+ * @brief Per-CPU allocation cache. Only ever touched by its own CPU with
+ * interrupts disabled, so needs no lock. Other CPUs may read the counters
+ * for statistics.
+ */
+typedef struct kmalloc_cpu_cache_t {
+	kmalloc_magazine_t classes[KMALLOC_CACHE_CLASSES];
+	uint64_t cached_bytes;
+} kmalloc_cpu_cache_t;
+
+static kmalloc_cpu_cache_t* kmalloc_caches[MAX_CPUS] = { 0 };
+static bool kmalloc_caches_enabled = false;
+
 // ReSharper disable once CppUseInternalLinkage
 volatile struct limine_memmap_request memory_map_request = {
 	.id = LIMINE_MEMMAP_REQUEST,
@@ -266,11 +292,171 @@ void init_heap(void) {
 	adopt_cloned_tables();
 }
 
+void init_kmalloc_caches(void) {
+	/* APs set up their own cpu_local_t as they come up */
+	cpu_local_init();
+	kmalloc_caches_enabled = true;
+	dprintf("heap: per-CPU caches enabled for %u size classes, %u to %u bytes\n", KMALLOC_CACHE_CLASSES, KMALLOC_CACHE_MIN, KMALLOC_CACHE_MAX);
+}
+
+/**
+ * @brief Size class a request is served from, or -1 if it is too large
+ * for the per-CPU caches. Requests are rounded up to the next class.
+ */
+static inline int kmalloc_class_for_size(uint64_t size) {
+	/* Zero byte requests get the general allocator's smallest block, not a cached one */
+	if (size == 0 || size > KMALLOC_CACHE_MAX) {
+		return -1;
+	}
+	if (size <= KMALLOC_CACHE_MIN) {
+		return 0;
+	}
+	return (64 - __builtin_clzll(size - 1)) - __builtin_ctz(KMALLOC_CACHE_MIN);
+}
+
+/**
+ * @brief Size class a freed block can be cached in, or -1 if it should go
+ * straight back to the general allocator. The block must be at least as big
+ * as the class, and is refused if more than half of it would be wasted.
+ */
+static inline int kmalloc_class_for_block(size_t usable) {
+	if (usable < KMALLOC_CACHE_MIN || usable >= KMALLOC_CACHE_MAX * 2) {
+		return -1;
+	}
+	return (63 - __builtin_clzll(usable)) - __builtin_ctz(KMALLOC_CACHE_MIN);
+}
+
+/**
+ * @brief Find the allocation cache of the calling CPU, creating it on first
+ * use. Interrupts must be disabled by the caller so that the process cannot
+ * move CPU while the cache is in use.
+ * @return Cache, or NULL if the CPU cannot be identified or the cache could
+ * not be allocated
+ */
+static kmalloc_cpu_cache_t* kmalloc_cpu_cache(void) {
+	uint8_t cpu = this_cpu_id();
+	if (cpu == INVALID_CPU_ID) {
+		return NULL;
+	}
+	kmalloc_cpu_cache_t* cache = kmalloc_caches[cpu];
+	if (!cache) {
+		lock_spinlock(&allocator_lock);
+		cache = allocator_alloc(sizeof(kmalloc_cpu_cache_t));
+		if (cache) {
+			allocated += allocator_usable_size(cache);
+			memset(cache, 0, sizeof(kmalloc_cpu_cache_t));
+			kmalloc_caches[cpu] = cache;
+		}
+		unlock_spinlock(&allocator_lock);
+	}
+	return cache;
+}
+
+/**
+ * @brief Return every block cached by the calling CPU to the general
+ * allocator, so that a large allocation can retry. The allocator lock must
+ * be held with interrupts disabled.
+ * @return true if any blocks were released
+ */
+static bool kmalloc_drain_locked(void) {
+	if (!kmalloc_caches_enabled) {
+		return false;
+	}
+	uint8_t cpu = this_cpu_id();
+	kmalloc_cpu_cache_t* cache = cpu == INVALID_CPU_ID ? NULL : kmalloc_caches[cpu];
+	if (!cache || !cache->cached_bytes) {
+		return false;
+	}
+	for (uint8_t c = 0; c < KMALLOC_CACHE_CLASSES; ++c) {
+		kmalloc_magazine_t* mag = &cache->classes[c];
+		while (mag->count) {
+			void* p = mag->blocks[--mag->count];
+			allocated -= allocator_usable_size(p);
+			allocator_free(p);
+		}
+	}
+	cache->cached_bytes = 0;
+	return true;
+}
+
+/**
+ * @brief Allocate a block for an empty magazine, and refill the magazine
+ * with a batch of further blocks under the same acquisition of the lock.
+ * If the heap has nothing left, blocks this CPU holds in other size classes
+ * are given back first and the allocation tried again.
+ * @return Block for the caller, or NULL if the heap is exhausted
+ */
+static void* kmalloc_refill(kmalloc_cpu_cache_t* cache, kmalloc_magazine_t* mag, size_t class_size) {
+	lock_spinlock(&allocator_lock);
+	void* p = allocator_alloc(class_size);
+	if (!p && kmalloc_drain_locked()) {
+		p = allocator_alloc(class_size);
+	}
+	if (p) {
+		allocated += allocator_usable_size(p);
+		while (mag->count < KMALLOC_CACHE_BATCH) {
+			void* extra = allocator_alloc(class_size);
+			if (!extra) {
+				break;
+			}
+			size_t usable = allocator_usable_size(extra);
+			allocated += usable;
+			cache->cached_bytes += usable;
+			mag->blocks[mag->count++] = extra;
+		}
+	}
+	unlock_spinlock(&allocator_lock);
+	return p;
+}
+
+/**
+ * @brief Return the oldest blocks of a full magazine to the general
+ * allocator, keeping the most recently freed ones which are still warm in
+ * the CPU's data cache.
+ */
+static void kmalloc_overflow(kmalloc_cpu_cache_t* cache, kmalloc_magazine_t* mag) {
+	lock_spinlock(&allocator_lock);
+	for (uint32_t i = 0; i < KMALLOC_CACHE_BATCH; ++i) {
+		size_t usable = allocator_usable_size(mag->blocks[i]);
+		allocated -= usable;
+		cache->cached_bytes -= usable;
+		allocator_free(mag->blocks[i]);
+	}
+	unlock_spinlock(&allocator_lock);
+	mag->count -= KMALLOC_CACHE_BATCH;
+	memmove(mag->blocks, mag->blocks + KMALLOC_CACHE_BATCH, mag->count * sizeof(void*));
+	mag->overflows++;
+}
 
 void* kmalloc(uint64_t size) {
 	uint64_t flags;
+	int class_index = kmalloc_caches_enabled ? kmalloc_class_for_size(size) : -1;
+	if (class_index >= 0) {
+		flags = read_rflags();
+		interrupts_off();
+		kmalloc_cpu_cache_t* cache = kmalloc_cpu_cache();
+		if (cache) {
+			kmalloc_magazine_t* mag = &cache->classes[class_index];
+			void* p;
+			if (mag->count) {
+				p = mag->blocks[--mag->count];
+				cache->cached_bytes -= allocator_usable_size(p);
+				mag->hits++;
+			} else {
+				p = kmalloc_refill(cache, mag, KMALLOC_CACHE_MIN << class_index);
+				mag->misses++;
+			}
+			write_rflags(flags);
+			KMALLOC_TRACE_ALLOC(p, size);
+			return p;
+		}
+		write_rflags(flags);
+	}
 	lock_spinlock_irq(&allocator_lock, &flags);
 	void* p = allocator_alloc(size);
+	if (!p && kmalloc_drain_locked()) {
+		p = allocator_alloc(size);
+	}
 	allocated += allocator_usable_size((void *) p);
 	unlock_spinlock_irq(&allocator_lock, flags);
 	KMALLOC_TRACE_ALLOC(p, size);
@@ -282,12 +468,38 @@ void kfree(const void* ptr) {
 		return;
 	}
 	uint64_t flags;
-	lock_spinlock_irq(&allocator_lock, &flags);
 	uintptr_t a = (uintptr_t)ptr;
 	if (a >= LOW_HEAP_START && a < LOW_HEAP_MAX) {
 		preboot_fail("kfree: tried to free low heap memory - use kfree_low instead!");
 	}
-	allocated -= allocator_usable_size((void *) ptr);
+	size_t usable = allocator_usable_size((void *) ptr);
+	int class_index = kmalloc_caches_enabled ? kmalloc_class_for_block(usable) : -1;
+	if (class_index >= 0) {
+		flags = read_rflags();
+		interrupts_off();
+		kmalloc_cpu_cache_t* cache = kmalloc_cpu_cache();
+		if (cache) {
+			kmalloc_magazine_t* mag = &cache->classes[class_index];
+			/* Cached blocks are not marked free, so catch double frees here */
+			for (uint32_t i = 0; i < mag->count; ++i) {
+				if (mag->blocks[i] == ptr) {
+					preboot_fail("Double free");
+				}
+			}
+			if (mag->count == KMALLOC_CACHE_DEPTH) {
+				kmalloc_overflow(cache, mag);
+			}
+			mag->blocks[mag->count++] = (void *) ptr;
+			cache->cached_bytes += usable;
+			mag->frees++;
+			write_rflags(flags);
+			KMALLOC_TRACE_FREE(ptr);
+			return;
+		}
+		write_rflags(flags);
+	}
+	lock_spinlock_irq(&allocator_lock, &flags);
+	allocated -= usable;
 	allocator_free((void *) ptr);
 	unlock_spinlock_irq(&allocator_lock, flags);
 	KMALLOC_TRACE_FREE(ptr);
@@ -331,12 +543,25 @@ void* krealloc(void* ptr, size_t new_size) {
 	return new_ptr;
 }
 
+uint64_t get_cached_memory() {
+	uint64_t cached = 0;
+	for (size_t cpu = 0; cpu < MAX_CPUS; ++cpu) {
+		const kmalloc_cpu_cache_t* cache = kmalloc_caches[cpu];
+		if (cache) {
+			cached += cache->cached_bytes;
+		}
+	}
+	return cached;
+}
+
 uint64_t get_free_memory() {
 	return heaplen - allocated;
 }
 
 uint64_t get_used_memory() {
-	return allocated;
+	/* Per-CPU counters are read without a lock, so may briefly overshoot */
+	uint64_t cached = get_cached_memory();
+	return allocated > cached ? allocated - cached : 0;
 }
 
 uint64_t get_total_memory() {
@@ -377,3 +602,183 @@ void kfree_aligned(const void* ptr) {
 	void *raw = ((void**)ptr)[-1];
 	kfree(raw);
 }
+
+void get_heap_stats(allocator_stats_t* stats) {
+	uint64_t flags;
+	lock_spinlock_irq(&allocator_lock, &flags);
+	allocator_get_stats(stats);
+	unlock_spinlock_irq(&allocator_lock, flags);
+}
+
+bool kmalloc_get_class_stats(uint8_t class_index, kmalloc_class_stats_t* stats) {
+	if (class_index >= KMALLOC_CACHE_CLASSES || !stats) {
+		return false;
+	}
+	memset(stats, 0, sizeof(kmalloc_class_stats_t));
+	stats->size = KMALLOC_CACHE_MIN << class_index;
+	for (size_t cpu = 0; cpu < MAX_CPUS; ++cpu) {
+		const kmalloc_cpu_cache_t* cache = kmalloc_caches[cpu];
+		if (cache) {
+			const kmalloc_magazine_t* mag = &cache->classes[class_index];
+			stats->hits += mag->hits;
+			stats->misses += mag->misses;
+			stats->frees += mag->frees;
+			stats->overflows += mag->overflows;
+			stats->cached += mag->count;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Render the per-class cache statistics table for /devices/kmalloc.
+ * Columns are fixed width so the size of the file never changes. Returns a
+ * kmalloc'd string which the caller must free.
+ */
+static char* kmalloc_stats_text(void)
+{
+	const size_t row = 128, size = row * (KMALLOC_CACHE_CLASSES + 5);
+	char* text = kmalloc(size);
+	if (!text) {
+		return NULL;
+	}
+	size_t len = snprintf(text, size, "CLASS                 HITS               MISSES                FREES  OVERFLOWS CACHED HIT%%\n");
+	for (uint8_t c = 0; c < KMALLOC_CACHE_CLASSES; ++c) {
+		kmalloc_class_stats_t s;
+		kmalloc_get_class_stats(c, &s);
+		uint64_t requests = s.hits + s.misses;
+		len += snprintf(text + len, size - len, "%5lu %20lu %20lu %20lu %10lu %6lu %4lu\n", s.size, s.hits, s.misses, s.frees, s.overflows, s.cached, requests ? s.hits * 100 / requests : 0);
+	}
+	len += snprintf(text + len, size - len, "USED %20lu CACHED %20lu FREE %20lu\n", get_used_memory(), get_cached_memory(), get_free_memory());
+
+	allocator_stats_t heap;
+	get_heap_stats(&heap);
+	uint64_t fragmentation = heap.free_bytes ? 100 - (heap.largest_free * 100 / heap.free_bytes) : 0;
+	len += snprintf(text + len, size - len, "HEAP FREE BLOCKS %12lu LARGEST %20lu FRAGMENTATION %3lu%%\n", heap.free_blocks, heap.largest_free, fragmentation);
+	snprintf(text + len, size - len, "CYCLES ALLOC AVG %8lu MAX %12lu FREE AVG %8lu MAX %12lu FAILED %10lu\n",
+		 heap.allocations ? heap.alloc_cycles / heap.allocations : 0, heap.alloc_cycles_max,
+		 heap.frees ? heap.free_cycles / heap.frees : 0, heap.free_cycles_max, heap.failures);
+	return text;
+}
+
+static void kmalloc_stats_update_cb(fs_directory_entry_t *ent) {
+	char* text = kmalloc_stats_text();
+	ent->size = text ? strlen(text) : 0;
+	kfree_null(&text);
+}
+
+static bool kmalloc_stats_read_cb(uint64_t start, uint32_t length, unsigned char *buffer) {
+	char* text = kmalloc_stats_text();
+	if (!text) {
+		fs_set_error(FS_ERR_OUT_OF_MEMORY);
+		return false;
+	}
+	uint64_t text_length = strlen(text);
+
+	if (start + length > text_length) {
+		kfree_null(&text);
+		fs_set_error(FS_ERR_SEEK_PAST_END);
+		return false;
+	}
+	memcpy(buffer, text + start, length);
+	kfree_null(&text);
+	return true;
+}
+
+void init_kmalloc_stats(void) {
+	devfs_register_text("kmalloc", kmalloc_stats_update_cb, kmalloc_stats_read_cb);
+}
+
+#ifdef ALLOCATOR_STRESS_TEST
+#define STRESS_SLOTS 4096
+
+static uint64_t stress_random(uint64_t* state) {
+	/* xorshift64, so every run makes the same sequence of requests */
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+/* Mostly small objects, some buffers, and the occasional large block */
+static size_t stress_size(uint64_t r) {
+	uint64_t kind = r % 20;
+	if (kind == 19) {
+		return 8192 + (r >> 8) % (256 * 1024);
+	} else if (kind >= 14) {
+		return 512 + (r >> 8) % 7680;
+	}
+	return 1 + (r >> 8) % 512;
+}
+
+static bool stress_check(uint8_t* block, size_t size, size_t slot) {
+	return block[0] == (uint8_t)slot && block[size - 1] == (uint8_t)~slot;
+}
+
+static void stress_report(uint64_t round) {
+	allocator_stats_t heap;
+	get_heap_stats(&heap);
+	dprintf("kmalloc stress: round %lu, used %lu, cached %lu, free blocks %lu, largest free %lu of %lu, alloc avg/max %lu/%lu cycles, free avg/max %lu/%lu cycles\n",
+		round, get_used_memory(), get_cached_memory(), heap.free_blocks, heap.largest_free, heap.free_bytes,
+		heap.allocations ? heap.alloc_cycles / heap.allocations : 0, heap.alloc_cycles_max,
+		heap.frees ? heap.free_cycles / heap.frees : 0, heap.free_cycles_max);
+}
+
+bool kmalloc_stress_test(uint64_t rounds) {
+	uint8_t** slots = kcalloc(STRESS_SLOTS, sizeof(uint8_t*));
+	size_t* sizes = kcalloc(STRESS_SLOTS, sizeof(size_t));
+	if (!slots || !sizes) {
+		kfree_null(&slots);
+		kfree_null(&sizes);
+		kprintf("kmalloc stress: out of memory\n");
+		return false;
+	}
+	uint64_t state = 0x2545F4914F6CDD1DULL, failures = 0, corrupt = 0;
+	uint64_t used_before = get_used_memory(), start = get_ticks();
+	uint64_t report_every = MAX(rounds / 10, 1);
+
+	kprintf("kmalloc stress: %lu rounds...\n", rounds);
+	for (uint64_t round = 1; round <= rounds; ++round) {
+		uint64_t r = stress_random(&state);
+		size_t slot = r % STRESS_SLOTS;
+		if (slots[slot]) {
+			if (!stress_check(slots[slot], sizes[slot], slot)) {
+				corrupt++;
+			}
+			kfree_null(&slots[slot]);
+		} else {
+			size_t size = stress_size(r >> 12);
+			slots[slot] = kmalloc(size);
+			if (!slots[slot]) {
+				failures++;
+				continue;
+			}
+			sizes[slot] = size;
+			slots[slot][0] = (uint8_t)slot;
+			slots[slot][size - 1] = (uint8_t)~slot;
+		}
+		if (round % report_every == 0) {
+			stress_report(round);
+		}
+	}
+
+	for (size_t slot = 0; slot < STRESS_SLOTS; ++slot) {
+		if (slots[slot]) {
+			if (!stress_check(slots[slot], sizes[slot], slot)) {
+				corrupt++;
+			}
+			kfree_null(&slots[slot]);
+		}
+	}
+	uint64_t used_after = get_used_memory();
+	stress_report(rounds);
+	kfree_null(&slots);
+	kfree_null(&sizes);
+
+	bool passed = !corrupt && used_after == used_before;
+	kprintf("kmalloc stress: %s in %lums, %lu failed allocations, %lu corrupt blocks, %ld bytes not returned\n",
+		passed ? "passed" : "FAILED", get_ticks() - start, failures, corrupt, (int64_t)(used_after - used_before));
+	return passed;
+}
+#endif
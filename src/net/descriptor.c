@@ -78,6 +78,7 @@ void tcp_set_close_code(tcp_conn_t* conn, tcp_error_code_t code) {
 	if (conn->close_code == TCP_ERROR_NONE) {
 		conn->close_code = code;
 		error_codes[conn->fd] = code;
+		proc_wake(WAIT_CHANNEL(WAIT_TCP, conn->fd));
 	}
 }
 
@@ -91,6 +92,7 @@ void tcp_set_close_code_by_fd(int this_fd, tcp_error_code_t code) {
 		conn->close_code = code;
 	}
 	error_codes[this_fd] = code;
+	proc_wake(WAIT_CHANNEL(WAIT_TCP, this_fd));
 }
 
 tcp_error_code_t tcp_get_close_code(int this_fd) {
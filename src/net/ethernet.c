@@ -2,6 +2,7 @@
 
 ethernet_protocol_t* protocol_handlers = NULL;
 spinlock_t ethernet_lock = 0;
+static uint32_t tx_batch_depth = 0;
 
 #define ETHERNET_MAX_FRAME (65536 - sizeof(ethernet_frame_t))
 
@@ -37,10 +38,54 @@ int ethernet_send_packet(const uint8_t* dst_mac_addr, const uint8_t* data, size_
 	memcpy(frame_data, data, len);
 	frame->type = htons(protocol);
 	dev->send_packet(frame, sizeof(ethernet_frame_t) + len);
+	if (tx_batch_depth == 0 && dev->flush_tx) {
+		dev->flush_tx();
+	}
 	unlock_spinlock_irq(&ethernet_lock, flags);
 	return len;
 }
 
+void ethernet_tx_batch_begin(void) {
+	uint64_t flags;
+	lock_spinlock_irq(&ethernet_lock, &flags);
+	tx_batch_depth++;
+	unlock_spinlock_irq(&ethernet_lock, flags);
+}
+
+void ethernet_tx_batch_end(void) {
+	uint64_t flags;
+	lock_spinlock_irq(&ethernet_lock, &flags);
+	if (tx_batch_depth > 0 && --tx_batch_depth == 0) {
+		netdev_t* dev = get_active_network_device();
+		if (dev && dev->flush_tx) {
+			dev->flush_tx();
+		}
+	}
+	unlock_spinlock_irq(&ethernet_lock, flags);
+}
+
+bool ethernet_tx_csum_offsets(const void* frame, uint16_t len, ethernet_tx_csum_t* csum) {
+	if (!network_device_offloads(NETDEV_OFFLOAD_TCP_CSUM)) {
+		return false;
+	}
+	const ethernet_frame_t* eth = frame;
+	const uint8_t* ip = eth->data;
+	if (len < sizeof(ethernet_frame_t) + sizeof(ip_packet_t) || ntohs(eth->type) != ETHERNET_TYPE_IP) {
+		return false;
+	}
+	/* Raw header bytes: version and IHL nibbles, then the protocol at offset 9 */
+	size_t ihl = (ip[0] & 0x0F) * 4;
+	if ((ip[0] >> 4) != IP_IPV4 || ihl < sizeof(ip_packet_t) || ip[9] != PROTOCOL_TCP) {
+		return false;
+	}
+	if (len < sizeof(ethernet_frame_t) + ihl + sizeof(tcp_segment_t)) {
+		return false;
+	}
+	csum->start = sizeof(ethernet_frame_t) + ihl;
+	csum->offset = csum->start + offsetof(tcp_segment_t, checksum);
+	return true;
+}
+
 void ethernet_handle_packet(ethernet_frame_t* packet, size_t len) {
 	if (!packet) {
 		return;
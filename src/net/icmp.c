@@ -5,17 +5,7 @@ static icmp_unreachable_handler_t icmp_unreachable_handlers[256];
 
 uint16_t icmp_calculate_checksum(void* packet, size_t len)
 {
-	int array_size = len / 2;
-	uint16_t * array = (uint16_t*)packet; // XXX: Alignment!
-	uint32_t sum = 0;
-	for(int i = 0; i < array_size; i++) {
-		sum += htons(array[i]);
-	}
-	uint32_t carry = sum >> 16;
-	sum = sum & 0x0000ffff;
-	sum = sum + carry;
-	uint16_t ret = ~sum;
-	return ret;
+	return ntohs(inet_checksum(packet, len));
 }
 
 void icmp_send(uint8_t* destination, void* icmp, uint16_t size)
@@ -34,10 +34,6 @@ static int ip_scratch_sel = 0; /* 0 => A, 1 => B */
 
 void ip_handle_packet(ip_packet_t* packet, [[maybe_unused]] int n_len);
 
-static inline bool ip_is_loopback(const uint8_t *ip) {
-	return ip[3] == 127; /* 127.0.0.0/8 */
-}
-
 void get_ip_str(char* ip_str, const uint8_t* ip) {
 	snprintf(ip_str, IP_BUF_LEN, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
 }
@@ -166,19 +162,7 @@ void ip_frag_gc(void) {
 
 
 uint16_t ip_calculate_checksum(ip_packet_t * packet) {
-	// Treat the packet header as a 2-byte-integer array
-	// Sum all integers switch to network byte order
-	int array_size = sizeof(ip_packet_t) / 2;
-	uint16_t * array = (uint16_t*)packet; // XXX: Alignment!
-	uint32_t sum = 0;
-	for(int i = 0; i < array_size; i++) {
-		sum += htons(array[i]);
-	}
-	uint32_t carry = sum >> 16;
-	sum = sum & 0x0000ffff;
-	sum = sum + carry;
-	uint16_t ret = ~sum;
-	return ret;
+	return ntohs(inet_checksum(packet, sizeof(ip_packet_t)));
 }
 
 void dequeue_packet(packet_queue_item_t* cur, packet_queue_item_t* last) {
@@ -211,6 +195,8 @@ void ip_idle()
 		packet_queue_item_t* cur = packet_queue;
 		packet_queue_item_t* last = NULL;
 
+		/* Packets released by one ARP reply go out under one doorbell */
+		ethernet_tx_batch_begin();
 		for (; cur; ) {
 			/* Save next pointer early, because cur may be freed */
 			packet_queue_item_t* next = cur->next;
@@ -264,6 +250,7 @@ void ip_idle()
 
 			cur = next; /* always advance from saved next pointer */
 		}
+		ethernet_tx_batch_end();
 	}
 }
 
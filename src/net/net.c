@@ -119,10 +119,26 @@ void network_down()
 {
 }
 
+/**
+ * @brief Foreground idle, runs any receive DPC the DPC queue had no room for.
+ */
+static void netdev_rx_recover(void) {
+	for (netdev_t* dev = networkdevices; dev; dev = dev->next) {
+		netdev_rx_stats_t* st = dev->rx_stats;
+		if (st && st->rx_poll_lost && st->rx_poll) {
+			st->rx_poll_lost = false;
+			st->rx_poll();
+		}
+	}
+}
+
 bool register_network_device(netdev_t* newdev) {
 	if (!newdev) {
 		return false;
 	}
+	if (!networkdevices) {
+		proc_register_idle(netdev_rx_recover, IDLE_FOREGROUND, NET_RX_RECOVER_MS);
+	}
 	/* Add the new network device to the start of the list */
 	dprintf("Registered network device '%s'\n", newdev->name);
 	newdev->next = networkdevices;
@@ -135,6 +151,92 @@ netdev_t* get_active_network_device() {
 	return networkdevices;
 }
 
+bool network_device_offloads(netdev_offload_t offload) {
+	netdev_t* dev = get_active_network_device();
+	return dev && (dev->offload & offload);
+}
+
+void netdev_rx_poll_start(netdev_rx_stats_t* stats, uint32_t waiting) {
+	stats->polls++;
+	stats->ring_used = waiting;
+	stats->ring_peak = MAX(stats->ring_peak, waiting);
+}
+
+void netdev_queue_rx_poll(netdev_rx_stats_t* stats, dpc_t poll) {
+	stats->rx_poll = poll;
+	if (!proc_queue_dpc(poll)) {
+		stats->rx_poll_lost = true;
+	}
+}
+
+void netdev_rx_poll_yield(netdev_rx_stats_t* stats, dpc_t poll) {
+	stats->budget_hits++;
+	netdev_queue_rx_poll(stats, poll);
+}
+
+/**
+ * @brief Render the receive statistics table for /devices/netstats.
+ * Columns are fixed width so the size of the file only changes when a device
+ * comes or goes. Returns a kmalloc'd string which the caller must free.
+ */
+static char* net_stats_text(void)
+{
+	const size_t row = 128;
+	size_t rows = 1;
+	for (const netdev_t* dev = networkdevices; dev; dev = dev->next) {
+		rows += dev->rx_stats ? 1 : 0;
+	}
+	const size_t size = row * rows;
+	char* text = kmalloc(size);
+	if (!text) {
+		return NULL;
+	}
+	size_t len = snprintf(text, size, "DEVICE         RX PACKETS PACKETS/SEC    DROPPED RING USED  PEAK  SIZE          POLLS  BUDGET HITS\n");
+	for (netdev_t* dev = networkdevices; dev; dev = dev->next) {
+		netdev_rx_stats_t* st = dev->rx_stats;
+		if (!st) {
+			continue;
+		}
+		uint64_t now = get_ticks();
+		if (now - st->rate_ticks >= 1000) {
+			st->rate = st->rate_ticks ? (st->packets - st->rate_packets) * 1000 / (now - st->rate_ticks) : 0;
+			st->rate_packets = st->packets;
+			st->rate_ticks = now;
+		}
+		len += snprintf(text + len, size - len, "%-8s %16lu %11lu %10lu %9u %5u %5u %14lu %12lu\n", dev->name, st->packets, st->rate,
+				st->dropped, st->ring_used, st->ring_peak, st->ring_size, st->polls, st->budget_hits);
+	}
+	return text;
+}
+
+static void net_stats_update_cb(fs_directory_entry_t* ent) {
+	char* text = net_stats_text();
+	ent->size = text ? strlen(text) : 0;
+	kfree_null(&text);
+}
+
+static bool net_stats_read_cb(uint64_t start, uint32_t length, unsigned char* buffer) {
+	char* text = net_stats_text();
+	if (!text) {
+		fs_set_error(FS_ERR_OUT_OF_MEMORY);
+		return false;
+	}
+	uint64_t text_length = strlen(text);
+
+	if (start + length > text_length) {
+		kfree_null(&text);
+		fs_set_error(FS_ERR_SEEK_PAST_END);
+		return false;
+	}
+	memcpy(buffer, text + start, length);
+	kfree_null(&text);
+	return true;
+}
+
+void init_net_stats(void) {
+	devfs_register_text("netstats", net_stats_update_cb, net_stats_read_cb);
+}
+
 netdev_t* find_network_device(const char* name) {
 	if (!name || !*name) {
 		return NULL;
@@ -19,6 +19,22 @@ static const uint64_t tcp_retx_initial_rto = 1000;
 /* Maximum retransmission attempts before abandoning the connection. */
 static const uint8_t tcp_retx_max_retries = 5;
 
+/* Time in milliseconds a connection spends in TIME-WAIT before its TCB is freed. */
+static const uint64_t tcp_time_wait_ms = 12000;
+
+/* Wake BASIC processes sleeping on this connection's socket */
+static void tcp_wake(const tcp_conn_t* conn)
+{
+	if (conn && conn->fd >= 0) {
+		proc_wake(WAIT_CHANNEL(WAIT_TCP, conn->fd));
+	}
+}
+
+static uint32_t tcp_mss(const tcp_conn_t* conn)
+{
+	return conn->peer_mss ? conn->peer_mss : 1460;
+}
+
 /* Must match up with order and amount of error messages in tcp_error_code_t */
 static const char* error_messages[] = {
 	"No error",
@@ -52,7 +68,9 @@ static const char* error_messages[] = {
 
 bool tcp_state_receive_fin(ip_packet_t* encap_packet, tcp_segment_t* segment, tcp_conn_t* conn, const tcp_options_t* options, size_t len);
 bool tcp_handle_data_in(ip_packet_t* encap_packet, tcp_segment_t* segment, tcp_conn_t* conn, const tcp_options_t* options, size_t len);
+void tcp_set_conn_msl_time(tcp_conn_t* conn);
 static bool tcp_retx_resend_head(tcp_conn_t* conn);
+static void tcp_mark_ready(tcp_conn_t* conn);
 size_t tcp_header_size(tcp_segment_t* s);
 
 const char* socket_error(int error_code) {
@@ -155,11 +173,12 @@ uint16_t tcp_recv_window(const tcp_conn_t* conn)
 	uint32_t space;
 	uint32_t max_window = 65535;
 
-	if (conn->recv_buffer_len >= TCP_ADVERTISED_WINDOW) {
+	/* Everything we advertise must fit in the receive ring as it stands */
+	if (conn->recv_buffer_len >= TCP_RECV_RING_SIZE) {
 		return 0;
 	}
 
-	space = TCP_ADVERTISED_WINDOW - conn->recv_buffer_len;
+	space = TCP_RECV_RING_SIZE - conn->recv_buffer_len;
 
 	if (conn->window_scaling) {
 		max_window <<= conn->rcv_wscale;
@@ -180,6 +199,73 @@ uint16_t tcp_recv_window(const tcp_conn_t* conn)
 	return (uint16_t)space;
 }
 
+/**
+ * @brief Append in-order data to the receive ring, allocating it on first use.
+ * The ring never grows, as the advertised window never exceeds its free space.
+ *
+ * @param conn TCB
+ * @param data data to append
+ * @param length number of octets
+ * @return true on success, false if there is no room or the ring could not be allocated
+ */
+static bool tcp_recv_ring_append(tcp_conn_t* conn, const uint8_t* data, size_t length)
+{
+	if (!conn->recv_buffer) {
+		conn->recv_buffer = kmalloc(TCP_RECV_RING_SIZE);
+		if (!conn->recv_buffer) {
+			return false;
+		}
+		conn->recv_buffer_size = TCP_RECV_RING_SIZE;
+		conn->recv_buffer_start = 0;
+		conn->recv_buffer_len = 0;
+	}
+	if (length > conn->recv_buffer_size - conn->recv_buffer_len) {
+		return false;
+	}
+	size_t tail = (conn->recv_buffer_start + conn->recv_buffer_len) & (conn->recv_buffer_size - 1);
+	size_t first = MIN(length, conn->recv_buffer_size - tail);
+	memcpy(conn->recv_buffer + tail, data, first);
+	memcpy(conn->recv_buffer, data + first, length - first);
+	conn->recv_buffer_len += length;
+	return true;
+}
+
+/**
+ * @brief Length of the unread data that is contiguous in the receive ring from its start
+ */
+static size_t tcp_recv_ring_contiguous(const tcp_conn_t* conn)
+{
+	if (conn->recv_buffer_len == 0) {
+		return 0;
+	}
+	return MIN(conn->recv_buffer_len, conn->recv_buffer_size - conn->recv_buffer_start);
+}
+
+/**
+ * @brief Drop length bytes from the start of the receive ring. If this reopens a window
+ * which had fallen below a segment, or half the ring, queue a window update for tcp_idle().
+ * Must be called with the TCP lock held.
+ *
+ * @param conn TCB
+ * @param length number of octets, no more than recv_buffer_len
+ */
+static void tcp_recv_ring_consume(tcp_conn_t* conn, size_t length)
+{
+	size_t threshold = MIN(tcp_mss(conn), TCP_RECV_RING_SIZE / 2);
+	bool was_closing = (TCP_RECV_RING_SIZE - conn->recv_buffer_len) < threshold;
+
+	conn->recv_buffer_start = (conn->recv_buffer_start + length) & (conn->recv_buffer_size - 1);
+	conn->recv_buffer_len -= length;
+	if (conn->recv_buffer_len == 0) {
+		conn->recv_buffer_start = 0;
+	}
+
+	if (was_closing && (TCP_RECV_RING_SIZE - conn->recv_buffer_len) >= threshold) {
+		conn->recv_window_update = true;
+		tcp_mark_ready(conn);
+	}
+}
+
 /**
  * @brief Comparison function for hash table of tcp connections
  * 
@@ -247,6 +333,84 @@ static void tcp_retx_free_all(tcp_conn_t* conn)
 	conn->retx_tail = NULL;
 }
 
+static void tcp_conn_key(const tcp_conn_t* conn, tcp_conn_key_t* key)
+{
+	key->local_addr = conn->local_addr;
+	key->remote_addr = conn->remote_addr;
+	key->local_port = conn->local_port;
+	key->remote_port = conn->remote_port;
+}
+
+/**
+ * @brief Find the TCB for a timer or ready list entry. Listeners never have either,
+ * so this is an exact 4-tuple match with no fallback to a listening socket.
+ */
+static tcp_conn_t* tcp_find_key(const tcp_conn_key_t* key)
+{
+	tcp_conn_t find_key = {
+		.local_addr  = key->local_addr,
+		.remote_addr = key->remote_addr,
+		.local_port  = key->local_port,
+		.remote_port = key->remote_port,
+		.state       = TCP_SYN_RECEIVED    /* any non-LISTEN value works */
+	};
+	return hashmap_get(tcb, &find_key);
+}
+
+/**
+ * @brief Arm or move one of a connection's timers. If its entry already on the
+ * wheel comes due no later, that entry is left to requeue itself for the new time.
+ *
+ * @param conn TCB, which must already be in the TCB hashmap
+ * @param kind which timer
+ * @param due tick to fire at
+ */
+static void tcp_timer_arm(tcp_conn_t* conn, tcp_timer_kind_t kind, uint64_t due)
+{
+	conn->timer_due[kind] = due;
+	if (conn->timer_queued[kind] != 0 && conn->timer_queued[kind] <= due) {
+		return;
+	}
+	tcp_conn_key_t key;
+	tcp_conn_key(conn, &key);
+	if (tcp_timer_add(&key, kind, due)) {
+		conn->timer_queued[kind] = due;
+	} else {
+		dprintf("TCP: out of memory arming timer %d\n", kind);
+	}
+}
+
+static void tcp_timer_cancel(tcp_conn_t* conn, tcp_timer_kind_t kind)
+{
+	conn->timer_due[kind] = 0;
+}
+
+/**
+ * @brief Keep the retransmission timer in step with the head of the retransmit queue
+ */
+static void tcp_retx_rearm(tcp_conn_t* conn)
+{
+	if (conn->retx_head) {
+		tcp_timer_arm(conn, TCP_TIMER_RETRANSMIT, conn->retx_head->sent_at + conn->retx_head->rto_ms);
+	} else {
+		tcp_timer_cancel(conn, TCP_TIMER_RETRANSMIT);
+	}
+}
+
+/**
+ * @brief Put a connection on the ready list for tcp_idle(), unless it is already there.
+ * Must be called with the TCP lock held.
+ */
+static void tcp_mark_ready(tcp_conn_t* conn)
+{
+	if (conn->tx_ready) {
+		return;
+	}
+	tcp_conn_key_t key;
+	tcp_conn_key(conn, &key);
+	conn->tx_ready = tcp_ready_push(&key);
+}
+
 void tcp_free(tcp_conn_t* conn, bool with_lock)
 {
 	uint64_t flags;
@@ -265,6 +429,11 @@ void tcp_free(tcp_conn_t* conn, bool with_lock)
 
 	tcp_retx_free_all(conn);
 
+	kfree_null(&conn->send_buffer);
+	conn->send_buffer_len = conn->send_buffer_size = conn->send_buffer_start = 0;
+	kfree_null(&conn->recv_buffer);
+	conn->recv_buffer_len = conn->recv_buffer_size = conn->recv_buffer_start = 0;
+
 	// Free pending queue if it exists
 	if (conn->pending) {
 		while (!queue_empty(conn->pending)) {
@@ -278,40 +447,51 @@ void tcp_free(tcp_conn_t* conn, bool with_lock)
 	conn->backlog = 0;
 
 	// Remove the TCB
+	const int conn_fd = conn->fd;
 	hashmap_delete(tcb, conn);
 	if (with_lock) {
 		unlock_spinlock_irq(&lock, flags);
 	}
+	if (conn_fd >= 0) {
+		proc_wake(WAIT_CHANNEL(WAIT_TCP, conn_fd));
+	}
+}
+
+/**
+ * @brief Partial one's complement sum of the IPv4 pseudo-header for a segment
+ */
+static uint64_t tcp_pseudo_header_sum(ip_packet_t* packet, size_t len)
+{
+	tcp_ip_pseudo_header_t pseudo = {
+		.src = *((uint32_t*)&packet->src_ip),
+		.dst = *((uint32_t*)&packet->dst_ip),
+		.reserved = 0,
+		.protocol = PROTOCOL_TCP,
+		.len = htons(len),
+	};
+	return inet_csum_partial(&pseudo, sizeof(pseudo), 0);
 }
 
 uint16_t tcp_calculate_checksum(ip_packet_t* packet, tcp_segment_t* segment, size_t len)
 {
-	int array_size = len + sizeof(tcp_ip_pseudo_header_t);
-	tcp_ip_pseudo_header_t pseudo[array_size * 2];
-	array_size += (array_size % 2); // Ensure buffer is even-aligned
-	memset(pseudo, 0, array_size * 2);
-	pseudo->dst = *((uint32_t*)&packet->dst_ip);
-	pseudo->src = *((uint32_t*)&packet->src_ip);
-	pseudo->protocol = PROTOCOL_TCP;
-	pseudo->reserved = 0;
-	pseudo->len = htons(len);
-	uint32_t checksum = segment->checksum;
+	/* Sum the pseudo-header and then the segment where it lies, with its checksum field zeroed */
+	uint16_t checksum = segment->checksum;
 	segment->checksum = 0;
-	memcpy(pseudo->body, segment, len);
+	uint64_t sum = inet_csum_partial(segment, len, tcp_pseudo_header_sum(packet, len));
 	segment->checksum = checksum;
 
-	// Treat the packet header as a 2-byte-integer array
-	// Sum all integers switch to network byte order
-	uint16_t * array = (uint16_t*)pseudo;
-	uint32_t sum = 0;
-	for(int i = 0; i < array_size / 2; i++) {
-		sum += htons(array[i]);
-	}
-	sum = (sum & 0xffff) + (sum >> 16);
-	sum += (sum >> 16);
+	uint16_t result = ntohs(inet_csum_fold(sum));
+	add_random_entropy(result ^ (uint64_t)segment);
+	return result;
+}
 
-	add_random_entropy(sum ^ (uint64_t)pseudo);
-	return ~sum;
+/**
+ * @brief True if segments for a connection leave through a device which
+ * fills in TCP checksums itself. Loopback segments never reach a device.
+ */
+static bool tcp_csum_offloaded(const tcp_conn_t* conn)
+{
+	return !ip_is_loopback((const uint8_t*)&conn->remote_addr) && network_device_offloads(NETDEV_OFFLOAD_TCP_CSUM);
 }
 
 static uint32_t tcp_segment_end_seq(uint32_t seq, uint8_t flags, size_t count)
@@ -372,27 +552,54 @@ static bool tcp_retx_enqueue(tcp_conn_t* conn, uint32_t seq, uint8_t flags, cons
 	entry->rto_ms = tcp_retx_initial_rto;
 	entry->retries = 0;
 	entry->len = len;
+	entry->csum_offloaded = tcp_csum_offloaded(conn);
 	entry->next = NULL;
 
 	if (conn->retx_tail) {
 		conn->retx_tail->next = entry;
 	} else {
 		conn->retx_head = entry;
+		tcp_retx_rearm(conn);
 	}
 	conn->retx_tail = entry;
 
 	return true;
 }
 
+/**
+ * @brief Grow the congestion window for newly acknowledged data (RFC 5681).
+ * Below ssthresh the window grows by up to one segment per ACK (slow start),
+ * doubling every round trip; above it, by about one segment per round trip.
+ */
+static void tcp_congestion_ack(tcp_conn_t* conn, uint32_t acked)
+{
+	uint32_t mss = tcp_mss(conn);
+	uint32_t growth = conn->cwnd < conn->ssthresh ? MIN(acked, mss) : MAX(mss * mss / MAX(conn->cwnd, 1), 1);
+	conn->cwnd = MIN((uint64_t)conn->cwnd + growth, INT32_MAX);
+}
+
+/**
+ * @brief Shrink the congestion window after a loss. Three duplicate ACKs
+ * halve it, a retransmission timeout drops it to one segment (RFC 5681).
+ */
+static void tcp_congestion_loss(tcp_conn_t* conn, bool timeout)
+{
+	uint32_t mss = tcp_mss(conn);
+	conn->ssthresh = MAX((conn->snd_nxt - conn->snd_una) / 2, 2 * mss);
+	conn->cwnd = timeout ? mss : conn->ssthresh;
+}
+
 static void tcp_retx_acknowledge(tcp_conn_t* conn, uint32_t ack)
 {
 	if (!seq_gt(ack, conn->snd_una)) {
 		return;
 	}
 
+	tcp_congestion_ack(conn, ack - conn->snd_una);
 	conn->snd_una = ack;
 	conn->last_dup_ack = 0;
 	conn->dup_ack_count = 0;
+	tcp_wake(conn);
 
 	while (conn->retx_head && seq_gte(ack, conn->retx_head->end_seq)) {
 		tcp_retx_entry_t* old = conn->retx_head;
@@ -405,6 +612,12 @@ static void tcp_retx_acknowledge(tcp_conn_t* conn, uint32_t ack)
 		kfree_null(&old->segment_copy);
 		kfree_null(&old);
 	}
+	tcp_retx_rearm(conn);
+
+	/* The window has moved on, so more buffered data may now go */
+	if (conn->send_buffer_len > 0) {
+		tcp_mark_ready(conn);
+	}
 }
 
 static void tcp_process_ack(tcp_conn_t* conn, tcp_segment_t* segment, size_t len)
@@ -427,6 +640,20 @@ static void tcp_process_ack(tcp_conn_t* conn, tcp_segment_t* segment, size_t len
 		return;
 	}
 
+	/* A window update without new data acknowledged, e.g. reopening a zero window */
+	if (seq_gt(segment->seq, conn->snd_wl1) || (segment->seq == conn->snd_wl1 && seq_gte(segment->ack, conn->snd_wl2))) {
+		uint32_t window = tcp_segment_window(conn, segment);
+		conn->snd_wl1 = segment->seq;
+		conn->snd_wl2 = segment->ack;
+		if (window != conn->snd_wnd) {
+			conn->snd_wnd = window;
+			if (conn->send_buffer_len > 0) {
+				tcp_mark_ready(conn);
+			}
+			return;
+		}
+	}
+
 	if (len != header_len) {
 		return;
 	}
@@ -455,6 +682,7 @@ static void tcp_process_ack(tcp_conn_t* conn, tcp_segment_t* segment, size_t len
 
 	if (conn->dup_ack_count == 3) {
 		dprintf("TCP fast retransmit\n");
+		tcp_congestion_loss(conn, false);
 		tcp_retx_resend_head(conn);
 	}
 }
@@ -468,6 +696,24 @@ static bool tcp_retx_resend_head(tcp_conn_t* conn)
 		return false;
 	}
 
+	/* The copy still carries the ACK and window from when it was first sent.
+	 * Bring them up to date, patching the checksum rather than summing the
+	 * whole segment again (RFC 1624). Where the device sums the segment, the
+	 * field holds only the pseudo-header sum, which these do not change. */
+	tcp_segment_t* segment = entry->segment_copy;
+	uint16_t check = segment->checksum;
+	if (entry->flags & TCP_ACK) {
+		uint32_t ack = htonl(conn->rcv_nxt);
+		check = inet_csum_update32(check, segment->ack, ack);
+		segment->ack = ack;
+	}
+	uint16_t window = htons(tcp_recv_window(conn));
+	check = inet_csum_update16(check, segment->window_size, window);
+	segment->window_size = window;
+	if (!entry->csum_offloaded) {
+		segment->checksum = check;
+	}
+
 	memcpy(&encap.src_ip, &conn->local_addr, 4);
 	memcpy(&encap.dst_ip, &conn->remote_addr, 4);
 	ip_send_packet(encap.dst_ip, entry->segment_copy, entry->len, PROTOCOL_TCP);
@@ -482,6 +728,7 @@ static bool tcp_retx_resend_head(tcp_conn_t* conn)
 	if (entry->retries < 255) {
 		++entry->retries;
 	}
+	tcp_retx_rearm(conn);
 
 	return true;
 }
@@ -631,7 +878,18 @@ tcp_conn_t* tcp_set_state(tcp_conn_t* conn, tcp_state_t new_state)
 	if (conn == NULL) {
 		return NULL;
 	}
+	if (new_state == TCP_ESTABLISHED && conn->state != TCP_ESTABLISHED) {
+		conn->cwnd = TCP_INITIAL_CWND * tcp_mss(conn);
+		conn->ssthresh = UINT32_MAX;
+		if (conn->send_buffer_len > 0) {
+			tcp_mark_ready(conn);
+		}
+	}
+	if (new_state == TCP_TIME_WAIT && conn->state != TCP_TIME_WAIT) {
+		tcp_set_conn_msl_time(conn);
+	}
 	conn->state = new_state;
+	tcp_wake(conn);
 	return conn;
 }
 
@@ -742,7 +1000,12 @@ tcp_conn_t* tcp_send_segment(tcp_conn_t *conn, uint32_t seq, uint8_t flags, cons
 	// Copy data over
 	memcpy((void*)packet->payload + opt_len, data, count);
 
-	packet->checksum = htons(tcp_calculate_checksum(&encap, packet, length));
+	if (tcp_csum_offloaded(conn)) {
+		/* The device sums from the TCP header on, so seed it with the pseudo-header */
+		packet->checksum = ~inet_csum_fold(tcp_pseudo_header_sum(&encap, length));
+	} else {
+		packet->checksum = htons(tcp_calculate_checksum(&encap, packet, length));
+	}
 
 #ifdef TCP_TRACE
 	tcp_byte_order_in(packet);
@@ -938,29 +1201,22 @@ void tcp_process_queue(tcp_conn_t* conn, tcp_segment_t* segment, size_t len)
 			}
 		}
 
-		if ((payload_len > 0) && (conn->recv_buffer_len + payload_len > TCP_RECV_BUFFER_LIMIT)) {
-			break;
-		}
-
-		// increment what we have received in our connection state
-		conn->rcv_nxt += payload_len;
-
-		// Append to recv buffer
+		// Append to recv ring; anything in the window fits, but check in case the window shrank
 		if (payload_len > 0) {
 			uint64_t flags;
 			lock_spinlock_irq(&lock, &flags);
-			uint8_t* new_buffer = krealloc(conn->recv_buffer, conn->recv_buffer_len + payload_len);
-			if (!new_buffer) {
-				dprintf("Error: resize of recv buffer to %lu failed!\n", conn->recv_buffer_len + payload_len);
+			bool stored = tcp_recv_ring_append(conn, payload, payload_len);
+			unlock_spinlock_irq(&lock, flags);
+			if (!stored) {
+				dprintf("TCP: no room in recv ring for %lu bytes (%lu buffered)\n", payload_len, conn->recv_buffer_len);
 				break;
 			}
-
-			conn->recv_buffer = new_buffer;
-			memcpy(conn->recv_buffer + conn->recv_buffer_len, payload, payload_len);
-			conn->recv_buffer_len += payload_len;
-			unlock_spinlock_irq(&lock, flags);
+			tcp_wake(conn);
 		}
 
+		// increment what we have received in our connection state
+		conn->rcv_nxt += payload_len;
+
 		// Save next before freeing
 		tcp_ordered_list_t* next = cur->next;
 
@@ -1029,7 +1285,12 @@ bool tcp_state_listen(ip_packet_t *encap_packet, tcp_segment_t *segment, tcp_con
 	child.recv_buffer           = NULL;
 	child.send_buffer           = NULL;
 	child.recv_buffer_len       = 0;
+	child.recv_buffer_start     = 0;
+	child.recv_buffer_size      = 0;
+	child.recv_window_update    = false;
 	child.send_buffer_len       = 0;
+	child.send_buffer_start     = 0;
+	child.send_buffer_size      = 0;
 	child.recv_buffer_spinlock  = 0;
 	child.send_buffer_spinlock  = 0;
 	child.pending               = NULL;
@@ -1320,13 +1581,13 @@ bool tcp_handle_data_in(ip_packet_t* encap_packet, tcp_segment_t* segment, tcp_c
 	return true;
 }
 /**
- * @brief Set connection timeout (12 seconds)
+ * @brief Start, or restart, the TIME-WAIT timer (12 seconds)
  * 
  * @param conn TCB
  */
 void tcp_set_conn_msl_time(tcp_conn_t* conn)
 {
-	conn->msl_time = time(NULL) + 12000;
+	tcp_timer_arm(conn, TCP_TIMER_TIME_WAIT, get_ticks() + tcp_time_wait_ms);
 }
 
 /**
@@ -1357,14 +1618,12 @@ bool tcp_state_receive_fin(ip_packet_t* encap_packet, tcp_segment_t* segment, tc
 		case TCP_FIN_WAIT_1:
 			if (seq_gte(segment->ack, conn->snd_nxt)) {
 				tcp_set_state(conn, TCP_TIME_WAIT);
-				tcp_set_conn_msl_time(conn);
 			} else {
 				tcp_set_state(conn, TCP_CLOSING);
 			}
 			break;
 		case TCP_FIN_WAIT_2:
 			tcp_set_state(conn, TCP_TIME_WAIT);
-			tcp_set_conn_msl_time(conn);
 			break;
 		case TCP_CLOSE_WAIT:
 		case TCP_CLOSING:
@@ -1486,7 +1745,6 @@ bool tcp_state_closing(ip_packet_t* encap_packet, tcp_segment_t* segment, tcp_co
 	tcp_process_ack(conn, segment, len);
 	if (seq_gte(conn->snd_una, conn->snd_nxt)) {
 		tcp_set_state(conn, TCP_TIME_WAIT);
-		tcp_set_conn_msl_time(conn);
 	}
 	return true;
 }
@@ -1594,7 +1852,139 @@ void tcp_handle_packet(ip_packet_t* encap_packet, tcp_segment_t* segment, size_t
 }
 
 /**
- * @brief ISR idle task
+ * @brief Append data to the send ring, doubling its capacity if it is full.
+ * Growing linearises the ring, so the cost of queueing is amortised O(1)
+ * per byte however much is already buffered.
+ *
+ * @param conn TCB
+ * @param data data to append
+ * @param length number of octets
+ * @return true on success, false if out of memory
+ */
+static bool tcp_send_buffer_append(tcp_conn_t* conn, const uint8_t* data, size_t length)
+{
+	size_t needed = conn->send_buffer_len + length;
+	if (needed > conn->send_buffer_size) {
+		size_t new_size = conn->send_buffer_size ? conn->send_buffer_size : TCP_SEND_BUFFER_INITIAL;
+		while (new_size < needed) {
+			new_size <<= 1;
+		}
+		uint8_t* new_buffer = kmalloc(new_size);
+		if (!new_buffer) {
+			return false;
+		}
+		if (conn->send_buffer_len) {
+			size_t first = MIN(conn->send_buffer_len, conn->send_buffer_size - conn->send_buffer_start);
+			memcpy(new_buffer, conn->send_buffer + conn->send_buffer_start, first);
+			memcpy(new_buffer + first, conn->send_buffer, conn->send_buffer_len - first);
+		}
+		kfree_null(&conn->send_buffer);
+		conn->send_buffer = new_buffer;
+		conn->send_buffer_size = new_size;
+		conn->send_buffer_start = 0;
+	}
+	size_t tail = (conn->send_buffer_start + conn->send_buffer_len) & (conn->send_buffer_size - 1);
+	size_t first = MIN(length, conn->send_buffer_size - tail);
+	memcpy(conn->send_buffer + tail, data, first);
+	memcpy(conn->send_buffer, data + first, length - first);
+	conn->send_buffer_len += length;
+	return true;
+}
+
+/**
+ * @brief Transmit buffered data as a burst of segments, as far as the
+ * peer's receive window and our congestion window allow.
+ *
+ * @param conn TCB
+ */
+static void tcp_output(tcp_conn_t* conn)
+{
+	size_t mss = tcp_mss(conn);
+	while (conn->send_buffer_len > 0) {
+		uint32_t in_flight = conn->snd_nxt - conn->snd_una;
+		uint32_t window = MIN(conn->snd_wnd, conn->cwnd);
+		if (window == 0 && in_flight == 0) {
+			/* Zero window probe, retransmitted on RTO until the peer reopens its window */
+			window = 1;
+		}
+		if (in_flight >= window) {
+			break;
+		}
+		size_t amount = MIN(MIN(mss, window - in_flight), conn->send_buffer_len);
+		if (amount < mss && amount < conn->send_buffer_len && in_flight > 0) {
+			/* Avoid silly window syndrome, wait for ACKs to open a full segment */
+			break;
+		}
+		/* Segments are sent straight from the ring, so stop at the wrap point */
+		amount = MIN(amount, conn->send_buffer_size - conn->send_buffer_start);
+		if (tcp_write(conn, conn->send_buffer + conn->send_buffer_start, amount) < 0) {
+			dprintf("tcp_write returned error\n");
+			break;
+		}
+		conn->send_buffer_start = (conn->send_buffer_start + amount) & (conn->send_buffer_size - 1);
+		conn->send_buffer_len -= amount;
+	}
+	if (conn->send_buffer_len == 0) {
+		conn->send_buffer_start = 0;
+		tcp_wake(conn);
+	}
+}
+
+/**
+ * @brief Retransmission timeout for the segment at the head of the retransmit queue
+ */
+static void tcp_retransmit_timeout(tcp_conn_t* conn)
+{
+	if (!conn->retx_head) {
+		return;
+	}
+	if (conn->retx_head->retries >= tcp_retx_max_retries) {
+		dprintf("TCP retransmit exhausted\n");
+		tcp_set_close_code(conn, TCP_CONNECTION_LOST);
+		tcp_free(conn, false);
+		return;
+	}
+	tcp_congestion_loss(conn, true);
+	tcp_retx_resend_head(conn);
+}
+
+/**
+ * @brief Timer wheel expiry. Entries for connections which have gone, or which an
+ * earlier entry replaced, are dropped; timers moved later are queued again.
+ */
+static void tcp_timer_expired(const tcp_conn_key_t* key, tcp_timer_kind_t kind, uint64_t due)
+{
+	tcp_conn_t* conn = tcp_find_key(key);
+	if (!conn || conn->timer_queued[kind] != due) {
+		return;
+	}
+	conn->timer_queued[kind] = 0;
+	if (conn->timer_due[kind] == 0) {
+		return;
+	}
+	if (conn->timer_due[kind] > due) {
+		tcp_timer_arm(conn, kind, conn->timer_due[kind]);
+		return;
+	}
+	conn->timer_due[kind] = 0;
+
+	switch (kind) {
+		case TCP_TIMER_RETRANSMIT:
+			tcp_retransmit_timeout(conn);
+			break;
+		case TCP_TIMER_TIME_WAIT:
+			if (conn->state == TCP_TIME_WAIT) {
+				tcp_free(conn, false);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * @brief Scheduler idle task. Runs the timers which are due, then sends for the
+ * connections on the ready list, so idle connections cost nothing per tick.
  */
 void tcp_idle()
 {
@@ -1602,58 +1992,36 @@ void tcp_idle()
 		return;
 	}
 
-	void *item;
-	size_t iter = 0;
 	uint64_t flags;
 
 	lock_spinlock_irq(&lock, &flags);
-	while (hashmap_iter(tcb, &iter, &item)) {
-		tcp_conn_t *conn = item;
-		if (conn && conn->retx_head) {
-			tcp_retx_entry_t* entry = conn->retx_head;
-
-			if ((get_ticks() - entry->sent_at) >= entry->rto_ms) {
-				if (entry->retries >= tcp_retx_max_retries) {
-					dprintf("TCP retransmit exhausted\n");
-					tcp_set_close_code(conn, TCP_CONNECTION_LOST);
-					tcp_free(conn, false);
-					break;
-				}
-				tcp_retx_resend_head(conn);
-			}
-		}
-		if (conn && conn->state == TCP_ESTABLISHED) {
-			if (conn->send_buffer_len > 0 && conn->send_buffer != NULL) {
-				/* There is buffered data to send from high level functions */
-				size_t max_segment = conn->peer_mss ? conn->peer_mss : 1460;
-				size_t amount_to_send = conn->send_buffer_len > max_segment ? max_segment : conn->send_buffer_len;
-				//dprintf("socket has %lu to send\n", conn->send_buffer_len);
-				if (tcp_write(conn, conn->send_buffer, amount_to_send) < 0) {
-					dprintf("tcp_write returned error\n");
-				}
-				if (amount_to_send >= conn->send_buffer_len) {
-					// Everything is sent, free buffer entirely
-					kfree_null(&conn->send_buffer);
-					conn->send_buffer = NULL;
-					conn->send_buffer_len = 0;
-				} else {
-					size_t new_len = conn->send_buffer_len - amount_to_send;
-					void *new_buf = kmalloc(new_len);
-					if (new_buf) {
-						memcpy(new_buf, (uint8_t *)conn->send_buffer + amount_to_send, new_len);
-						kfree_null(&conn->send_buffer);
-						conn->send_buffer = new_buf;
-						conn->send_buffer_len = new_len;
-					} else {
-						tcp_set_close_code(conn, TCP_ERROR_OUT_OF_MEMORY);
-					}
-				}
-			}
-		} else if (conn && conn->state == TCP_TIME_WAIT && seq_gte(get_isn(conn->local_addr, conn->remote_addr, conn->local_port, conn->remote_port), conn->msl_time)) {
-			tcp_free(conn, false);
+	/* Retransmits, window updates and bursts for every connection share one doorbell */
+	ethernet_tx_batch_begin();
+	tcp_timer_advance(get_ticks(), tcp_timer_expired);
+
+	/* Only those already waiting, anything added meanwhile is left for the next pass */
+	for (size_t waiting = tcp_ready_count(); waiting > 0; waiting--) {
+		tcp_conn_key_t key;
+		if (!tcp_ready_pop(&key)) {
 			break;
 		}
+		tcp_conn_t* conn = tcp_find_key(&key);
+		if (!conn || !conn->tx_ready) {
+			continue;
+		}
+		conn->tx_ready = false;
+		if (conn->recv_window_update) {
+			/* Not tcp_send_ack(), which would suppress this as a duplicate of the last ACK */
+			conn->recv_window_update = false;
+			tcp_send_segment(conn, conn->snd_nxt, TCP_ACK, NULL, 0);
+		}
+		if (conn->state == TCP_ESTABLISHED && conn->send_buffer_len > 0) {
+			/* There is buffered data to send from high level functions. Whatever the
+			 * windows hold back is queued again when an ACK opens them. */
+			tcp_output(conn);
+		}
 	}
+	ethernet_tx_batch_end();
 	unlock_spinlock_irq(&lock, flags);
 }
 
@@ -1709,6 +2077,7 @@ void tcp_init() {
 	isn_hash_seed0 = seeds[0];
 	isn_hash_seed1 = seeds[1];
 	isn_tick_base = get_ticks();
+	tcp_timer_init(isn_tick_base);
 	ip_register_protocol(PROTOCOL_TCP, (ip_protocol_handler_t)tcp_handle_packet);
 	icmp_register_unreachable_handler(PROTOCOL_TCP, tcp_handle_icmp_unreachable);
 	proc_register_idle(tcp_idle, IDLE_BACKGROUND, 1);
@@ -1821,7 +2190,12 @@ int tcp_connect(uint32_t target_addr, uint16_t target_port, uint16_t source_port
 	conn.recv_buffer = NULL;
 	conn.send_buffer = NULL;
 	conn.recv_buffer_len = 0;
+	conn.recv_buffer_start = 0;
+	conn.recv_buffer_size = 0;
+	conn.recv_window_update = false;
 	conn.send_buffer_len = 0;
+	conn.send_buffer_start = 0;
+	conn.send_buffer_size = 0;
 	conn.recv_buffer_spinlock = 0;
 	conn.send_buffer_spinlock = 0;
 	conn.pending = NULL;
@@ -1913,15 +2287,12 @@ int send(int socket, const void* buffer, uint32_t length)
 		unlock_spinlock_irq(&lock, flags);
 		return TCP_ERROR_INVALID_SOCKET;
 	}
-	uint8_t* new_buffer = krealloc(conn->send_buffer, length + conn->send_buffer_len);
-	if (!new_buffer) {
+	if (!tcp_send_buffer_append(conn, buffer, length)) {
 		dprintf("send(): out of memory on socket %d!\n", socket);
 		unlock_spinlock_irq(&lock, flags);
 		return TCP_ERROR_OUT_OF_MEMORY;
 	}
-	conn->send_buffer = new_buffer;
-	memcpy(conn->send_buffer + conn->send_buffer_len, buffer, length);
-	conn->send_buffer_len += length;
+	tcp_mark_ready(conn);
 	unlock_spinlock_irq(&lock, flags);
 	tcp_idle(); // kick buffer drain
 	return (int)length;
@@ -1972,7 +2343,7 @@ bool is_connected(int socket)
 		return false;
 	}
 
-	if (conn->recv_buffer != NULL && conn->recv_buffer_len > 0) {
+	if (conn->recv_buffer_len > 0) {
 		return true;
 	}
 
@@ -2000,7 +2371,7 @@ int recv(int socket, void* buffer, uint32_t maxlen, bool blocking, uint32_t time
 
 	if (blocking) {
 		time_t now = get_ticks();
-		while (conn->recv_buffer_len == 0 || conn->recv_buffer == NULL) {
+		while (conn->recv_buffer_len == 0) {
 			if (get_ticks() - now > timeout || conn->state != TCP_ESTABLISHED) {
 				return TCP_ERROR_CONNECTION_FAILED;
 			}
@@ -2009,32 +2380,72 @@ int recv(int socket, void* buffer, uint32_t maxlen, bool blocking, uint32_t time
 
 	lock_spinlock_irq(&lock, &flags);
 
-	if (conn->recv_buffer_len > 0 && conn->recv_buffer != NULL) {
-		/* There is buffered data to receive  */
-		size_t amount_to_recv = conn->recv_buffer_len > maxlen ? maxlen : conn->recv_buffer_len;
-		memcpy(buffer, conn->recv_buffer, amount_to_recv);
-		/* Resize recv buffer down */
-		if (conn->recv_buffer_len - amount_to_recv <= 0) {
-			kfree_null(&conn->recv_buffer);
-			conn->recv_buffer_len = 0;
-		} else {
-			size_t new_len = conn->recv_buffer_len - amount_to_recv;
-			void *new_buf = kmalloc(new_len);
-			if (new_buf) {
-				memcpy(new_buf, conn->recv_buffer + amount_to_recv, new_len);
-				kfree_null(&conn->recv_buffer);
-				conn->recv_buffer = new_buf;
-				conn->recv_buffer_len = new_len;
+	/* Copy out of the ring in at most two pieces, either side of the wrap point */
+	size_t received = 0;
+	while (received < maxlen) {
+		size_t amount = MIN(tcp_recv_ring_contiguous(conn), maxlen - received);
+		if (amount == 0) {
+			break;
+		}
+		memcpy((uint8_t*)buffer + received, conn->recv_buffer + conn->recv_buffer_start, amount);
+		tcp_recv_ring_consume(conn, amount);
+		received += amount;
+	}
+
+	unlock_spinlock_irq(&lock, flags);
+	return received;
+}
+
+int tcp_recv_escaped(int socket, char* buffer, size_t size)
+{
+	tcp_conn_t* conn = tcp_find_by_fd(socket);
+	uint64_t flags;
+
+	if (conn == NULL) {
+		dprintf("tcp_recv_escaped(): invalid socket\n");
+		return TCP_ERROR_INVALID_SOCKET;
+	}
+	if (size == 0) {
+		return 0;
+	}
+
+	lock_spinlock_irq(&lock, &flags);
+
+	/* Walk each side of the wrap point, stopping at the first byte whose escape would not fit */
+	size_t out = 0, received = 0;
+	for (;;) {
+		size_t avail = tcp_recv_ring_contiguous(conn);
+		if (avail == 0) {
+			break;
+		}
+		const uint8_t* run = conn->recv_buffer + conn->recv_buffer_start;
+		size_t taken = 0;
+		while (taken < avail) {
+			uint8_t b = run[taken];
+			if (b == 0 || b == STRING_ESCAPE_BYTE) {
+				if (out + 2 >= size) {
+					break;
+				}
+				buffer[out++] = (char) STRING_ESCAPE_BYTE;
+				buffer[out++] = (char) (b == 0 ? STRING_ESCAPED_NUL : STRING_ESCAPED_ESC);
 			} else {
-				tcp_set_close_code(conn, TCP_ERROR_OUT_OF_MEMORY);
+				if (out + 1 >= size) {
+					break;
+				}
+				buffer[out++] = (char) b;
 			}
+			taken++;
+		}
+		tcp_recv_ring_consume(conn, taken);
+		received += taken;
+		if (taken < avail) {
+			break;
 		}
-		unlock_spinlock_irq(&lock, flags);
-		return amount_to_recv;
 	}
 
 	unlock_spinlock_irq(&lock, flags);
-	return 0;
+	buffer[out] = 0;
+	return (int) received;
 }
 
 bool sock_ready_to_read(int socket) {
@@ -2043,7 +2454,7 @@ bool sock_ready_to_read(int socket) {
 		dprintf("sock_ready_to_read on non-established sock\n");
 		return false;
 	}
-	return conn->recv_buffer && conn->recv_buffer_len > 0;
+	return conn->recv_buffer_len > 0;
 }
 
 
@@ -2175,7 +2586,7 @@ static inline bool tcp_tx_drained_nolock(const tcp_conn_t *c) {
 	} else if (c->state != TCP_ESTABLISHED) {
 		return true;
 	}
-	return (c->send_buffer_len == 0 && c->send_buffer == NULL);
+	return c->send_buffer_len == 0;
 }
 
 bool sock_sent(int fd) {
@@ -0,0 +1,237 @@
+/**
+ * @file tcp_timer.c
+ * @brief Hierarchical timer wheel and ready list for TCP connections
+ *
+ * TCBs are held by value in a hashmap, which moves them about as it grows and
+ * shrinks, so neither structure here may point at one. Both hold the
+ * connection's 4-tuple instead, and the TCP layer looks the connection up
+ * again when a timer fires or it comes off the ready list. Timers for
+ * connections which have since gone, or which were moved, are left where they
+ * are and thrown away by the TCP layer when they come due, so nothing is ever
+ * unlinked from the middle of a slot.
+ *
+ * The wheel has TCP_TIMER_LEVELS levels of TCP_TIMER_SLOTS slots. Level 0
+ * slots are one tick wide, and each slot on a higher level spans a whole turn
+ * of the level below. Whenever a level wraps, the next slot of the level above
+ * is cascaded down. A timer up to 2^24 ticks (about 4.6 hours) ahead goes
+ * straight into a slot, and one further out is parked in the furthest slot
+ * and placed again when it gets there. Each tick costs one level 0 slot plus
+ * the occasional cascade, however many connections are open.
+ */
+#include <kernel.h>
+
+#define TCP_TIMER_BITS		6
+#define TCP_TIMER_SLOTS		(1 << TCP_TIMER_BITS)
+#define TCP_TIMER_LEVELS	4
+#define TCP_TIMER_SPAN		(1ULL << (TCP_TIMER_BITS * TCP_TIMER_LEVELS))
+/* Freed nodes kept for reuse, so arming a timer does not usually need kmalloc() */
+#define TCP_TIMER_SPARE_MAX	256
+
+typedef struct tcp_timer_node_t {
+	struct tcp_timer_node_t* next;
+	tcp_conn_key_t key;
+	tcp_timer_kind_t kind;
+	uint64_t due;
+} tcp_timer_node_t;
+
+static tcp_timer_node_t* wheel[TCP_TIMER_LEVELS][TCP_TIMER_SLOTS] = { 0 };
+/* Last tick the wheel was turned to */
+static uint64_t wheel_now = 0;
+/* Timers on the wheel, when zero turning it is skipped */
+static size_t wheel_count = 0;
+
+static tcp_timer_node_t* ready_head = NULL;
+static tcp_timer_node_t* ready_tail = NULL;
+static size_t ready_count = 0;
+
+static tcp_timer_node_t* spare = NULL;
+static size_t spare_count = 0;
+
+/* Leaf lock, never held while calling out */
+static spinlock_t timer_lock = 0;
+
+static tcp_timer_node_t* tcp_timer_node_new(void)
+{
+	tcp_timer_node_t* n = spare;
+	if (n) {
+		spare = n->next;
+		spare_count--;
+		return n;
+	}
+	return kmalloc(sizeof(tcp_timer_node_t));
+}
+
+static void tcp_timer_node_release(tcp_timer_node_t* n)
+{
+	if (spare_count >= TCP_TIMER_SPARE_MAX) {
+		kfree_null(&n);
+		return;
+	}
+	n->next = spare;
+	spare = n;
+	spare_count++;
+}
+
+/**
+ * @brief Put a node in the slot its due tick falls in, relative to wheel_now.
+ * Nodes due before @p floor go in floor's slot.
+ */
+static void tcp_timer_place(tcp_timer_node_t* n, uint64_t floor)
+{
+	uint64_t due = MAX(n->due, floor);
+	if (due - wheel_now >= TCP_TIMER_SPAN) {
+		/* Parked; the node keeps its real due tick and is placed again from here */
+		due = wheel_now + TCP_TIMER_SPAN - 1;
+	}
+	size_t level = 0;
+	while (level < TCP_TIMER_LEVELS - 1 && due - wheel_now >= (1ULL << (TCP_TIMER_BITS * (level + 1)))) {
+		level++;
+	}
+	size_t slot = (due >> (TCP_TIMER_BITS * level)) & (TCP_TIMER_SLOTS - 1);
+	n->next = wheel[level][slot];
+	wheel[level][slot] = n;
+}
+
+/**
+ * @brief Move every node in a slot of a higher level down to the levels below.
+ * @return the slot index, zero when this level has itself wrapped
+ */
+static size_t tcp_timer_cascade(size_t level)
+{
+	size_t slot = (wheel_now >> (TCP_TIMER_BITS * level)) & (TCP_TIMER_SLOTS - 1);
+	tcp_timer_node_t* n = wheel[level][slot];
+	wheel[level][slot] = NULL;
+	while (n) {
+		tcp_timer_node_t* next = n->next;
+		/* Due this very tick goes in the level 0 slot about to be run */
+		tcp_timer_place(n, wheel_now);
+		n = next;
+	}
+	return slot;
+}
+
+void tcp_timer_init(uint64_t now)
+{
+	uint64_t flags;
+	lock_spinlock_irq(&timer_lock, &flags);
+	wheel_now = now;
+	unlock_spinlock_irq(&timer_lock, flags);
+}
+
+bool tcp_timer_add(const tcp_conn_key_t* key, tcp_timer_kind_t kind, uint64_t due)
+{
+	uint64_t flags;
+	lock_spinlock_irq(&timer_lock, &flags);
+	tcp_timer_node_t* n = tcp_timer_node_new();
+	if (!n) {
+		unlock_spinlock_irq(&timer_lock, flags);
+		return false;
+	}
+	n->key = *key;
+	n->kind = kind;
+	n->due = due;
+	tcp_timer_place(n, wheel_now + 1);
+	wheel_count++;
+	unlock_spinlock_irq(&timer_lock, flags);
+	return true;
+}
+
+void tcp_timer_advance(uint64_t now, tcp_timer_handler_t handler)
+{
+	tcp_timer_node_t* expired = NULL;
+	uint64_t flags;
+
+	lock_spinlock_irq(&timer_lock, &flags);
+	if (wheel_count == 0 && now > wheel_now) {
+		/* Nothing to find on the way */
+		wheel_now = now;
+	}
+	while (wheel_now < now) {
+		wheel_now++;
+		for (size_t level = 1; level < TCP_TIMER_LEVELS; level++) {
+			if ((wheel_now & ((1ULL << (TCP_TIMER_BITS * level)) - 1)) != 0 || tcp_timer_cascade(level) != 0) {
+				break;
+			}
+		}
+		size_t slot = wheel_now & (TCP_TIMER_SLOTS - 1);
+		tcp_timer_node_t* n = wheel[0][slot];
+		wheel[0][slot] = NULL;
+		while (n) {
+			tcp_timer_node_t* next = n->next;
+			if (n->due > wheel_now) {
+				/* Parked beyond the span of the wheel */
+				tcp_timer_place(n, wheel_now + 1);
+			} else {
+				n->next = expired;
+				expired = n;
+				wheel_count--;
+			}
+			n = next;
+		}
+	}
+	unlock_spinlock_irq(&timer_lock, flags);
+
+	/* Handlers take the tick order within a pass as a hint only */
+	for (tcp_timer_node_t* n = expired; n; n = n->next) {
+		handler(&n->key, n->kind, n->due);
+	}
+
+	lock_spinlock_irq(&timer_lock, &flags);
+	while (expired) {
+		tcp_timer_node_t* next = expired->next;
+		tcp_timer_node_release(expired);
+		expired = next;
+	}
+	unlock_spinlock_irq(&timer_lock, flags);
+}
+
+bool tcp_ready_push(const tcp_conn_key_t* key)
+{
+	uint64_t flags;
+	lock_spinlock_irq(&timer_lock, &flags);
+	tcp_timer_node_t* n = tcp_timer_node_new();
+	if (!n) {
+		unlock_spinlock_irq(&timer_lock, flags);
+		return false;
+	}
+	n->key = *key;
+	n->next = NULL;
+	if (ready_tail) {
+		ready_tail->next = n;
+	} else {
+		ready_head = n;
+	}
+	ready_tail = n;
+	ready_count++;
+	unlock_spinlock_irq(&timer_lock, flags);
+	return true;
+}
+
+bool tcp_ready_pop(tcp_conn_key_t* key)
+{
+	uint64_t flags;
+	lock_spinlock_irq(&timer_lock, &flags);
+	tcp_timer_node_t* n = ready_head;
+	if (!n) {
+		unlock_spinlock_irq(&timer_lock, flags);
+		return false;
+	}
+	ready_head = n->next;
+	if (!ready_head) {
+		ready_tail = NULL;
+	}
+	ready_count--;
+	*key = n->key;
+	tcp_timer_node_release(n);
+	unlock_spinlock_irq(&timer_lock, flags);
+	return true;
+}
+
+size_t tcp_ready_count(void)
+{
+	uint64_t flags;
+	lock_spinlock_irq(&timer_lock, &flags);
+	size_t count = ready_count;
+	unlock_spinlock_irq(&timer_lock, flags);
+	return count;
+}
@@ -459,7 +459,7 @@ static int tcp_recv_nb(void *ctx, unsigned char *buf, size_t len) {
 	if (n < 0) {
 		return -1;
 	}
-	if (conn != NULL && conn->state != TCP_ESTABLISHED && (!conn->recv_buffer || conn->recv_buffer_len == 0)) {
+	if (conn != NULL && conn->state != TCP_ESTABLISHED && conn->recv_buffer_len == 0) {
 		return 0;
 	}
 	return MBEDTLS_ERR_SSL_WANT_READ;
@@ -2,7 +2,10 @@
 
 #define INIT_PROGRAM "/programs/init"
 
-static void proc_update_cpu_usage(void);
+static void proc_update_cpu_usage(uint8_t cpu);
+static void proc_balance(uint8_t cpu);
+static void proc_unpark_woken(uint8_t cpu);
+static void proc_wake_timers(uint64_t now);
 
 volatile struct limine_kernel_file_request rr_kfile_req = {
 	.id = LIMINE_KERNEL_FILE_REQUEST,
@@ -62,10 +65,58 @@ uint32_t process_count = 0;
  */
 idle_timer_t* task_idles = NULL, *timer_idles = NULL;
 
+/**
+ * @brief Deferred procedure calls waiting for the BSP, in the order queued
+ */
+static dpc_t dpc_queue[PROC_DPC_QUEUE];
+static volatile size_t dpc_count = 0;
+static spinlock_t dpc_lock = 0;
+
+static void run_dpcs(uint8_t cpu);
+
 extern simple_cv_t boot_condition;
 
 uint64_t basic_lines = 0;
 
+/**
+ * @brief Run queue statistics for each CPU, used by the balancer
+ */
+proc_cpu_stats_t proc_cpu_stats[MAX_CPUS] = { 0 };
+/**
+ * @brief Highest logical CPU ID that has entered proc_loop()
+ */
+uint8_t proc_highest_cpu = 0;
+
+/**
+ * @brief Processes on each CPU which are sleeping on a wait channel.
+ * Linked through sched_next/sched_prev like proc_list, and guarded by
+ * the same per-CPU lock.
+ */
+process_t* proc_parked[MAX_CPUS] = { NULL };
+/**
+ * @brief Set when a process parked on the CPU has been woken, so the
+ * scheduling loop knows to move it back to the run list.
+ */
+volatile bool proc_wake_pending[MAX_CPUS] = { false };
+
+/**
+ * @brief A hash bucket of sleeping processes.
+ * The sequence number advances on every wakeup in the bucket, which lets
+ * proc_park() detect a wakeup racing with its final readiness check.
+ */
+typedef struct wait_bucket_t {
+	spinlock_t lock;	/**< Guards the list; always taken with interrupts off */
+	uint64_t seq;		/**< Incremented by every wakeup in this bucket */
+	process_t* head;	/**< Sleeping processes, linked through wait_next */
+} wait_bucket_t;
+
+static wait_bucket_t wait_buckets[WAIT_BUCKETS] = { 0 };
+/**
+ * @brief Earliest wake_tick of any process sleeping on the WAIT_TIMER
+ * channel, guarded by that channel's bucket lock
+ */
+static uint64_t proc_timer_deadline = UINT64_MAX;
+
 bool booted_from_cd(void) {
 	if (rr_kfile_req.response) {
 		struct limine_kernel_file_response *kernel_info = rr_kfile_req.response;
@@ -196,7 +247,6 @@ static process_t* proc_create_common(const char* source, pid_t parent_pid, const
 	}
 
 	process_count++;
-	proc_update_cpu_usage();
 
 	unlock_spinlock(&combined_proc_lock);
 	unlock_spinlock(&proc_lock[newproc->cpu]);
@@ -277,7 +327,7 @@ bool proc_kill_id(pid_t id)
 		return false;
 	}
 	process_t* cur = proc_cur(proc->cpu);
-	if (cur->pid == id) {
+	if (cur && cur->pid == id) {
 		return false;
 	}
 	proc_kill(proc);
@@ -295,10 +345,211 @@ void proc_set_idle(process_t* proc, activity_callback_t callback, void* context)
 	} else {
 		proc->check_idle = NULL;
 		proc->idle_context = NULL;
+		proc->wait_channel = 0;
 		proc->state = PROC_RUNNING;
 	}
 }
 
+static wait_bucket_t* wait_bucket(uint64_t channel)
+{
+	return &wait_buckets[(channel ^ (channel >> 56)) % WAIT_BUCKETS];
+}
+
+void proc_wait_on(process_t* proc, uint64_t channel)
+{
+	if (proc && proc->check_idle) {
+		proc->wait_channel = channel;
+	}
+}
+
+void proc_wait_until(process_t* proc, uint64_t tick)
+{
+	if (proc && proc->check_idle) {
+		proc->wake_tick = tick;
+		proc->wait_channel = WAIT_CHANNEL(WAIT_TIMER, 0);
+	}
+}
+
+/**
+ * @brief Wake the sleepers in a bucket whose channel matches, or all of
+ * them if channel is 0. Caller holds the bucket lock.
+ */
+static void proc_wake_locked(wait_bucket_t* b, uint64_t channel)
+{
+	b->seq++;
+	process_t** p = &b->head;
+	while (*p) {
+		process_t* sleeper = *p;
+		if (channel && sleeper->wait_channel != channel) {
+			p = &sleeper->wait_next;
+			continue;
+		}
+		*p = sleeper->wait_next;
+		sleeper->wait_next = NULL;
+		sleeper->woken = true;
+		__atomic_store_n(&proc_wake_pending[sleeper->cpu], true, __ATOMIC_RELEASE);
+	}
+}
+
+void proc_wake(uint64_t channel)
+{
+	uint64_t flags;
+	wait_bucket_t* b = wait_bucket(channel);
+	lock_spinlock_irq(&b->lock, &flags);
+	proc_wake_locked(b, channel);
+	unlock_spinlock_irq(&b->lock, flags);
+}
+
+void proc_wake_all(void)
+{
+	for (size_t i = 0; i < WAIT_BUCKETS; ++i) {
+		uint64_t flags;
+		lock_spinlock_irq(&wait_buckets[i].lock, &flags);
+		proc_wake_locked(&wait_buckets[i], 0);
+		unlock_spinlock_irq(&wait_buckets[i].lock, flags);
+	}
+}
+
+/**
+ * @brief Wake sleepers on the WAIT_TIMER channel once the earliest
+ * deadline has passed. Those not yet due park again and re-arm it.
+ */
+static void proc_wake_timers(uint64_t now)
+{
+	if (now < proc_timer_deadline) {
+		return;
+	}
+	uint64_t flags;
+	const uint64_t channel = WAIT_CHANNEL(WAIT_TIMER, 0);
+	wait_bucket_t* b = wait_bucket(channel);
+	lock_spinlock_irq(&b->lock, &flags);
+	if (now >= proc_timer_deadline) {
+		proc_timer_deadline = UINT64_MAX;
+		proc_wake_locked(b, channel);
+	}
+	unlock_spinlock_irq(&b->lock, flags);
+}
+
+/**
+ * @brief Remove a process from a CPU's run list. Caller holds proc_lock[cpu].
+ * If it is the CPU's current process, the round robin carries on from the
+ * process before it.
+ */
+static void proc_unlink_run_list(uint8_t cpu, process_t* proc)
+{
+	if (proc_current[cpu] == proc) {
+		proc_current[cpu] = proc->sched_prev;
+	}
+	if (proc->sched_prev == NULL) {
+		proc_list[cpu] = proc->sched_next;
+	} else {
+		proc->sched_prev->sched_next = proc->sched_next;
+	}
+	if (proc->sched_next != NULL) {
+		proc->sched_next->sched_prev = proc->sched_prev;
+	}
+	if (proc_current[cpu] == NULL) {
+		proc_current[cpu] = proc_list[cpu];
+	}
+	proc->sched_next = proc->sched_prev = NULL;
+}
+
+/**
+ * @brief Take a suspended process off the run list until its wait channel
+ * is signalled.
+ *
+ * The bucket sequence number is sampled before the idle callback's final
+ * check, so a wakeup between that check and the process joining the bucket
+ * is seen and the process stays on the run list instead.
+ *
+ * @return true if the process was parked
+ */
+static bool proc_park(uint8_t cpu, process_t* proc)
+{
+	if (!proc->wait_channel || !proc->check_idle || proc_ended(proc)) {
+		return false;
+	}
+
+	wait_bucket_t* b = wait_bucket(proc->wait_channel);
+	const uint64_t seq = __atomic_load_n(&b->seq, __ATOMIC_ACQUIRE);
+
+	if (!proc->check_idle(proc, proc->idle_context)) {
+		/* Became ready while we were deciding; run it on the next pass */
+		proc_set_idle(proc, NULL, NULL);
+		return false;
+	}
+
+	uint64_t flags;
+	lock_spinlock(&proc_lock[cpu]);
+	lock_spinlock_irq(&b->lock, &flags);
+
+	if (b->seq != seq) {
+		unlock_spinlock_irq(&b->lock, flags);
+		unlock_spinlock(&proc_lock[cpu]);
+		return false;
+	}
+
+	proc_unlink_run_list(cpu, proc);
+	proc->sched_next = proc_parked[cpu];
+	if (proc_parked[cpu]) {
+		proc_parked[cpu]->sched_prev = proc;
+	}
+	proc_parked[cpu] = proc;
+	proc->parked = true;
+	proc->woken = false;
+
+	proc->wait_next = b->head;
+	b->head = proc;
+	if (proc->wait_channel == WAIT_CHANNEL(WAIT_TIMER, 0) && proc->wake_tick < proc_timer_deadline) {
+		proc_timer_deadline = proc->wake_tick;
+	}
+
+	unlock_spinlock_irq(&b->lock, flags);
+	unlock_spinlock(&proc_lock[cpu]);
+	return true;
+}
+
+/**
+ * @brief Move processes whose wait channel was signalled from the CPU's
+ * parked list back onto its run list.
+ */
+static void proc_unpark_woken(uint8_t cpu)
+{
+	if (!__atomic_exchange_n(&proc_wake_pending[cpu], false, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+
+	lock_spinlock(&proc_lock[cpu]);
+	process_t* cur = proc_parked[cpu];
+	while (cur) {
+		process_t* next = cur->sched_next;
+		if (cur->woken) {
+			if (cur->sched_prev == NULL) {
+				proc_parked[cpu] = next;
+			} else {
+				cur->sched_prev->sched_next = next;
+			}
+			if (next != NULL) {
+				next->sched_prev = cur->sched_prev;
+			}
+
+			cur->parked = false;
+			cur->woken = false;
+			cur->sched_prev = NULL;
+			cur->sched_next = proc_list[cpu];
+			if (proc_list[cpu] != NULL) {
+				proc_list[cpu]->sched_prev = cur;
+			}
+			proc_list[cpu] = cur;
+			if (proc_current[cpu] == NULL) {
+				proc_current[cpu] = cur;
+			}
+		}
+		cur = next;
+	}
+	unlock_spinlock(&proc_lock[cpu]);
+}
+
 void proc_wait(process_t* proc, pid_t otherpid)
 {
 	if (!proc_find(otherpid)) {
@@ -307,6 +558,7 @@ void proc_wait(process_t* proc, pid_t otherpid)
 	}
 	proc->waitpid = otherpid;
 	proc_set_idle(proc, check_wait_pid, NULL);
+	proc_wait_on(proc, WAIT_CHANNEL(WAIT_PROCESS, otherpid));
 }
 
 const char* proc_set_csd(process_t* proc, const char* csd)
@@ -346,15 +598,47 @@ void proc_kill(process_t* proc)
 	uint8_t cpu = proc->cpu;
 	dprintf("proc_kill id %lu on cpu %d\n", proc->pid, cpu);
 	lock_spinlock(&proc_lock[cpu]);
+	while (proc->cpu != cpu) {
+		/* The balancer moved it to another CPU before we got the lock */
+		unlock_spinlock(&proc_lock[cpu]);
+		cpu = proc->cpu;
+		lock_spinlock(&proc_lock[cpu]);
+	}
 	lock_spinlock(&combined_proc_lock);
+	const pid_t pid = proc->pid;
 
-	if (proc->sched_prev == NULL) {
-		proc_list[cpu] = proc->sched_next;
+	if (proc->parked) {
+		/* Sleeping on a wait channel rather than on the run list */
+		if (proc->sched_prev == NULL) {
+			proc_parked[cpu] = proc->sched_next;
+		} else {
+			proc->sched_prev->sched_next = proc->sched_next;
+		}
+		if (proc->sched_next != NULL) {
+			proc->sched_next->sched_prev = proc->sched_prev;
+		}
+		uint64_t flags;
+		wait_bucket_t* b = wait_bucket(proc->wait_channel);
+		lock_spinlock_irq(&b->lock, &flags);
+		for (process_t** p = &b->head; *p; p = &(*p)->wait_next) {
+			if (*p == proc) {
+				*p = proc->wait_next;
+				break;
+			}
+		}
+		unlock_spinlock_irq(&b->lock, flags);
 	} else {
-		proc->sched_prev->sched_next = proc->sched_next;
-	}
-	if (proc->sched_next != NULL) {
-		proc->sched_next->sched_prev = proc->sched_prev;
+		if (proc->sched_prev == NULL) {
+			proc_list[cpu] = proc->sched_next;
+		} else {
+			proc->sched_prev->sched_next = proc->sched_next;
+		}
+		if (proc->sched_next != NULL) {
+			proc->sched_next->sched_prev = proc->sched_prev;
+		}
+		if (proc_current[cpu] == proc) {
+			proc_current[cpu] = proc->sched_next ? proc->sched_next : proc_list[cpu];
+		}
 	}
 
 	if (proc->global_prev == NULL) {
@@ -366,27 +650,28 @@ void proc_kill(process_t* proc)
 		proc->global_next->global_prev = proc->global_prev;
 	}
 
-	if (proc_current[cpu] == proc) {
-		proc_current[cpu] = proc->sched_next ? proc->sched_next : proc_list[cpu];
-	}
+	hashmap_delete(process_by_pid, &(proc_id_t){ .id = proc->pid });
+	process_count--;
+	const bool last = combined_proc_list == NULL;
+	unlock_spinlock(&proc_lock[cpu]);
+	unlock_spinlock(&combined_proc_lock);
 
+	/* Unlinked now, so teardown, which may write out the program's files, runs without the locks */
 	basic_destroy(proc->code);
 	kfree_null(&proc->name);
 	kfree_null(&proc->directory);
 	kfree_null(&proc->csd);
-	hashmap_delete(process_by_pid, &(proc_id_t){ .id = proc->pid });
 	kfree_null(&proc);
-	process_count--;
 
 	/* Killed the last process? */
-	if (combined_proc_list == NULL) {
+	if (last) {
 		setforeground(COLOUR_LIGHTRED);
 		kprintf("\nSystem halted.");
 		interrupts_off();
 		wait_forever();
 	}
-	unlock_spinlock(&proc_lock[cpu]);
-	unlock_spinlock(&combined_proc_lock);
+
+	proc_wake(WAIT_CHANNEL(WAIT_PROCESS, pid));
 }
 
 int64_t proc_total()
@@ -409,6 +694,49 @@ pid_t proc_id(int64_t index)
 	return 0;
 }
 
+/**
+ * @brief Scale a nice 0 time slice parameter by a process's nice value.
+ * Each five points below zero doubles it, each five above halves it.
+ */
+static uint64_t proc_scale_by_nice(const process_t* proc, uint64_t base)
+{
+	int shift = proc->nice / 5;
+	return shift < 0 ? base << -shift : base >> shift;
+}
+
+/**
+ * @brief Run one time slice of a process.
+ *
+ * Lines are executed back to back until the process blocks, ends, yields,
+ * re-runs the same line to poll for input, or exhausts its quantum of
+ * lines or milliseconds.
+ */
+static void proc_run_quantum(process_t* proc)
+{
+	struct basic_ctx* ctx = proc->code;
+	uint64_t deadline = get_ticks() + MAX(proc_scale_by_nice(proc, PROC_QUANTUM_MS), 1);
+	uint64_t start = rdtsc(), run = 0;
+
+	proc->quantum_left = MAX(proc_scale_by_nice(proc, PROC_QUANTUM_LINES), 1);
+	while (true) {
+		const char* line = ctx->ptr;
+		basic_run(ctx);
+		run++;
+		if (proc->quantum_left) {
+			proc->quantum_left--;
+		}
+		if (!proc->quantum_left || proc->check_idle || proc_ended(proc) || ctx->ptr == line || get_ticks() >= deadline) {
+			break;
+		}
+	}
+	proc->quantum_left = 0;
+
+	proc->lines += run;
+	proc->run_cycles += rdtsc() - start;
+	proc_cpu_stats[proc->cpu].lines += run;
+	basic_lines += run;
+}
+
 void proc_run_next(uint8_t cpu)
 {
 	lock_spinlock(&proc_lock[cpu]);
@@ -423,9 +751,9 @@ void proc_run_next(uint8_t cpu)
 		proc_current[cpu] = proc_current[cpu]->sched_next;
 	}
 
+	process_t* current = proc_current[cpu];
 	unlock_spinlock(&proc_lock[cpu]);
 
-	process_t* current = proc_current[cpu];
 	if (current == NULL) {
 		__builtin_ia32_pause();
 		return;
@@ -433,12 +761,19 @@ void proc_run_next(uint8_t cpu)
 
 	if (current->check_idle && !current->check_idle(current, current->idle_context)) {
 		proc_set_idle(current, NULL, NULL);
-		basic_run(current->code);
+		proc_run_quantum(current);
 	} else if (current->check_idle) {
-		__builtin_ia32_pause();
+		if (!proc_park(cpu, current)) {
+			__builtin_ia32_pause();
+		}
+		return;
 	} else {
-		basic_run(current->code);
-		basic_lines++;
+		proc_run_quantum(current);
+	}
+
+	if (current->check_idle && proc_park(cpu, current)) {
+		/* Blocked during its time slice; sleep until signalled */
+		return;
 	}
 
 	if (proc_ended(current)) {
@@ -517,25 +852,63 @@ _Noreturn void proc_loop()
 		/* BSP signals APs to start their proc_loops too */
 		simple_cv_broadcast(&boot_condition);
 	}
-	uint64_t last = get_ticks();
-	proc_register_idle(proc_update_cpu_usage, IDLE_BACKGROUND, 150);
+	uint64_t last = get_ticks(), last_accounting = last;
+	proc_cpu_stats[cpu].online = true;
+	if (cpu > proc_highest_cpu) {
+		proc_highest_cpu = cpu;
+	}
 	while (true) {
+		proc_unpark_woken(cpu);
 		if (likely(proc_list[cpu] != NULL)) {
 			proc_run_next(cpu);
 		} else {
 			/* This CPU has nothing to do; prevent busy spin */
 			__asm__("hlt");
 		}
+		run_dpcs(cpu);
 		uint64_t ticks = get_ticks();
 		if (unlikely(ticks != last)) {
+			proc_wake_timers(ticks);
 			run_idles(cpu);
+			if (proc_list[cpu] == NULL || proc_cpu_stats[cpu].runnable == 0) {
+				/* Nothing to run here; look for work every tick */
+				proc_balance(cpu);
+			}
 			last = ticks;
 		}
+		if (unlikely(ticks - last_accounting >= PROC_ACCOUNTING_MS)) {
+			proc_update_cpu_usage(cpu);
+			proc_balance(cpu);
+			last_accounting = ticks;
+		}
+	}
+}
+
+/**
+ * @brief Run every DPC queued so far on the BSP. DPCs queued while these
+ * run, including by themselves, wait for the next call.
+ */
+static void run_dpcs(uint8_t cpu)
+{
+	if (cpu != 0 || dpc_count == 0) {
+		return;
+	}
+	dpc_t pending[PROC_DPC_QUEUE];
+	uint64_t flags;
+	lock_spinlock_irq(&dpc_lock, &flags);
+	size_t count = dpc_count;
+	memcpy(pending, dpc_queue, count * sizeof(dpc_t));
+	dpc_count = 0;
+	unlock_spinlock_irq(&dpc_lock, flags);
+
+	for (size_t i = 0; i < count; i++) {
+		pending[i]();
 	}
 }
 
 void run_idles(uint8_t cpu)
 {
+	run_dpcs(cpu);
 	if (cpu == 0 && task_idles) {
 		/* Idle foreground tasks only run on BSP */
 		idle_timer_t **p = &task_idles;
@@ -583,45 +956,202 @@ void proc_register_idle(proc_idle_timer_t handler, idle_type_t type, uint64_t fr
 	}
 }
 
-void proc_queue_dpc(dpc_t handler)
+bool proc_queue_dpc(dpc_t handler)
 {
 	if (!handler) {
-		return;
+		return false;
 	}
 
-	idle_timer_t* newidle = kmalloc(sizeof(idle_timer_t));
-	if (!newidle) {
-		return;
+	uint64_t flags;
+	lock_spinlock_irq(&dpc_lock, &flags);
+	for (size_t i = 0; i < dpc_count; i++) {
+		if (dpc_queue[i] == handler) {
+			unlock_spinlock_irq(&dpc_lock, flags);
+			return true;
+		}
 	}
-
-	newidle->func = handler;
-	newidle->next_tick = get_ticks();
-	newidle->frequency = 0;
-	newidle->next = task_idles;
-
-	task_idles = newidle;
+	bool queued = dpc_count < PROC_DPC_QUEUE;
+	if (queued) {
+		dpc_queue[dpc_count++] = handler;
+	} else {
+		dprintf("proc_queue_dpc: queue full, DPC %p not queued\n", handler);
+	}
+	unlock_spinlock_irq(&dpc_lock, flags);
+	return queued;
 }
 
-static void proc_update_cpu_usage(void) {
+/**
+ * @brief Recalculate the CPU usage of every process on a CPU.
+ *
+ * Each process's sample is the share of TSC cycles it spent inside its
+ * time slices since the previous call, folded into a rolling average.
+ * Only called from the CPU's own scheduling loop, so the cycle counters
+ * are never updated concurrently.
+ */
+static void proc_update_cpu_usage(uint8_t cpu)
+{
+	static uint64_t last_sample[MAX_CPUS] = { 0 };
+	const uint64_t now = rdtsc();
+	const uint64_t elapsed = last_sample[cpu] ? now - last_sample[cpu] : 0;
+	last_sample[cpu] = now;
 
-	uint32_t runnable = 0;
-	const uint8_t cpu = logical_cpu_id();
+	uint32_t processes = 0, runnable = 0, load = 0;
 
+	lock_spinlock(&proc_lock[cpu]);
 	for (process_t* cur = proc_list[cpu]; cur; cur = cur->sched_next) {
-		if (cur->state == PROC_RUNNING) {
+		uint32_t sample = 0;
+
+		if (elapsed) {
+			sample = MIN(cur->run_cycles * 100 / elapsed, 100);
+		}
+
+		cur->run_cycles = 0;
+		cur->cpu_percent = ((cur->cpu_percent * 31) + sample) / 32;
+
+		processes++;
+		load += cur->cpu_percent;
+		if (!cur->check_idle) {
 			runnable++;
 		}
 	}
+	for (process_t* cur = proc_parked[cpu]; cur; cur = cur->sched_next) {
+		cur->run_cycles = 0;
+		cur->cpu_percent = (cur->cpu_percent * 31) / 32;
+		processes++;
+		load += cur->cpu_percent;
+	}
+	proc_cpu_stats[cpu].processes = processes;
+	proc_cpu_stats[cpu].runnable = runnable;
+	proc_cpu_stats[cpu].load_percent = MIN(load, 100);
+	unlock_spinlock(&proc_lock[cpu]);
+}
 
-	for (process_t* cur = proc_list[cpu]; cur; cur = cur->sched_next) {
-		uint32_t sample = 0;
+/**
+ * @brief Pull one runnable process onto this CPU from the busiest CPU.
+ *
+ * A CPU only steals when the busiest CPU has at least two more runnable
+ * processes than it does, so a single process never bounces between two
+ * CPUs. The process taken is the one with the highest cpu_percent which
+ * is neither waiting on an idle callback nor currently executing, so
+ * compute-bound jobs are the ones which spread out.
+ */
+static void proc_balance(uint8_t cpu)
+{
+	uint8_t busiest = cpu;
+	uint32_t most = 0;
 
-		if (runnable && cur->state == PROC_RUNNING) {
-			sample = 100 / runnable;
+	for (uint16_t other = 0; other <= proc_highest_cpu; ++other) {
+		if (other != cpu && proc_cpu_stats[other].online && proc_cpu_stats[other].runnable > most) {
+			most = proc_cpu_stats[other].runnable;
+			busiest = other;
 		}
+	}
+	if (busiest == cpu || most < 2 || most < proc_cpu_stats[cpu].runnable + 2) {
+		return;
+	}
 
-		cur->cpu_percent = ((cur->cpu_percent * 31) + sample) / 32;
+	/* Always lock the lower numbered CPU first */
+	lock_spinlock(&proc_lock[MIN(cpu, busiest)]);
+	lock_spinlock(&proc_lock[MAX(cpu, busiest)]);
+
+	process_t* victim = NULL;
+	for (process_t* cur = proc_list[busiest]; cur; cur = cur->sched_next) {
+		if (cur != proc_current[busiest] && !cur->check_idle && !proc_ended(cur) && (!victim || cur->cpu_percent > victim->cpu_percent)) {
+			victim = cur;
+		}
+	}
+
+	if (victim) {
+		if (victim->sched_prev == NULL) {
+			proc_list[busiest] = victim->sched_next;
+		} else {
+			victim->sched_prev->sched_next = victim->sched_next;
+		}
+		if (victim->sched_next != NULL) {
+			victim->sched_next->sched_prev = victim->sched_prev;
+		}
+
+		victim->sched_prev = NULL;
+		victim->sched_next = proc_list[cpu];
+		if (proc_list[cpu] != NULL) {
+			proc_list[cpu]->sched_prev = victim;
+		}
+		proc_list[cpu] = victim;
+		if (proc_current[cpu] == NULL) {
+			proc_current[cpu] = victim;
+		}
+		victim->cpu = cpu;
+		victim->run_cycles = 0;
+
+		proc_cpu_stats[busiest].processes--;
+		proc_cpu_stats[busiest].runnable--;
+		proc_cpu_stats[busiest].stolen++;
+		proc_cpu_stats[cpu].processes++;
+		proc_cpu_stats[cpu].runnable++;
+		proc_cpu_stats[cpu].steals++;
+	}
+
+	unlock_spinlock(&proc_lock[MAX(cpu, busiest)]);
+	unlock_spinlock(&proc_lock[MIN(cpu, busiest)]);
+
+	if (victim) {
+		dprintf("CPU#%d took process %lu from CPU#%d\n", cpu, victim->pid, busiest);
+	}
+}
+
+const proc_cpu_stats_t* proc_get_cpu_stats(uint8_t cpu)
+{
+	return cpu <= proc_highest_cpu ? &proc_cpu_stats[cpu] : NULL;
+}
+
+/**
+ * @brief Render the per-CPU statistics table for /devices/sched.
+ * Columns are fixed width so the size of the file only changes when a CPU
+ * comes online. Returns a kmalloc'd string which the caller must free.
+ */
+static char* sched_stats_text(void)
+{
+	const size_t row = 128, size = row * ((size_t)proc_highest_cpu + 2);
+	char* text = kmalloc(size);
+	if (!text) {
+		return NULL;
+	}
+	size_t len = snprintf(text, size, "CPU PROCESSES RUNNABLE LOAD                LINES     STEALS     STOLEN\n");
+	for (uint16_t cpu = 0; cpu <= proc_highest_cpu; ++cpu) {
+		const proc_cpu_stats_t* s = &proc_cpu_stats[cpu];
+		if (s->online) {
+			len += snprintf(text + len, size - len, "%3u %9u %8u %4u %20lu %10lu %10lu\n", cpu, s->processes, s->runnable, s->load_percent, s->lines, s->steals, s->stolen);
+		}
 	}
+	return text;
+}
+
+static void sched_update_cb(fs_directory_entry_t *ent) {
+	char* text = sched_stats_text();
+	ent->size = text ? strlen(text) : 0;
+	kfree_null(&text);
+}
+
+static bool sched_read_cb(uint64_t start, uint32_t length, unsigned char *buffer) {
+	char* text = sched_stats_text();
+	if (!text) {
+		fs_set_error(FS_ERR_OUT_OF_MEMORY);
+		return false;
+	}
+	uint64_t text_length = strlen(text);
+
+	if (start + length > text_length) {
+		kfree_null(&text);
+		fs_set_error(FS_ERR_SEEK_PAST_END);
+		return false;
+	}
+	memcpy(buffer, text + start, length);
+	kfree_null(&text);
+	return true;
+}
+
+void init_sched_stats(void) {
+	devfs_register_text("sched", sched_update_cb, sched_read_cb);
 }
 
 uint32_t proc_cpu_percent(pid_t pid)
@@ -639,3 +1169,33 @@ uint32_t proc_cpu_percent(pid_t pid)
 	unlock_spinlock(&combined_proc_lock);
 	return perc;
 }
+
+bool proc_set_nice(pid_t pid, int64_t nice)
+{
+	lock_spinlock(&combined_proc_lock);
+	proc_id_t* id = hashmap_get(process_by_pid, &(proc_id_t){ .id = pid });
+	if (id) {
+		id->proc->nice = (int8_t)MIN(MAX(nice, PROC_NICE_MIN), PROC_NICE_MAX);
+	}
+	unlock_spinlock(&combined_proc_lock);
+	return id != NULL;
+}
+
+int64_t proc_get_nice(pid_t pid)
+{
+	int64_t nice = 0;
+	lock_spinlock(&combined_proc_lock);
+	proc_id_t* id = hashmap_get(process_by_pid, &(proc_id_t){ .id = pid });
+	if (id) {
+		nice = id->proc->nice;
+	}
+	unlock_spinlock(&combined_proc_lock);
+	return nice;
+}
+
+void proc_yield(process_t* proc)
+{
+	if (proc) {
+		proc->quantum_left = 0;
+	}
+}